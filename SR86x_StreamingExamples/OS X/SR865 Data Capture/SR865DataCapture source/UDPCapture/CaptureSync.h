@@ -0,0 +1,110 @@
+//---------------------------------------------------------------------------
+
+#ifndef CaptureSyncH
+#define CaptureSyncH
+
+// portable synchronization helpers for the capture pipeline.
+// The VCL units use TMutex & TThread; the pipeline units underneath them
+// do not depend on the VCL, so they can also be built into command line tools.
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+//---------------------------------------------------------------------------
+
+// atomic load & store of a 32bit index shared between two threads
+// load has acquire semantics, store has release semantics
+inline long atomicLoad(volatile long *p)
+{
+#ifdef _WIN32
+    return InterlockedCompareExchange(p, 0, 0);
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+inline void atomicStore(volatile long *p, long val)
+{
+#ifdef _WIN32
+    InterlockedExchange(p, val);
+#else
+    __atomic_store_n(p, val, __ATOMIC_RELEASE);
+#endif
+}
+
+// full memory barrier
+inline void atomicFence()
+{
+#ifdef _WIN32
+    volatile long dummy = 0;
+    InterlockedExchange(&dummy, 0);
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+// monotonic time in seconds
+// used to timestamp packets as they arrive
+inline double captureClock()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq = { 0 };
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+#endif
+}
+
+// sleep for a few milliseconds (idle threads)
+inline void captureSleep(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// simple mutex
+// only held briefly (swapping sinks), never by the receive thread
+class CaptureLock
+{
+protected:
+#ifdef _WIN32
+    CRITICAL_SECTION cs;
+#else
+    pthread_mutex_t mtx;
+#endif
+
+public:
+#ifdef _WIN32
+    CaptureLock() { InitializeCriticalSection(&cs); }
+    ~CaptureLock() { DeleteCriticalSection(&cs); }
+    void acquire() { EnterCriticalSection(&cs); }
+    void release() { LeaveCriticalSection(&cs); }
+#else
+    CaptureLock() { pthread_mutex_init(&mtx, NULL); }
+    ~CaptureLock() { pthread_mutex_destroy(&mtx); }
+    void acquire() { pthread_mutex_lock(&mtx); }
+    void release() { pthread_mutex_unlock(&mtx); }
+#endif
+
+private:
+    CaptureLock(const CaptureLock &);
+    CaptureLock &operator=(const CaptureLock &);
+};
+
+//---------------------------------------------------------------------------
+#endif
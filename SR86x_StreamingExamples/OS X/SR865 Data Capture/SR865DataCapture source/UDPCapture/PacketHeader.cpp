@@ -51,4 +51,19 @@ bool PacketHeader::dataErr() const
 {
     return over;
 }
+int PacketHeader::channels() const
+{
+    // x, x&y, r&th, xyr&th
+    switch (what & 3)
+    {
+        default: return 1;
+        case 1:
+        case 2: return 2;
+        case 3: return 4;
+    }
+}
+bool PacketHeader::isInt() const
+{
+    return (what >= 4);
+}
 
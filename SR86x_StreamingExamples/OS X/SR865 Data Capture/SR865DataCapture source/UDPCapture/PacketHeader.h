@@ -23,6 +23,8 @@ public:
     void setHeader(unsigned int hd);
     bool isGood() const;
     bool dataErr() const;
+    int channels() const;
+    bool isInt() const;
     int byteLength() const;
     double sampleRate() const;
 };
@@ -0,0 +1,170 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "PacketSequence.h"
+#include "PacketHeader.h"
+#include <math.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// sequence numbers from packet counter & arrival time
+//
+// For a packet with counter c arriving at time t, the candidates are
+//   newest + d + 256*k,    d = (c - counter of newest) mod 256
+// and (t - origin) / period is the highest sequence number that could have arrived by t.
+// The candidate nearest to that wins; k = 0 with d = 0 is a duplicate,
+// k = -1 with the packet at most SEQ_REORDER behind is a late packet.
+
+#define SEQ_FORMAT      0x00ffff00  // header bits that stay the same while a stream runs (content, length, rate)
+
+PacketSequence::PacketSequence()
+{
+    restart();
+}
+
+void PacketSequence::restart()
+{
+    counter = -1;
+    newest = -1;
+    seq = -1;
+    sample = -1;
+    missing = 0;
+    retracted = 0;
+    format = 0;
+    lastTime = 0.0;
+    period = 1.0;
+    frames = 0;
+    origin = 0.0;
+    baseSeq = 0;
+    baseSample = 0;
+    pendingTurns = 0;
+}
+
+// first packet of a stream; numbering carries on from the previous one, without a gap
+void PacketSequence::start(unsigned int header, double arrival)
+{
+    seq = newest + 1;
+    baseSample = (newest < 0) ? 0 : baseSample + (seq - baseSeq) * frames;
+    baseSeq = seq;
+    format = header & SEQ_FORMAT;
+    period = periodOf(header);
+    frames = framesOf(header);
+    origin = arrival - seq * period;
+    pendingTurns = 0;
+    newest = seq;
+    counter = header & 0xff;
+    lastTime = arrival;
+    sample = baseSample;
+}
+
+int PacketSequence::next(unsigned int header, double arrival)
+{
+    missing = 0;
+    retracted = 0;
+    double silence = arrival - lastTime;
+    if (counter < 0)
+    {
+        start(header, arrival);
+        return SEQ_FIRST;
+    }
+    if ((header & SEQ_FORMAT) != format || (silence > SEQ_RESUME_TIME && silence > SEQ_TURN * period))
+    {
+        start(header, arrival);
+        return SEQ_RESUME;
+    }
+
+    int d = ((header & 0xff) - counter) & 0xff;
+    if (silence > 0.0)
+    {
+        origin += silence * SEQ_CREEP;
+        lastTime = arrival;
+    }
+    double highest = (arrival - origin) / period;
+    long long k = (long long)floor((highest - newest - d) / SEQ_TURN + 0.5);
+    if (k < 0)
+    {
+        // arrived before its turn could have come round
+        k = (d != 0 && SEQ_TURN - d <= SEQ_REORDER) ? -1 : 0;
+    }
+    seq = newest + d + k * SEQ_TURN;
+
+    int kind;
+    if (seq == newest)
+        kind = SEQ_DUPLICATE;
+    else if (seq < newest)
+        kind = SEQ_LATE;
+    else
+    {
+        missing = (int)(seq - newest - 1);
+        kind = missing ? SEQ_GAP : SEQ_NEXT;
+        if (k > 0)
+        {
+            // turns only the clock saw
+            if (pendingTurns == 0)
+                pendingOrigin = origin;
+            pendingTurns += (int)k;
+            pendingUntil = seq + SEQ_CONFIRM;
+        }
+        newest = seq;
+        counter = header & 0xff;
+    }
+
+    if (kind != SEQ_DUPLICATE)
+    {
+        double early = arrival - seq * period;
+        if (early < origin)
+            origin = early;
+
+        if (pendingTurns > 0)
+        {
+            // ahead of the schedule from before the turns by half a turn or more:
+            // the instrument didn't send them, we received them late
+            int w = (int)floor((pendingOrigin - early) / (period * SEQ_TURN) + 0.5);
+            if (w > pendingTurns)
+                w = pendingTurns;
+            if (w > 0)
+            {
+                long long back = (long long)w * SEQ_TURN;
+                seq -= back;
+                newest -= back;
+                pendingTurns -= w;
+                origin = early + back * period;
+                if (origin > pendingOrigin)
+                    origin = pendingOrigin;
+                retracted = (int)back;
+                kind = SEQ_RESYNC;
+            }
+            else if (newest >= pendingUntil)
+                pendingTurns = 0;
+        }
+    }
+
+    sample = baseSample + (seq - baseSeq) * frames;
+    return kind;
+}
+
+long long PacketSequence::newestSeq() const
+{
+    return newest;
+}
+double PacketSequence::packetPeriod() const
+{
+    return period;
+}
+
+// seconds between packets of a stream, from its header
+double PacketSequence::periodOf(unsigned int header)
+{
+    PacketHeader hdr(header);
+    return framesOf(header) / hdr.sampleRate();
+}
+// samples per channel in each packet
+int PacketSequence::framesOf(unsigned int header)
+{
+    PacketHeader hdr(header);
+    return hdr.byteLength() / (hdr.channels() * (hdr.isInt() ? 2 : 4));
+}
@@ -0,0 +1,78 @@
+//---------------------------------------------------------------------------
+
+#ifndef PacketSequenceH
+#define PacketSequenceH
+
+//---------------------------------------------------------------------------
+
+// 64 bit sequence numbers for a stream whose packets only carry an 8 bit counter
+//
+// The counter says where a packet is modulo 256; the arrival time says roughly
+// how many packet periods have gone by. Together they give the sequence number,
+// so a gap of exactly 256 packets (or 512, ...) is seen, and so are duplicates
+// and packets that arrive out of order.
+//
+// Arrival times can only be late, never early: the schedule (origin) is the
+// earliest arrival of any packet, projected back to sequence 0.
+// A receive thread stall with packets waiting in the socket buffer looks just
+// like lost turns of the counter, so turns that only the clock saw are provisional:
+// if the packets that follow arrive faster than the instrument could have sent them,
+// it was a stall, and the turns are taken back (SEQ_RESYNC).
+
+#define SEQ_TURN        256         // packet counter range
+#define SEQ_REORDER     32          // packets this far behind the newest count as late, not as the next turn
+#define SEQ_CONFIRM     1024        // packets after turns seen by the clock before they count as lost for good
+#define SEQ_RESUME_TIME 1.0         // silence (s) after which the stream counts as restarted
+#define SEQ_CREEP       1.0e-3      // how fast the schedule may drift later (clock rate differences)
+
+enum SequenceKind
+{
+    SEQ_FIRST,                      // first packet, or first after restart()
+    SEQ_NEXT,                       // packet after the newest one
+    SEQ_GAP,                        // packets missing before this one
+    SEQ_DUPLICATE,                  // newest packet again
+    SEQ_LATE,                       // older than the newest packet (reordered, or a gap filled late)
+    SEQ_RESUME,                     // stream restarted: long silence, or new content, length or rate
+    SEQ_RESYNC,                     // turns counted as lost were a receive stall; numbering moved back
+    SEQ_KINDS
+};
+
+class PacketSequence
+{
+protected:
+    unsigned int format;            // content, length & rate bits of the stream's header
+    int counter;                    // counter of newest packet; -1 = no packet yet
+    long long newest;               // sequence number of newest packet
+    double lastTime;                // latest arrival
+    double period;                  // seconds per packet
+    int frames;                     // samples per packet (per channel)
+    double origin;                  // earliest arrival of any packet, less seq * period
+    long long baseSeq;              // sequence number of first packet in this format
+    long long baseSample;           // and its sample index
+    int pendingTurns;               // turns seen by the clock only, not yet confirmed
+    long long pendingUntil;         // confirmed when newest reaches this
+    double pendingOrigin;           // origin before those turns
+
+    void start(unsigned int header, double arrival);
+
+public:
+    // result of last next()
+    long long seq;                  // sequence number; 0 = first packet
+    long long sample;               // index of its first sample, counting every sample sent since the first packet
+    int missing;                    // packets missing just before this one
+    int retracted;                  // packets counted missing before that were a stall (SEQ_RESYNC)
+
+    PacketSequence();
+
+    void restart();                 // number from 0 again at the next packet
+    int next(unsigned int header, double arrival);     // header in host order; returns SequenceKind
+
+    long long newestSeq() const;
+    double packetPeriod() const;
+
+    static double periodOf(unsigned int header);
+    static int framesOf(unsigned int header);
+};
+
+//---------------------------------------------------------------------------
+#endif
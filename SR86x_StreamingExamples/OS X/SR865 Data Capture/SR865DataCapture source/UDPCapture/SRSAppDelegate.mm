@@ -28,6 +28,7 @@
 @property (atomic, readwrite) bool isLE;
 @property (atomic, readwrite) bool sendLE;
 @property (atomic, readwrite) bool sendCS;
+@property (nonatomic, assign) LiveData lastLive;    // receive counters at last update
 @end
 
 
@@ -100,12 +101,18 @@ void connectionFailed(bool ok, bool settry)
 // we update UI only at a few Hz
 - (void)updateInfo
 {
-    int what, rate, count;
-    float liax, liay, liar, liath;
-    bool missed, over;
     // get snapshot of data from server thread
     // and then format & update UI
-    [_server getData:&what rate:&rate liax:&liax liay:&liay liar:&liar liath:&liath count:&count missed:&missed overload:&over];
+    LiveData live;
+    [_server getData:&live];
+    int what = live.what;
+    int rate = live.rate;
+    float liax = live.x, liay = live.y, liar = live.r, liath = live.th;
+    // counters are totals; what happened since last update?
+    int count = (int)(live.bytes - _lastLive.bytes);
+    bool missed = (live.dropped != _lastLive.dropped);
+    bool over = (live.overloads != _lastLive.overloads);
+    _lastLive = live;
 
     _WhatField.enabled = true;
     switch (what)
@@ -9,6 +9,8 @@
 #import <Foundation/Foundation.h>
 #import "UDPServe.h"
 #import "PacketHeader.h"
+#import "LiveSnapshot.h"
+#import "PacketSequence.h"
 
 @interface UDPServerThread : NSThread <UDPServerDelegate>
 
@@ -25,6 +27,6 @@
 - (void)startServer;
 - (bool)serverOk;
 - (void)gotData:(unsigned int)nwords;
-- (void)getData:(int *)pwhat rate:(int *)prate liax:(float *)pliax liay:(float *)pliay liar:(float *)pliar liath:(float *)pliath count:(int *)pbyte_count missed:(bool *)pmissed overload:(bool *)pover;
+- (void)getData:(LiveData *)pdata;
 
 @end
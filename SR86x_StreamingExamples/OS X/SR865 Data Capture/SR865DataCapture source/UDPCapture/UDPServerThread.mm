@@ -146,19 +146,16 @@ static NSString * DisplayErrorFromError(NSError *error)
 @property (atomic, readwrite) unsigned int *buffer;
 @property (nonatomic, readwrite) PacketHeader *hdr;
 @property (nonatomic, readwrite) int port;
-@property (atomic, readwrite) int index;
-@property (atomic, readwrite) bool overload;
-@property (atomic, readwrite) bool missed;
-@property (atomic, readwrite) int count;
-@property (atomic, readwrite) float liaX;
-@property (atomic, readwrite) float liaY;
-@property (atomic, readwrite) float liaR;
-@property (atomic, readwrite) float liaTh;
 @property (atomic, readwrite) bool csvFmt;
 @property (atomic, readwrite) unsigned int lastHeader;
 @end
 
 @implementation UDPServerThread
+{
+    LiveData _live;             // receive thread's working copy
+    LiveSnapshot _snapshot;     // what the user interface sees of _live
+    PacketSequence _sequence;   // sequence numbers from the packet counter
+}
 
 std::ofstream stream;
 - (void)dealloc
@@ -176,6 +173,10 @@ std::ofstream stream;
     
     _hdr = new PacketHeader;
     _hdr->setHeader(-1);
+    memset(&_live, 0, sizeof(_live));
+    _live.what = -1;
+    _live.rate = -1;
+    _snapshot.publish(_live);
     
     assert(self.echo == nil);
     self.echo = [[UDPServe alloc] init];
@@ -231,8 +232,10 @@ std::ofstream stream;
 - (void)setFile:(NSString *)fname truncate:(bool)trunc
 {
     [self closeFile];
+    [_udpLock lock];
+    _sequence.restart();         // number from 0 in the new file
+    [_udpLock unlock];
     [_streamLock lock];
-    _index = -1;
     stream.clear();
     stream.open([fname UTF8String], (_csvFmt?0:std::ios::binary) | (trunc?std::ios::trunc:std::ios::app));
     if (_csvFmt)
@@ -301,27 +304,35 @@ std::ofstream stream;
         }
     }
     
-    // check for dropped packet
-    // is (last packet counter + 1)%256 == this packet counter?
-    int idx = _hdr->counter;
-    if (_index >= 0)
+    // check for dropped packets
+    // the 8 bit counter and the arrival time give the packet's sequence number (PacketSequence.cpp)
+    int kind = _sequence.next(_buffer[0], _live.rxTime);
+    int missing = _sequence.missing;
+    if (missing)
     {
-        _index = (_index + 1)%256;
-        if (_index != idx)
-        {
-            _missed = true;
-            _index = idx - _index;
-            if (_index < 0)
-                _index += 256;
-            stream << "Dropped " << _index << " packets!" << std::endl;
-            NSLog([NSString stringWithFormat:@"dropped %d", _index]);
-        }
+        _live.dropped += missing;
+        int b = 0;
+        while ((missing >> (b + 1)) && b < GAP_BUCKETS-1)
+            ++b;
+        ++_live.gaps[b];
+        stream << "Dropped " << missing << " packets!" << std::endl;
+        NSLog([NSString stringWithFormat:@"dropped %d", missing]);
+    }
+    if (kind == SEQ_DUPLICATE)
+    {
+        ++_live.duplicates;
+        [_udpLock unlock];
+        return;                 // already have it
     }
-    _index = idx;
+    if (kind == SEQ_LATE)
+        ++_live.late;
+    _live.retracted += _sequence.retracted;
     
     // overload
-    if (!_overload)
-        _overload = _hdr->over;
+    if (_hdr->over)
+        ++_live.overloads;
+    _live.what = _hdr->what;
+    _live.rate = _hdr->rate;
     
     
     // union for interpreting 32bit data word as different types
@@ -339,68 +350,68 @@ std::ofstream stream;
         case 0:
             // x-only (float)
             dat.ival = _buffer[1];
-            _liaX = dat.fval;         // interpret as float
-            _liaY = _liaR = _liaTh = 0.0;
+            _live.x = dat.fval;       // interpret as float
+            _live.y = _live.r = _live.th = 0.0;
             break;
         case 1:
             // xy (float)
             dat.ival = _buffer[1];
-            _liaX = dat.fval;         // interpret as float
+            _live.x = dat.fval;       // interpret as float
             dat.ival = _buffer[2];
-            _liaY = dat.fval;         // interpret as float
-            _liaR = _liaTh = 0.0;
+            _live.y = dat.fval;       // interpret as float
+            _live.r = _live.th = 0.0;
             break;
         case 2:
             // rth (float)
             dat.ival = _buffer[1];
-            _liaR = dat.fval;         // interpret as float
+            _live.r = dat.fval;       // interpret as float
             dat.ival = _buffer[2];
-            _liaTh = dat.fval;        // interpret as float
-            _liaX = _liaY = 0.0;
+            _live.th = dat.fval;      // interpret as float
+            _live.x = _live.y = 0.0;
             break;
         case 3:
             // xyrth (float)
             dat.ival = _buffer[1];
-            _liaX = dat.fval;         // interpret as float
+            _live.x = dat.fval;       // interpret as float
             dat.ival = _buffer[2];
-            _liaY = dat.fval;         // interpret as float
+            _live.y = dat.fval;       // interpret as float
             dat.ival = _buffer[3];
-            _liaR = dat.fval;         // interpret as float
+            _live.r = dat.fval;       // interpret as float
             dat.ival = _buffer[4];
-            _liaTh = dat.fval;        // interpret as float
+            _live.th = dat.fval;      // interpret as float
             break;
 
         case 4:
             // x-only (int)
             dat.ival = _buffer[1];
-            _liaX = dat.sval[0];      // interpret as int
-            _liaY = _liaR = _liaTh = 0.0;
+            _live.x = dat.sval[0];    // interpret as int
+            _live.y = _live.r = _live.th = 0.0;
             break;
         case 5:
             // xy (int)
             dat.ival = _buffer[1];
-            _liaX = dat.sval[0];      // interpret as int
-            _liaY = dat.sval[1];      // interpret as int
-            _liaR = _liaTh = 0.0;
+            _live.x = dat.sval[0];    // interpret as int
+            _live.y = dat.sval[1];    // interpret as int
+            _live.r = _live.th = 0.0;
             break;
         case 6:
             // rth (int)
             dat.ival = _buffer[1];
-            _liaR = dat.sval[0];      // interpret as int
-            _liaTh = dat.sval[1];     // interpret as int
-            _liaX = _liaY = 0.0;
+            _live.r = dat.sval[0];    // interpret as int
+            _live.th = dat.sval[1];   // interpret as int
+            _live.x = _live.y = 0.0;
             break;
         case 7:
             // xyrth (int)
             dat.ival = _buffer[1];
-            _liaX = dat.sval[0];      // interpret as int
-            _liaY = dat.sval[1];      // interpret as int
+            _live.x = dat.sval[0];    // interpret as int
+            _live.y = dat.sval[1];    // interpret as int
             dat.ival = _buffer[2];
-            _liaR = dat.sval[0];      // interpret as int
-            _liaTh = dat.sval[1];     // interpret as int
+            _live.r = dat.sval[0];    // interpret as int
+            _live.th = dat.sval[1];   // interpret as int
             break;
         default:
-            _liaX = _liaY = _liaR = _liaTh = 0.0;
+            _live.x = _live.y = _live.r = _live.th = 0.0;
             break;
     }
 
@@ -500,21 +511,11 @@ std::ofstream stream;
     }
     [_streamLock unlock];
 }
-- (void)getData:(int *)pwhat rate:(int *)prate liax:(float *)pliax liay:(float *)pliay liar:(float *)pliar liath:(float *)pliath count:(int *)pbyte_count missed:(bool *)pmissed overload:(bool *)pover
+// latest published state, for the user interface
+// counters are totals; caller takes differences
+- (void)getData:(LiveData *)pdata
 {
-    *pwhat = _hdr->what;
-    *prate = _hdr->rate;
-    *pliax = _liaX;
-    *pliay = _liaY;
-    *pliar = _liaR;
-    *pliath = _liaTh;
-    *pbyte_count = _count;
-    *pmissed = _missed;
-    *pover = _overload;
-    
-    _count = 0;
-    _missed = false;
-    _overload = false;
+    _snapshot.read(*pdata);
 }
 
 
@@ -530,8 +531,12 @@ std::ofstream stream;
 
     _buffer = (unsigned int *)data;
     unsigned int len32 = (unsigned int)len;
-    _count += len32;
+    _live.rxTime = captureClock();
+    _live.bytes += len32;
+    ++_live.packets;
     [self gotData:(len32 >> 2)];
+    // packets arrive from the run loop, with no idle wakeup to publish a batch later
+    _snapshot.publish(_live);
 }
 
 - (void)echo:(UDPServe *)echo didReceiveError:(NSError *)error
@@ -0,0 +1,92 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "AlignSink.h"
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+AlignSink::AlignSink(StreamAligner *streamAligner, int streamNumber, CaptureSink *sampleSink)
+{
+    aligner = streamAligner;
+    stream = streamNumber;
+    samples = sampleSink;
+    cross = NULL;
+    crossInput = 0;
+    opened = false;
+    packets = 0;
+}
+/*virtual*/ AlignSink::~AlignSink()
+{
+    close();
+    delete samples;
+}
+
+void AlignSink::setCross(CrossSpectrum *spectrum, int input)
+{
+    cross = spectrum;
+    crossInput = input;
+}
+
+// fname is this stream's own capture file, if it has one
+/*virtual*/ bool AlignSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    if (samples && !samples->open(fname, trunc))
+        return false;
+    opened = true;
+    packets = 0;
+    return true;
+}
+/*virtual*/ bool AlignSink::isOpen() const
+{
+    return opened;
+}
+/*virtual*/ void AlignSink::write(const CapturePacket &pkt)
+{
+    if (!opened)
+        return;
+    if (samples)
+        samples->write(pkt);
+    if (aligner)
+        aligner->write(stream, pkt);
+    if (cross)
+        cross->write(crossInput, pkt);
+    ++packets;
+}
+/*virtual*/ void AlignSink::close()
+{
+    if (samples)
+        samples->close();
+    opened = false;
+}
+
+/*virtual*/ long long AlignSink::bytesWritten()
+{
+    return samples ? samples->bytesWritten() : 0;
+}
+/*virtual*/ long long AlignSink::packetsWritten() const
+{
+    return samples ? samples->packetsWritten() : packets;
+}
+/*virtual*/ void AlignSink::note(const std::string &text)
+{
+    if (samples)
+        samples->note(text);
+}
+/*virtual*/ long long AlignSink::syncCount() const
+{
+    return samples ? samples->syncCount() : 0;
+}
+/*virtual*/ double AlignSink::syncTime() const
+{
+    return samples ? samples->syncTime() : 0.0;
+}
+/*virtual*/ void AlignSink::idle(double now)
+{
+    if (samples)
+        samples->idle(now);
+}
@@ -0,0 +1,52 @@
+//---------------------------------------------------------------------------
+
+#ifndef AlignSinkH
+#define AlignSinkH
+
+#include "CaptureSink.h"
+#include "StreamAlign.h"
+#include "CrossSpectrum.h"
+
+//---------------------------------------------------------------------------
+
+// one instrument's stream into a StreamAligner (see StreamAlign.h)
+//
+// Each stream has its own receive thread, packet queue and writer thread, as a single capture does;
+// this sink hands its packets to the aligner they all share, and optionally saves them to a
+// capture file of their own as well. The aligner is opened and closed by its owner, not by the sinks.
+// The two streams of a CrossSpectrum are fed the same way (setCross()).
+
+class AlignSink : public CaptureSink
+{
+protected:
+    StreamAligner *aligner;         // NULL = none
+    int stream;
+    CrossSpectrum *cross;           // NULL = none
+    int crossInput;
+    CaptureSink *samples;           // capture file of this stream; NULL = merged records only
+    bool opened;
+    long long packets;
+
+public:
+    // takes ownership of samples (may be NULL), not of the aligner (may be NULL)
+    AlignSink(StreamAligner *aligner, int stream, CaptureSink *samples);
+    virtual ~AlignSink();
+
+    // also feed input 0 (A) or 1 (B) of a cross spectrum; not owned
+    void setCross(CrossSpectrum *spectrum, int input);
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+    virtual long long syncCount() const;
+    virtual double syncTime() const;
+    virtual void idle(double now);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,320 @@
+//---------------------------------------------------------------------------
+// CaptureAlign
+// command line capture of several SR86x streams at once, merged onto one time base
+//
+// usage: CaptureAlign -p port[,delay] -p port[,delay] ... [-t seconds] [-o file] [-D align] [-c file] [-C cross] [-k] [-R receive]
+//   -p   UDP port of one instrument's stream (up to 8); delay (seconds) is taken off its times,
+//        e.g. the difference in network latency if it is known
+//   -t   stop after this many seconds (default: at ctrl-C)
+//   -o   merged records: .csv = comma separated, else binary (see StreamAlign.h); default "align.dat"
+//        unless -c is given
+//   -D   record rate & clock fit, e.g. "rate=1000;passband=0.9;memory=60;timeout=0.5" (see StreamAlign.h)
+//   -c   cross spectrum & coherence of the first two streams (see CrossSpectrum.h)
+//   -C   its segments & channels, e.g. "fft=8192;averages=32;seconds=2;a=X;b=XY"
+//   -k   also keep each stream's own capture, "<file>.<port>.dat" (file of -o, else of -c)
+//   -R   receive buffer & mode of every socket, e.g. "buffer=32M" (see ReceiveSocket.h)
+//
+// Start the streams from the capture program or over VXI-11 (STREAM ON) on each instrument,
+// each to its own port; this program only listens.
+// Each port has its own ReceiveSocket, PacketDecoder, packet queue and writer thread, as in CaptureLive;
+// the writer threads all feed one StreamAligner, which writes the merged records, and a CrossSpectrum.
+// Once a second it prints each stream's packets, losses and clock drift against this computer's.
+//
+// This is a separate console program, not part of UDPCapture.cbproj. Build with e.g.
+//   g++ -O2 -o CaptureAlign CaptureAlign.cpp CaptureLoop.cpp StreamAlign.cpp CrossSpectrum.cpp AlignSink.cpp ReceiveSocket.cpp PacketDecoder.cpp PacketSequence.cpp
+//       PacketQueue.cpp CaptureWriter.cpp CaptureSink.cpp CompressedSink.cpp ColumnSink.cpp JournalSink.cpp SpectrumSink.cpp WelchPsd.cpp
+//       Fft.cpp ResampleSink.cpp Resampler.cpp EnvelopeSink.cpp Envelope.cpp FlagSink.cpp PolarSink.cpp Polar.cpp StreamStats.cpp SampleScale.cpp
+//       TriggerSink.cpp Trigger.cpp Deinterleave.cpp DeltaCodec.cpp PacketHeader.cpp CaptureTrace.cpp -lpthread
+
+#pragma hdrstop
+
+#include "CaptureLoop.h"
+#include "CaptureSink.h"
+#include "StreamAlign.h"
+#include "CrossSpectrum.h"
+#include "AlignSink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <signal.h>
+
+//---------------------------------------------------------------------------
+
+// one instrument's stream
+struct AlignInput
+{
+    int port;
+    double delay;
+    ReceiveSocket sock;
+    PacketQueue queue;
+    PacketDecoder decoder;
+    CaptureWriter writer;
+    LiveSnapshot snapshot;          // what the main thread sees of decoder.live
+    volatile long stopReceive, stopWriter;
+    bool failed;
+    LiveData last;                  // at the last report
+#ifdef _WIN32
+    HANDLE receiveThread, writerThread;
+#else
+    pthread_t receiveThread, writerThread;
+#endif
+
+    AlignInput() : decoder(&queue), writer(&queue), stopReceive(0), stopWriter(0), failed(false) {}
+};
+
+static volatile sig_atomic_t stopCapture = 0;
+
+static void onSignal(int)
+{
+    stopCapture = 1;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI receiveMain(LPVOID arg)
+#else
+static void *receiveMain(void *arg)
+#endif
+{
+    AlignInput *in = (AlignInput *)arg;
+    if (!receiveLoop(in->sock, in->decoder, in->snapshot, &in->stopReceive))
+        in->failed = true;
+    return 0;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI writerMain(LPVOID arg)
+#else
+static void *writerMain(void *arg)
+#endif
+{
+    AlignInput *in = (AlignInput *)arg;
+    writerLoop(in->writer, &in->stopWriter);
+    return 0;
+}
+
+#ifdef _WIN32
+static void startThread(HANDLE &thread, LPTHREAD_START_ROUTINE main, void *arg)
+{
+    thread = CreateThread(NULL, 0, main, arg, 0, NULL);
+}
+static void joinThread(HANDLE thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+static void startThread(pthread_t &thread, void *(*main)(void *), void *arg)
+{
+    pthread_create(&thread, NULL, main, arg);
+}
+static void joinThread(pthread_t thread)
+{
+    pthread_join(thread, NULL);
+}
+#endif
+
+//---------------------------------------------------------------------------
+
+static void usage()
+{
+    printf("usage: CaptureAlign -p port[,delay] -p port[,delay] ... [-t seconds] [-o file] [-D align] [-c file] [-C cross] [-k] [-R receive]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<AlignInput *> inputs;
+    double seconds = 0.0;
+    std::string outName, crossName;
+    bool keep = false;
+    AlignOptions opt;
+    CrossOptions crossOpt;
+    ReceiveOptions receive;
+    std::string err;
+
+    for (int i=1;i<argc;++i)
+    {
+        if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+        {
+            AlignInput *in = new AlignInput;
+            const char *arg = argv[++i];
+            in->port = atoi(arg);
+            const char *comma = strchr(arg, ',');
+            in->delay = comma ? atof(comma + 1) : 0.0;
+            inputs.push_back(in);
+            if (in->port <= 0 || in->port > 65535 || (int)inputs.size() > ALIGN_MAX_STREAMS)
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i+1 < argc)
+            seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            outName = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0 && i+1 < argc)
+            crossName = argv[++i];
+        else if (strcmp(argv[i], "-C") == 0 && i+1 < argc)
+        {
+            if (!parseCross(argv[++i], crossOpt, err))
+            {
+                printf("-C: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-k") == 0)
+            keep = true;
+        else if (strcmp(argv[i], "-D") == 0 && i+1 < argc)
+        {
+            if (!parseAlign(argv[++i], opt, err))
+            {
+                printf("-D: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-R") == 0 && i+1 < argc)
+        {
+            if (!parseReceive(argv[++i], receive, err))
+            {
+                printf("-R: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (inputs.empty() || (!crossName.empty() && inputs.size() < 2))
+    {
+        usage();
+        return 2;
+    }
+    if (outName.empty() && crossName.empty())
+        outName = "align.dat";
+    std::string keepName = outName.empty() ? crossName : outName;
+
+#ifdef _WIN32
+    WSAData wsdat;
+    WSAStartup(0x0101, &wsdat);
+#endif
+    StreamAligner aligner(opt);
+    CrossSpectrum cross(crossOpt);
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        AlignInput *in = inputs[i];
+        if (!in->sock.open(in->port, receive, err))
+        {
+            printf("port %d: %s\n", in->port, err.c_str());
+            return 1;
+        }
+        if (!in->sock.warning().empty())
+            printf("port %d: %s\n", in->port, in->sock.warning().c_str());
+        printf("listening on UDP port %d, receive buffer %d kB\n", in->port, in->sock.bufferBytes() >> 10);
+
+        int stream = aligner.addStream(in->delay);
+        CaptureSink *own = keep ? newFileSink(SinkOptions()) : NULL;
+        AlignSink *sink = new AlignSink(outName.empty() ? NULL : &aligner, stream, own);
+        if (!crossName.empty() && i < 2)
+        {
+            cross.setDelay((int)i, in->delay);
+            sink->setCross(&cross, (int)i);
+        }
+        char name[32];
+        sprintf(name, ".%d.dat", in->port);
+        if (!sink->open(sinkPath((keepName + name).c_str()), true))
+        {
+            printf("%s%s: could not create file\n", keepName.c_str(), name);
+            delete sink;
+            return 1;
+        }
+        in->writer.setSink(sink);
+    }
+    if (!outName.empty() && !aligner.open(sinkPath(outName.c_str())))
+    {
+        printf("%s: could not create file\n", outName.c_str());
+        return 1;
+    }
+    if (!crossName.empty() && !cross.open(sinkPath(crossName.c_str())))
+    {
+        printf("%s: could not create file\n", crossName.c_str());
+        return 1;
+    }
+
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        startThread(inputs[i]->writerThread, writerMain, inputs[i]);
+        startThread(inputs[i]->receiveThread, receiveMain, inputs[i]);
+    }
+    signal(SIGINT, onSignal);
+
+    double t0 = captureClock();
+    double nextReport = t0 + 1.0;
+    while (!stopCapture)
+    {
+        captureSleep(50);
+        double now = captureClock();
+        if (now >= nextReport)
+        {
+            printf("%6.0f s:", now - t0);
+            if (!outName.empty())
+                printf(" %lld records;", aligner.recordsWritten());
+            if (!crossName.empty())
+                printf(" %lld spectra;", cross.spectrumCount());
+            for (size_t i=0;i<inputs.size();++i)
+            {
+                AlignInput *in = inputs[i];
+                LiveData live;
+                in->snapshot.read(live);
+                double drift, late;
+                printf(" %d: %lld packets, %lld lost", in->port, live.packets - in->last.packets, live.dropped - in->last.dropped);
+                if (aligner.clockOf((int)i, drift, late))
+                    printf(", drift %+.2f ppm, late %.1f ms", drift, late * 1.0e3);
+                printf(i+1 < inputs.size() ? ";" : "\n");
+                in->last = live;
+            }
+            fflush(stdout);
+            nextReport += 1.0;
+        }
+        if (seconds > 0.0 && now - t0 >= seconds)
+            break;
+    }
+
+    // receive threads first, so the writers get everything that came
+    for (size_t i=0;i<inputs.size();++i)
+        atomicStore(&inputs[i]->stopReceive, 1);
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        joinThread(inputs[i]->receiveThread);
+        inputs[i]->sock.close();
+        atomicStore(&inputs[i]->stopWriter, 1);
+        joinThread(inputs[i]->writerThread);
+    }
+    for (size_t i=0;i<inputs.size();++i)
+        inputs[i]->writer.setSink(NULL);
+    aligner.close();
+    cross.close();
+
+    double elapsed = captureClock() - t0;
+    if (!outName.empty())
+        printf("%lld records ", aligner.recordsWritten());
+    if (!crossName.empty())
+        printf("%s%lld spectra ", outName.empty() ? "" : "and ", cross.spectrumCount());
+    printf("in %.1f s\n", elapsed);
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        AlignInput *in = inputs[i];
+        const LiveData &live = in->decoder.live;
+        double drift, late;
+        printf("  port %d: %lld packets, %lld lost, %lld not saved (queue full)", in->port,
+               live.packets, live.dropped, live.unsaved);
+        if (aligner.clockOf((int)i, drift, late))
+            printf(", clock drift %+.2f ppm", drift);
+        printf("%s\n", in->failed ? ", receive failed" : "");
+        delete in;
+    }
+    return 0;
+}
+//---------------------------------------------------------------------------
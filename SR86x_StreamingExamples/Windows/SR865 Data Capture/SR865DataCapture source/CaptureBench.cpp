@@ -0,0 +1,676 @@
+//---------------------------------------------------------------------------
+// CaptureBench
+// command line benchmark of the capture pipeline, from received packet to file
+//
+// usage: CaptureBench [-n packets] [-d dir] [-r capture.dat | capture.pcapng] [-p port] [-j journal] [-e rate] [-x seconds]
+//   -n   packets per case (default 10000)
+//   -d   directory for the capture files (default: current directory); removed after each case
+//   -r   replay the packets of a binary capture file, or a network capture (pcap / pcapng),
+//        instead of generated packets
+//   -p   UDP port of the stream in a network capture (default 1865)
+//   -j   sync settings of the journal case (default "packets=1000;seconds=0"; see JournalSink.h)
+//   -e   only the envelope zoom benchmark, at this rate code (see below)
+//   -x   only the cross spectrum benchmark, this many seconds of both streams (see below)
+//
+// Every case runs packets through PacketDecoder and CaptureWriter, the same code UDPServerThread uses:
+// byte order, packet counter, live values, packet queue, then the file sink.
+// Generated packets cover every content code (0-7), packet length (1024, 512, 256, 128 bytes)
+// and data byte order (big & little endian), each saved as binary, csv, compressed and column files,
+// as noise spectra, as binary with an envelope pyramid beside it, as binary with R and theta
+// added to X,Y packets (polar), triggered (only the packets around X crossing zero),
+// and journaled (synced to disk with a checkpoint every so often; -d decides which disk).
+//
+// The envelope zoom benchmark (-e) builds the envelope (Envelope.h) of a 24 hour X,Y capture at
+// 1.25 MHz / 2^rate (rate 8: 4.9 kHz, a 120 MB envelope; every step down doubles it), then draws spans
+// from the whole day down to about a millisecond on 1920 points, at 50 places each:
+//   query_us (mean & max), bytes_per_query, and the level read.
+// The file is read through the system's cache, as a viewer scrolling about a capture would.
+//
+// The cross spectrum benchmark (-x) feeds two X,Y streams at 1.25 MHz (the fastest rate; the second
+// instrument's clock 20 ppm fast) packet by packet into one CrossSpectrum, for X against X
+// (one-sided) and XY against XY (two-sided), at several segment sizes:
+//   cpu_s, realtime (stream seconds per cpu second: above 1 keeps up on one core), ns_per_sample.
+// Decode and save run one after the other on one thread, so the times are cpu cost, not thread hand-off.
+//
+// Results go to stdout as JSON, one case per line, for comparing releases:
+//   packets_per_s, mb_per_s (UDP bytes), ns_per_packet (decode + save),
+//   decode_ns_per_packet, save_ns_per_packet, allocs & alloc_bytes (operator new during the timed run),
+//   syncs & sync_us (journal: syncs to disk, the one at close as well, and the mean time of one)
+//
+// This is a separate console program, not part of UDPCapture.cbproj. Build with e.g.
+//   g++ -O2 -o CaptureBench CaptureBench.cpp PacketDecoder.cpp PacketSequence.cpp PacketQueue.cpp CaptureWriter.cpp CaptureSink.cpp
+//       CompressedSink.cpp ColumnSink.cpp JournalSink.cpp SpectrumSink.cpp WelchPsd.cpp Fft.cpp ResampleSink.cpp Resampler.cpp
+//       EnvelopeSink.cpp Envelope.cpp FlagSink.cpp PolarSink.cpp Polar.cpp StreamStats.cpp SampleScale.cpp Deinterleave.cpp DeltaCodec.cpp
+//       TriggerSink.cpp Trigger.cpp PacketHeader.cpp CaptureTrace.cpp PcapReader.cpp CrossSpectrum.cpp StreamAlign.cpp -lpthread
+
+#pragma hdrstop
+
+#include "PacketDecoder.h"
+#include "PcapReader.h"
+#include "CaptureWriter.h"
+#include "CaptureSink.h"
+#include "EnvelopeSink.h"
+#include "CrossSpectrum.h"
+#include "SampleScale.h"
+#include "CaptureSimd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <new>
+#include <vector>
+#include <string>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+//---------------------------------------------------------------------------
+// allocation counting
+
+static long long allocCount = 0;
+static long long allocBytes = 0;
+
+// exception specifications were dropped from the language in C++17
+#if __cplusplus < 201103L
+#define THROWS_BAD_ALLOC throw (std::bad_alloc)
+#define THROWS_NOTHING throw()
+#else
+#define THROWS_BAD_ALLOC
+#define THROWS_NOTHING noexcept
+#endif
+// kept out of line: inlined into a caller, malloc / free would meet new / delete there (-Wmismatched-new-delete)
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+NOINLINE void *operator new(size_t n) THROWS_BAD_ALLOC
+{
+    ++allocCount;
+    allocBytes += n;
+    void *p = malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+NOINLINE void *operator new[](size_t n) THROWS_BAD_ALLOC
+{
+    ++allocCount;
+    allocBytes += n;
+    void *p = malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+NOINLINE void operator delete(void *p) THROWS_NOTHING
+{
+    free(p);
+}
+NOINLINE void operator delete[](void *p) THROWS_NOTHING
+{
+    free(p);
+}
+#if __cplusplus >= 201402L
+// sized forms (C++14), so the compiler's own calls come here too
+NOINLINE void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+NOINLINE void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+#endif
+
+//---------------------------------------------------------------------------
+// packet sources
+
+// one packet as it arrives from the network
+struct WirePacket
+{
+    unsigned int buffer[300];
+    int bytes;
+};
+
+// 256 packets (one full turn of the packet counter) of slowly varying data
+static void generatePackets(int what, int length, bool little, std::vector<WirePacket> &pkts)
+{
+    PacketHeader hdr(what << 8 | length << 12);
+    int nbytes = hdr.byteLength();
+    pkts.resize(256);
+    double phase = 0.0;
+    for (int k=0;k<256;++k)
+    {
+        WirePacket &w = pkts[k];
+        unsigned int head = (unsigned int)k | (what << 8) | (length << 12) | (little ? 0x10000000 : 0);
+        w.buffer[0] = htonl(head);
+        w.bytes = 4 + nbytes;
+        if (hdr.isInt())
+        {
+            unsigned short *s = (unsigned short *)(w.buffer + 1);
+            for (int i=0;i<nbytes/2;++i, phase+=0.001)
+            {
+                unsigned short v = (unsigned short)(short)(20000.0 * sin(phase) + (i & 7));
+                s[i] = little ? v : htons(v);
+            }
+        }
+        else
+        {
+            union { float f; unsigned int u; } v;
+            for (int i=0;i<nbytes/4;++i, phase+=0.001)
+            {
+                v.f = (float)(1.0e-3 * sin(phase) + 1.0e-7 * (i & 7));
+                w.buffer[1+i] = little ? v.u : htonl(v.u);
+            }
+        }
+    }
+}
+
+// UDP payloads of a network capture
+static bool networkPackets(const char *fname, int port, std::vector<WirePacket> &pkts)
+{
+    PcapReader reader;
+    if (!reader.open(sinkPath(fname)))
+        return false;
+    WirePacket w;
+    double time;
+    const unsigned char *payload;
+    int length;
+    while (reader.next(port, time, payload, length))
+    {
+        w.bytes = (length < (int)sizeof(w.buffer)) ? length : (int)sizeof(w.buffer);
+        memcpy(w.buffer, payload, w.bytes);
+        pkts.push_back(w);
+    }
+    return !pkts.empty();
+}
+
+// packets of a binary capture file, put back into network order
+static bool replayPackets(const char *fname, std::vector<WirePacket> &pkts)
+{
+    FILE *f = fopen(fname, "rb");
+    if (!f)
+        return false;
+    WirePacket w;
+    while (fread(w.buffer, 4, 1, f) == 1)
+    {
+        PacketHeader hdr(w.buffer[0]);
+        if (!hdr.isGood())
+            break;
+        int nbytes = hdr.byteLength();
+        if (fread(w.buffer + 1, 1, nbytes, f) != (size_t)nbytes)
+            break;
+        w.bytes = 4 + nbytes;
+        w.buffer[0] = htonl(w.buffer[0]);
+        if (!hdr.littleEnd)
+        {
+            if (hdr.isInt())
+            {
+                unsigned short *s = (unsigned short *)(w.buffer + 1);
+                for (int i=0;i<nbytes/2;++i)
+                    s[i] = htons(s[i]);
+            }
+            else
+            {
+                for (int i=0;i<nbytes/4;++i)
+                    w.buffer[1+i] = htonl(w.buffer[1+i]);
+            }
+        }
+        pkts.push_back(w);
+    }
+    fclose(f);
+    return !pkts.empty();
+}
+
+//---------------------------------------------------------------------------
+// one case
+
+enum { SINK_BINARY, SINK_CSV, SINK_COMPRESSED, SINK_COLUMNS, SINK_SPECTRA, SINK_ENVELOPE, SINK_POLAR, SINK_TRIGGER, SINK_JOURNAL, SINKS };
+static const char *sinkNames[SINKS] = { "binary", "csv", "compressed", "columns", "spectra", "envelope", "polar", "trigger", "journal" };
+static const char *sinkExt[SINKS] = { "dat", "csv", "dat", "idx", "psd", "dat", "dat", "dat", "dat" };
+
+static SinkOptions journalOptions;  // -j
+
+struct BenchResult
+{
+    long long packets;
+    long long udpBytes;
+    long long fileBytes;
+    double decodeTime;
+    double saveTime;
+    long long allocs;
+    long long allocBytes;
+    long long syncs;
+    double syncTime;
+};
+
+static void removeCapture(const std::string &fname, int sink)
+{
+    remove(fname.c_str());
+    if (sink == SINK_COLUMNS)
+    {
+        std::string base = fname.substr(0, fname.length() - 4);
+        const char *cols[] = { ".X.col", ".Y.col", ".R.col", ".Th.col" };
+        for (int c=0;c<4;++c)
+            remove((base + cols[c]).c_str());
+    }
+    if (sink == SINK_ENVELOPE)
+        remove((fname + ".env").c_str());
+    if (sink == SINK_TRIGGER)
+        remove((fname + ".log").c_str());
+    if (sink == SINK_JOURNAL)
+        remove((fname + ".ckp").c_str());
+}
+
+static bool runCase(const std::vector<WirePacket> &pkts, int sink, long long npackets, const std::string &fname, BenchResult &res)
+{
+    SinkOptions opt;
+    opt.csv = (sink == SINK_CSV);
+    opt.compress = (sink == SINK_COMPRESSED);
+    opt.columns = (sink == SINK_COLUMNS);
+    opt.spectra = (sink == SINK_SPECTRA);
+    opt.envelope.side = (sink == SINK_ENVELOPE);
+    opt.polar.on = (sink == SINK_POLAR);
+    if (sink == SINK_TRIGGER)
+    {
+        // X of the generated data crossing zero: a window every few dozen packets;
+        // each event is a note, so this case allocates (a line of text per event)
+        std::string err;
+        parseTrigger("source=X;edge=both;level=0;pre=0.0001;post=0.0001", opt.trigger, err);
+    }
+    if (sink == SINK_JOURNAL)
+    {
+        opt.journal = true;
+        opt.syncPackets = journalOptions.syncPackets;
+        opt.syncSeconds = journalOptions.syncSeconds;
+    }
+
+    PacketQueue queue;
+    PacketDecoder decoder(&queue);
+    CaptureWriter writer(&queue);
+    CaptureSink *file = newFileSink(opt);
+    if (!file->open(sinkPath(fname.c_str()), true))
+    {
+        delete file;
+        return false;
+    }
+    writer.setSink(file);
+
+    memset(&res, 0, sizeof(res));
+    long long allocs0 = allocCount;
+    long long bytes0 = allocBytes;
+    int npkts = (int)pkts.size();
+    const int batch = 64;           // packets decoded between drains
+    for (long long i=0;i<npackets;)
+    {
+        double t0 = captureClock();
+        for (int k=0;k<batch && i<npackets;++k, ++i)
+        {
+            const WirePacket &w = pkts[(int)(i % npkts)];
+            CapturePacket *pkt = decoder.slot();
+            memcpy(pkt->buffer, w.buffer, w.bytes);
+            TRACE_STAMP(pkt, TRACE_RECV);
+            pkt->rxTime = captureClock();
+            pkt->scale = 6;         // 10 mV full scale
+            decoder.decode(pkt, w.bytes);
+            res.udpBytes += w.bytes;
+        }
+        double t1 = captureClock();
+        while (writer.drain() > 0)
+            ;
+        double t2 = captureClock();
+        res.decodeTime += t1 - t0;
+        res.saveTime += t2 - t1;
+    }
+    decoder.flush();
+    while (writer.drain() > 0)
+        ;
+    res.fileBytes = file->bytesWritten();
+
+    // closing flushes the last of the data; that's part of saving
+    // (closed here, everything is drained, so its syncs can be read before the writer deletes it)
+    double t0 = captureClock();
+    file->close();
+    res.saveTime += captureClock() - t0;
+    res.syncs = file->syncCount();
+    res.syncTime = file->syncTime();
+    t0 = captureClock();
+    writer.setSink(NULL);
+    res.saveTime += captureClock() - t0;
+
+    res.allocs = allocCount - allocs0;
+    res.allocBytes = allocBytes - bytes0;
+    res.packets = npackets;
+    return true;
+}
+
+static bool firstCase = true;
+
+static void printResult(const char *what, const BenchResult &res)
+{
+    double t = res.decodeTime + res.saveTime;
+    printf("%s    {%s, \"packets\": %lld, \"seconds\": %.6f, \"packets_per_s\": %.0f, \"mb_per_s\": %.3f, "
+           "\"ns_per_packet\": %.1f, \"decode_ns_per_packet\": %.1f, \"save_ns_per_packet\": %.1f, "
+           "\"allocs\": %lld, \"alloc_bytes\": %lld, \"file_bytes\": %lld, \"syncs\": %lld, \"sync_us\": %.1f}",
+           firstCase ? "" : ",\n", what, res.packets, t, res.packets / t, res.udpBytes / t / 1.0e6,
+           1.0e9 * t / res.packets, 1.0e9 * res.decodeTime / res.packets, 1.0e9 * res.saveTime / res.packets,
+           res.allocs, res.allocBytes, res.fileBytes, res.syncs, res.syncs ? 1.0e6 * res.syncTime / res.syncs : 0.0);
+    fflush(stdout);
+    firstCase = false;
+}
+
+//---------------------------------------------------------------------------
+// envelope zoom
+
+static bool runZoom(int rateCode, const std::string &fname)
+{
+    const double hours = 24.0;
+    const int points = 1920;
+    const int block = 4096;
+    double rate = 1.25e6 / (1 << rateCode);
+    long long frames = (long long)(hours * 3600.0 * rate);
+    EnvelopeOptions opt;
+
+    // build: slowly drifting X,Y with a little noise
+    FILE *f = sinkOpen(sinkPath(fname.c_str()), "w+b");
+    if (!f)
+        return false;
+    EnvelopeBuilder *builder = new EnvelopeBuilder;
+    builder->start(f, opt.bucketFrames);
+    EnvelopeSectionHead head;
+    memset(&head, 0, sizeof(head));
+    head.header = (1 << 8) | (rateCode << 16);
+    head.sampleRate = rate;
+    head.bucketSeconds = opt.bucketFrames / rate;
+    builder->beginSection(head);
+    std::vector<float> values(2 * block);
+    int cols[2] = { 0, 1 };
+    unsigned int noise = 1;
+    double t0 = captureClock();
+    for (long long s=0;s<frames;s+=block)
+    {
+        double drift = 1.0e-3 * sin(s * 2.0e-7);
+        for (int i=0;i<2*block;++i)
+        {
+            noise = noise * 1664525u + 1013904223u;
+            values[i] = (float)(drift + 1.0e-6 * ((int)(noise >> 16) - 32768) / 32768.0);
+        }
+        int n = (frames - s < block) ? (int)(frames - s) : block;
+        builder->add(&values[0], n, 2, cols, s, false);
+    }
+    builder->endSection();
+    double buildTime = captureClock() - t0;
+    long long fileBytes = builder->bytesWritten();
+    delete builder;
+    fclose(f);
+    printf("%s    {\"envelope_hours\": %.0f, \"rate_hz\": %.1f, \"samples\": %lld, \"build_s\": %.3f, \"ns_per_sample\": %.2f, \"file_bytes\": %lld}",
+           firstCase ? "" : ",\n", hours, rate, 2 * frames, buildTime, 1.0e9 * buildTime / (2 * frames), fileBytes);
+    firstCase = false;
+
+    // zoom: each span 4 times shorter, at 50 places
+    EnvelopeReader *reader = new EnvelopeReader;
+    if (!reader->open(sinkPath(fname.c_str())))
+    {
+        delete reader;
+        return false;
+    }
+    std::vector<EnvelopePoint> out(points);
+    double start = reader->startTime(), end = reader->endTime();
+    unsigned int pos = 12345;
+    for (double span=end-start;span>=1.0e-3;span/=4.0)
+    {
+        double total = 0.0, longest = 0.0;
+        long long bytes0 = reader->bytesRead();
+        int level = -1;
+        const int places = 50;
+        for (int k=0;k<places;++k)
+        {
+            pos = pos * 1664525u + 1013904223u;
+            double a = start + (end - start - span) * (pos >> 8) / 16777216.0;
+            double q0 = captureClock();
+            level = reader->query(a, a + span, points, &out[0]);
+            double q = captureClock() - q0;
+            total += q;
+            if (q > longest)
+                longest = q;
+        }
+        printf(",\n    {\"span_s\": %.6g, \"points\": %d, \"level\": %d, \"query_us\": %.1f, \"max_query_us\": %.1f, \"bytes_per_query\": %lld}",
+               span, points, level, 1.0e6 * total / places, 1.0e6 * longest, (reader->bytesRead() - bytes0) / places);
+        fflush(stdout);
+    }
+    delete reader;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// cross spectrum
+
+static bool runCross(double seconds, const std::string &fname)
+{
+    static const char *channels[2] = { "X", "XY" };
+    const int frames = 128;         // X,Y floats, 1024 byte packets
+    const double rate = 1.25e6;
+
+    // 256 packets of each stream: a shared tone and noise of their own
+    std::vector<CapturePacket> pkts(2 * 256);
+    unsigned int noise = 1;
+    for (int k=0;k<2*256;++k)
+    {
+        CapturePacket &p = pkts[k];
+        memset(&p, 0, sizeof(p));
+        p.buffer[0] = (unsigned int)(k & 0xff) | (1 << 8);
+        p.nwords = 1 + 2 * frames;
+        p.scale = SCALE_UNKNOWN;
+        float *d = (float *)(p.buffer + 1);
+        for (int i=0;i<frames;++i)
+        {
+            double a = 2.0e-2 * ((k & 0xff) * frames + i);
+            noise = noise * 1664525u + 1013904223u;
+            d[2*i] = (float)(1.0e-3 * cos(a) + 1.0e-4 * ((int)(noise >> 16) - 32768) / 32768.0);
+            noise = noise * 1664525u + 1013904223u;
+            d[2*i+1] = (float)(1.0e-3 * sin(a) + 1.0e-4 * ((int)(noise >> 16) - 32768) / 32768.0);
+        }
+    }
+
+    long long npackets = (long long)(seconds * rate / frames);
+    for (int c=0;c<2;++c)
+    {
+        for (int fft=1024;fft<=16384;fft*=4)
+        {
+            CrossOptions opt;
+            opt.fftSize = fft;
+            opt.channelA = opt.channelB = (c == 0) ? CROSS_X : CROSS_XY;
+            CrossSpectrum *cross = new CrossSpectrum(opt);
+            if (!cross->open(sinkPath(fname.c_str())))
+            {
+                delete cross;
+                return false;
+            }
+            long long allocs0 = allocCount;
+            double t0 = captureClock();
+            for (long long k=0;k<npackets;++k)
+            {
+                for (int s=0;s<2;++s)
+                {
+                    CapturePacket &p = pkts[s * 256 + (int)(k & 0xff)];
+                    p.sample = k * frames;
+                    p.rxTime = 1.0e-3 + (p.sample + frames) / (rate * (s ? 1.00002 : 1.0));
+                    cross->write(s, p);
+                }
+            }
+            cross->close();
+            double cpu = captureClock() - t0;
+            printf("%s    {\"cross\": \"%s,%s\", \"fft\": %d, \"stream_s\": %.1f, \"spectra\": %lld, \"cpu_s\": %.3f, "
+                   "\"realtime\": %.2f, \"ns_per_sample\": %.2f, \"allocs\": %lld, \"file_bytes\": %lld}",
+                   firstCase ? "" : ",\n", channels[c], channels[c], fft, npackets * frames / rate, cross->spectrumCount(), cpu,
+                   npackets * frames / rate / cpu, 1.0e9 * cpu / (2.0 * npackets * frames), allocCount - allocs0, cross->bytesWritten());
+            fflush(stdout);
+            firstCase = false;
+            delete cross;
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    long long npackets = 10000;
+    std::string dir;
+    const char *replay = NULL;
+    int port = 1865;
+    int zoomRate = -1;
+    double crossSeconds = 0.0;
+    std::string err;
+
+    journalOptions.syncPackets = 1000;
+    journalOptions.syncSeconds = 0.0;
+    for (int i=1;i<argc;++i)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            npackets = atol(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i+1 < argc)
+        {
+            dir = argv[++i];
+            if (!dir.empty() && dir[dir.length()-1] != '/' && dir[dir.length()-1] != '\\')
+                dir += '/';
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            replay = argv[++i];
+        else if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+        {
+            if (!parseJournal(argv[++i], journalOptions, err))
+            {
+                fprintf(stderr, "-j: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-e") == 0 && i+1 < argc)
+            zoomRate = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-x") == 0 && i+1 < argc)
+            crossSeconds = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: CaptureBench [-n packets] [-d dir] [-r capture.dat | capture.pcapng] [-p port] [-j journal] [-e rate] [-x seconds]\n");
+            return 2;
+        }
+    }
+    if (npackets < 1)
+        npackets = 1;
+
+    const char *simd = "none";
+#if defined(CAPTURE_AVX2)
+    simd = "avx2";
+#elif defined(CAPTURE_SSE2)
+    simd = "sse2";
+#elif defined(CAPTURE_NEON)
+    simd = "neon";
+#endif
+#ifdef CAPTURE_TRACE
+    const char *tracing = "true";
+#else
+    const char *tracing = "false";
+#endif
+
+    if (zoomRate >= 0)
+    {
+        if (zoomRate > 20)
+        {
+            fprintf(stderr, "-e: rate code 0 .. 20\n");
+            return 2;
+        }
+        printf("{\n  \"benchmark\": \"CaptureBench\", \"format\": 1, \"simd\": \"%s\", \"tracing\": %s,\n", simd, tracing);
+        printf("  \"source\": \"envelope\",\n  \"cases\": [\n");
+        std::string fname = dir + "CaptureBench.env";
+        bool ok = runZoom(zoomRate, fname);
+        remove(fname.c_str());
+        printf("\n  ]\n}\n");
+        if (!ok)
+            fprintf(stderr, "could not write or read back an envelope in \"%s\"\n", dir.c_str());
+        return ok ? 0 : 1;
+    }
+    if (crossSeconds > 0.0)
+    {
+        printf("{\n  \"benchmark\": \"CaptureBench\", \"format\": 1, \"simd\": \"%s\", \"tracing\": %s,\n", simd, tracing);
+        printf("  \"source\": \"cross\",\n  \"cases\": [\n");
+        std::string fname = dir + "CaptureBench.csd";
+        bool ok = runCross(crossSeconds, fname);
+        remove(fname.c_str());
+        printf("\n  ]\n}\n");
+        if (!ok)
+            fprintf(stderr, "could not write a cross spectrum in \"%s\"\n", dir.c_str());
+        return ok ? 0 : 1;
+    }
+
+    std::vector<WirePacket> pkts;
+    if (replay && !networkPackets(replay, port, pkts) && !replayPackets(replay, pkts))
+    {
+        fprintf(stderr, "%s: no packets (not a binary capture file, or no UDP packets for port %d)\n", replay, port);
+        return 1;
+    }
+
+    printf("{\n  \"benchmark\": \"CaptureBench\", \"format\": 1, \"simd\": \"%s\", \"tracing\": %s,\n", simd, tracing);
+    printf("  \"packets_per_case\": %lld, \"source\": \"%s\",\n  \"cases\": [\n", npackets, replay ? "replay" : "generated");
+
+    int failed = 0;
+    char what[200];
+    BenchResult res;
+
+    // warm up caches & file system; not reported
+    {
+        std::vector<WirePacket> warm;
+        generatePackets(3, 0, false, warm);
+        std::string fname = dir + "CaptureBench.dat";
+        if (runCase(replay ? pkts : warm, SINK_BINARY, npackets, fname, res))
+            removeCapture(fname, SINK_BINARY);
+    }
+    if (replay)
+    {
+        for (int sink=0;sink<SINKS;++sink)
+        {
+            std::string fname = dir + "CaptureBench." + sinkExt[sink];
+            if (!runCase(pkts, sink, npackets, fname, res))
+            {
+                ++failed;
+                continue;
+            }
+            removeCapture(fname, sink);
+            sprintf(what, "\"replay_packets\": %d, \"sink\": \"%s\"", (int)pkts.size(), sinkNames[sink]);
+            printResult(what, res);
+        }
+    }
+    else
+    {
+        for (int code=0;code<8;++code)
+            for (int length=0;length<4;++length)
+                for (int little=0;little<2;++little)
+                {
+                    generatePackets(code, length, little != 0, pkts);
+                    for (int sink=0;sink<SINKS;++sink)
+                    {
+                        std::string fname = dir + "CaptureBench." + sinkExt[sink];
+                        if (!runCase(pkts, sink, npackets, fname, res))
+                        {
+                            ++failed;
+                            continue;
+                        }
+                        removeCapture(fname, sink);
+                        PacketHeader hdr(code << 8 | length << 12);
+                        sprintf(what, "\"content\": %d, \"type\": \"%s\", \"channels\": %d, \"length\": %d, \"endian\": \"%s\", \"sink\": \"%s\"",
+                                code, hdr.isInt() ? "int" : "float", hdr.channels(), hdr.byteLength(),
+                                little ? "little" : "big", sinkNames[sink]);
+                        printResult(what, res);
+                    }
+                }
+    }
+    printf("\n  ]\n}\n");
+
+    if (failed)
+        fprintf(stderr, "%d cases could not open a capture file in \"%s\"\n", failed, dir.c_str());
+    return failed ? 1 : 0;
+}
+//---------------------------------------------------------------------------
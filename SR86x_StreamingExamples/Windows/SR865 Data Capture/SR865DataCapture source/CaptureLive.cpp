@@ -0,0 +1,398 @@
+//---------------------------------------------------------------------------
+// CaptureLive
+// command line capture of a live SR86x stream, without the user interface
+//
+// usage: CaptureLive [-p port] [-t seconds] [-o file] [-z] [-j journal] [-s segments] [-S spectra] [-D resample] [-A stats] [-E envelope] [-F] [-T polar] [-G trigger] [-R receive] [-r nic] [-P placement]
+//   -p   UDP port of the stream (default 1865)
+//   -t   stop after this many seconds (default: at ctrl-C)
+//   -o   save to file, like the capture program: .csv = comma separated, .idx = column files,
+//        .psd = noise spectra only, .rsd = resampled data only, else binary
+//   -z   compressed binary file
+//   -j   journaled binary file, synced to disk with a checkpoint every so often so a crash loses little,
+//        e.g. "on" (every second) or "packets=1000;seconds=0" (see JournalSink.h)
+//   -s   save in segments, rolled over at a size, time or packet count, e.g. "bytes=500M;seconds=3600"
+//        (run.dat -> run_0000.dat, run_0001.dat, ...; see CaptureSink.h)
+//   -S   noise spectra settings, e.g. "fft=8192;averages=32"; add "side" to save them beside the samples (see WelchPsd.h)
+//   -D   output rate of resampled data, e.g. "rate=1000;passband=0.9"; add "side" to save it beside the samples (see Resampler.h)
+//   -A   save running statistics (mean, deviation, Allan deviation) every so often, e.g. "file=stats.csv;seconds=60"
+//        (see StreamStats.h); a summary is printed at the end
+//   -E   save a min / max / mean pyramid beside the samples for fast display, e.g. "bucket=256" (see Envelope.h)
+//   -F   save where the overload / error flags change beside the samples, to mask or skip those packets (see FlagSink.h)
+//   -T   add R and theta to X,Y streams, so the instrument only has to send X,Y: "on", or "unwrap"
+//        for continuous theta (see PolarSink.h)
+//   -G   save only the samples around events, e.g. "source=R;edge=rise;level=0.5;pre=0.01;post=0.1",
+//        "source=theta;outside=-10,10" or "overload" (see Trigger.h, TriggerSink.h)
+//   -R   receive buffer & mode, e.g. "buffer=32M;busypoll=50" or "spin" (see ReceiveSocket.h)
+//   -r   read the stream from interface nic's packet ring (Linux, CAP_NET_RAW; see PacketRing.h),
+//        for a network card that only carries instrument streams; falls back to the socket if it can't
+//   -P   cores & priority of the receive (this) and writer threads, e.g. "receive=2;writer=3;fifo=receive;nic=eth0"
+//        (see ThreadPlacement.h)
+//
+// Start the stream from the capture program or over VXI-11 (STREAM ON); this program only listens.
+// Packets go through ReceiveSocket (or PacketRing), PacketDecoder, the packet queue and a writer thread,
+// as in UDPServerThread.
+// Once a second it prints the packets received and where any were lost:
+// on the network or by the instrument (gaps in the packet counter), in this computer's
+// socket buffer or packet ring (Linux counts these), or in the packet queue.
+//
+// This is a separate console program, not part of UDPCapture.cbproj. Build with e.g.
+//   g++ -O2 -o CaptureLive CaptureLive.cpp CaptureLoop.cpp ReceiveSocket.cpp PacketRing.cpp ThreadPlacement.cpp PacketDecoder.cpp PacketSequence.cpp
+//       PacketQueue.cpp CaptureWriter.cpp CaptureSink.cpp CompressedSink.cpp ColumnSink.cpp JournalSink.cpp SpectrumSink.cpp WelchPsd.cpp
+//       Fft.cpp ResampleSink.cpp Resampler.cpp EnvelopeSink.cpp Envelope.cpp FlagSink.cpp PolarSink.cpp Polar.cpp StreamStats.cpp SampleScale.cpp
+//       TriggerSink.cpp Trigger.cpp Deinterleave.cpp DeltaCodec.cpp PacketHeader.cpp CaptureTrace.cpp -lpthread
+
+#pragma hdrstop
+
+#include "CaptureLoop.h"
+#include "PacketRing.h"
+#include "ThreadPlacement.h"
+#include "CaptureSink.h"
+#include "SampleScale.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+
+//---------------------------------------------------------------------------
+// writer thread
+
+static CaptureWriter *writer = NULL;
+static volatile long stopWriter = 0;
+static volatile sig_atomic_t stopCapture = 0;
+
+#ifdef _WIN32
+static DWORD WINAPI writerMain(LPVOID)
+#else
+static void *writerMain(void *)
+#endif
+{
+    writerLoop(*writer, &stopWriter);
+    return 0;
+}
+
+static void onSignal(int)
+{
+    stopCapture = 1;
+}
+
+//---------------------------------------------------------------------------
+
+static void usage()
+{
+    printf("usage: CaptureLive [-p port] [-t seconds] [-o file] [-z] [-j journal] [-s segments] [-S spectra] [-D resample] [-A stats] [-E envelope] [-F] [-T polar] [-G trigger] [-R receive] [-r nic] [-P placement]\n");
+}
+
+// lost before reaching this computer; sequence gaps less the ones the socket buffer caused
+static long long networkDrops(const LiveData &live)
+{
+    return live.dropped - live.retracted - live.socketDrops;
+}
+
+// running statistics at the end, for -A
+static void printStats(const StreamStats &s)
+{
+    static const char *column[4] = { "X", "Y", "R", "Th" };
+    for (int c=0;c<4;++c)
+    {
+        const ChannelStats &ch = s.ch[c];
+        if (ch.count == 0)
+            continue;
+        printf("  %-2s %lld samples, mean %.9g, std dev %.4g, min %.9g, max %.9g, Allan dev %.4g at %.4g s\n", column[c],
+               ch.count, ch.mean, sqrt(statsVariance(ch)), ch.min, ch.max, statsAllan(ch, 0), 1.0 / s.sampleRate);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int port = 1865;
+    double seconds = 0.0;
+    const char *outName = NULL;
+    const char *nic = NULL;
+    std::string statsName;
+    double statsSeconds = 60.0;
+    SinkOptions opt;
+    SegmentPolicy segments;
+    SegmentSink *segmented = NULL;
+    ReceiveOptions receive;
+    PlacementPolicy placement;
+    std::string err;
+
+    for (int i=1;i<argc;++i)
+    {
+        if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i+1 < argc)
+            seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            outName = argv[++i];
+        else if (strcmp(argv[i], "-z") == 0)
+            opt.compress = true;
+        else if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+        {
+            if (!parseJournal(argv[++i], opt, err))
+            {
+                printf("-j: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i+1 < argc)
+        {
+            if (!parseSegments(argv[++i], segments, err))
+            {
+                printf("-s: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-D") == 0 && i+1 < argc)
+        {
+            if (!parseResample(argv[++i], opt.resample, err))
+            {
+                printf("-D: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-S") == 0 && i+1 < argc)
+        {
+            if (!parseSpectrum(argv[++i], opt.spectrum, err))
+            {
+                printf("-S: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-E") == 0 && i+1 < argc)
+        {
+            if (!parseEnvelope(argv[++i], opt.envelope, err))
+            {
+                printf("-E: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-F") == 0)
+            opt.flags = true;
+        else if (strcmp(argv[i], "-T") == 0 && i+1 < argc)
+        {
+            if (!parsePolar(argv[++i], opt.polar, err))
+            {
+                printf("-T: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-G") == 0 && i+1 < argc)
+        {
+            if (!parseTrigger(argv[++i], opt.trigger, err))
+            {
+                printf("-G: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-A") == 0 && i+1 < argc)
+        {
+            if (!parseStatsLog(argv[++i], statsName, statsSeconds, err))
+            {
+                printf("-A: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-R") == 0 && i+1 < argc)
+        {
+            if (!parseReceive(argv[++i], receive, err))
+            {
+                printf("-R: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            nic = argv[++i];
+        else if (strcmp(argv[i], "-P") == 0 && i+1 < argc)
+        {
+            if (!parsePlacement(argv[++i], placement, err))
+            {
+                printf("-P: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (port <= 0 || port > 65535)
+    {
+        usage();
+        return 2;
+    }
+
+#ifdef _WIN32
+    WSAData wsdat;
+    WSAStartup(0x0101, &wsdat);
+#endif
+    PacketRing ring;
+    if (nic)
+    {
+        std::vector<int> ports(1, port);
+        if (ring.open(nic, ports, RingOptions(), err))
+        {
+            // the socket only holds the port
+            receive.bufferBytes = 1;
+            receive.forceBuffer = false;
+        }
+        else
+            printf("%s; using the socket\n", err.c_str());
+    }
+    ReceiveSocket sock;
+    if (!sock.open(port, receive, err))
+    {
+        printf("%s\n", err.c_str());
+        return 1;
+    }
+    if (ring.isOpen())
+        printf("listening on UDP port %d, %s packet ring\n", port, nic);
+    else
+    {
+        if (!sock.warning().empty())
+            printf("receive: %s\n", sock.warning().c_str());
+        printf("listening on UDP port %d, receive buffer %d kB%s\n", port, sock.bufferBytes() >> 10, receive.spin ? ", spinning" : "");
+    }
+
+    PacketQueue queue;
+    PacketDecoder decoder(&queue);
+    CaptureWriter w(&queue);
+    writer = &w;
+#ifdef CAPTURE_TRACE
+    CaptureTrace trace;
+    decoder.setTrace(&trace);
+    writer->setTrace(&trace);
+#endif
+
+    if (outName)
+    {
+        const char *ext = strrchr(outName, '.');
+        opt.csv = (ext && strcmp(ext, ".csv") == 0);
+        opt.columns = (ext && strcmp(ext, ".idx") == 0);
+        opt.spectra = (ext && strcmp(ext, ".psd") == 0);
+        opt.resampled = (ext && strcmp(ext, ".rsd") == 0);
+        CaptureSink *file;
+        if (segments.enabled())
+            file = segmented = new SegmentSink(opt, segments);
+        else
+            file = newFileSink(opt);
+        if (!file->open(sinkPath(outName), true))
+        {
+            printf("%s: could not create file\n", outName);
+            delete file;
+            return 1;
+        }
+        writer->setSink(file);
+    }
+    if (!statsName.empty() && !writer->setStatsLog(sinkPath(statsName.c_str()), statsSeconds))
+    {
+        printf("%s: could not create file\n", statsName.c_str());
+        return 1;
+    }
+
+#ifdef _WIN32
+    HANDLE thread = CreateThread(NULL, 0, writerMain, NULL, 0, NULL);
+#else
+    pthread_t thread;
+    pthread_create(&thread, NULL, writerMain, NULL);
+#endif
+    if (placement.enabled())
+    {
+        // warnings only; the capture runs either way
+        if (!placeThread(captureThreadSelf(), PLACE_RECEIVE, placement, err))
+            printf("placement: %s\n", err.c_str());
+        if (!placeThread(thread, PLACE_WRITER, placement, err))
+            printf("placement: %s\n", err.c_str());
+        std::vector<std::string> warnings = checkPlacement(placement);
+        for (size_t i=0;i<warnings.size();++i)
+            printf("placement: %s\n", warnings[i].c_str());
+    }
+    signal(SIGINT, onSignal);
+
+    // receive thread; the steps of receiveLoop() (CaptureLoop.h), with the packet ring and a report every second
+    LiveData &live = decoder.live;
+    LiveData last = live;
+    double t0 = captureClock();
+    double nextReport = t0 + 1.0;
+    while (!stopCapture)
+    {
+        if (ring.isOpen())
+        {
+            // payload read where the kernel put it
+            int n, dport;
+            double arrival;
+            const unsigned char *data = ring.next(n, dport, arrival, receive.timeoutMs);
+            if (data)
+                decoder.decode(data, n, arrival, SCALE_UNKNOWN);
+            else
+                decoder.idle(captureClock());
+        }
+        else if (receiveStep(sock, decoder, SCALE_UNKNOWN) < 0)
+        {
+            printf("receive failed\n");
+            break;
+        }
+        double now = captureClock();
+        if (now >= nextReport)
+        {
+            live.socketQueued = ring.isOpen() ? 0 : sock.queuedBytes();
+            live.socketDrops = ring.isOpen() ? ring.kernelDrops() : sock.kernelDrops();
+            printf("%6.0f s: %lld packets, lost: %lld network/instrument, %lld socket buffer, %lld queue; socket %lld kB queued\n",
+                   now - t0, live.packets - last.packets, networkDrops(live) - networkDrops(last),
+                   live.socketDrops - last.socketDrops, live.unsaved - last.unsaved, live.socketQueued >> 10);
+            fflush(stdout);
+            last = live;
+            nextReport += 1.0;
+        }
+        if (seconds > 0.0 && now - t0 >= seconds)
+            break;
+    }
+    double elapsed = captureClock() - t0;
+    decoder.flush();
+    live.socketDrops = ring.isOpen() ? ring.kernelDrops() : sock.kernelDrops();
+    const char *where = ring.isOpen() ? "packet ring" : "socket buffer";
+    ring.close();
+    sock.close();
+
+    atomicStore(&stopWriter, 1);
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+    WriterStats ws;
+    StreamStats ss;
+    writer->getStats(ws);
+    writer->getStreamStats(ss);
+    int segmentCount = segmented ? segmented->segmentIndex() + 1 : 0;
+    long long segmentUnsaved = segmented ? segmented->packetsUnsaved() : 0;
+    writer->setSink(NULL);
+    writer->setStatsLog(SinkPath(), 0.0);
+
+    printf("%lld packets in %.1f s", live.packets, elapsed);
+    if (elapsed > 0.0)
+        printf(" (%.0f packets/s, %.3f MB/s)", live.packets / elapsed, live.bytes / elapsed / 1.0e6);
+    printf("\n");
+    printf("  lost on the network or by the instrument: %lld packets\n", networkDrops(live));
+    printf("  dropped by this computer, %s full: %lld packets%s\n", where, live.socketDrops,
+#ifdef __linux__
+           "");
+#else
+           " (not counted on this system)");
+#endif
+    printf("  not saved (queue full): %lld packets, deepest queue %d of %d\n", live.unsaved, ws.maxDepth, queue.capacity());
+    if (segmentCount > 0)
+        printf("  %d segments; not saved (segment could not be opened): %lld packets\n", segmentCount, segmentUnsaved);
+    if (ws.syncs > 0)
+        printf("  journal: %lld syncs, %.3f ms each\n", ws.syncs, ws.syncTime / ws.syncs * 1.0e3);
+    if (live.duplicates || live.late || live.retracted)
+        printf("  duplicates: %lld, late: %lld, drops retracted (receive stall): %lld\n", live.duplicates, live.late, live.retracted);
+    printf("  overload/error flag: %lld packets\n", live.overloads);
+    if (!statsName.empty())
+        printStats(ss);
+    return 0;
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,70 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "CaptureLoop.h"
+#include "SampleScale.h"
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// console receive & writer loops
+// The decoder holds packets while the numbering may still be taken back (PacketDecoder.h);
+// nothing waiting lets it publish them once the stream has gone quiet, and the end of the loop publishes the rest.
+
+int receiveStep(ReceiveSocket &sock, PacketDecoder &decoder, int scale)
+{
+    // receive straight into next free slot of packet queue
+    CapturePacket *pkt = decoder.slot();
+    int n = sock.receive(pkt->buffer, sizeof(pkt->buffer));
+    if (n > 0)
+    {
+        TRACE_STAMP(pkt, TRACE_RECV);
+        pkt->rxTime = captureClock();
+        pkt->scale = scale;
+        decoder.decode(pkt, n);
+        return 1;
+    }
+    if (n < 0)
+        return -1;
+    decoder.idle(captureClock());
+    return 0;
+}
+
+bool receiveLoop(ReceiveSocket &sock, PacketDecoder &decoder, LiveSnapshot &snapshot, volatile long *stop)
+{
+    bool ok = true;
+    double nextPublish = 0.0;
+    while (!atomicLoad(stop))
+    {
+        if (receiveStep(sock, decoder, SCALE_UNKNOWN) < 0)
+        {
+            ok = false;
+            break;
+        }
+        double now = captureClock();
+        if (now >= nextPublish)
+        {
+            snapshot.publish(decoder.live);
+            nextPublish = now + LOOP_PUBLISH;
+        }
+    }
+    decoder.flush();
+    snapshot.publish(decoder.live);
+    return ok;
+}
+
+void writerLoop(CaptureWriter &writer, volatile long *stop)
+{
+    // when the queue is empty, sleep briefly (see WriterThread.cpp)
+    while (!atomicLoad(stop))
+    {
+        if (writer.drain() == 0)
+            captureSleep(2);
+    }
+    // save whatever is left
+    while (writer.drain() > 0)
+        ;
+}
@@ -0,0 +1,31 @@
+//---------------------------------------------------------------------------
+
+#ifndef CaptureLoopH
+#define CaptureLoopH
+
+#include "ReceiveSocket.h"
+#include "PacketDecoder.h"
+#include "CaptureWriter.h"
+#include "LiveSnapshot.h"
+
+//---------------------------------------------------------------------------
+
+// receive & writer loops of the console programs (CaptureLive, CaptureAlign, CaptureSweep)
+// The same steps as UDPServerThread::Execute and WriterThread::Execute, without VCL threads;
+// each program starts its own threads and calls these from them.
+
+#define LOOP_PUBLISH    0.1         // seconds between snapshots of the receive loop
+
+// one packet from the socket into the decoder, or nothing waiting (receive timeout, spinning);
+// returns the packets decoded (0 or 1), -1 if the socket failed
+int receiveStep(ReceiveSocket &sock, PacketDecoder &decoder, int scale);
+
+// receive until *stop is set, publishing decoder.live every LOOP_PUBLISH seconds and at the end;
+// false if the socket failed
+bool receiveLoop(ReceiveSocket &sock, PacketDecoder &decoder, LiveSnapshot &snapshot, volatile long *stop);
+
+// write queued packets until *stop is set, then whatever is left
+void writerLoop(CaptureWriter &writer, volatile long *stop);
+
+//---------------------------------------------------------------------------
+#endif
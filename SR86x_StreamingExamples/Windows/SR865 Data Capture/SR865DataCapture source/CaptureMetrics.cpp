@@ -0,0 +1,354 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "CaptureMetrics.h"
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define INVALID_SOCKET  (-1)
+#define closesocket     ::close
+#define SD_BOTH         SHUT_RDWR
+#endif
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// capture metrics
+// Values are read from the receive thread's and writer thread's snapshots,
+// so serving them never slows down either thread.
+
+static const char *gapLabel[GAP_BUCKETS] = { "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64-127", "128-255", "256+" };
+
+static void metricHead(std::ostream &out, const char *name, const char *type, const char *help)
+{
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+void formatMetrics(std::ostream &out, int streamPort, const LiveData &live, const WriterStats &writer, int depth, int capacity)
+{
+    std::ostringstream lbl;
+    lbl << "port=\"" << streamPort << "\"";
+    std::string port = lbl.str();
+    out.precision(9);
+
+    // receive thread
+    metricHead(out, "sr86x_packets_total", "counter", "UDP packets received.");
+    out << "sr86x_packets_total{" << port << "} " << live.packets << "\n";
+    metricHead(out, "sr86x_bytes_total", "counter", "UDP payload bytes received.");
+    out << "sr86x_bytes_total{" << port << "} " << live.bytes << "\n";
+    metricHead(out, "sr86x_dropped_packets_total", "counter", "Packets lost (sequence gaps), including socket buffer overflows.");
+    out << "sr86x_dropped_packets_total{" << port << "} " << live.dropped << "\n";
+    metricHead(out, "sr86x_drop_gaps_total", "counter", "Sequence gaps, by number of packets lost.");
+    for (int b=0;b<GAP_BUCKETS;++b)
+        out << "sr86x_drop_gaps_total{" << port << ",gap=\"" << gapLabel[b] << "\"} " << live.gaps[b] << "\n";
+    metricHead(out, "sr86x_duplicate_packets_total", "counter", "Packets received twice.");
+    out << "sr86x_duplicate_packets_total{" << port << "} " << live.duplicates << "\n";
+    metricHead(out, "sr86x_late_packets_total", "counter", "Packets received out of order.");
+    out << "sr86x_late_packets_total{" << port << "} " << live.late << "\n";
+    metricHead(out, "sr86x_retracted_drops_total", "counter", "Packets counted as dropped that were a receive stall.");
+    out << "sr86x_retracted_drops_total{" << port << "} " << live.retracted << "\n";
+    metricHead(out, "sr86x_unsaved_packets_total", "counter", "Packets received but not saved because the queue was full.");
+    out << "sr86x_unsaved_packets_total{" << port << "} " << live.unsaved << "\n";
+    metricHead(out, "sr86x_overload_packets_total", "counter", "Packets with the overload or error flag set.");
+    out << "sr86x_overload_packets_total{" << port << "} " << live.overloads << "\n";
+    metricHead(out, "sr86x_socket_queued_bytes", "gauge", "Bytes waiting in the socket receive buffer (Linux: buffer memory in use, per-datagram overhead included).");
+    out << "sr86x_socket_queued_bytes{" << port << "} " << live.socketQueued << "\n";
+    metricHead(out, "sr86x_socket_buffer_bytes", "gauge", "Size of the socket receive buffer.");
+    out << "sr86x_socket_buffer_bytes{" << port << "} " << live.socketBuffer << "\n";
+    metricHead(out, "sr86x_socket_drops_total", "counter", "Packets dropped by this computer because the socket receive buffer was full (Linux only).");
+    out << "sr86x_socket_drops_total{" << port << "} " << live.socketDrops << "\n";
+    if (live.what >= 0)
+    {
+        metricHead(out, "sr86x_stream_content", "gauge", "Content code of the latest packet (0-7).");
+        out << "sr86x_stream_content{" << port << "} " << live.what << "\n";
+        metricHead(out, "sr86x_stream_rate_hz", "gauge", "Sample rate of the latest packet.");
+        out << "sr86x_stream_rate_hz{" << port << "} " << ldexp(1.25e6, -live.rate) << "\n";     // any rate code (8 bits)
+        metricHead(out, "sr86x_last_packet_age_seconds", "gauge", "Time since the latest packet arrived.");
+        out << "sr86x_last_packet_age_seconds{" << port << "} " << captureClock() - live.rxTime << "\n";
+    }
+
+    // packet queue
+    metricHead(out, "sr86x_queue_depth", "gauge", "Packets waiting for the writer thread.");
+    out << "sr86x_queue_depth{" << port << "} " << depth << "\n";
+    metricHead(out, "sr86x_queue_max_depth", "gauge", "Deepest queue seen by the writer thread.");
+    out << "sr86x_queue_max_depth{" << port << "} " << writer.maxDepth << "\n";
+    metricHead(out, "sr86x_queue_capacity", "gauge", "Packet queue size.");
+    out << "sr86x_queue_capacity{" << port << "} " << capacity << "\n";
+
+    // writer thread
+    metricHead(out, "sr86x_written_packets_total", "counter", "Packets taken from the queue by the writer thread.");
+    out << "sr86x_written_packets_total{" << port << "} " << writer.packets << "\n";
+    metricHead(out, "sr86x_written_bytes_total", "counter", "Bytes of packets taken from the queue by the writer thread.");
+    out << "sr86x_written_bytes_total{" << port << "} " << writer.bytes << "\n";
+    metricHead(out, "sr86x_writer_latency_seconds", "histogram", "Time from packet arrival until written to the capture file.");
+    long long cum = 0;
+    for (int b=0;b<LATENCY_BUCKETS;++b)
+    {
+        cum += writer.latency[b];
+        out << "sr86x_writer_latency_seconds_bucket{" << port << ",le=\"";
+        if (b < LATENCY_BUCKETS-1)
+            out << latencyBounds[b];
+        else
+            out << "+Inf";
+        out << "\"} " << cum << "\n";
+    }
+    out << "sr86x_writer_latency_seconds_sum{" << port << "} " << writer.latencySum << "\n";
+    out << "sr86x_writer_latency_seconds_count{" << port << "} " << cum << "\n";
+    metricHead(out, "sr86x_writer_latency_max_seconds", "gauge", "Longest time from packet arrival until written.");
+    out << "sr86x_writer_latency_max_seconds{" << port << "} " << writer.latencyMax << "\n";
+    metricHead(out, "sr86x_file_syncs_total", "counter", "Forced writes to disk (journaled capture files).");
+    out << "sr86x_file_syncs_total{" << port << "} " << writer.syncs << "\n";
+    metricHead(out, "sr86x_file_sync_seconds_total", "counter", "Time spent in forced writes to disk.");
+    out << "sr86x_file_sync_seconds_total{" << port << "} " << writer.syncTime << "\n";
+}
+
+// running statistics of each channel (StreamStats.h)
+void formatStatsMetrics(std::ostream &out, int streamPort, const StreamStats &stats)
+{
+    static const char *column[4] = { "X", "Y", "R", "Th" };
+    if (stats.what < 0)
+        return;
+    std::string label[4];
+    for (int c=0;c<4;++c)
+    {
+        std::ostringstream lbl;
+        lbl << "port=\"" << streamPort << "\",channel=\"" << column[c] << "\"";
+        label[c] = lbl.str();
+    }
+    out.precision(9);
+
+    metricHead(out, "sr86x_channel_samples", "gauge", "Samples in the running statistics since the stream format last changed.");
+    for (int c=0;c<4;++c)
+        if (stats.ch[c].count > 0)
+            out << "sr86x_channel_samples{" << label[c] << "} " << stats.ch[c].count << "\n";
+    metricHead(out, "sr86x_channel_mean", "gauge", "Running mean of each channel.");
+    for (int c=0;c<4;++c)
+        if (stats.ch[c].count > 0)
+            out << "sr86x_channel_mean{" << label[c] << "} " << stats.ch[c].mean << "\n";
+    metricHead(out, "sr86x_channel_stddev", "gauge", "Running standard deviation of each channel.");
+    for (int c=0;c<4;++c)
+        if (stats.ch[c].count > 0)
+            out << "sr86x_channel_stddev{" << label[c] << "} " << sqrt(statsVariance(stats.ch[c])) << "\n";
+    metricHead(out, "sr86x_channel_allan_deviation", "gauge", "Allan deviation of each channel, by averaging time tau in seconds.");
+    for (int c=0;c<4;++c)
+        for (int k=0;k<ALLAN_LEVELS;++k)
+            if (stats.ch[c].avarCount[k] > 0)
+                out << "sr86x_channel_allan_deviation{" << label[c] << ",tau=\"" << ldexp(1.0, k) / stats.sampleRate << "\"} "
+                    << statsAllan(stats.ch[c], k) << "\n";
+}
+
+//---------------------------------------------------------------------------
+// MetricsServer
+
+MetricsServer::MetricsServer(LiveSnapshot *l, CaptureWriter *w, PacketQueue *q)
+{
+    live = l;
+    writer = w;
+    queue = q;
+    trace = NULL;
+    streamPort = 0;
+    sd = INVALID_SOCKET;
+    polling = false;
+}
+MetricsServer::~MetricsServer()
+{
+    close();
+}
+
+void MetricsServer::setTrace(CaptureTrace *t)
+{
+    trace = t;
+}
+
+bool MetricsServer::open(int port, int udpPort)
+{
+    close();
+
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET)
+        return false;
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+
+    // this computer only
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(s, 8) != 0)
+    {
+        closesocket(s);
+        return false;
+    }
+
+    lock.acquire();
+    sd = s;
+    streamPort = udpPort;
+    lock.release();
+    return true;
+}
+void MetricsServer::close()
+{
+    lock.acquire();
+    if (sd != INVALID_SOCKET)
+    {
+        if (polling)
+            shutdown(sd, SD_BOTH);      // wakes poll() where it can; poll() closes it
+        else
+            closesocket(sd);
+        sd = INVALID_SOCKET;
+    }
+    lock.release();
+}
+bool MetricsServer::isOpen()
+{
+    lock.acquire();
+    bool open = (sd != INVALID_SOCKET);
+    lock.release();
+    return open;
+}
+
+std::string MetricsServer::text()
+{
+    LiveData l;
+    WriterStats w;
+    StreamStats s;
+    live->read(l);
+    writer->getStats(w);
+    writer->getStreamStats(s);
+    std::ostringstream out;
+    formatMetrics(out, streamPort, l, w, queue->depth(), queue->capacity());
+    formatStatsMetrics(out, streamPort, s);
+    return out.str();
+}
+
+// socket readable (or writable) before deadline (captureClock() seconds)?
+static bool waitFor(SOCKET s, bool write, double deadline)
+{
+    double left = deadline - captureClock();
+    if (left < 0.0)
+        left = 0.0;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(s, &fds);
+    timeval tv;
+    tv.tv_sec = (long)left;
+    tv.tv_usec = (long)((left - tv.tv_sec) * 1.0e6);
+    return (select((int)s + 1, write ? NULL : &fds, write ? &fds : NULL, NULL, &tv) > 0);
+}
+
+int MetricsServer::poll(int timeoutMs)
+{
+    lock.acquire();
+    SOCKET s = sd;
+    polling = (s != INVALID_SOCKET);
+    lock.release();
+    if (s == INVALID_SOCKET)
+    {
+        captureSleep(timeoutMs);
+        return 0;
+    }
+
+    SOCKET client = INVALID_SOCKET;
+    if (waitFor(s, false, captureClock() + timeoutMs * 1.0e-3))
+        client = accept(s, NULL, NULL);
+
+    lock.acquire();
+    polling = false;
+    if (s != sd)
+        closesocket(s);             // closed (or reopened) meanwhile
+    lock.release();
+
+    if (client == INVALID_SOCKET)
+        return 0;
+    answer(client);
+    closesocket(client);
+    return 1;
+}
+
+// one client gets METRICS_CLIENT_TIME in all; a slow one can't hold up the next
+void MetricsServer::answer(SOCKET client)
+{
+    double deadline = captureClock() + METRICS_CLIENT_TIME;
+
+    // read request head
+    char req[1024];
+    int n = 0;
+    while (n < (int)sizeof(req) - 1)
+    {
+        if (!waitFor(client, false, deadline))
+            return;                 // client went quiet
+        int got = recv(client, req + n, sizeof(req) - 1 - n, 0);
+        if (got <= 0)
+            return;
+        n += got;
+        req[n] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+            break;
+    }
+
+    // "GET /path HTTP/1.x"; any other path gets the metrics
+    std::string path;
+    const char *p = strchr(req, ' ');
+    if (p)
+    {
+        const char *e = strchr(++p, ' ');
+        path.assign(p, e ? e - p : strlen(p));
+    }
+
+    std::string body;
+    const char *type = "text/plain; version=0.0.4";
+    if (trace && path.compare(0, 8, "/latency") == 0)
+    {
+        std::ostringstream out;
+        trace->report(out);
+        body = out.str();
+        type = "text/plain";
+    }
+    else if (trace && path.compare(0, 6, "/trace") == 0)
+    {
+        double seconds = 1.0;
+        std::string::size_type q = path.find("seconds=");
+        if (q != std::string::npos)
+            seconds = atof(path.c_str() + q + 8);
+        double now = captureClock();
+        std::ostringstream out;
+        trace->exportChrome(out, now - seconds, now);
+        body = out.str();
+        type = "application/json";
+    }
+    else
+        body = text();
+
+    std::ostringstream head;
+    head << "HTTP/1.0 200 OK\r\n"
+         << "Content-Type: " << type << "\r\n"
+         << "Content-Length: " << body.length() << "\r\n"
+         << "Connection: close\r\n\r\n";
+    std::string resp = head.str() + body;
+
+    p = resp.c_str();
+    int left = (int)resp.length();
+    while (left > 0 && waitFor(client, true, deadline))
+    {
+        // a little at a time, so send() returns without waiting for the client
+        int sent = send(client, p, (left < 4096) ? left : 4096, 0);
+        if (sent <= 0)
+            break;
+        p += sent;
+        left -= sent;
+    }
+}
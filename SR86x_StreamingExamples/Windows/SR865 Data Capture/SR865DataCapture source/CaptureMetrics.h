@@ -0,0 +1,70 @@
+//---------------------------------------------------------------------------
+
+#ifndef CaptureMetricsH
+#define CaptureMetricsH
+
+#include <ostream>
+#include <string>
+#include "CaptureSync.h"
+#include "LiveSnapshot.h"
+#include "CaptureWriter.h"
+#include "PacketQueue.h"
+#include "CaptureTrace.h"
+
+#ifndef _WIN32
+typedef int SOCKET;
+#endif
+
+//---------------------------------------------------------------------------
+
+// capture metrics in Prometheus text format
+//
+// Every capture process serves its counters at http://127.0.0.1:<port>/metrics,
+// where port = UDP stream port + METRICS_PORT_OFFSET (1865 -> 9865),
+// so several captures on one computer never collide.
+// All values carry a port="<UDP port>" label.
+// With tracing built in, /latency gives stage latency percentiles
+// and /trace?seconds=N the last N seconds of packets as a Chrome / Perfetto trace.
+
+#define METRICS_PORT_OFFSET 8000
+#define METRICS_CLIENT_TIME 0.5     // seconds one client may take, request & response
+
+void formatMetrics(std::ostream &out, int streamPort, const LiveData &live, const WriterStats &writer, int depth, int capacity);
+void formatStatsMetrics(std::ostream &out, int streamPort, const StreamStats &stats);
+
+// minimal HTTP server for the metrics text
+// poll() is called in a loop by its own thread; open() and close() may be called from any thread,
+// and don't wait for poll(): the lock is only held to look at the socket, never while waiting on it.
+class MetricsServer
+{
+protected:
+    LiveSnapshot *live;
+    CaptureWriter *writer;
+    PacketQueue *queue;
+    CaptureTrace *trace;            // not owned; may be NULL
+    int streamPort;
+    SOCKET sd;
+    bool polling;                   // poll() is waiting on sd; a close() leaves closing it to poll()
+    CaptureLock lock;               // protects sd, polling
+
+    void answer(SOCKET client);
+
+public:
+    MetricsServer(LiveSnapshot *l, CaptureWriter *w, PacketQueue *q);
+    ~MetricsServer();
+
+    void setTrace(CaptureTrace *t); // before the metrics thread starts
+    bool open(int port, int udpPort);   // listen on loopback port; labels values with udpPort
+    void close();
+    bool isOpen();
+
+    int poll(int timeoutMs);        // wait for and answer at most one request; returns 1 if answered
+    std::string text();             // current metrics
+
+private:
+    MetricsServer(const MetricsServer &);
+    MetricsServer &operator=(const MetricsServer &);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,65 @@
+//---------------------------------------------------------------------------
+// CaptureRecover
+// command line tool; repairs journaled capture files after a crash
+//
+// usage: CaptureRecover [-n] file.dat ...
+//   -n   report only, leave the files alone
+//
+// Each file is cut back to the last checkpoint in file.dat.ckp.
+// Only the checkpoint and the last good packet header are read, so this is instant for any file size.
+//
+// This is a separate console program, not part of UDPCapture.cbproj. Build with e.g.
+//   bcc32 CaptureRecover.cpp JournalSink.cpp CaptureSink.cpp CompressedSink.cpp ColumnSink.cpp SpectrumSink.cpp
+//         WelchPsd.cpp Fft.cpp ResampleSink.cpp Resampler.cpp EnvelopeSink.cpp Envelope.cpp FlagSink.cpp PolarSink.cpp Polar.cpp SampleScale.cpp
+//         TriggerSink.cpp Trigger.cpp Deinterleave.cpp DeltaCodec.cpp PacketHeader.cpp
+
+#pragma hdrstop
+
+#include "JournalSink.h"
+#include <stdio.h>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    bool dryRun = false;
+    int failed = 0;
+    int nfiles = 0;
+
+    for (int i=1;i<argc;++i)
+    {
+        if (strcmp(argv[i], "-n") == 0)
+        {
+            dryRun = true;
+            continue;
+        }
+        ++nfiles;
+
+        CheckpointRecord rec;
+        long long cut;
+        switch (recoverCapture(sinkPath(argv[i]), rec, cut, !dryRun))
+        {
+            case recoverNone:
+                printf("%s: no checkpoint (closed normally, or not a journaled capture)\n", argv[i]);
+                break;
+            case recoverDone:
+                printf("%s: %lld good bytes, last packet counter %u at %.3f s; %s %lld bytes\n",
+                       argv[i], rec.bytes, rec.lastHeader & 0xff, rec.lastTime,
+                       dryRun ? "would remove" : "removed", cut);
+                break;
+            default:
+                printf("%s: checkpoint does not match file, not changed\n", argv[i]);
+                ++failed;
+                break;
+        }
+    }
+
+    if (nfiles == 0)
+    {
+        printf("usage: CaptureRecover [-n] file.dat ...\n");
+        return 2;
+    }
+    return failed ? 1 : 0;
+}
+//---------------------------------------------------------------------------
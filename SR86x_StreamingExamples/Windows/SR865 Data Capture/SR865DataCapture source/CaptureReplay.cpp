@@ -0,0 +1,332 @@
+//---------------------------------------------------------------------------
+// CaptureReplay
+// command line tool; plays a network capture of an SR86x stream through the capture pipeline
+//
+// usage: CaptureReplay [-p port] [-x speed | -f] [-o file] [-z] [-j journal] [-s segments] [-S spectra] [-D resample] [-A stats] [-E envelope] [-F] [-T polar] [-G trigger] [-P placement] capture.pcapng
+//   -p   UDP port of the stream (default 1865; 0 = all UDP packets)
+//   -x   replay speed; 1 = original timing (default), 2 = twice as fast, ...
+//   -f   as fast as possible
+//   -o   save to file, like the capture program: .csv = comma separated, .idx = column files,
+//        .psd = noise spectra only, .rsd = resampled data only, else binary
+//   -z   compressed binary file
+//   -j   journaled binary file, synced to disk with a checkpoint every so often so a crash loses little,
+//        e.g. "on" (every second) or "packets=1000;seconds=0" (see JournalSink.h)
+//   -s   save in segments, rolled over at a size, time or packet count, e.g. "bytes=500M;seconds=3600"
+//        (run.dat -> run_0000.dat, run_0001.dat, ...; see CaptureSink.h)
+//   -S   noise spectra settings, e.g. "fft=8192;averages=32"; add "side" to save them beside the samples (see WelchPsd.h)
+//   -D   output rate of resampled data, e.g. "rate=1000;passband=0.9"; add "side" to save it beside the samples (see Resampler.h)
+//   -A   save running statistics (mean, deviation, Allan deviation) every so often, e.g. "file=stats.csv;seconds=60"
+//        (see StreamStats.h); a summary is printed at the end
+//   -E   save a min / max / mean pyramid beside the samples for fast display, e.g. "bucket=256" (see Envelope.h)
+//   -F   save where the overload / error flags change beside the samples, to mask or skip those packets (see FlagSink.h)
+//   -T   add R and theta to X,Y streams, so the instrument only has to send X,Y: "on", or "unwrap"
+//        for continuous theta (see PolarSink.h)
+//   -G   save only the samples around events, e.g. "source=R;edge=rise;level=0.5;pre=0.01;post=0.1",
+//        "source=theta;outside=-10,10" or "overload" (see Trigger.h, TriggerSink.h)
+//   -P   cores & priority of the receive (this) and writer threads, e.g. "receive=2;writer=3;fifo=receive"
+//        (see ThreadPlacement.h); add "nic=eth0" to check them against the interface's interrupts
+//
+// Reads Wireshark / tcpdump files (pcap or pcapng). The UDP payloads go through PacketDecoder
+// on this thread and the packet queue to a writer thread, exactly as in UDPServerThread,
+// so a field capture shows the same drops, queue backlog and write latency here.
+//
+// This is a separate console program, not part of UDPCapture.cbproj. Build with e.g.
+//   bcc32 -tWM CaptureReplay.cpp PacketReplay.cpp PcapReader.cpp PacketDecoder.cpp PacketQueue.cpp CaptureWriter.cpp
+//         CaptureSink.cpp CompressedSink.cpp ColumnSink.cpp JournalSink.cpp SpectrumSink.cpp WelchPsd.cpp Fft.cpp
+//         ResampleSink.cpp Resampler.cpp EnvelopeSink.cpp Envelope.cpp FlagSink.cpp PolarSink.cpp Polar.cpp StreamStats.cpp SampleScale.cpp
+//         TriggerSink.cpp Trigger.cpp Deinterleave.cpp DeltaCodec.cpp PacketHeader.cpp PacketSequence.cpp CaptureTrace.cpp
+//         ThreadPlacement.cpp
+
+#pragma hdrstop
+
+#include "PacketReplay.h"
+#include "CaptureWriter.h"
+#include "CaptureSink.h"
+#include "ThreadPlacement.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+
+//---------------------------------------------------------------------------
+// writer thread
+
+static CaptureWriter *writer = NULL;
+static volatile long stopWriter = 0;
+
+#ifdef _WIN32
+static DWORD WINAPI writerMain(LPVOID)
+#else
+static void *writerMain(void *)
+#endif
+{
+    while (!atomicLoad(&stopWriter))
+    {
+        if (writer->drain() == 0)
+            captureSleep(2);
+    }
+    // save whatever is left
+    while (writer->drain() > 0)
+        ;
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+
+// running statistics at the end, for -A
+static void printStats(const StreamStats &s)
+{
+    static const char *column[4] = { "X", "Y", "R", "Th" };
+    for (int c=0;c<4;++c)
+    {
+        const ChannelStats &ch = s.ch[c];
+        if (ch.count == 0)
+            continue;
+        printf("  %-2s %lld samples, mean %.9g, std dev %.4g, min %.9g, max %.9g, Allan dev %.4g at %.4g s\n", column[c],
+               ch.count, ch.mean, sqrt(statsVariance(ch)), ch.min, ch.max, statsAllan(ch, 0), 1.0 / s.sampleRate);
+    }
+}
+
+static void usage()
+{
+    printf("usage: CaptureReplay [-p port] [-x speed | -f] [-o file] [-z] [-j journal] [-s segments] [-S spectra] [-D resample] [-A stats] [-E envelope] [-F] [-T polar] [-G trigger] [-P placement] capture.pcapng\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int port = 1865;
+    double speed = 1.0;
+    const char *outName = NULL;
+    const char *inName = NULL;
+    std::string statsName;
+    double statsSeconds = 60.0;
+    SinkOptions opt;
+    SegmentPolicy segments;
+    SegmentSink *segmented = NULL;
+    PlacementPolicy placement;
+    std::string err;
+
+    for (int i=1;i<argc;++i)
+    {
+        if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-x") == 0 && i+1 < argc)
+            speed = atof(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0)
+            speed = 0.0;
+        else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            outName = argv[++i];
+        else if (strcmp(argv[i], "-z") == 0)
+            opt.compress = true;
+        else if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+        {
+            if (!parseJournal(argv[++i], opt, err))
+            {
+                printf("-j: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i+1 < argc)
+        {
+            if (!parseSegments(argv[++i], segments, err))
+            {
+                printf("-s: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-D") == 0 && i+1 < argc)
+        {
+            if (!parseResample(argv[++i], opt.resample, err))
+            {
+                printf("-D: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-S") == 0 && i+1 < argc)
+        {
+            if (!parseSpectrum(argv[++i], opt.spectrum, err))
+            {
+                printf("-S: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-E") == 0 && i+1 < argc)
+        {
+            if (!parseEnvelope(argv[++i], opt.envelope, err))
+            {
+                printf("-E: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-F") == 0)
+            opt.flags = true;
+        else if (strcmp(argv[i], "-T") == 0 && i+1 < argc)
+        {
+            if (!parsePolar(argv[++i], opt.polar, err))
+            {
+                printf("-T: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-G") == 0 && i+1 < argc)
+        {
+            if (!parseTrigger(argv[++i], opt.trigger, err))
+            {
+                printf("-G: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-A") == 0 && i+1 < argc)
+        {
+            if (!parseStatsLog(argv[++i], statsName, statsSeconds, err))
+            {
+                printf("-A: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-P") == 0 && i+1 < argc)
+        {
+            if (!parsePlacement(argv[++i], placement, err))
+            {
+                printf("-P: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (argv[i][0] != '-' && !inName)
+            inName = argv[i];
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (!inName || speed < 0.0)
+    {
+        usage();
+        return 2;
+    }
+
+    PacketQueue queue;
+    PacketDecoder decoder(&queue);
+    CaptureWriter w(&queue);
+    writer = &w;
+#ifdef CAPTURE_TRACE
+    CaptureTrace trace;
+    decoder.setTrace(&trace);
+    writer->setTrace(&trace);
+#endif
+
+    PacketReplay replay;
+    if (!replay.open(sinkPath(inName), port))
+    {
+        printf("%s: not a pcap or pcapng file\n", inName);
+        return 1;
+    }
+    replay.setSpeed(speed);
+
+    if (outName)
+    {
+        const char *ext = strrchr(outName, '.');
+        opt.csv = (ext && strcmp(ext, ".csv") == 0);
+        opt.columns = (ext && strcmp(ext, ".idx") == 0);
+        opt.spectra = (ext && strcmp(ext, ".psd") == 0);
+        opt.resampled = (ext && strcmp(ext, ".rsd") == 0);
+        CaptureSink *file;
+        if (segments.enabled())
+            file = segmented = new SegmentSink(opt, segments);
+        else
+            file = newFileSink(opt);
+        if (!file->open(sinkPath(outName), true))
+        {
+            printf("%s: could not create file\n", outName);
+            delete file;
+            return 1;
+        }
+        writer->setSink(file);
+    }
+    if (!statsName.empty() && !writer->setStatsLog(sinkPath(statsName.c_str()), statsSeconds))
+    {
+        printf("%s: could not create file\n", statsName.c_str());
+        return 1;
+    }
+
+#ifdef _WIN32
+    HANDLE thread = CreateThread(NULL, 0, writerMain, NULL, 0, NULL);
+#else
+    pthread_t thread;
+    pthread_create(&thread, NULL, writerMain, NULL);
+#endif
+    if (placement.enabled())
+    {
+        // warnings only; the replay runs either way
+        if (!placeThread(captureThreadSelf(), PLACE_RECEIVE, placement, err))
+            printf("placement: %s\n", err.c_str());
+        if (!placeThread(thread, PLACE_WRITER, placement, err))
+            printf("placement: %s\n", err.c_str());
+        std::vector<std::string> warnings = checkPlacement(placement);
+        for (size_t i=0;i<warnings.size();++i)
+            printf("placement: %s\n", warnings[i].c_str());
+    }
+
+    // receive side; this thread plays the part of UDPServerThread
+    double t0 = captureClock();
+    int n;
+    while ((n = replay.step(&decoder)) >= 0)
+    {
+        if (n == 0)
+            captureSleep(1);
+    }
+    double elapsed = captureClock() - t0;
+
+    atomicStore(&stopWriter, 1);
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+    WriterStats ws;
+    StreamStats ss;
+    writer->getStats(ws);
+    writer->getStreamStats(ss);
+    int segmentCount = segmented ? segmented->segmentIndex() + 1 : 0;
+    long long segmentUnsaved = segmented ? segmented->packetsUnsaved() : 0;
+    writer->setSink(NULL);
+    writer->setStatsLog(SinkPath(), 0.0);
+
+    const LiveData &live = decoder.live;
+    printf("%s: %lld frames, %lld SR86x packets (%lld other frames skipped) in %.3f s\n",
+           inName, replay.source().framesRead(), live.packets, replay.source().framesSkipped(), elapsed);
+    if (elapsed > 0.0)
+        printf("  %.0f packets/s, %.3f MB/s\n", live.packets / elapsed, live.bytes / elapsed / 1.0e6);
+    printf("  dropped on the network: %lld packets", live.dropped);
+    if (live.dropped)
+    {
+        static const char *gap[GAP_BUCKETS] = { "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64-127", "128-255", "256+" };
+        printf(" (gaps:");
+        for (int b=0;b<GAP_BUCKETS;++b)
+            if (live.gaps[b])
+                printf(" %s x%lld", gap[b], live.gaps[b]);
+        printf(")");
+    }
+    printf("\n");
+    if (live.duplicates || live.late || live.retracted)
+        printf("  duplicates: %lld, late: %lld, drops retracted (receive stall): %lld\n", live.duplicates, live.late, live.retracted);
+    printf("  not saved (queue full): %lld packets, deepest queue %d of %d\n", live.unsaved, ws.maxDepth, queue.capacity());
+    if (segmentCount > 0)
+        printf("  %d segments; not saved (segment could not be opened): %lld packets\n", segmentCount, segmentUnsaved);
+    if (ws.syncs > 0)
+        printf("  journal: %lld syncs, %.3f ms each\n", ws.syncs, ws.syncTime / ws.syncs * 1.0e3);
+    printf("  overload/error flag: %lld packets\n", live.overloads);
+    if (replay.packetsTruncated())
+        printf("  %lld payloads too long for an SR86x packet (wrong port?)\n", replay.packetsTruncated());
+    if (!statsName.empty())
+        printStats(ss);
+#ifdef CAPTURE_TRACE
+    printf("\n");
+    trace.report(std::cout);
+#endif
+    return 0;
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,26 @@
+//---------------------------------------------------------------------------
+
+#ifndef CaptureSimdH
+#define CaptureSimdH
+
+// which vector instruction sets the data kernels may use.
+// Every kernel also has a plain C++ version, used when none of these are available
+// (e.g. 32bit builds without SSE2 code generation); results are identical.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CAPTURE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define CAPTURE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CAPTURE_NEON 1
+#include <arm_neon.h>
+#endif
+
+//---------------------------------------------------------------------------
+#endif
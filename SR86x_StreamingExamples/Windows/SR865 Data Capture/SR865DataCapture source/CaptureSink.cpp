@@ -0,0 +1,652 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "CaptureSink.h"
+#include "CompressedSink.h"
+#include "ColumnSink.h"
+#include "JournalSink.h"
+#include "SpectrumSink.h"
+#include "ResampleSink.h"
+#include "EnvelopeSink.h"
+#include "FlagSink.h"
+#include "PolarSink.h"
+#include "TriggerSink.h"
+#include "SampleScale.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <sstream>
+#include <iomanip>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// capture files
+// packets arrive here from the writer thread, already converted to host byte order
+
+SinkPath sinkPath(const char *s)
+{
+    SinkPath path;
+    while (*s)
+        path += (SinkPath::value_type)*s++;
+    return path;
+}
+
+#ifdef _WIN32
+FILE *sinkOpen(const SinkPath &fname, const char *mode)
+{
+    return _wfopen(fname.c_str(), sinkPath(mode).c_str());
+}
+void sinkRename(const SinkPath &from, const SinkPath &to)
+{
+    _wremove(to.c_str());
+    _wrename(from.c_str(), to.c_str());
+}
+bool sinkSeek(FILE *f, long long pos)
+{
+    return (_fseeki64(f, pos, SEEK_SET) == 0);
+}
+long long sinkTell(FILE *f)
+{
+    return _ftelli64(f);
+}
+bool sinkSync(FILE *f)
+{
+    if (fflush(f) != 0)
+        return false;
+    return (FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(f))) != 0);
+}
+bool sinkTruncate(const SinkPath &fname, long long len)
+{
+    int fd = _wopen(fname.c_str(), _O_RDWR | _O_BINARY);
+    if (fd < 0)
+        return false;
+    bool ok = (_chsize_s(fd, len) == 0);
+    _close(fd);
+    return ok;
+}
+void sinkRemove(const SinkPath &fname)
+{
+    _wremove(fname.c_str());
+}
+#else
+FILE *sinkOpen(const SinkPath &fname, const char *mode)
+{
+    return fopen(fname.c_str(), mode);
+}
+void sinkRename(const SinkPath &from, const SinkPath &to)
+{
+    rename(from.c_str(), to.c_str());
+}
+bool sinkSeek(FILE *f, long long pos)
+{
+    return (fseeko(f, (off_t)pos, SEEK_SET) == 0);
+}
+long long sinkTell(FILE *f)
+{
+    return (long long)ftello(f);
+}
+bool sinkSync(FILE *f)
+{
+    if (fflush(f) != 0)
+        return false;
+    return (fsync(fileno(f)) == 0);
+}
+bool sinkTruncate(const SinkPath &fname, long long len)
+{
+    return (truncate(fname.c_str(), (off_t)len) == 0);
+}
+void sinkRemove(const SinkPath &fname)
+{
+    remove(fname.c_str());
+}
+#endif
+bool sinkExists(const SinkPath &fname)
+{
+    FILE *f = sinkOpen(fname, "rb");
+    if (f)
+        fclose(f);
+    return (f != NULL);
+}
+
+//---------------------------------------------------------------------------
+// SinkNotes
+
+SinkNotes::SinkNotes()
+{
+    file = NULL;
+}
+SinkNotes::~SinkNotes()
+{
+    close();
+}
+
+void SinkNotes::setCapture(const SinkPath &capture)
+{
+    close();
+    name = capture;
+    SinkPath part = sinkPath(".part");
+    if (name.length() > part.length() && name.compare(name.length() - part.length(), part.length(), part) == 0)
+        name.erase(name.length() - part.length());
+    name += sinkPath(".log");
+}
+void SinkNotes::write(const std::string &text)
+{
+    if (!file && !name.empty())
+        file = sinkOpen(name, "a");
+    if (!file)
+        return;
+    fputs(text.c_str(), file);
+    fputc('\n', file);
+    fflush(file);
+}
+void SinkNotes::close()
+{
+    if (file)
+        fclose(file);
+    file = NULL;
+}
+
+//---------------------------------------------------------------------------
+// FileSink
+
+FileSink::FileSink(bool csv)
+{
+    csvFmt = csv;
+    lastHeader = 0;
+    lastScale = SCALE_UNKNOWN;
+    bytes = 0;
+    packets = 0;
+}
+/*virtual*/ FileSink::~FileSink()
+{
+    close();
+}
+
+bool FileSink::open(const SinkPath &fname, bool trunc)
+{
+    std::ios::openmode mode = std::ios::out;
+    if (!csvFmt)
+        mode |= std::ios::binary;
+    mode |= (trunc ? std::ios::trunc : std::ios::app);
+
+    fstream.clear();
+    fstream.open(fname.c_str(), mode);
+    if (!(fstream.is_open() && fstream.good() && !fstream.fail()))
+    {
+        fstream.close();
+        return false;
+    }
+
+    bytes = 0;
+    packets = 0;
+    if (!csvFmt)
+        notes.setCapture(fname);
+    if (csvFmt)
+    {
+        time_t t = time(0);
+        struct tm *now = localtime(&t);
+        char dtbuff[80];
+        strftime(dtbuff, 80, "%Y-%m-%d %H:%M", now);
+        lastHeader = 0;
+        fstream << dtbuff << std::endl;
+        // specify float fmt
+        // precision means (1 + prec) sig fig;
+        // 24 bits of mantissa in float means 7.2 decimal digits,
+        // so we need 8 sig fig to completely specify float
+        // however, 6 sig fig (1ppm) is usually more than enough!
+        // we could go as low as 5 sig fig (1 in 100,000), which is still better than 16bits
+        fstream << std::scientific;
+        fstream.precision(5);
+    }
+    return true;
+}
+/*virtual*/ bool FileSink::isOpen() const
+{
+    return fstream.is_open();
+}
+/*virtual*/ void FileSink::close()
+{
+    fstream.close();
+    notes.close();
+}
+/*virtual*/ void FileSink::note(const std::string &text)
+{
+    if (!fstream.is_open())
+        return;
+    if (csvFmt)
+        fstream << text << std::endl;
+    else
+        notes.write(text);
+}
+
+/*virtual*/ void FileSink::write(const CapturePacket &pkt)
+{
+    if (!fstream.is_open())
+        return;
+
+    if (csvFmt)
+    {
+        PacketHeader hdr(pkt.buffer[0]);
+        writeCSV(pkt, hdr);
+    }
+    else
+    {
+        fstream.write((const char *)pkt.buffer, pkt.nwords << 2);     // binary data; save entire udp packet to disk
+        bytes += (pkt.nwords << 2);
+    }
+    ++packets;
+}
+void FileSink::writeCSV(const CapturePacket &pkt, const PacketHeader &hdr)
+{
+    if (pkt.dropped)
+        fstream << "Dropped " << pkt.dropped << " packets!" << std::endl;
+
+    // comma separated values (ASCII) format
+    // did data content, rate or scale change?
+    if (((lastHeader ^ hdr.getHeader()) & 0x00ff0f00) || (hdr.isInt() && pkt.scale != lastScale))
+    {
+        lastHeader = hdr.getHeader();
+        lastScale = pkt.scale;
+        switch (hdr.what)
+        {
+            default: fstream << "X (float)"; break;
+            case 1: fstream << "X,Y (float)"; break;
+            case 2: fstream << "R,theta (float)"; break;
+            case 3: fstream << "X,Y,R,theta (float)"; break;
+            case 4: fstream << "X (int)"; break;
+            case 5: fstream << "X,Y (int)"; break;
+            case 6: fstream << "R,theta (int)"; break;
+            case 7: fstream << "X,Y,R,theta (int)"; break;
+        }
+        fstream << " @ " << hdr.sampleRate() << " Hz";
+        if (hdr.isInt() && pkt.scale != SCALE_UNKNOWN)
+            fstream << ", full scale " << sensitivityOf(pkt.scale) << " " << scaleUnit(pkt.scale) << " = 32767";
+        fstream << std::endl;
+    }
+
+    union
+    {
+        unsigned int raw;
+        float fval;
+        short sval[2];
+    }
+    dat;
+    const unsigned int *buffer = pkt.buffer;
+    int nwords = pkt.nwords;
+    for (int i=1;i<nwords;)
+    {
+        dat.raw = buffer[i];
+        switch (hdr.what)
+        {
+            default:
+                // x only (float)
+                fstream << dat.fval << std::endl;
+                ++i;
+                break;
+            case 1:
+            case 2:
+                // x&y or r&th (float)
+                fstream << dat.fval << ",";
+                dat.raw = buffer[i+1];
+                fstream << dat.fval << std::endl;
+                i += 2;
+                break;
+            case 3:
+                // xyr&th (float)
+                fstream << dat.fval << ",";
+                dat.raw = buffer[i+1];
+                fstream << dat.fval << ",";
+                dat.raw = buffer[i+2];
+                fstream << dat.fval << ",";
+                dat.raw = buffer[i+3];
+                fstream << dat.fval << std::endl;
+                i += 4;
+                break;
+
+            case 4:
+                // x-only (int)
+                fstream << dat.sval[0] << std::endl << dat.sval[1] << std::endl;
+                ++i;
+                break;
+            case 5:
+            case 6:
+                // x&y or r&th (int)
+                fstream << dat.sval[0] << "," << dat.sval[1] << std::endl;
+                ++i;
+                break;
+            case 7:
+                // xyr&th (int)
+                fstream << dat.sval[0] << "," << dat.sval[1] << ",";
+                dat.raw = buffer[i+1];
+                fstream << dat.sval[0] << "," << dat.sval[1] << std::endl;
+                i += 2;
+                break;
+        }
+    }
+}
+
+long long FileSink::bytesWritten()
+{
+    if (csvFmt && fstream.is_open())
+        return (long long)fstream.tellp();
+    return bytes;
+}
+long long FileSink::packetsWritten() const
+{
+    return packets;
+}
+
+static CaptureSink *newSampleSink(const SinkOptions &opt)
+{
+    CaptureSink *file;
+    if (opt.columns)
+        file = new ColumnSink();
+    else if (!opt.csv && !opt.compress && opt.journal)
+        file = new JournalSink(opt.syncPackets, opt.syncSeconds);
+    else if (!opt.csv && opt.compress)
+        file = new CompressedSink();
+    else
+        file = new FileSink(opt.csv);
+    if (opt.envelope.side)
+        file = new EnvelopeSink(opt.envelope, file);
+    if (opt.flags)
+        file = new FlagSink(file);
+    if (opt.trigger.on)
+        file = new TriggerSink(opt.trigger, file);
+    return file;
+}
+
+CaptureSink *newFileSink(const SinkOptions &opt)
+{
+    CaptureSink *file;
+    if (opt.spectra)
+        file = new SpectrumSink(opt.spectrum, NULL);
+    else
+    {
+        if (opt.resampled)
+            file = new ResampleSink(opt.resample, NULL);
+        else if (opt.resample.side)
+            file = new ResampleSink(opt.resample, newSampleSink(opt));
+        else
+            file = newSampleSink(opt);
+        // spectra always come from the full rate stream
+        if (opt.spectrum.side)
+            file = new SpectrumSink(opt.spectrum, file);
+    }
+    // R & theta before anything else, so every file sees them
+    if (opt.polar.on)
+        file = new PolarSink(opt.polar, file);
+    return file;
+}
+
+bool parseSegments(const std::string &spec, SegmentPolicy &pol, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key != "bytes" && key != "seconds" && key != "packets")
+        {
+            err = "unknown segment setting \"" + item + "\"";
+            return false;
+        }
+        char *end;
+        double v = strtod(val.c_str(), &end);
+        if (key == "bytes" && end != val.c_str())
+        {
+            // plain bytes, or k / M / G
+            if (*end == 'k' || *end == 'K')
+                v *= 1024.0, ++end;
+            else if (*end == 'm' || *end == 'M')
+                v *= 1024.0 * 1024.0, ++end;
+            else if (*end == 'g' || *end == 'G')
+                v *= 1024.0 * 1024.0 * 1024.0, ++end;
+        }
+        if (end == val.c_str() || *end || !(v > 0.0) || v > 1.0e15 || (key != "seconds" && v != floor(v)))
+        {
+            err = "bad value for " + key + ": \"" + val + "\"";
+            return false;
+        }
+        if (key == "bytes")
+            pol.maxBytes = (long long)v;
+        else if (key == "seconds")
+            pol.maxSeconds = v;
+        else
+            pol.maxPackets = (long long)v;
+    }
+    return true;
+}
+
+bool parseJournal(const std::string &spec, SinkOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty() || item == "on")
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key != "packets" && key != "seconds")
+        {
+            err = "unknown journal setting \"" + item + "\"";
+            return false;
+        }
+        char *end;
+        double v = strtod(val.c_str(), &end);
+        if (end == val.c_str() || *end || !(v >= 0.0) || v > 1.0e9 || (key == "packets" && v != floor(v)))
+        {
+            err = "bad value for " + key + ": \"" + val + "\"";
+            return false;
+        }
+        if (key == "packets")
+            opt.syncPackets = (int)v;
+        else
+            opt.syncSeconds = v;
+    }
+    opt.journal = true;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// SegmentSink
+
+SegmentSink::SegmentSink(const SinkOptions &opt, const SegmentPolicy &pol)
+{
+    options = opt;
+    policy = pol;
+    index = 0;
+    file = NULL;
+    doneSyncs = 0;
+    doneSyncTime = 0.0;
+    startTime = 0.0;
+    opened = false;
+    unsaved = gap = 0;
+    failures = 0;
+    retryTime = 0.0;
+}
+/*virtual*/ SegmentSink::~SegmentSink()
+{
+    close();
+}
+
+bool SegmentSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+
+    // split "run.dat" into "run" and ".dat"
+    SinkPath::size_type dot = fname.find_last_of('.');
+    SinkPath::size_type sep = fname.find_last_of(sinkPath("/\\"));
+    if (dot == SinkPath::npos || (sep != SinkPath::npos && dot < sep))
+        dot = fname.length();
+    base = fname.substr(0, dot);
+    ext = fname.substr(dot);
+
+    index = 0;
+    if (!trunc)
+    {
+        // appending: carry on after the last segment already on disk
+        while (sinkExists(segmentName(index)) || sinkExists(segmentName(index) + sinkPath(".part")))
+            ++index;
+    }
+    unsaved = gap = 0;
+    failures = 0;
+    opened = openSegment();
+    return opened;
+}
+
+SinkPath SegmentSink::segmentName(int idx) const
+{
+    std::basic_ostringstream<SinkPath::value_type> name;
+    name << base << '_' << std::setw(4) << std::setfill((SinkPath::value_type)'0') << idx << ext;
+    return name.str();
+}
+bool SegmentSink::openSegment()
+{
+    finalName = segmentName(index);
+    partName = finalName + sinkPath(".part");
+
+    file = newFileSink(options);
+    if (!file->open(partName, true))
+    {
+        delete file;
+        file = NULL;
+        return false;
+    }
+    return true;
+}
+void SegmentSink::closeSegment()
+{
+    if (file)
+    {
+        file->close();
+        doneSyncs += file->syncCount();
+        doneSyncTime += file->syncTime();
+        delete file;
+        file = NULL;
+        // segment is complete; give it its real name
+        sinkRename(partName, finalName);
+    }
+}
+
+bool SegmentSink::needRoll(const CapturePacket &pkt)
+{
+    long long n = file->packetsWritten();
+    if (n == 0)
+        return false;               // every segment holds at least one packet
+    if (policy.maxPackets > 0 && n >= policy.maxPackets)
+        return true;
+    if (policy.maxSeconds > 0.0 && (pkt.rxTime - startTime) >= policy.maxSeconds)
+        return true;
+    // csv lines are longer than the packet, so csv segments can run a little over maxBytes
+    if (policy.maxBytes > 0 && file->bytesWritten() + (pkt.nwords << 2) > policy.maxBytes)
+        return true;
+    return false;
+}
+
+/*virtual*/ bool SegmentSink::isOpen() const
+{
+    return opened;
+}
+/*virtual*/ void SegmentSink::write(const CapturePacket &pkt)
+{
+    if (!opened)
+        return;
+
+    // roll over between packets, never inside one
+    if (file && needRoll(pkt))
+    {
+        closeSegment();
+        ++index;
+    }
+    if (!file)
+    {
+        // a roll, or the last open failed: again with the next packet, then every SEGMENT_RETRY seconds
+        bool retry = (gap <= 1 || pkt.rxTime - retryTime >= SEGMENT_RETRY);
+        if (!retry || !openSegment())
+        {
+            if (retry)
+            {
+                ++failures;
+                retryTime = pkt.rxTime;
+            }
+            ++unsaved;
+            ++gap;
+            return;
+        }
+        if (gap > 0)
+        {
+            std::ostringstream text;
+            text << gap << " packets not saved: segment could not be opened";
+            file->note(text.str());
+            gap = 0;
+        }
+    }
+    if (file->packetsWritten() == 0)
+        startTime = pkt.rxTime;
+    file->write(pkt);
+}
+/*virtual*/ void SegmentSink::close()
+{
+    closeSegment();
+    opened = false;
+}
+/*virtual*/ void SegmentSink::note(const std::string &text)
+{
+    if (file)
+        file->note(text);
+}
+
+/*virtual*/ long long SegmentSink::bytesWritten()
+{
+    return file ? file->bytesWritten() : 0;
+}
+/*virtual*/ long long SegmentSink::packetsWritten() const
+{
+    return file ? file->packetsWritten() : 0;
+}
+
+/*virtual*/ long long SegmentSink::syncCount() const
+{
+    return doneSyncs + (file ? file->syncCount() : 0);
+}
+/*virtual*/ double SegmentSink::syncTime() const
+{
+    return doneSyncTime + (file ? file->syncTime() : 0.0);
+}
+/*virtual*/ void SegmentSink::idle(double now)
+{
+    if (file)
+        file->idle(now);
+}
+
+int SegmentSink::segmentIndex() const
+{
+    return index;
+}
+long long SegmentSink::packetsUnsaved() const
+{
+    return unsaved;
+}
+int SegmentSink::openFailures() const
+{
+    return failures;
+}
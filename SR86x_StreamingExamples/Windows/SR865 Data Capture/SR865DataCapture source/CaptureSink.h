@@ -0,0 +1,214 @@
+//---------------------------------------------------------------------------
+
+#ifndef CaptureSinkH
+#define CaptureSinkH
+
+#include <stdio.h>
+#include <fstream>
+#include <string>
+#include "PacketHeader.h"
+#include "PacketQueue.h"
+#include "WelchPsd.h"
+#include "Resampler.h"
+#include "Envelope.h"
+#include "Polar.h"
+#include "Trigger.h"
+
+//---------------------------------------------------------------------------
+
+// file names are wide on Windows (ofstream accepts wchar_t* there)
+#ifdef _WIN32
+typedef std::wstring SinkPath;
+#else
+typedef std::string SinkPath;
+#endif
+
+// file helpers for SinkPath names
+SinkPath sinkPath(const char *s);                           // ascii string as a file name
+FILE *sinkOpen(const SinkPath &fname, const char *mode);    // fopen()
+bool sinkExists(const SinkPath &fname);
+void sinkRename(const SinkPath &from, const SinkPath &to);  // replaces "to" if it exists
+bool sinkSeek(FILE *f, long long pos);                      // fseek() to 64bit offset from start
+long long sinkTell(FILE *f);                                // ftell(), 64bit
+bool sinkSync(FILE *f);                                     // fflush(), then wait until the data is on disk
+bool sinkTruncate(const SinkPath &fname, long long len);
+void sinkRemove(const SinkPath &fname);
+
+// text notes (settings changes and the like) for a capture file that can't hold text,
+// kept beside it: "run.dat" -> "run.dat.log" (segments: "run_0000.dat.log", without ".part")
+// The log is only created when the first note arrives.
+class SinkNotes
+{
+protected:
+    SinkPath name;
+    FILE *file;
+
+public:
+    SinkNotes();
+    ~SinkNotes();
+
+    void setCapture(const SinkPath &capture);
+    void write(const std::string &text);
+    void close();
+
+private:
+    SinkNotes(const SinkNotes &);
+    SinkNotes &operator=(const SinkNotes &);
+};
+
+// destination for captured packets
+// sinks are only ever called from the writer thread
+class CaptureSink
+{
+public:
+    virtual ~CaptureSink() {}
+
+    virtual bool open(const SinkPath &fname, bool trunc) = 0;
+    virtual bool isOpen() const = 0;
+    virtual void write(const CapturePacket &pkt) = 0;
+    virtual void close() = 0;
+
+    virtual long long bytesWritten() = 0;
+    virtual long long packetsWritten() const = 0;
+
+    // one line of text, between the packets written before and after it
+    virtual void note(const std::string &text) = 0;
+
+    // time spent forcing data to disk (journaled files only)
+    virtual long long syncCount() const { return 0; }
+    virtual double syncTime() const { return 0.0; }
+
+    // writer has nothing to write (captureClock() seconds); timed work that can't wait for the next packet
+    virtual void idle(double /*now*/) {}
+};
+
+// single capture file, binary or CSV
+// For binary file format, the UDP packet is saved in native endian format, and includes the header.
+// For ASCII file format, the data is saved in CSV format, with a date-time at the beginning, and a description of the data & data rate when they change.
+class FileSink : public CaptureSink
+{
+protected:
+    std::ofstream fstream;
+    bool csvFmt;
+    unsigned int lastHeader;
+    int lastScale;
+    long long bytes;                // bytes written to this file (binary only; csv uses tellp)
+    long long packets;
+    SinkNotes notes;                // binary only; csv has its notes inline
+
+    void writeCSV(const CapturePacket &pkt, const PacketHeader &hdr);
+
+public:
+    FileSink(bool csv);
+    virtual ~FileSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+};
+
+// how capture files are written
+struct SinkOptions
+{
+    bool csv;                       // comma separated values instead of binary
+    bool compress;                  // binary only; integer data is delta coded (see CompressedSink)
+    bool columns;                   // one file per channel plus an index (see ColumnSink)
+    bool journal;                   // plain binary only; periodic sync & checkpoint (see JournalSink)
+    int syncPackets;                // journal: sync after this many packets (0 = no limit)
+    double syncSeconds;             // journal: sync at least this often (0 = no limit)
+    bool spectra;                   // averaged noise spectra instead of samples (see SpectrumSink)
+    SpectrumOptions spectrum;       // segment size & averaging; spectrum.side = spectra as well as samples
+    bool resampled;                 // samples at resample.rate instead of the stream rate (see ResampleSink)
+    ResampleOptions resample;       // output rate & passband; resample.side = resampled data as well as samples
+    EnvelopeOptions envelope;       // envelope.side = min / max / mean pyramid beside the samples (see EnvelopeSink)
+    PolarOptions polar;             // polar.on = X,Y streams saved with R and theta (see PolarSink)
+    TriggerOptions trigger;         // trigger.on = samples saved only around events (see TriggerSink)
+    bool flags;                     // overload / error flag timeline beside the samples (see FlagSink)
+
+    SinkOptions() : csv(false), compress(false), columns(false), journal(false), syncPackets(0), syncSeconds(1.0),
+                    spectra(false), resampled(false), flags(false) {}
+};
+
+// new, unopened capture file for these options
+CaptureSink *newFileSink(const SinkOptions &opt);
+
+// journaled binary files, e.g. "on", "seconds=0.5" or "packets=1000;seconds=0" (0 = no limit); sets opt.journal
+bool parseJournal(const std::string &spec, SinkOptions &opt, std::string &err);
+
+#define SEGMENT_RETRY   1.0         // seconds between attempts to open a segment that failed to open
+
+// rules for starting a new segment; 0 means no limit
+struct SegmentPolicy
+{
+    long long maxBytes;             // roll before a segment would exceed this size
+    double maxSeconds;              // roll when a segment spans this much time (packet arrival time)
+    long long maxPackets;           // roll after this many packets
+
+    SegmentPolicy() : maxBytes(0), maxSeconds(0.0), maxPackets(0) {}
+    bool enabled() const { return (maxBytes > 0 || maxSeconds > 0.0 || maxPackets > 0); }
+};
+
+// policy from text, e.g. "bytes=500M;seconds=3600" or "packets=100000" (bytes: plain, k, M or G)
+bool parseSegments(const std::string &spec, SegmentPolicy &pol, std::string &err);
+
+// series of capture files, rolled over on a packet boundary.
+// "run.dat" becomes run_0000.dat, run_0001.dat, ...
+// Every segment is a complete capture file on its own:
+// binary segments begin with a packet (every packet carries its own header),
+// csv segments begin with the date line, and the data description is repeated.
+// A segment is written as "run_0000.dat.part" and renamed when it is complete,
+// so finished segments can be moved off the computer while capture continues.
+// If the next segment can't be opened (disk full, name in use), packets are counted as not saved
+// and the open is tried again with the next packet (then at most every SEGMENT_RETRY seconds);
+// the segment that finally opens gets a note of how many were lost.
+class SegmentSink : public CaptureSink
+{
+protected:
+    SinkOptions options;
+    SegmentPolicy policy;
+    SinkPath base, ext;
+    int index;                      // index of current segment
+    CaptureSink *file;
+    long long doneSyncs;            // syncs of closed segments
+    double doneSyncTime;
+    SinkPath partName, finalName;
+    double startTime;               // arrival time of first packet in segment
+    bool opened;                    // between open() and close(), whether or not a segment is open
+    long long unsaved;              // packets lost while no segment could be opened, all segments
+    long long gap;                  // of those, since the last segment was open
+    int failures;                   // segment opens that failed
+    double retryTime;               // arrival time of the last failed open
+
+    SinkPath segmentName(int idx) const;
+    bool openSegment();
+    void closeSegment();
+    bool needRoll(const CapturePacket &pkt);
+
+public:
+    SegmentSink(const SinkOptions &opt, const SegmentPolicy &pol);
+    virtual ~SegmentSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();           // current segment
+    virtual long long packetsWritten() const;   // current segment
+    virtual void note(const std::string &text); // current segment
+    virtual long long syncCount() const;        // all segments
+    virtual double syncTime() const;
+    virtual void idle(double now);
+
+    int segmentIndex() const;
+    long long packetsUnsaved() const;
+    int openFailures() const;
+};
+
+//---------------------------------------------------------------------------
+#endif
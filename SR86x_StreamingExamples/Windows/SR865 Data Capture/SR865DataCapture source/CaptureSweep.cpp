@@ -0,0 +1,408 @@
+//---------------------------------------------------------------------------
+// CaptureSweep
+// command line sweep of an instrument setting on one or more SR86x, with the data of every point
+// taken from their streams into one indexed file
+//
+// usage: CaptureSweep -i address,port[,delay] [-i address,port[,delay] ...] -c command -v values [-S sweep] [-o file] [-k] [-R receive]
+//   -i   instrument: IP address (VXI-11) and the UDP port of its stream (up to 8); delay (seconds) is taken
+//        off its times, e.g. the difference in network latency if it is known
+//   -c   the command that sets a point, with %g for the value, e.g. "FREQ %g" or "SLVL %.4f"
+//   -v   the values: "100,200,500", "start:stop:points" or "start:stop:points:log"
+//   -S   timing of every point, e.g. "settle=0.5;capture=1;lockstep" (see SweepPlan.h)
+//   -o   the points: .csv = comma separated, else binary, indexed by point and instrument (see SweepSink.h);
+//        default "sweep.dat"
+//   -k   also keep each stream's own capture, "<file>.<port>.dat"
+//   -R   receive buffer & mode of every socket, e.g. "buffer=32M" (see ReceiveSocket.h)
+//
+// Start the streams first, from the capture program or over VXI-11 (STREAM ON), each to its own port.
+// Each instrument has a receive thread, packet queue and writer thread as in CaptureAlign, plus
+// a command thread with its own VXI-11 link, so a command that takes the instrument a while
+// holds up neither the capture nor the other instruments. SweepScheduler decides what is due;
+// the writer threads reduce each point (SweepSink) while the next point's command goes out.
+// Once a second it prints the point each instrument is on and the sweep rate in points per minute.
+//
+// This is a separate console program, not part of UDPCapture.cbproj, and Windows only (vxi11.cpp).
+// Build with e.g.
+//   bcc32 CaptureSweep.cpp CaptureLoop.cpp SweepPlan.cpp SweepSink.cpp StreamAlign.cpp vxi11.cpp rpc.cpp xdr.cpp ReceiveSocket.cpp
+//         PacketDecoder.cpp PacketSequence.cpp PacketQueue.cpp CaptureWriter.cpp CaptureSink.cpp CompressedSink.cpp
+//         ColumnSink.cpp JournalSink.cpp SpectrumSink.cpp WelchPsd.cpp Fft.cpp ResampleSink.cpp Resampler.cpp
+//         EnvelopeSink.cpp Envelope.cpp FlagSink.cpp PolarSink.cpp Polar.cpp StreamStats.cpp SampleScale.cpp TriggerSink.cpp
+//         Trigger.cpp Deinterleave.cpp DeltaCodec.cpp PacketHeader.cpp CaptureTrace.cpp ws2_32.lib
+
+#pragma hdrstop
+
+#include "CaptureLoop.h"
+#include "CaptureSink.h"
+#include "SweepPlan.h"
+#include "SweepSink.h"
+#include "vxi11.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <signal.h>
+
+//---------------------------------------------------------------------------
+
+#define SWEEP_MAX_INSTRUMENTS   8
+#define SWEEP_STREAM_WAIT       5.0     // seconds to wait for every stream before the sweep starts
+#define SWEEP_DATA_WAIT         1.0     // seconds after a point's capture time its data may still come
+
+// one instrument
+struct SweepInput
+{
+    std::string address;
+    int port;
+    double delay;
+    ReceiveSocket sock;
+    PacketQueue queue;
+    PacketDecoder decoder;
+    CaptureWriter writer;
+    LiveSnapshot snapshot;          // what the main thread sees of decoder.live
+    SweepSink *sink;
+    volatile long stopReceive, stopWriter, stopCommand;
+    bool failed;
+    LiveData last;                  // at the last report
+
+    // commands: the main thread sets command and counts sent; the command thread answers
+    vxi11_client vxi;
+    bool confirm;                   // ask *OPC? after each command
+    std::string command;
+    int point;                      // of the command
+    volatile long sent, answered;
+    double answerTime;
+    bool answerOk;
+    long windows;                   // capture times handed to the sink
+    HANDLE receiveThread, writerThread, commandThread;
+
+    SweepInput() : decoder(&queue), writer(&queue), sink(NULL), stopReceive(0), stopWriter(0), stopCommand(0),
+                   failed(false), confirm(true), point(0), sent(0), answered(0), answerTime(0.0), answerOk(false),
+                   windows(0) {}
+};
+
+static volatile sig_atomic_t stopSweep = 0;
+
+static void onSignal(int)
+{
+    stopSweep = 1;
+}
+
+static DWORD WINAPI receiveMain(LPVOID arg)
+{
+    SweepInput *in = (SweepInput *)arg;
+    if (!receiveLoop(in->sock, in->decoder, in->snapshot, &in->stopReceive))
+        in->failed = true;
+    return 0;
+}
+
+static DWORD WINAPI writerMain(LPVOID arg)
+{
+    SweepInput *in = (SweepInput *)arg;
+    writerLoop(in->writer, &in->stopWriter);
+    return 0;
+}
+
+static DWORD WINAPI commandMain(LPVOID arg)
+{
+    // VXI-11 calls block until the instrument answers; here they hold up only this instrument
+    SweepInput *in = (SweepInput *)arg;
+    char reply[1024];
+    while (!atomicLoad(&in->stopCommand))
+    {
+        long n = atomicLoad(&in->sent);
+        if (n == atomicLoad(&in->answered))
+        {
+            captureSleep(1);
+            continue;
+        }
+        bool ok = in->vxi.device_write(in->command.c_str());
+        if (ok && in->confirm)
+            ok = in->vxi.device_write("*OPC?") && in->vxi.device_read(reply);
+        in->answerTime = captureClock();
+        in->answerOk = ok;
+        atomicStore(&in->answered, n);
+    }
+    return 0;
+}
+
+static void startThread(HANDLE &thread, LPTHREAD_START_ROUTINE main, void *arg)
+{
+    thread = CreateThread(NULL, 0, main, arg, 0, NULL);
+}
+static void joinThread(HANDLE thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+//---------------------------------------------------------------------------
+
+static void usage()
+{
+    printf("usage: CaptureSweep -i address,port[,delay] [-i address,port[,delay] ...] -c command -v values [-S sweep] [-o file] [-k] [-R receive]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<SweepInput *> inputs;
+    std::string command;
+    std::vector<double> values;
+    std::string outName = "sweep.dat";
+    bool keep = false;
+    SweepOptions opt;
+    ReceiveOptions receive;
+    std::string err;
+
+    for (int i=1;i<argc;++i)
+    {
+        if (strcmp(argv[i], "-i") == 0 && i+1 < argc)
+        {
+            SweepInput *in = new SweepInput;
+            std::string arg = argv[++i];
+            size_t comma = arg.find(',');
+            in->address = arg.substr(0, comma);
+            in->port = (comma == std::string::npos) ? 0 : atoi(arg.c_str() + comma + 1);
+            size_t second = (comma == std::string::npos) ? comma : arg.find(',', comma + 1);
+            in->delay = (second == std::string::npos) ? 0.0 : atof(arg.c_str() + second + 1);
+            inputs.push_back(in);
+            if (in->address.empty() || in->address.length() > 32 || in->port <= 0 || in->port > 65535 ||
+                (int)inputs.size() > SWEEP_MAX_INSTRUMENTS)
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i+1 < argc)
+        {
+            command = argv[++i];
+            if (!checkSweepCommand(command, err))
+            {
+                printf("-c: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-v") == 0 && i+1 < argc)
+        {
+            if (!parseSweepValues(argv[++i], values, err))
+            {
+                printf("-v: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-S") == 0 && i+1 < argc)
+        {
+            if (!parseSweep(argv[++i], opt, err))
+            {
+                printf("-S: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            outName = argv[++i];
+        else if (strcmp(argv[i], "-k") == 0)
+            keep = true;
+        else if (strcmp(argv[i], "-R") == 0 && i+1 < argc)
+        {
+            if (!parseReceive(argv[++i], receive, err))
+            {
+                printf("-R: %s\n", err.c_str());
+                return 2;
+            }
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (inputs.empty() || command.empty() || values.empty())
+    {
+        usage();
+        return 2;
+    }
+
+    WSAData wsdat;
+    WSAStartup(0x0101, &wsdat);
+    SweepDataset dataset;
+    if (!dataset.open(sinkPath(outName.c_str()), (int)inputs.size(), (int)values.size()))
+    {
+        printf("%s: could not create file\n", outName.c_str());
+        return 1;
+    }
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        SweepInput *in = inputs[i];
+        char addr[33];
+        strcpy(addr, in->address.c_str());
+        if (!in->vxi.connectToDevice(addr))
+        {
+            printf("%s: no VXI-11 connection (%s)\n", addr, in->vxi.getLastError());
+            return 1;
+        }
+        in->vxi.device_clear();
+        in->confirm = opt.confirm;
+
+        if (!in->sock.open(in->port, receive, err))
+        {
+            printf("port %d: %s\n", in->port, err.c_str());
+            return 1;
+        }
+        if (!in->sock.warning().empty())
+            printf("port %d: %s\n", in->port, in->sock.warning().c_str());
+        printf("%s: listening on UDP port %d, receive buffer %d kB\n", addr, in->port, in->sock.bufferBytes() >> 10);
+
+        CaptureSink *own = keep ? newFileSink(SinkOptions()) : NULL;
+        in->sink = new SweepSink(&dataset, (int)i, in->delay, own);
+        char name[32];
+        sprintf(name, ".%d.dat", in->port);
+        if (!in->sink->open(sinkPath((outName + name).c_str()), true))
+        {
+            printf("%s%s: could not create file\n", outName.c_str(), name);
+            return 1;
+        }
+        in->writer.setSink(in->sink);
+    }
+
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        startThread(inputs[i]->writerThread, writerMain, inputs[i]);
+        startThread(inputs[i]->receiveThread, receiveMain, inputs[i]);
+        startThread(inputs[i]->commandThread, commandMain, inputs[i]);
+    }
+    signal(SIGINT, onSignal);
+
+    // the clock fits need packets before the first point is timed
+    double t0 = captureClock();
+    bool streaming = false;
+    while (!streaming && !stopSweep && captureClock() - t0 < SWEEP_STREAM_WAIT)
+    {
+        captureSleep(50);
+        streaming = true;
+        for (size_t i=0;i<inputs.size();++i)
+        {
+            LiveData live;
+            inputs[i]->snapshot.read(live);
+            if (live.packets == 0)
+                streaming = false;
+        }
+    }
+    for (size_t i=0;i<inputs.size() && !streaming;++i)
+    {
+        LiveData live;
+        inputs[i]->snapshot.read(live);
+        if (live.packets == 0)
+            printf("port %d: no stream; start it first\n", inputs[i]->port);
+    }
+
+    SweepScheduler scheduler(opt, (int)inputs.size(), values);
+    t0 = captureClock();
+    scheduler.start(t0);
+    double nextReport = t0 + 1.0;
+    double finished = 0.0;
+    while (streaming && !stopSweep)
+    {
+        captureSleep(1);
+        double now = captureClock();
+        for (size_t i=0;i<inputs.size();++i)
+        {
+            SweepInput *in = inputs[i];
+            if (in->answered != 0 && atomicLoad(&in->answered) == in->sent)
+                scheduler.completed((int)i, in->point, in->answerTime, in->answerOk);
+        }
+        SweepStep step;
+        while (scheduler.next(now, step))
+        {
+            SweepInput *in = inputs[step.instrument];
+            if (step.action == SWEEP_SEND)
+            {
+                in->command = sweepCommand(command, step.value);
+                in->point = step.point;
+                atomicStore(&in->sent, in->sent + 1);
+            }
+            else if (step.action == SWEEP_WINDOW)
+            {
+                in->sink->addWindow(step.point, step.value, step.start, step.end);
+                ++in->windows;
+            }
+            else
+            {
+                printf("%s: \"%s\" failed\n", in->address.c_str(), sweepCommand(command, step.value).c_str());
+                dataset.writeMissing(step.point, step.instrument, step.value, SWEEP_NOCMD);
+            }
+        }
+        for (size_t i=0;i<inputs.size();++i)
+            inputs[i]->sink->expire(now, SWEEP_DATA_WAIT);
+
+        if (now >= nextReport)
+        {
+            printf("%6.0f s: %d of %d points, %.1f points/min;", now - t0, scheduler.pointsDone(), scheduler.pointCount(),
+                   scheduler.pointsPerMinute(now));
+            for (size_t i=0;i<inputs.size();++i)
+            {
+                SweepInput *in = inputs[i];
+                LiveData live;
+                in->snapshot.read(live);
+                double drift;
+                printf(" %d: point %d, %lld lost", in->port, scheduler.pointOf((int)i), live.dropped - in->last.dropped);
+                if (in->sink->clockOf(drift))
+                    printf(", drift %+.2f ppm", drift);
+                printf(i+1 < inputs.size() ? ";" : "\n");
+                in->last = live;
+            }
+            fflush(stdout);
+            nextReport += 1.0;
+        }
+
+        if (scheduler.finished())
+        {
+            if (finished == 0.0)
+                finished = now;
+            // until the last points are reduced
+            bool pending = false;
+            for (size_t i=0;i<inputs.size();++i)
+                pending = pending || inputs[i]->sink->pointsWritten() < inputs[i]->windows;
+            if (!pending)
+                break;
+        }
+    }
+    double elapsed = (finished > 0.0 ? finished : captureClock()) - t0;
+
+    // receive threads first, so the writers get everything that came
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        atomicStore(&inputs[i]->stopReceive, 1);
+        atomicStore(&inputs[i]->stopCommand, 1);
+    }
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        joinThread(inputs[i]->receiveThread);
+        joinThread(inputs[i]->commandThread);
+        inputs[i]->sock.close();
+        atomicStore(&inputs[i]->stopWriter, 1);
+        joinThread(inputs[i]->writerThread);
+    }
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        // points whose data never came
+        inputs[i]->sink->expire(captureClock() + SWEEP_DATA_WAIT, SWEEP_DATA_WAIT);
+        inputs[i]->writer.setSink(NULL);
+    }
+    long long records = dataset.recordsWritten();
+    dataset.close();
+
+    printf("%d of %d points in %.1f s, %.1f points/min; %d commands failed; %lld records\n", scheduler.pointsDone(),
+           scheduler.pointCount(), elapsed, elapsed > 0.0 ? 60.0 * scheduler.pointsDone() / elapsed : 0.0,
+           scheduler.failureCount(), records);
+    for (size_t i=0;i<inputs.size();++i)
+    {
+        SweepInput *in = inputs[i];
+        const LiveData &live = in->decoder.live;
+        printf("  %s port %d: %lld packets, %lld lost, %lld not saved (queue full)%s\n", in->address.c_str(), in->port,
+               live.packets, live.dropped, live.unsaved, in->failed ? ", receive failed" : "");
+        in->vxi.destroy_link();
+        delete in;
+    }
+    return 0;
+}
+//---------------------------------------------------------------------------
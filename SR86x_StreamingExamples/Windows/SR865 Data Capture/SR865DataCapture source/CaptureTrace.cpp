@@ -0,0 +1,271 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "CaptureTrace.h"
+#include <string.h>
+#include <iomanip>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// per-stage latency tracing
+//
+// Filing a packet costs a few stamps, five histogram increments and one ring slot,
+// a small fraction of a microsecond against 50 us between packets at the highest stream rate.
+// The tick rate is measured against captureClock() over the whole run,
+// so it gets more accurate the longer capture runs.
+
+static const char *intervalNames[TRACE_INTERVALS] =
+{
+    "byteswap",                     // recv -> swapped
+    "process",                      // swapped -> queued
+    "queue",                        // queued -> dequeued
+    "write",                        // dequeued -> written
+    "total"                         // recv -> written
+};
+
+//---------------------------------------------------------------------------
+// TraceHistogram
+
+TraceHistogram::TraceHistogram()
+{
+    clear();
+}
+void TraceHistogram::clear()
+{
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    maxValue = 0;
+}
+
+int TraceHistogram::bucketOf(traceTick v)
+{
+    // position of highest set bit
+    int msb = 0;
+    traceTick w = v;
+    if (w >> 32) { w >>= 32; msb += 32; }
+    if (w >> 16) { w >>= 16; msb += 16; }
+    if (w >> 8) { w >>= 8; msb += 8; }
+    if (w >> 4) { w >>= 4; msb += 4; }
+    if (w >> 2) { w >>= 2; msb += 2; }
+    if (w >> 1) { msb += 1; }
+
+    // values below 64 are exact; above, keep the top 6 bits
+    int shift = msb - TRACE_SUB_BITS;
+    if (shift < 0)
+        shift = 0;
+    return (shift << TRACE_SUB_BITS) + (int)(v >> shift);
+}
+traceTick TraceHistogram::lowestOf(int b)
+{
+    if (b < (2 << TRACE_SUB_BITS))
+        return (traceTick)b;
+    int shift = (b >> TRACE_SUB_BITS) - 1;
+    return (traceTick)(b - (shift << TRACE_SUB_BITS)) << shift;
+}
+
+void TraceHistogram::record(traceTick v)
+{
+    ++counts[bucketOf(v)];
+    ++total;
+    if (v > maxValue)
+        maxValue = v;
+}
+void TraceHistogram::add(const TraceHistogram &h)
+{
+    for (int b=0;b<TRACE_BUCKETS;++b)
+        counts[b] += h.counts[b];
+    total += h.total;
+    if (h.maxValue > maxValue)
+        maxValue = h.maxValue;
+}
+
+long long TraceHistogram::count() const
+{
+    return total;
+}
+traceTick TraceHistogram::max() const
+{
+    return maxValue;
+}
+traceTick TraceHistogram::valueAt(double q) const
+{
+    if (total == 0)
+        return 0;
+    long long want = (long long)(q * total + 0.5);
+    if (want < 1)
+        want = 1;
+    long long sum = 0;
+    for (int b=0;b<TRACE_BUCKETS;++b)
+    {
+        sum += counts[b];
+        if (sum >= want)
+        {
+            // upper edge of bucket, but never above the largest value seen
+            traceTick top = (b+1 < TRACE_BUCKETS) ? lowestOf(b+1) - 1 : maxValue;
+            return (top < maxValue) ? top : maxValue;
+        }
+    }
+    return maxValue;
+}
+
+//---------------------------------------------------------------------------
+// TraceLog
+//
+// The owner writes slot (count & mask), then advances count.
+// A reader copies the whole ring between two reads of count,
+// and keeps only the slots the owner can't have touched meanwhile.
+
+TraceLog::TraceLog(int nrecords)
+{
+    size = 16;
+    while (size < nrecords)
+        size <<= 1;
+    mask = size - 1;
+    ring = new TraceRecord[size];
+    memset(ring, 0, size * sizeof(TraceRecord));
+    count = 0;
+}
+TraceLog::~TraceLog()
+{
+    delete [] ring;
+}
+
+void TraceLog::record(const traceTick *stamp, int nstamps, unsigned int header)
+{
+    // histograms of time between stages
+    for (int i=0;i+1<nstamps;++i)
+        hist[i].record(stamp[i+1] - stamp[i]);
+    if (nstamps == TRACE_STAGES)
+        hist[TRACE_INTERVALS-1].record(stamp[TRACE_STAGES-1] - stamp[0]);
+
+    long c = count;                 // we own count
+    TraceRecord *r = &ring[c & mask];
+    memcpy(r->stamp, stamp, nstamps * sizeof(traceTick));
+    r->header = header;
+    r->nstamps = nstamps;
+    atomicStore(&count, c + 1);
+    atomicFence();                  // next slot write stays after the count
+}
+
+int TraceLog::copy(TraceRecord *out)
+{
+    // counts are free-running (unsigned differences)
+    unsigned long c1 = (unsigned long)atomicLoad(&count);
+    long n = (c1 < (unsigned long)size) ? (long)c1 : size;
+    unsigned long first = c1 - n;
+    for (long i=0;i<n;++i)
+        out[i] = ring[(first + i) & mask];
+    atomicFence();
+    unsigned long c2 = (unsigned long)atomicLoad(&count);
+
+    // slots up to index (c2 - size) may have been overwritten while we copied
+    long skip = (long)(c2 - size + 1 - first);
+    if (skip <= 0)
+        return (int)n;
+    if (skip >= n)
+        return 0;
+    memmove(out, out + skip, (n - skip) * sizeof(TraceRecord));
+    return (int)(n - skip);
+}
+
+int TraceLog::capacity() const
+{
+    return (int)size;
+}
+
+//---------------------------------------------------------------------------
+// CaptureTrace
+
+CaptureTrace::CaptureTrace(int nrecords)
+{
+    for (int t=0;t<TRACE_THREADS;++t)
+        logs[t] = new TraceLog(nrecords);
+    baseClock = captureClock();
+    baseTicks = traceTicks();
+}
+CaptureTrace::~CaptureTrace()
+{
+    for (int t=0;t<TRACE_THREADS;++t)
+        delete logs[t];
+}
+
+const char *CaptureTrace::intervalName(int i)
+{
+    return intervalNames[i];
+}
+
+double CaptureTrace::ticksPerSecond()
+{
+    // wait a little if we were only just created
+    double now = captureClock();
+    while (now - baseClock < 0.02)
+    {
+        captureSleep(5);
+        now = captureClock();
+    }
+    traceTick t = traceTicks();
+    return (double)(t - baseTicks) / (now - baseClock);
+}
+double CaptureTrace::clockOf(traceTick t)
+{
+    return baseClock + (double)(long long)(t - baseTicks) / ticksPerSecond();
+}
+
+void CaptureTrace::report(std::ostream &out)
+{
+    // histograms may be a packet behind; good enough for percentiles
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    double usPerTick = 1.0e6 / ticksPerSecond();
+
+    out << "stage        packets      p50 us      p90 us      p99 us    p99.9 us      max us" << "\n";
+    out << std::fixed << std::setprecision(2);
+    for (int i=0;i<TRACE_INTERVALS;++i)
+    {
+        TraceHistogram h;
+        for (int t=0;t<TRACE_THREADS;++t)
+            h.add(logs[t]->hist[i]);
+        out << std::left << std::setw(9) << intervalNames[i] << std::right << std::setw(11) << h.count();
+        for (int q=0;q<4;++q)
+            out << std::setw(12) << h.valueAt(quantiles[q]) * usPerTick;
+        out << std::setw(12) << h.max() * usPerTick << "\n";
+    }
+}
+
+void CaptureTrace::exportChrome(std::ostream &out, double from, double to)
+{
+    // trace event format: one complete ("X") event per stage, times in microseconds
+    double tps = ticksPerSecond();
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"receive\"}},\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"writer\"}}";
+    out << std::fixed << std::setprecision(3);
+
+    TraceRecord *recs = new TraceRecord[logs[0]->capacity()];
+    for (int t=0;t<TRACE_THREADS;++t)
+    {
+        int n = logs[t]->copy(recs);
+        for (int k=0;k<n;++k)
+        {
+            const TraceRecord &r = recs[k];
+            double start = baseClock + (double)(long long)(r.stamp[0] - baseTicks) / tps;
+            if (start < from || start > to)
+                continue;
+            for (int i=0;i+1<r.nstamps;++i)
+            {
+                double ts = baseClock + (double)(long long)(r.stamp[i] - baseTicks) / tps;
+                double dur = (double)(r.stamp[i+1] - r.stamp[i]) / tps;
+                out << ",\n{\"name\":\"" << intervalNames[i] << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                    << ((i < TRACE_QUEUED) ? 1 : 2)
+                    << ",\"ts\":" << ts * 1.0e6 << ",\"dur\":" << dur * 1.0e6
+                    << ",\"args\":{\"counter\":" << (r.header & 0xff) << ",\"content\":" << ((r.header >> 8) & 0xf)
+                    << (r.nstamps < TRACE_STAGES ? ",\"saved\":false" : "") << "}}";
+            }
+        }
+    }
+    delete [] recs;
+    out << "\n]}\n";
+}
@@ -0,0 +1,179 @@
+//---------------------------------------------------------------------------
+
+#ifndef CaptureTraceH
+#define CaptureTraceH
+
+#include <ostream>
+#include "CaptureSync.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <x86intrin.h>
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#endif
+
+//---------------------------------------------------------------------------
+
+// per-stage latency tracing, from packet arrival to disk
+//
+// Each packet carries a cpu timestamp for every stage it passes.
+// When a thread is finished with a packet it files the stamps in its own ring
+// (the last few seconds of packets, for trace export) and its own histograms.
+// Nothing is shared between threads on the hot path, and nothing is locked.
+//
+// Tracing is built in unless CAPTURE_NO_TRACE is defined;
+// then TRACE_STAMP() is empty and CapturePacket carries no stamps.
+
+#ifndef CAPTURE_NO_TRACE
+#define CAPTURE_TRACE
+#endif
+
+typedef unsigned long long traceTick;
+
+// cpu time stamp counter (or the nearest thing the platform has)
+inline traceTick traceTicks()
+{
+#if defined(__BORLANDC__) && !defined(_WIN64)
+    unsigned int lo, hi;
+    __emit__(0x0F, 0x31);           // rdtsc
+    lo = _EAX;
+    hi = _EDX;
+    return ((traceTick)hi << 32) | lo;
+#elif defined(_MSC_VER) || (defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)))
+    return __rdtsc();
+#elif defined(__APPLE__)
+    return mach_absolute_time();
+#elif defined(_WIN32)
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (traceTick)now.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (traceTick)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// stages, in the order a saved packet passes them
+enum TraceStage
+{
+    TRACE_RECV,                     // recvfrom() returned (receive thread)
+    TRACE_SWAPPED,                  // converted to host byte order
+    TRACE_QUEUED,                   // header checked, handed to writer
+    TRACE_DEQUEUED,                 // taken from queue (writer thread)
+    TRACE_WRITTEN,                  // formatted & written by the sink
+    TRACE_STAGES
+};
+#define TRACE_INTERVALS TRACE_STAGES    // time between each pair of stages, plus total
+
+// threads that file stamps
+enum TraceThread
+{
+    TRACE_RECEIVER,                 // packets that could not be queued (queue full)
+    TRACE_WRITER,                   // saved packets
+    TRACE_THREADS
+};
+
+#ifdef CAPTURE_TRACE
+#define TRACE_STAMP(pkt, stage)     ((pkt)->stamp[stage] = traceTicks())
+#else
+#define TRACE_STAMP(pkt, stage)
+#endif
+
+//---------------------------------------------------------------------------
+
+// one packet's way through the stages
+struct TraceRecord
+{
+    traceTick stamp[TRACE_STAGES];
+    unsigned int header;            // packet header (counter, content, rate)
+    int nstamps;                    // stamps [0, nstamps) are valid
+};
+
+// log-linear histogram (HDR style) of tick counts
+// 32 sub-buckets per power of 2, so any value is known to within 3%.
+#define TRACE_SUB_BITS  5
+#define TRACE_BUCKETS   ((64 - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS)
+
+class TraceHistogram
+{
+protected:
+    long long counts[TRACE_BUCKETS];
+    long long total;
+    traceTick maxValue;
+
+public:
+    TraceHistogram();
+
+    void record(traceTick v);       // owner thread only
+    void add(const TraceHistogram &h);
+    void clear();
+
+    long long count() const;
+    traceTick max() const;
+    traceTick valueAt(double q) const;  // q-quantile (0..1), upper edge of its bucket
+
+    static int bucketOf(traceTick v);
+    static traceTick lowestOf(int b);
+};
+
+// ring & histograms filled by one thread
+class TraceLog
+{
+protected:
+    TraceRecord *ring;
+    long size;                      // power of 2
+    long mask;
+    volatile long count;            // records filed (written by owner only)
+
+public:
+    TraceHistogram hist[TRACE_INTERVALS];
+
+    TraceLog(int nrecords);
+    ~TraceLog();
+
+    void record(const traceTick *stamp, int nstamps, unsigned int header);     // owner thread only
+    int copy(TraceRecord *out);     // any thread; consistent copy of ring, oldest first; returns number of records
+
+    int capacity() const;
+
+private:
+    TraceLog(const TraceLog &);
+    TraceLog &operator=(const TraceLog &);
+};
+
+// tracing for one capture stream
+class CaptureTrace
+{
+protected:
+    TraceLog *logs[TRACE_THREADS];
+    traceTick baseTicks;            // tick count at baseClock; for converting ticks to seconds
+    double baseClock;
+
+public:
+    CaptureTrace(int nrecords=65536);   // ring size per thread; 65536 packets is 3 s at the highest rate
+    ~CaptureTrace();
+
+    void record(int thread, const traceTick *stamp, int nstamps, unsigned int header)
+    {
+        logs[thread]->record(stamp, nstamps, header);
+    }
+
+    double ticksPerSecond();
+    double clockOf(traceTick t);    // tick count as captureClock() seconds
+
+    // stage latency percentiles, as text
+    void report(std::ostream &out);
+    // packets between captureClock() times from and to, as a Chrome / Perfetto trace (json)
+    void exportChrome(std::ostream &out, double from, double to);
+
+    static const char *intervalName(int i);
+
+private:
+    CaptureTrace(const CaptureTrace &);
+    CaptureTrace &operator=(const CaptureTrace &);
+};
+
+//---------------------------------------------------------------------------
+#endif
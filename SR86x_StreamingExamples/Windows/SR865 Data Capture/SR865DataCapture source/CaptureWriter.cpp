@@ -0,0 +1,224 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "CaptureWriter.h"
+#include <string.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+const double latencyBounds[LATENCY_BUCKETS-1] =
+{
+    1.0e-4, 3.0e-4, 1.0e-3, 3.0e-3, 1.0e-2, 3.0e-2, 0.1, 0.3, 1.0, 3.0
+};
+
+// packets are always removed from the queue, even when no file is open,
+// so the receive thread never sees a full queue just because saving is paused.
+
+CaptureWriter::CaptureWriter(PacketQueue *q)
+{
+    queue = q;
+    sink = NULL;
+    memset(&stats, 0, sizeof(stats));
+    oldSyncs = 0;
+    oldSyncTime = 0.0;
+    trace = NULL;
+    nextDue = 0;
+    statsPublishTime = 0.0;
+    statsReset = 0;
+    statsLog = NULL;
+    statsPeriod = 60.0;
+    statsLogTime = 0.0;
+    statsLogged.what = -1;
+}
+CaptureWriter::~CaptureWriter()
+{
+    setSink(NULL);
+    setStatsLog(SinkPath(), 0.0);
+}
+
+void CaptureWriter::setSink(CaptureSink *s)
+{
+    long long syncs = 0;
+    double syncTime = 0.0;
+    sinkLock.acquire();
+    CaptureSink *old = sink;
+    sink = s;
+    if (old)
+    {
+        // keep sync totals from going backwards
+        syncs = old->syncCount();
+        syncTime = old->syncTime();
+        oldSyncs += syncs;
+        oldSyncTime += syncTime;
+    }
+    sinkLock.release();
+
+    // close old file outside the lock
+    if (old)
+    {
+        old->close();               // may sync once more
+        sinkLock.acquire();
+        oldSyncs += old->syncCount() - syncs;
+        oldSyncTime += old->syncTime() - syncTime;
+        sinkLock.release();
+        delete old;
+    }
+}
+void CaptureWriter::setTrace(CaptureTrace *t)
+{
+    trace = t;
+}
+void CaptureWriter::note(const std::string &text)
+{
+    CaptureNote n;
+    n.time = captureClock();
+    n.text = text;
+    noteLock.acquire();
+    notes.push_back(n);
+    noteLock.release();
+}
+void CaptureWriter::writeNote(const CaptureNote &n)
+{
+    if (sink)
+        sink->note(n.text);
+}
+bool CaptureWriter::sinkIsOpen()
+{
+    sinkLock.acquire();
+    bool open = (sink != NULL && sink->isOpen());
+    sinkLock.release();
+    return open;
+}
+
+int CaptureWriter::drain(int maxPackets)
+{
+    int n = 0;
+    CapturePacket *pkt = NULL;
+
+    int depth = queue->depth();
+    if (depth > stats.maxDepth)
+        stats.maxDepth = depth;
+
+    // notes go in among the packets by arrival time
+    noteLock.acquire();
+    if (!notes.empty())
+    {
+        due.insert(due.end(), notes.begin(), notes.end());
+        notes.clear();
+    }
+    noteLock.release();
+
+    sinkLock.acquire();
+    if (atomicLoad(&statsReset))
+    {
+        atomicStore(&statsReset, 0);
+        streamStats.reset();
+        statsPublishTime = 0.0;
+    }
+    while (n < maxPackets && (pkt = queue->front()) != NULL)
+    {
+        while (nextDue < due.size() && due[nextDue].time <= pkt->rxTime)
+            writeNote(due[nextDue++]);
+        TRACE_STAMP(pkt, TRACE_DEQUEUED);
+        streamStats.add(*pkt);
+        if (sink)
+            sink->write(*pkt);
+        TRACE_STAMP(pkt, TRACE_WRITTEN);
+#ifdef CAPTURE_TRACE
+        if (trace)
+            trace->record(TRACE_WRITER, pkt->stamp, TRACE_STAGES, pkt->buffer[0]);
+#endif
+
+        // arrival to written
+        double lat = captureClock() - pkt->rxTime;
+        int b = 0;
+        while (b < LATENCY_BUCKETS-1 && lat > latencyBounds[b])
+            ++b;
+        ++stats.latency[b];
+        stats.latencySum += lat;
+        if (lat > stats.latencyMax)
+            stats.latencyMax = lat;
+        stats.bytes += pkt->nwords << 2;
+        ++stats.packets;
+
+        queue->release();
+        ++n;
+    }
+    if (!pkt)
+    {
+        // queue is empty; nothing else arrived before them
+        while (nextDue < due.size())
+            writeNote(due[nextDue++]);
+    }
+    if (n == 0 && sink)
+        sink->idle(captureClock());
+    long long syncs = stats.syncs;
+    if (nextDue == due.size())
+    {
+        due.clear();
+        nextDue = 0;
+    }
+    stats.syncs = oldSyncs + (sink ? sink->syncCount() : 0);
+    stats.syncTime = oldSyncTime + (sink ? sink->syncTime() : 0.0);
+    logStats(false);
+    sinkLock.release();
+
+    if (n > 0 || stats.syncs != syncs)
+        published.publish(stats);
+
+    // statistics a few times a second; publishing copies a few kB
+    double now = captureClock();
+    if ((n > 0 && now - statsPublishTime >= 0.1) || statsPublishTime == 0.0)
+    {
+        statsPublished.publish(streamStats.current());
+        statsPublishTime = now;
+    }
+    return n;
+}
+void CaptureWriter::getStats(WriterStats &s)
+{
+    published.read(s);
+}
+
+void CaptureWriter::getStreamStats(StreamStats &s)
+{
+    statsPublished.read(s);
+}
+void CaptureWriter::resetStreamStats()
+{
+    atomicStore(&statsReset, 1);
+}
+bool CaptureWriter::setStatsLog(const SinkPath &fname, double period)
+{
+    FILE *f = fname.empty() ? NULL : sinkOpen(fname, "a");
+    sinkLock.acquire();
+    logStats(true);                 // last line of the old log
+    if (statsLog)
+        fclose(statsLog);
+    statsLog = f;
+    statsPeriod = period;
+    statsLogTime = captureClock();
+    statsLogged.what = -1;
+    sinkLock.release();
+    return (f != NULL || fname.empty());
+}
+
+// writer thread, or under sinkLock
+void CaptureWriter::logStats(bool force)
+{
+    if (!statsLog)
+        return;
+    double now = captureClock();
+    if (!force && (statsPeriod <= 0.0 || now - statsLogTime < statsPeriod))
+        return;
+    statsLogTime = now;
+    const StreamStats &s = streamStats.current();
+    bool header = (s.what != statsLogged.what || s.rate != statsLogged.rate || s.scale != statsLogged.scale);
+    streamStats.writeLog(statsLog, header);
+    if (s.what >= 0)
+        statsLogged = s;
+}
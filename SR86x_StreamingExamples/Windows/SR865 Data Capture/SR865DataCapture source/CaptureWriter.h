@@ -0,0 +1,93 @@
+//---------------------------------------------------------------------------
+
+#ifndef CaptureWriterH
+#define CaptureWriterH
+
+#include "CaptureSync.h"
+#include "PacketQueue.h"
+#include "CaptureSink.h"
+#include "LiveSnapshot.h"
+#include "StreamStats.h"
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------------
+
+#define LATENCY_BUCKETS 11
+
+// upper bounds (seconds) of writer latency buckets; the last bucket has no bound
+extern const double latencyBounds[LATENCY_BUCKETS-1];
+
+// writer thread counters; totals since program start
+struct WriterStats
+{
+    long long packets;              // packets taken from the queue
+    long long bytes;                // bytes of those packets
+    long long latency[LATENCY_BUCKETS];     // packets by time from arrival until written to sink
+    double latencySum;
+    double latencyMax;
+    int maxDepth;                   // deepest queue seen by writer
+    long long syncs;                // forced writes to disk (journaled files)
+    double syncTime;                // seconds spent in them
+};
+
+// line of text for the capture file, placed before the first packet that arrived after it
+struct CaptureNote
+{
+    double time;                    // captureClock() when noted
+    std::string text;
+};
+
+// consumer side of the packet queue
+// moves packets from the queue into the current sink.
+// Runs on the writer thread, so slow disk writes or opening a new file
+// never hold up the receive thread; the queue absorbs the delay.
+class CaptureWriter
+{
+protected:
+    PacketQueue *queue;
+    CaptureSink *sink;              // owned; NULL if not saving
+    CaptureLock sinkLock;           // protects sink (user interface swaps it)
+    WriterStats stats;              // writer thread's working copy
+    SeqSnapshot<WriterStats> published;
+    long long oldSyncs;             // syncs of sinks already closed
+    double oldSyncTime;
+    CaptureTrace *trace;            // not owned; NULL if not tracing
+    std::vector<CaptureNote> notes; // from note(); protected by noteLock
+    CaptureLock noteLock;
+    std::vector<CaptureNote> due;   // writer thread's; waiting for their place among the packets
+    size_t nextDue;
+    StatsAccumulator streamStats;   // of every packet, saved or not
+    StatsSnapshot statsPublished;
+    double statsPublishTime;
+    volatile long statsReset;
+    FILE *statsLog;                 // protected by sinkLock; NULL if not logging
+    double statsPeriod;
+    double statsLogTime;            // last line written
+    StreamStats statsLogged;        // stream of the last header
+
+    void writeNote(const CaptureNote &n);
+    void logStats(bool force);
+
+public:
+    CaptureWriter(PacketQueue *q);
+    ~CaptureWriter();
+
+    void setSink(CaptureSink *s);   // takes ownership of s, closes & deletes previous sink
+    bool sinkIsOpen();
+    void setTrace(CaptureTrace *t); // before the writer thread starts
+    void note(const std::string &text);     // any thread; logged in the capture file, if one is open
+
+    int drain(int maxPackets=256);  // write queued packets; returns number of packets taken from queue
+    void getStats(WriterStats &s);  // any thread
+
+    // running statistics of the stream (StreamStats.h); any thread
+    void getStreamStats(StreamStats &s);
+    void resetStreamStats();        // start again with the next packet
+    // append the statistics to a comma separated file every period seconds (and when it is closed);
+    // an empty name stops logging
+    bool setStatsLog(const SinkPath &fname, double period);
+};
+
+//---------------------------------------------------------------------------
+#endif
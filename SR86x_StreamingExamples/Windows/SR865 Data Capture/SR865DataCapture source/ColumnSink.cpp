@@ -0,0 +1,339 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "ColumnSink.h"
+#include "Deinterleave.h"
+#include "CaptureSync.h"
+#include "SampleScale.h"
+#include <string.h>
+#include <time.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// column capture files
+// The writer thread splits every packet into channels (Deinterleave.cpp)
+// and appends each channel to its own file; the index records where each packet went.
+
+static const char indexId[9] = "SR86xCI1";
+static const char *channelName[COLUMN_CHANNELS] = { "X", "Y", "R", "Th" };
+
+int columnsOf(int what, int *cols)
+{
+    switch (what & 3)
+    {
+        default:
+            cols[0] = 0;
+            return 1;
+        case 1:
+            cols[0] = 0; cols[1] = 1;
+            return 2;
+        case 2:
+            cols[0] = 2; cols[1] = 3;
+            return 2;
+        case 3:
+            cols[0] = 0; cols[1] = 1; cols[2] = 2; cols[3] = 3;
+            return 4;
+    }
+}
+
+// "run.idx" -> "run.X.col", ...; "run.idx.part" -> "run.X.col.part", ...
+static bool columnNames(const SinkPath &fname, SinkPath *names)
+{
+    SinkPath stem = fname;
+    SinkPath part = sinkPath(".part");
+    bool partial = (stem.length() > part.length() && stem.compare(stem.length() - part.length(), part.length(), part) == 0);
+    if (partial)
+        stem = stem.substr(0, stem.length() - part.length());
+
+    SinkPath::size_type dot = stem.find_last_of('.');
+    SinkPath::size_type sep = stem.find_last_of(sinkPath("/\\"));
+    if (dot != SinkPath::npos && (sep == SinkPath::npos || dot > sep))
+        stem = stem.substr(0, dot);
+
+    for (int c=0;c<COLUMN_CHANNELS;++c)
+    {
+        names[c] = stem + sinkPath(".") + sinkPath(channelName[c]) + sinkPath(".col");
+        if (partial)
+            names[c] += part;
+    }
+    return partial;
+}
+
+//---------------------------------------------------------------------------
+// ColumnSink
+
+ColumnSink::ColumnSink()
+{
+    index = NULL;
+    for (int c=0;c<COLUMN_CHANNELS;++c)
+    {
+        column[c] = NULL;
+        colBytes[c] = 0;
+    }
+    partial = false;
+    packets = 0;
+    bytes = 0;
+}
+/*virtual*/ ColumnSink::~ColumnSink()
+{
+    close();
+}
+
+/*virtual*/ bool ColumnSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    partial = columnNames(fname, colName);
+    const char *mode = trunc ? "wb" : "ab";
+
+    index = sinkOpen(fname, mode);
+    if (!index)
+        return false;
+    fseek(index, 0, SEEK_END);
+    if (sinkTell(index) == 0)
+    {
+        ColumnIndexHead head;
+        memcpy(head.id, indexId, 8);
+        head.wallTime = (double)time(0);
+        head.clockTime = captureClock();
+        fwrite(&head, sizeof(head), 1, index);
+    }
+
+    for (int c=0;c<COLUMN_CHANNELS;++c)
+    {
+        column[c] = sinkOpen(colName[c], mode);
+        if (!column[c])
+        {
+            close();
+            return false;
+        }
+        fseek(column[c], 0, SEEK_END);
+        colBytes[c] = sinkTell(column[c]);
+    }
+    packets = 0;
+    bytes = 0;
+    notes.setCapture(fname);
+    return true;
+}
+/*virtual*/ bool ColumnSink::isOpen() const
+{
+    return (index != NULL);
+}
+/*virtual*/ void ColumnSink::close()
+{
+    if (index)
+    {
+        fclose(index);
+        index = NULL;
+    }
+    for (int c=0;c<COLUMN_CHANNELS;++c)
+    {
+        if (column[c])
+        {
+            fclose(column[c]);
+            column[c] = NULL;
+            if (partial)
+            {
+                SinkPath done = colName[c].substr(0, colName[c].length() - 5);    // drop ".part"
+                sinkRename(colName[c], done);
+            }
+        }
+    }
+    notes.close();
+}
+/*virtual*/ void ColumnSink::note(const std::string &text)
+{
+    if (index)
+        notes.write(text);
+}
+
+/*virtual*/ void ColumnSink::write(const CapturePacket &pkt)
+{
+    if (!index || pkt.nwords < 2)
+        return;
+
+    PacketHeader hdr(pkt.buffer[0]);
+    int cols[COLUMN_CHANNELS];
+    int nch = columnsOf(hdr.what, cols);
+    int elem = hdr.isInt() ? 2 : 4;
+    int frames = ((pkt.nwords - 1) << 2) / (nch * elem);
+
+    ColumnIndexEntry e;
+    e.header = pkt.buffer[0];
+    e.frames = frames;
+    e.dropped = pkt.dropped;
+    e.scale = pkt.scale;
+    e.rxTime = pkt.rxTime;
+    for (int c=0;c<COLUMN_CHANNELS;++c)
+        e.offset[c] = -1;
+
+    // split packet into channels
+    const void *src[COLUMN_CHANNELS];
+    if (hdr.isInt())
+    {
+        short *dst[COLUMN_CHANNELS];
+        for (int k=0;k<nch;++k)
+            src[k] = dst[k] = sbuf[k];
+        deinterleaveShort((const short *)(pkt.buffer + 1), frames, nch, dst);
+    }
+    else
+    {
+        float *dst[COLUMN_CHANNELS];
+        for (int k=0;k<nch;++k)
+            src[k] = dst[k] = fbuf[k];
+        deinterleaveFloat((const float *)(pkt.buffer + 1), frames, nch, dst);
+    }
+
+    for (int k=0;k<nch;++k)
+    {
+        int c = cols[k];
+        e.offset[c] = colBytes[c];
+        fwrite(src[k], elem, frames, column[c]);
+        colBytes[c] += frames * elem;
+    }
+    fwrite(&e, sizeof(e), 1, index);
+
+    bytes += nch * frames * elem + sizeof(e);
+    ++packets;
+}
+
+/*virtual*/ long long ColumnSink::bytesWritten()
+{
+    return bytes;
+}
+/*virtual*/ long long ColumnSink::packetsWritten() const
+{
+    return packets;
+}
+
+//---------------------------------------------------------------------------
+// ColumnReader
+
+ColumnReader::ColumnReader()
+{
+    index = NULL;
+    for (int c=0;c<COLUMN_CHANNELS;++c)
+        column[c] = NULL;
+    nentries = 0;
+    memset(&head, 0, sizeof(head));
+}
+ColumnReader::~ColumnReader()
+{
+    close();
+}
+
+bool ColumnReader::open(const SinkPath &idxName)
+{
+    close();
+    index = sinkOpen(idxName, "rb");
+    if (!index)
+        return false;
+    if (fread(&head, sizeof(head), 1, index) != 1 || memcmp(head.id, indexId, 8) != 0)
+    {
+        close();
+        return false;
+    }
+    fseek(index, 0, SEEK_END);
+    nentries = (sinkTell(index) - (long long)sizeof(head)) / (long long)sizeof(ColumnIndexEntry);
+
+    // missing column files just read as empty
+    columnNames(idxName, colName);
+    for (int c=0;c<COLUMN_CHANNELS;++c)
+        column[c] = sinkOpen(colName[c], "rb");
+    return true;
+}
+void ColumnReader::close()
+{
+    if (index)
+    {
+        fclose(index);
+        index = NULL;
+    }
+    for (int c=0;c<COLUMN_CHANNELS;++c)
+    {
+        if (column[c])
+        {
+            fclose(column[c]);
+            column[c] = NULL;
+        }
+    }
+    nentries = 0;
+}
+
+long long ColumnReader::entries() const
+{
+    return nentries;
+}
+const ColumnIndexHead &ColumnReader::info() const
+{
+    return head;
+}
+bool ColumnReader::entry(long long i, ColumnIndexEntry &e)
+{
+    if (!index || i < 0 || i >= nentries)
+        return false;
+    if (!sinkSeek(index, sizeof(head) + i * sizeof(ColumnIndexEntry)))
+        return false;
+    return (fread(&e, sizeof(e), 1, index) == 1);
+}
+long long ColumnReader::findTime(double t)
+{
+    // entries are in arrival order
+    long long lo = 0, hi = nentries;
+    ColumnIndexEntry e;
+    while (lo < hi)
+    {
+        long long mid = lo + (hi - lo)/2;
+        if (!entry(mid, e))
+            break;
+        if (e.rxTime < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+long long ColumnReader::readChannel(int c, long long first, long long count, float *out, long long maxSamples)
+{
+    if (c < 0 || c >= COLUMN_CHANNELS || !column[c])
+        return 0;
+
+    long long n = 0;
+    long long pos = -1;             // current position in column file
+    short sbuf[512];
+    ColumnIndexEntry e;
+    for (long long i=first;i<first+count && i<nentries;++i)
+    {
+        if (!entry(i, e))
+            break;
+        if (e.offset[c] < 0)
+            continue;               // channel not in this packet
+        PacketHeader hdr(e.header);
+        int frames = e.frames;
+        if (frames > 512 || n + frames > maxSamples)
+            break;
+
+        if (pos != e.offset[c] && !sinkSeek(column[c], e.offset[c]))
+            break;
+        if (hdr.isInt())
+        {
+            if (fread(sbuf, 2, frames, column[c]) != (size_t)frames)
+                break;
+            float k = countScale(e.scale, c == 3);
+            int16ToFloat(sbuf, frames, 1, &k, out + n);
+            pos = e.offset[c] + 2*frames;
+        }
+        else
+        {
+            if (fread(out + n, 4, frames, column[c]) != (size_t)frames)
+                break;
+            pos = e.offset[c] + 4*frames;
+        }
+        n += frames;
+    }
+    return n;
+}
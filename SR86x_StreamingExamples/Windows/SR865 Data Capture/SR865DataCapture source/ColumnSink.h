@@ -0,0 +1,101 @@
+//---------------------------------------------------------------------------
+
+#ifndef ColumnSinkH
+#define ColumnSinkH
+
+#include <stdio.h>
+#include "CaptureSink.h"
+
+//---------------------------------------------------------------------------
+
+// column (one file per channel) capture
+//
+// Saving to "run.idx" writes
+//   run.X.col, run.Y.col, run.R.col, run.Th.col   samples of one channel, as received (float or 16bit int)
+//   run.idx                                       index: one fixed size entry per packet
+// Reading one channel over a time range only touches that channel's file,
+// plus a binary search of the index.
+// If the index name ends in ".part" (segmented capture), the column files get ".part" too,
+// and lose it again when the segment is closed.
+//
+// run.idx starts with a ColumnIndexHead, followed by ColumnIndexEntry records (host byte order)
+
+#define COLUMN_CHANNELS 4           // X, Y, R, theta
+
+struct ColumnIndexHead
+{
+    char id[8];                     // "SR86xCI1"
+    double wallTime;                // time() when file was created
+    double clockTime;               // captureClock() when file was created
+};
+
+struct ColumnIndexEntry
+{
+    unsigned int header;            // packet header (content, rate, counter, status)
+    int frames;                     // samples per channel in this packet
+    int dropped;                    // packets missed just before this one
+    int scale;                      // scale code of integer samples (SampleScale.h)
+    double rxTime;                  // packet arrival time (captureClock() seconds)
+    long long offset[COLUMN_CHANNELS];  // byte offset of this packet's samples in each column file; -1 if channel not in packet
+};
+
+class ColumnSink : public CaptureSink
+{
+protected:
+    FILE *index;
+    FILE *column[COLUMN_CHANNELS];
+    long long colBytes[COLUMN_CHANNELS];
+    SinkPath colName[COLUMN_CHANNELS];
+    bool partial;                   // column files carry ".part" until closed
+    long long packets;
+    long long bytes;
+    float fbuf[COLUMN_CHANNELS][256];
+    short sbuf[COLUMN_CHANNELS][512];
+    SinkNotes notes;                // "run.idx.log"
+
+public:
+    ColumnSink();
+    virtual ~ColumnSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+};
+
+// which column files hold the channels of content code "what"
+int columnsOf(int what, int *cols);
+
+// read back column captures
+class ColumnReader
+{
+protected:
+    FILE *index;
+    FILE *column[COLUMN_CHANNELS];
+    SinkPath colName[COLUMN_CHANNELS];
+    long long nentries;
+    ColumnIndexHead head;
+
+public:
+    ColumnReader();
+    ~ColumnReader();
+
+    bool open(const SinkPath &idxName);
+    void close();
+
+    long long entries() const;
+    const ColumnIndexHead &info() const;
+    bool entry(long long i, ColumnIndexEntry &e);
+    long long findTime(double t);   // first entry that arrived at or after t (entries() if none)
+
+    // samples of one channel from count entries starting at entry first, as float
+    // (integer data in engineering units, or counts if the scale was unknown); returns number of samples, at most maxSamples
+    long long readChannel(int c, long long first, long long count, float *out, long long maxSamples);
+};
+
+//---------------------------------------------------------------------------
+#endif
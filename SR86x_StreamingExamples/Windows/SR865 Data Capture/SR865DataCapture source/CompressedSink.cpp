@@ -0,0 +1,119 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "CompressedSink.h"
+#include "DeltaCodec.h"
+#include "SampleScale.h"
+#include <string.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// delta coded capture file
+// Integer lock-in data changes little from one sample to the next,
+// so typical captures shrink 2-6x; see DeltaCodec.cpp.
+
+static const char fileId[9] = "SR86xDZ1";
+
+#define MAX_PAYLOAD (sizeof(((CapturePacket *)0)->buffer) - 4)
+
+CompressedSink::CompressedSink() : FileSink(false)
+{
+    encoded = new unsigned char[deltaMaxBytes(MAX_PAYLOAD/2, 4)];
+}
+/*virtual*/ CompressedSink::~CompressedSink()
+{
+    delete [] encoded;
+}
+
+/*virtual*/ bool CompressedSink::open(const SinkPath &fname, bool trunc)
+{
+    if (!FileSink::open(fname, trunc))
+        return false;
+    // new file starts with file id
+    fstream.seekp(0, std::ios::end);
+    if (fstream.tellp() == (std::streampos)0)
+        fstream.write(fileId, 8);
+    return true;
+}
+
+/*virtual*/ void CompressedSink::write(const CapturePacket &pkt)
+{
+    if (!fstream.is_open() || pkt.nwords < 1)
+        return;
+
+    PacketHeader hdr(pkt.buffer[0]);
+    const unsigned char *payload = (const unsigned char *)(pkt.buffer + 1);
+    int nbytes = (pkt.nwords - 1) << 2;
+    int flags = 0;
+    if (hdr.isInt() && nbytes == hdr.byteLength())
+    {
+        int n = deltaEncode((const short *)payload, nbytes >> 1, hdr.channels(), encoded);
+        if (n < nbytes)
+        {
+            payload = encoded;
+            nbytes = n;
+            flags = 1;
+        }
+    }
+
+    unsigned char rec[8];
+    memcpy(rec, &pkt.buffer[0], 4);
+    rec[4] = (unsigned char)(nbytes & 0xff);
+    rec[5] = (unsigned char)(nbytes >> 8);
+    rec[6] = (unsigned char)flags;
+    rec[7] = 0;
+    fstream.write((const char *)rec, 8);
+    fstream.write((const char *)payload, nbytes);
+    bytes += 8 + nbytes;
+    ++packets;
+}
+
+//---------------------------------------------------------------------------
+// reading
+
+bool readCompressedId(FILE *f)
+{
+    char id[8];
+    return (fread(id, 1, 8, f) == 8 && memcmp(id, fileId, 8) == 0);
+}
+
+bool readCompressedPacket(FILE *f, CapturePacket &pkt)
+{
+    unsigned char rec[8];
+    if (fread(rec, 1, 8, f) != 8)
+        return false;
+    int nbytes = rec[4] | (rec[5] << 8);
+    int flags = rec[6] | (rec[7] << 8);
+    memcpy(&pkt.buffer[0], rec, 4);
+    pkt.dropped = 0;
+    pkt.rxTime = 0.0;
+    pkt.scale = SCALE_UNKNOWN;
+
+    if (!(flags & 1))
+    {
+        // stored as received
+        if (nbytes > (int)MAX_PAYLOAD || (nbytes & 3))
+            return false;
+        if (fread(pkt.buffer + 1, 1, nbytes, f) != (size_t)nbytes)
+            return false;
+        pkt.nwords = 1 + (nbytes >> 2);
+        return true;
+    }
+
+    // delta coded; packet length comes from header
+    unsigned char enc[2*MAX_PAYLOAD + 16];
+    PacketHeader hdr(pkt.buffer[0]);
+    int n = hdr.byteLength() >> 1;
+    if (nbytes > (int)sizeof(enc) || 2*n > (int)MAX_PAYLOAD)
+        return false;
+    if (fread(enc, 1, nbytes, f) != (size_t)nbytes)
+        return false;
+    if (deltaDecode(enc, nbytes, n, hdr.channels(), (short *)(pkt.buffer + 1)) != nbytes)
+        return false;
+    pkt.nwords = 1 + (n >> 1);
+    return true;
+}
@@ -0,0 +1,38 @@
+//---------------------------------------------------------------------------
+
+#ifndef CompressedSinkH
+#define CompressedSinkH
+
+#include <stdio.h>
+#include "CaptureSink.h"
+
+//---------------------------------------------------------------------------
+
+// compressed binary capture file (.sdz)
+//
+// 8 byte file id "SR86xDZ1", then one record per UDP packet:
+//   32bit packet header (host order, as in a .dat file)
+//   16bit number of payload bytes that follow (little-endian)
+//   16bit flags (little-endian); bit 0 set = payload is delta coded (DeltaCodec.h)
+//   payload
+// Integer packets (content codes 4-7) are delta coded;
+// float packets, and integer packets that would not get smaller, are stored as received.
+// readCompressedPacket() gives back the packet exactly as it would be in a .dat file.
+class CompressedSink : public FileSink
+{
+protected:
+    unsigned char *encoded;
+
+public:
+    CompressedSink();
+    virtual ~CompressedSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual void write(const CapturePacket &pkt);
+};
+
+bool readCompressedId(FILE *f);
+bool readCompressedPacket(FILE *f, CapturePacket &pkt);
+
+//---------------------------------------------------------------------------
+#endif
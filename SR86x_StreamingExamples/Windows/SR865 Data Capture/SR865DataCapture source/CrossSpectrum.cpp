@@ -0,0 +1,504 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "CrossSpectrum.h"
+#include "PacketHeader.h"
+#include "ColumnSink.h"
+#include "SampleScale.h"
+#include "Polar.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// cross spectra of two streams
+// Runs on the writer threads, under the lock; a stream's packet waits for the other stream
+// only as long as the FFTs of the pairs it completes take.
+
+static const char crossId[9] = "SR86xCS1";
+
+#define CROSS_WAIT      0.5         // seconds a segment of A waits for B before it is left out
+#define CLOCK_MEMORY    60.0        // seconds the clock fits remember
+
+bool parseCross(const std::string &spec, CrossOptions &opt, std::string &err)
+{
+    static const char *names[5] = { "X", "Y", "R", "theta", "XY" };
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        bool ok = true;
+        if (key == "fft" || key == "averages")
+        {
+            char *end;
+            long n = strtol(val.c_str(), &end, 10);
+            ok = (end != val.c_str() && !*end);
+            if (key == "fft")
+                ok = ok && n >= 64 && n <= 65536 && isPowerOf2((int)n);
+            else
+                ok = ok && n >= 1 && n <= 1000000;
+            if (key == "fft")
+                opt.fftSize = (int)n;
+            else
+                opt.averages = (int)n;
+        }
+        else if (key == "seconds")
+        {
+            char *end;
+            double s = strtod(val.c_str(), &end);
+            ok = (end != val.c_str() && !*end && s >= 0.0);
+            opt.maxSeconds = s;
+        }
+        else if (key == "a" || key == "b")
+        {
+            ok = false;
+            for (int c=0;c<5;++c)
+            {
+                if (val == names[c])
+                {
+                    (key == "a" ? opt.channelA : opt.channelB) = c;
+                    ok = true;
+                }
+            }
+        }
+        else
+        {
+            err = "unknown cross spectrum setting \"" + item + "\"";
+            return false;
+        }
+        if (!ok)
+        {
+            err = "bad value for " + key + ": \"" + val + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+CrossSpectrum::CrossSpectrum(const CrossOptions &opt)
+    : options(opt), fft(opt.fftSize)
+{
+    n = opt.fftSize;
+    hop = n / 2;
+    twoSided = (opt.channelA == CROSS_XY || opt.channelB == CROSS_XY);
+    bins = twoSided ? n : n / 2 + 1;
+    // periodic Hann window
+    const double pi = 3.14159265358979323846;
+    window.resize(n);
+    double power = 0.0;
+    for (int i=0;i<n;++i)
+    {
+        window[i] = (float)(0.5 - 0.5 * cos(2.0 * pi * i / n));
+        power += (double)window[i] * window[i];
+    }
+    norm = 1.0 / power;
+    ar.resize(n);
+    ai.resize(n);
+    br.resize(n);
+    bi.resize(n);
+    saa.resize(bins);
+    sbb.resize(bins);
+    sabRe.resize(bins);
+    sabIm.resize(bins);
+    out.resize(5 * bins);
+    for (int k=0;k<2;++k)
+    {
+        in[k].delay = 0.0;
+        in[k].seen = 0.0;
+        in[k].header = 0;
+        in[k].scale = 0;
+        in[k].channel = k ? opt.channelB : opt.channelA;
+        in[k].rate = 0.0;
+        in[k].mask = 0;
+        in[k].runStart = in[k].next = 0;
+    }
+    segA = 0;
+    memset(&rec, 0, sizeof(rec));
+    file = NULL;
+    bytes = 0;
+    now = 0.0;
+    spectra = 0;
+}
+CrossSpectrum::~CrossSpectrum()
+{
+    close();
+}
+
+void CrossSpectrum::setDelay(int input, double seconds)
+{
+    if (input == 0 || input == 1)
+        in[input].delay = seconds;
+}
+
+bool CrossSpectrum::open(const SinkPath &fname)
+{
+    close();
+    lock.acquire();
+    file = sinkOpen(fname, "wb");
+    if (file)
+    {
+        CrossFileHead head;
+        memcpy(head.id, crossId, 8);
+        head.wallTime = (double)time(0);
+        head.clockTime = captureClock();
+        fwrite(&head, sizeof(head), 1, file);
+        bytes = sizeof(head);
+    }
+    for (int k=0;k<2;++k)
+    {
+        in[k].header = 0;
+        in[k].seen = 0.0;
+    }
+    rec.segments = 0;
+    now = 0.0;
+    spectra = 0;
+    lock.release();
+    return (file != NULL);
+}
+
+void CrossSpectrum::close()
+{
+    lock.acquire();
+    if (file)
+    {
+        flush();
+        fclose(file);
+        file = NULL;
+    }
+    lock.release();
+}
+
+bool CrossSpectrum::isOpen() const
+{
+    return (file != NULL);
+}
+
+// new run of a stream: first packet, or a change of content, rate or sensitivity
+void CrossSpectrum::begin(Input &s, const CapturePacket &pkt)
+{
+    PacketHeader hdr(pkt.buffer[0]);
+    s.header = pkt.buffer[0] & 0x00ff0f00;
+    s.scale = pkt.scale;
+    s.rate = hdr.sampleRate();
+
+    // room for CROSS_WAIT seconds behind the other stream, and a segment either side
+    long long need = (long long)((CROSS_WAIT + 0.5) * s.rate) + 2 * n;
+    int size = 1;
+    while (size < need)
+        size <<= 1;
+    if (size > s.mask + 1)
+    {
+        s.re.resize(size);
+        if (s.channel == CROSS_XY)
+            s.im.resize(size);
+        s.mask = size - 1;
+    }
+    s.runStart = s.next = pkt.sample;
+    if (&s == &in[0])
+        segA = pkt.sample;
+}
+
+// the packet's samples of the input's channel into its ring
+void CrossSpectrum::store(Input &s, const CapturePacket &pkt)
+{
+    PacketHeader hdr(pkt.buffer[0]);
+    int cols[4];
+    int nch = columnsOf(hdr.what, cols);
+    int frames = packetToFloat(pkt, values) / nch;
+    if (pkt.dropped > 0 || pkt.sample != s.next)
+        s.runStart = pkt.sample;    // segments never span lost data
+    s.next = pkt.sample + frames;
+
+    int x = -1, y = -1, ch = -1;
+    for (int k=0;k<nch;++k)
+    {
+        if (cols[k] == CROSS_X)
+            x = k;
+        if (cols[k] == CROSS_Y)
+            y = k;
+        if (cols[k] == s.channel)
+            ch = k;
+    }
+    const float *v = NULL, *w = NULL;
+    int stride = nch;
+    if (s.channel == CROSS_XY)
+    {
+        if (x >= 0 && y >= 0)
+        {
+            v = values + x;
+            w = values + y;
+        }
+    }
+    else if (ch >= 0)
+    {
+        v = values + ch;
+        if (s.channel == CROSS_THETA && hdr.isInt() && pkt.scale < 0)
+        {
+            // theta still in counts
+            for (int i=0;i<frames;++i)
+                values[i * nch + ch] *= countScale(0, true);
+        }
+    }
+    else if (s.channel >= CROSS_R && nch == 2 && x == 0 && y == 1)
+    {
+        xyToPolar(values, frames, polar);
+        v = polar + s.channel;
+        stride = 4;
+    }
+    if (!v)
+    {
+        s.runStart = s.next;        // stream doesn't have the channel
+        return;
+    }
+    long long at = pkt.sample;
+    for (int i=0;i<frames;++i, ++at)
+        s.re[(size_t)(at & s.mask)] = v[i * stride];
+    if (w)
+    {
+        at = pkt.sample;
+        for (int i=0;i<frames;++i, ++at)
+            s.im[(size_t)(at & s.mask)] = w[i * stride];
+    }
+}
+
+void CrossSpectrum::write(int input, const CapturePacket &pkt)
+{
+    if ((input != 0 && input != 1) || pkt.nwords < 2)
+        return;
+    lock.acquire();
+    if (file)
+    {
+        Input &s = in[input];
+        PacketHeader hdr(pkt.buffer[0]);
+        unsigned int h = pkt.buffer[0] & 0x00ff0f00;    // content & rate
+        if (h != s.header)
+            s.clock.reset(hdr.sampleRate(), CLOCK_MEMORY);
+        if (h != s.header || (hdr.isInt() && pkt.scale != s.scale))
+        {
+            flush();                // the spectrum so far was of the old units or rate
+            begin(s, pkt);
+        }
+        int words = pkt.nwords - 1;
+        int frames = (hdr.isInt() ? words * 2 : words) / hdr.channels();
+        s.clock.add(pkt.sample + frames - 1, pkt.rxTime);
+        s.seen = pkt.rxTime;
+        if (pkt.rxTime > now)
+            now = pkt.rxTime;
+        store(s, pkt);
+        process();
+    }
+    lock.release();
+}
+
+// pairs the segments both streams have
+void CrossSpectrum::process()
+{
+    Input &a = in[0], &b = in[1];
+    if (!a.header || !b.header || a.rate != b.rate)
+        return;
+    for (;;)
+    {
+        if (segA < a.runStart)
+            segA = a.runStart;
+        if (segA < a.next - (a.mask + 1))
+            segA = a.next - (a.mask + 1);
+        if (segA + n > a.next)
+            return;
+
+        // pair the middles of the segments: drift then shifts the ends by as much either way
+        double t = a.clock.time((double)segA) - a.delay;
+        double sb = b.clock.sample(a.clock.time(segA + 0.5 * n) - a.delay + b.delay) - 0.5 * n;
+        long long fromB = (long long)floor(sb + 0.5);
+        bool missing = (fromB < b.runStart || fromB < b.next - (b.mask + 1));
+        if (!missing && fromB + n > b.next)
+        {
+            if (now - b.seen <= CROSS_WAIT)
+                return;             // B still to come
+            missing = true;
+        }
+        if (!missing)
+        {
+            if (rec.segments == 0)
+            {
+                rec.firstSample = segA;
+                rec.firstSampleB = fromB;
+                rec.firstTime = t;
+            }
+            transform(segA, fromB, sb - fromB);
+            ++rec.segments;
+            rec.lastTime = t;
+        }
+        segA += hop;
+        if (rec.segments >= options.averages ||
+            (rec.segments > 0 && options.maxSeconds > 0.0 && segA + hop - rec.firstSample >= options.maxSeconds * a.rate))
+            flush();
+    }
+}
+
+// n samples of an input from sample index from, mean removed & windowed
+void CrossSpectrum::segment(const Input &s, long long from, float *re, float *im)
+{
+    int at = (int)(from & s.mask);
+    int first = s.mask + 1 - at;    // samples before the ring wraps
+    if (first > n)
+        first = n;
+    memcpy(re, &s.re[at], first * sizeof(float));
+    memcpy(re + first, &s.re[0], (n - first) * sizeof(float));
+    if (s.channel == CROSS_XY)
+    {
+        memcpy(im, &s.im[at], first * sizeof(float));
+        memcpy(im + first, &s.im[0], (n - first) * sizeof(float));
+    }
+    // remove the mean; a lock-in output's DC level would otherwise leak into the lowest bins
+    double mr = 0.0, mi = 0.0;
+    for (int j=0;j<n;++j)
+        mr += re[j];
+    float m = (float)(mr / n);
+    for (int j=0;j<n;++j)
+        re[j] = (re[j] - m) * window[j];
+    if (s.channel == CROSS_XY)
+    {
+        for (int j=0;j<n;++j)
+            mi += im[j];
+        m = (float)(mi / n);
+        for (int j=0;j<n;++j)
+            im[j] = (im[j] - m) * window[j];
+    }
+    else if (im)
+        memset(im, 0, n * sizeof(float));
+}
+
+// transform a pair of segments and add them to the sums
+// B's segment started frac samples (-0.5 .. 0.5) before the time of A's; multiplying bin k of B by
+// exp(2 pi i k frac / n) moves it to A's time.
+void CrossSpectrum::transform(long long fromA, long long fromB, double frac)
+{
+    const double pi = 3.14159265358979323846;
+    double stepRe = cos(2.0 * pi * frac / n), stepIm = sin(2.0 * pi * frac / n);
+    if (!twoSided)
+    {
+        // Z = A + iB:  A[k] = (Z[k] + conj Z[n-k]) / 2,  B[k] = (Z[k] - conj Z[n-k]) / 2i
+        segment(in[0], fromA, &ar[0], NULL);
+        segment(in[1], fromB, &ai[0], NULL);
+        fft.forward(&ar[0], &ai[0]);
+        double rotRe = 1.0, rotIm = 0.0;
+        for (int k=0;k<bins;++k)
+        {
+            int m = (n - k) & (n - 1);
+            double xr = 0.5 * ((double)ar[k] + ar[m]), xi = 0.5 * ((double)ai[k] - ai[m]);
+            double yr0 = 0.5 * ((double)ai[k] + ai[m]), yi0 = 0.5 * ((double)ar[m] - ar[k]);
+            double yr = yr0 * rotRe - yi0 * rotIm, yi = yr0 * rotIm + yi0 * rotRe;
+            saa[k] += xr * xr + xi * xi;
+            sbb[k] += yr * yr + yi * yi;
+            sabRe[k] += xr * yr + xi * yi;
+            sabIm[k] += xi * yr - xr * yi;
+            double r = rotRe * stepRe - rotIm * stepIm;
+            rotIm = rotRe * stepIm + rotIm * stepRe;
+            rotRe = r;
+        }
+        return;
+    }
+
+    segment(in[0], fromA, &ar[0], &ai[0]);
+    segment(in[1], fromB, &br[0], &bi[0]);
+    fft.forward(&ar[0], &ai[0]);
+    fft.forward(&br[0], &bi[0]);
+    // positive frequencies turn one way, negative the other; bin i of the sums is k = i - n/2
+    for (int side=0;side<2;++side)
+    {
+        double rotRe = 1.0, rotIm = 0.0;
+        double sIm = side ? -stepIm : stepIm;
+        for (int j=0;j<hop;++j)
+        {
+            int k = side ? n - 1 - j : j;
+            if (side)
+            {
+                // k = -(j + 1)
+                double r = rotRe * stepRe - rotIm * sIm;
+                rotIm = rotRe * sIm + rotIm * stepRe;
+                rotRe = r;
+            }
+            double yr = br[k] * rotRe - bi[k] * rotIm, yi = br[k] * rotIm + bi[k] * rotRe;
+            double xr = ar[k], xi = ai[k];
+            int i = (k + hop) & (n - 1);
+            saa[i] += xr * xr + xi * xi;
+            sbb[i] += yr * yr + yi * yi;
+            sabRe[i] += xr * yr + xi * yi;
+            sabIm[i] += xi * yr - xr * yi;
+            if (!side)
+            {
+                double r = rotRe * stepRe - rotIm * sIm;
+                rotIm = rotRe * sIm + rotIm * stepRe;
+                rotRe = r;
+            }
+        }
+    }
+}
+
+// write the spectrum so far, if it has a pair
+void CrossSpectrum::flush()
+{
+    if (!file || rec.segments == 0)
+        return;
+    rec.headerA = in[0].header;
+    rec.headerB = in[1].header;
+    rec.channelA = options.channelA;
+    rec.channelB = options.channelB;
+    rec.bins = bins;
+    rec.twoSided = twoSided ? 1 : 0;
+    rec.fftSize = n;
+    rec.scaleA = in[0].scale;
+    rec.scaleB = in[1].scale;
+    rec.sampleRate = in[0].rate;
+    rec.binWidth = in[0].rate / n;
+
+    double scaleBy = norm / (in[0].rate * rec.segments);
+    float *pa = &out[0], *pb = pa + bins, *cr = pb + bins, *ci = cr + bins, *coh = ci + bins;
+    for (int k=0;k<bins;++k)
+    {
+        // one-sided: every bin but DC and Nyquist carries the negative frequencies too
+        double s = scaleBy * ((twoSided || k == 0 || k == bins - 1) ? 1.0 : 2.0);
+        pa[k] = (float)(saa[k] * s);
+        pb[k] = (float)(sbb[k] * s);
+        cr[k] = (float)(sabRe[k] * s);
+        ci[k] = (float)(sabIm[k] * s);
+        double d = saa[k] * sbb[k];
+        coh[k] = (d > 0.0) ? (float)((sabRe[k] * sabRe[k] + sabIm[k] * sabIm[k]) / d) : 0.0f;
+    }
+    fwrite(&rec, sizeof(rec), 1, file);
+    fwrite(&out[0], sizeof(float), 5 * bins, file);
+    bytes += sizeof(rec) + sizeof(float) * 5 * bins;
+    ++spectra;
+
+    for (int k=0;k<bins;++k)
+        saa[k] = sbb[k] = sabRe[k] = sabIm[k] = 0.0;
+    rec.segments = 0;
+}
+
+long long CrossSpectrum::spectrumCount()
+{
+    lock.acquire();
+    long long c = spectra;
+    lock.release();
+    return c;
+}
+
+long long CrossSpectrum::bytesWritten()
+{
+    lock.acquire();
+    long long b = bytes;
+    lock.release();
+    return b;
+}
@@ -0,0 +1,151 @@
+//---------------------------------------------------------------------------
+
+#ifndef CrossSpectrumH
+#define CrossSpectrumH
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "CaptureSync.h"
+#include "CaptureSink.h"
+#include "StreamAlign.h"
+#include "Fft.h"
+
+//---------------------------------------------------------------------------
+
+// cross spectral density and coherence of one channel of each of two instruments' streams (Welch's method)
+//
+// Both streams are cut into segments of fftSize samples, overlapping by half, at their own sample rate
+// (which must be the same). Each segment of stream A is paired with the segment of stream B taken at
+// the same time, by the clock fits of StreamAlign.h: the nearest whole sample, and the rest of the
+// offset (at most half a sample) taken out as a phase ramp on B's transform. The middles of the segments
+// are paired; clock drift within a segment is not corrected (100 ppm is +-0.2 samples over 4096).
+// Each segment has its mean removed and a Hann window; the averages of |A|^2, |B|^2 and A conj(B) over
+// "averages" pairs give the power spectra of both channels, their cross spectrum, and the coherence
+// |Sab|^2 / (Saa Sbb), 0 .. 1.
+//
+// A channel is X, Y, R or theta (R and theta computed from X,Y if the stream lacks them), or XY,
+// the complex X + iY. Two real channels share one complex transform and the spectra are one-sided,
+// bins 0 .. fftSize/2; with XY on either side they are two-sided, fftSize bins from -rate/2 up.
+// Units are as in WelchPsd.h: units^2/Hz, Sab in units_A units_B/Hz.
+//
+// Lost packets end the segments of that stream (segments never span lost data); a pair that one stream
+// has no data for is left out. A spectrum is finished after averages pairs, or maxSeconds.
+// Thread safe: each stream's writer thread calls write() for its packets. The buffers are allocated when
+// the rate is first seen; memory is bounded (about a second of the one or two channels, per stream).
+//
+// The file starts with a CrossFileHead, followed by CrossRecord records (host byte order), each followed
+// by bins floats of each of: Saa, Sbb, Re Sab, Im Sab, coherence.
+
+#define CROSS_X         0           // channel: ColumnSink.h order
+#define CROSS_Y         1
+#define CROSS_R         2
+#define CROSS_THETA     3
+#define CROSS_XY        4           // X + iY
+
+struct CrossOptions
+{
+    int fftSize;                    // samples per segment (power of 2, 64 .. 65536)
+    int averages;                   // segment pairs per spectrum
+    double maxSeconds;              // finish a spectrum at least this often (stream time); 0 = no limit
+    int channelA, channelB;         // CROSS_X .. CROSS_XY
+
+    CrossOptions() : fftSize(4096), averages(16), maxSeconds(1.0), channelA(CROSS_X), channelB(CROSS_X) {}
+};
+
+// options from text, e.g. "fft=8192;averages=32;seconds=2;a=X;b=XY"
+bool parseCross(const std::string &spec, CrossOptions &opt, std::string &err);
+
+struct CrossFileHead
+{
+    char id[8];                     // "SR86xCS1"
+    double wallTime;                // time() when file was created
+    double clockTime;               // captureClock() when file was created
+};
+
+struct CrossRecord
+{
+    unsigned int headerA;           // packet headers (content, rate) of the streams
+    unsigned int headerB;
+    int channelA, channelB;         // CROSS_X .. CROSS_XY
+    int bins;                       // fftSize/2 + 1 (one-sided) or fftSize (two-sided)
+    int twoSided;                   // 1: bin i at (i - fftSize/2) * binWidth; 0: bin i at i * binWidth
+    int segments;                   // pairs averaged
+    int fftSize;
+    int scaleA, scaleB;             // scale codes of integer data (SampleScale.h)
+    double sampleRate;              // Hz
+    double binWidth;                // Hz between bins
+    long long firstSample;          // first sample of stream A in the spectrum (CapturePacket.sample)
+    double firstTime;               // time of the first sample of the first and last segments
+    double lastTime;                // (captureClock() seconds, by A's clock fit)
+    long long firstSampleB;         // sample of stream B paired with firstSample
+};
+
+class CrossSpectrum
+{
+protected:
+    struct Input
+    {
+        StreamClock clock;
+        double delay;               // seconds taken off the clock fit
+        double seen;                // rxTime of the last packet; 0 = none yet
+        unsigned int header;        // content & rate; 0 = none yet
+        int scale;
+        int channel;                // CROSS_X .. CROSS_XY
+        double rate;
+        std::vector<float> re, im;  // the channel (im: Y of XY), a ring
+        int mask;                   // ring size - 1; 0 = not allocated
+        long long runStart;         // first sample kept since lost data or a change
+        long long next;             // sample after the newest
+    };
+
+    CaptureLock lock;
+    CrossOptions options;
+    Input in[2];
+    Fft fft;
+    int n, hop, bins;
+    bool twoSided;
+    std::vector<float> window;
+    double norm;                    // 1 / sum of window^2
+    std::vector<float> ar, ai, br, bi;  // transforms
+    std::vector<double> saa, sbb, sabRe, sabIm;
+    std::vector<float> out;
+    long long segA;                 // next segment of A (sample index)
+    CrossRecord rec;
+    FILE *file;
+    long long bytes;
+    double now;                     // latest arrival, either stream
+    long long spectra;
+    float values[512];
+    float polar[1024];
+
+    void begin(Input &s, const CapturePacket &pkt);
+    void store(Input &s, const CapturePacket &pkt);
+    void process();
+    void segment(const Input &s, long long from, float *re, float *im);
+    void transform(long long fromA, long long fromB, double frac);
+    void flush();
+
+public:
+    CrossSpectrum(const CrossOptions &opt);
+    ~CrossSpectrum();
+
+    void setDelay(int input, double seconds);   // before open(); taken off the input's times
+
+    bool open(const SinkPath &fname);
+    void close();                   // finishes the spectrum so far
+    bool isOpen() const;
+
+    // a packet of stream A (input 0) or B (1)
+    void write(int input, const CapturePacket &pkt);
+
+    long long spectrumCount();
+    long long bytesWritten();
+
+private:
+    CrossSpectrum(const CrossSpectrum &);
+    CrossSpectrum &operator=(const CrossSpectrum &);
+};
+
+//---------------------------------------------------------------------------
+#endif
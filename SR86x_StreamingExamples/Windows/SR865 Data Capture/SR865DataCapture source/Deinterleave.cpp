@@ -0,0 +1,153 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "Deinterleave.h"
+#include "CaptureSimd.h"
+#include <string.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// de-interleave kernels for the column writer
+// SSE2 handles 4 float frames or 8 int frames per step;
+// NEON loads de-interleave directly (vld2/vld4).
+
+void deinterleaveFloat(const float *in, int frames, int nch, float **out)
+{
+    int i = 0;
+    if (nch == 1)
+    {
+        memcpy(out[0], in, frames*sizeof(float));
+        return;
+    }
+#if defined(CAPTURE_SSE2)
+    if (nch == 2)
+    {
+        for (; i+4<=frames; i+=4)
+        {
+            __m128 a = _mm_loadu_ps(in + 2*i);          // x0 y0 x1 y1
+            __m128 b = _mm_loadu_ps(in + 2*i + 4);      // x2 y2 x3 y3
+            _mm_storeu_ps(out[0] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+            _mm_storeu_ps(out[1] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+        }
+    }
+    else if (nch == 4)
+    {
+        for (; i+4<=frames; i+=4)
+        {
+            // 4x4 transpose
+            __m128 a = _mm_loadu_ps(in + 4*i);
+            __m128 b = _mm_loadu_ps(in + 4*i + 4);
+            __m128 c = _mm_loadu_ps(in + 4*i + 8);
+            __m128 d = _mm_loadu_ps(in + 4*i + 12);
+            _MM_TRANSPOSE4_PS(a, b, c, d);
+            _mm_storeu_ps(out[0] + i, a);
+            _mm_storeu_ps(out[1] + i, b);
+            _mm_storeu_ps(out[2] + i, c);
+            _mm_storeu_ps(out[3] + i, d);
+        }
+    }
+#elif defined(CAPTURE_NEON)
+    if (nch == 2)
+    {
+        for (; i+4<=frames; i+=4)
+        {
+            float32x4x2_t v = vld2q_f32(in + 2*i);
+            vst1q_f32(out[0] + i, v.val[0]);
+            vst1q_f32(out[1] + i, v.val[1]);
+        }
+    }
+    else if (nch == 4)
+    {
+        for (; i+4<=frames; i+=4)
+        {
+            float32x4x4_t v = vld4q_f32(in + 4*i);
+            vst1q_f32(out[0] + i, v.val[0]);
+            vst1q_f32(out[1] + i, v.val[1]);
+            vst1q_f32(out[2] + i, v.val[2]);
+            vst1q_f32(out[3] + i, v.val[3]);
+        }
+    }
+#endif
+    for (; i<frames; ++i)
+        for (int c=0;c<nch;++c)
+            out[c][i] = in[i*nch + c];
+}
+
+#if defined(CAPTURE_SSE2)
+// even and odd 16bit lanes of a & b, sign preserved
+static inline __m128i evenShorts(__m128i a, __m128i b)
+{
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+static inline __m128i oddShorts(__m128i a, __m128i b)
+{
+    return _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+}
+#endif
+
+void deinterleaveShort(const short *in, int frames, int nch, short **out)
+{
+    int i = 0;
+    if (nch == 1)
+    {
+        memcpy(out[0], in, frames*sizeof(short));
+        return;
+    }
+#if defined(CAPTURE_SSE2)
+    if (nch == 2)
+    {
+        for (; i+8<=frames; i+=8)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(in + 2*i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(in + 2*i + 8));
+            _mm_storeu_si128((__m128i *)(out[0] + i), evenShorts(a, b));
+            _mm_storeu_si128((__m128i *)(out[1] + i), oddShorts(a, b));
+        }
+    }
+    else if (nch == 4)
+    {
+        for (; i+8<=frames; i+=8)
+        {
+            // split twice: (x,r)/(y,th) pairs, then single channels
+            __m128i a = _mm_loadu_si128((const __m128i *)(in + 4*i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(in + 4*i + 8));
+            __m128i c = _mm_loadu_si128((const __m128i *)(in + 4*i + 16));
+            __m128i d = _mm_loadu_si128((const __m128i *)(in + 4*i + 24));
+            __m128i xr0 = evenShorts(a, b), yt0 = oddShorts(a, b);
+            __m128i xr1 = evenShorts(c, d), yt1 = oddShorts(c, d);
+            _mm_storeu_si128((__m128i *)(out[0] + i), evenShorts(xr0, xr1));
+            _mm_storeu_si128((__m128i *)(out[2] + i), oddShorts(xr0, xr1));
+            _mm_storeu_si128((__m128i *)(out[1] + i), evenShorts(yt0, yt1));
+            _mm_storeu_si128((__m128i *)(out[3] + i), oddShorts(yt0, yt1));
+        }
+    }
+#elif defined(CAPTURE_NEON)
+    if (nch == 2)
+    {
+        for (; i+8<=frames; i+=8)
+        {
+            int16x8x2_t v = vld2q_s16(in + 2*i);
+            vst1q_s16(out[0] + i, v.val[0]);
+            vst1q_s16(out[1] + i, v.val[1]);
+        }
+    }
+    else if (nch == 4)
+    {
+        for (; i+8<=frames; i+=8)
+        {
+            int16x8x4_t v = vld4q_s16(in + 4*i);
+            vst1q_s16(out[0] + i, v.val[0]);
+            vst1q_s16(out[1] + i, v.val[1]);
+            vst1q_s16(out[2] + i, v.val[2]);
+            vst1q_s16(out[3] + i, v.val[3]);
+        }
+    }
+#endif
+    for (; i<frames; ++i)
+        for (int c=0;c<nch;++c)
+            out[c][i] = in[i*nch + c];
+}
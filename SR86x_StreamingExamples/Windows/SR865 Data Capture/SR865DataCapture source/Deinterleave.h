@@ -0,0 +1,16 @@
+//---------------------------------------------------------------------------
+
+#ifndef DeinterleaveH
+#define DeinterleaveH
+
+//---------------------------------------------------------------------------
+
+// split interleaved stream data (X,Y,X,Y,...) into one array per channel
+// frames = samples per channel; out[c] receives channel c
+// nch of 2 and 4 use vector code; any other count uses plain code
+
+void deinterleaveFloat(const float *in, int frames, int nch, float **out);
+void deinterleaveShort(const short *in, int frames, int nch, short **out);
+
+//---------------------------------------------------------------------------
+#endif
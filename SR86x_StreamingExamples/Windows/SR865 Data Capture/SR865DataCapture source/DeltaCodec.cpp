@@ -0,0 +1,360 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "DeltaCodec.h"
+#include "CaptureSimd.h"
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// delta + zig-zag + bit-packing for 16bit stream data
+//
+// A full block is packed "vertically": value i of the block goes to lane (i % 8),
+// and each lane is its own little bit stream of 16 values.
+// That way one 128bit register packs or unpacks 8 values at a time with plain shifts,
+// and the plain C++ code below produces exactly the same bytes.
+// Lock-in outputs change slowly from sample to sample,
+// so the differences usually need only a few bits.
+
+#define BLOCK   128         // differences per block
+#define LANES   8           // 16bit lanes per block word
+
+static inline void put16(unsigned char *p, unsigned short v)
+{
+    p[0] = (unsigned char)(v & 0xff);
+    p[1] = (unsigned char)(v >> 8);
+}
+static inline unsigned short get16(const unsigned char *p)
+{
+    return (unsigned short)(p[0] | (p[1] << 8));
+}
+
+static inline unsigned short zigzag(short d)
+{
+    return (unsigned short)(((unsigned short)d << 1) ^ (unsigned short)(d >> 15));
+}
+static inline short unzigzag(unsigned short z)
+{
+    return (short)((z >> 1) ^ (unsigned short)(0 - (z & 1)));
+}
+
+static int bitWidth(unsigned int v)
+{
+    int b = 0;
+    while (v)
+    {
+        ++b;
+        v >>= 1;
+    }
+    return b;
+}
+
+//---------------------------------------------------------------------------
+// differences
+
+// z[i] = zigzag(cur[i] - prev[i]); returns OR of all z (for bit width)
+static unsigned int zigzagDiff(const short *cur, const short *prev, int n, unsigned short *z)
+{
+    unsigned int bits = 0;
+    int i = 0;
+#ifdef CAPTURE_SSE2
+    __m128i acc = _mm_setzero_si128();
+    for (; i+LANES<=n; i+=LANES)
+    {
+        __m128i d = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(cur + i)), _mm_loadu_si128((const __m128i *)(prev + i)));
+        __m128i zz = _mm_xor_si128(_mm_slli_epi16(d, 1), _mm_srai_epi16(d, 15));
+        _mm_storeu_si128((__m128i *)(z + i), zz);
+        acc = _mm_or_si128(acc, zz);
+    }
+    acc = _mm_or_si128(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_or_si128(acc, _mm_srli_si128(acc, 4));
+    acc = _mm_or_si128(acc, _mm_srli_si128(acc, 2));
+    bits = _mm_cvtsi128_si32(acc) & 0xffff;
+#endif
+    for (; i<n; ++i)
+    {
+        z[i] = zigzag((short)(cur[i] - prev[i]));
+        bits |= z[i];
+    }
+    return bits;
+}
+
+//---------------------------------------------------------------------------
+// full blocks
+
+static void packBlock(const unsigned short *z, int b, unsigned char *out)
+{
+    if (b == 0)
+        return;
+#ifdef CAPTURE_SSE2
+    __m128i acc = _mm_setzero_si128();
+    int shift = 0;
+    for (int k=0;k<BLOCK/LANES;++k)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(z + k*LANES));
+        acc = _mm_or_si128(acc, _mm_sll_epi16(v, _mm_cvtsi32_si128(shift)));
+        shift += b;
+        if (shift >= 16)
+        {
+            // lane words full; carry leftover high bits of v into next word
+            _mm_storeu_si128((__m128i *)out, acc);
+            out += 16;
+            shift -= 16;
+            acc = _mm_srl_epi16(v, _mm_cvtsi32_si128(b - shift));
+        }
+    }
+#else
+    for (int lane=0;lane<LANES;++lane)
+    {
+        unsigned int acc = 0;
+        int shift = 0;
+        unsigned char *p = out + 2*lane;
+        for (int k=0;k<BLOCK/LANES;++k)
+        {
+            acc |= (unsigned int)z[k*LANES + lane] << shift;
+            shift += b;
+            if (shift >= 16)
+            {
+                put16(p, (unsigned short)acc);
+                p += 2*LANES;
+                acc >>= 16;
+                shift -= 16;
+            }
+        }
+    }
+#endif
+}
+static void unpackBlock(const unsigned char *in, int b, unsigned short *z)
+{
+    int k;
+    if (b == 0)
+    {
+        for (k=0;k<BLOCK;++k)
+            z[k] = 0;
+        return;
+    }
+#ifdef CAPTURE_SSE2
+    __m128i mask = _mm_set1_epi16((short)((1u << b) - 1));
+    __m128i w = _mm_loadu_si128((const __m128i *)in);
+    int shift = 0;
+    for (k=0;k<BLOCK/LANES;++k)
+    {
+        __m128i v = _mm_srl_epi16(w, _mm_cvtsi32_si128(shift));
+        shift += b;
+        if (shift > 16)
+        {
+            // value straddles two lane words
+            in += 16;
+            w = _mm_loadu_si128((const __m128i *)in);
+            shift -= 16;
+            v = _mm_or_si128(v, _mm_sll_epi16(w, _mm_cvtsi32_si128(b - shift)));
+        }
+        else if (shift == 16 && k < BLOCK/LANES-1)
+        {
+            in += 16;
+            w = _mm_loadu_si128((const __m128i *)in);
+            shift = 0;
+        }
+        _mm_storeu_si128((__m128i *)(z + k*LANES), _mm_and_si128(v, mask));
+    }
+#else
+    unsigned int mask = (1u << b) - 1;
+    for (int lane=0;lane<LANES;++lane)
+    {
+        const unsigned char *p = in + 2*lane;
+        unsigned int acc = get16(p);
+        int avail = 16;
+        for (k=0;k<BLOCK/LANES;++k)
+        {
+            if (avail < b)
+            {
+                p += 2*LANES;
+                acc |= (unsigned int)get16(p) << avail;
+                avail += 16;
+            }
+            z[k*LANES + lane] = (unsigned short)(acc & mask);
+            acc >>= b;
+            avail -= b;
+        }
+    }
+#endif
+}
+
+//---------------------------------------------------------------------------
+// partial block at end; plain sequential bit stream
+
+static void packTail(const unsigned short *z, int n, int b, unsigned char *out)
+{
+    unsigned int acc = 0;
+    int nbits = 0;
+    for (int i=0;i<n;++i)
+    {
+        acc |= (unsigned int)z[i] << nbits;
+        nbits += b;
+        while (nbits >= 8)
+        {
+            *out++ = (unsigned char)(acc & 0xff);
+            acc >>= 8;
+            nbits -= 8;
+        }
+    }
+    if (nbits > 0)
+        *out = (unsigned char)(acc & 0xff);
+}
+static void unpackTail(const unsigned char *in, int n, int b, unsigned short *z)
+{
+    unsigned int acc = 0;
+    unsigned int mask = (1u << b) - 1;
+    int nbits = 0;
+    for (int i=0;i<n;++i)
+    {
+        while (nbits < b)
+        {
+            acc |= (unsigned int)(*in++) << nbits;
+            nbits += 8;
+        }
+        z[i] = (unsigned short)(acc & mask);
+        acc >>= b;
+        nbits -= b;
+    }
+}
+
+//---------------------------------------------------------------------------
+// prefix sums; out[i] = out[i-nch] + unzigzag(z[i-nch])
+
+#ifdef CAPTURE_SSE2
+// lanes holding the newest sample of each channel, repeated across the register
+static inline __m128i lastSamples(__m128i y, int nch)
+{
+    switch (nch)
+    {
+        case 1: return _mm_shuffle_epi32(_mm_shufflehi_epi16(y, 0xff), 0xff);
+        case 2: return _mm_shuffle_epi32(y, 0xff);
+        default: return _mm_shuffle_epi32(y, 0xee);
+    }
+}
+// running sum of each channel within the register
+static inline __m128i scanChannels(__m128i s, int nch)
+{
+    switch (nch)
+    {
+        case 1:
+            s = _mm_add_epi16(s, _mm_slli_si128(s, 2));
+            s = _mm_add_epi16(s, _mm_slli_si128(s, 4));
+            return _mm_add_epi16(s, _mm_slli_si128(s, 8));
+        case 2:
+            s = _mm_add_epi16(s, _mm_slli_si128(s, 4));
+            return _mm_add_epi16(s, _mm_slli_si128(s, 8));
+        default:
+            return _mm_add_epi16(s, _mm_slli_si128(s, 8));
+    }
+}
+#endif
+
+static void undiff(const unsigned short *z, int n, int nch, short *out)
+{
+    // out points at first sample to reconstruct; out[-nch] .. out[-1] are already known
+    int i = 0;
+#ifdef CAPTURE_SSE2
+    if (nch == 1 || nch == 2 || nch == 4)
+    {
+        short prev[LANES];
+        for (int k=0;k<LANES;++k)
+            prev[k] = (k >= LANES-nch) ? out[k - LANES] : 0;
+        __m128i carry = lastSamples(_mm_loadu_si128((const __m128i *)prev), nch);
+        __m128i one = _mm_set1_epi16(1);
+        for (; i+LANES<=n; i+=LANES)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(z + i));
+            __m128i d = _mm_xor_si128(_mm_srli_epi16(v, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(v, one)));
+            __m128i y = _mm_add_epi16(scanChannels(d, nch), carry);
+            _mm_storeu_si128((__m128i *)(out + i), y);
+            carry = lastSamples(y, nch);
+        }
+    }
+#endif
+    for (; i<n; ++i)
+        out[i] = (short)(out[i - nch] + unzigzag(z[i]));
+}
+
+//---------------------------------------------------------------------------
+
+int deltaMaxBytes(int n, int nch)
+{
+    return 2*nch + 2*n + n/BLOCK + 2;
+}
+
+int deltaEncode(const short *in, int n, int nch, unsigned char *out)
+{
+    unsigned char *p = out;
+    unsigned short z[BLOCK];
+
+    // first sample of each channel as is
+    int nraw = (n < nch) ? n : nch;
+    for (int i=0;i<nraw;++i, p+=2)
+        put16(p, (unsigned short)in[i]);
+
+    int m = n - nraw;
+    const short *cur = in + nraw;
+    int j = 0;
+    for (; j+BLOCK<=m; j+=BLOCK)
+    {
+        int b = bitWidth(zigzagDiff(cur + j, in + j, BLOCK, z));
+        *p++ = (unsigned char)b;
+        packBlock(z, b, p);
+        p += 16*b;
+    }
+    int t = m - j;
+    if (t > 0)
+    {
+        int b = bitWidth(zigzagDiff(cur + j, in + j, t, z));
+        *p++ = (unsigned char)b;
+        packTail(z, t, b, p);
+        p += (t*b + 7)/8;
+    }
+    return (int)(p - out);
+}
+
+int deltaDecode(const unsigned char *in, int nbytes, int n, int nch, short *out)
+{
+    const unsigned char *p = in;
+    const unsigned char *end = in + nbytes;
+    unsigned short z[BLOCK];
+
+    int nraw = (n < nch) ? n : nch;
+    if (p + 2*nraw > end)
+        return -1;
+    for (int i=0;i<nraw;++i, p+=2)
+        out[i] = (short)get16(p);
+
+    int m = n - nraw;
+    short *cur = out + nraw;
+    int j = 0;
+    for (; j+BLOCK<=m; j+=BLOCK)
+    {
+        if (p >= end)
+            return -1;
+        int b = *p++;
+        if (b > 16 || p + 16*b > end)
+            return -1;
+        unpackBlock(p, b, z);
+        p += 16*b;
+        undiff(z, BLOCK, nch, cur + j);
+    }
+    int t = m - j;
+    if (t > 0)
+    {
+        if (p >= end)
+            return -1;
+        int b = *p++;
+        if (b > 16 || p + (t*b + 7)/8 > end)
+            return -1;
+        unpackTail(p, t, b, z);
+        p += (t*b + 7)/8;
+        undiff(z, t, nch, cur + j);
+    }
+    return (int)(p - in);
+}
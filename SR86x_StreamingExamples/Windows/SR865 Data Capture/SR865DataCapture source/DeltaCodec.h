@@ -0,0 +1,29 @@
+//---------------------------------------------------------------------------
+
+#ifndef DeltaCodecH
+#define DeltaCodecH
+
+//---------------------------------------------------------------------------
+
+// lossless codec for 16bit integer stream data (content codes 4-7)
+//
+// Samples are interleaved by channel (X,Y,X,Y,...).
+// Each channel is predicted from its previous sample (delta),
+// the differences are zig-zag coded (small +/- values become small unsigned values)
+// and bit-packed in blocks of 128, using only as many bits as the largest value in the block needs.
+//
+// Encoded layout (little-endian):
+//   first sample of each channel, raw (nch x 16 bits)
+//   for each full block of 128 differences:
+//       1 byte bit width b (0-16), then b x 16 bytes; 8 interleaved 16bit lanes, 16 values per lane
+//   for the remaining differences (< 128):
+//       1 byte bit width b, then (count x b + 7)/8 bytes, packed low bit first
+//
+// nch must be 1, 2 or 4 for the vector code; other values work but use the plain code.
+
+int deltaMaxBytes(int n, int nch);
+int deltaEncode(const short *in, int n, int nch, unsigned char *out);          // returns encoded bytes
+int deltaDecode(const unsigned char *in, int nbytes, int n, int nch, short *out);   // returns bytes used, or -1 if data is bad
+
+//---------------------------------------------------------------------------
+#endif
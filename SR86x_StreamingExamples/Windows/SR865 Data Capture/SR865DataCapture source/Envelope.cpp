@@ -0,0 +1,321 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "Envelope.h"
+#include "CaptureSink.h"
+#include "CaptureSync.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// envelope pyramid
+// The builder keeps one open page per level (ENVELOPE_LEVELS * ENVELOPE_PAGE buckets, allocated with it);
+// add() allocates nothing and writes a page about every ENVELOPE_PAGE * bucketFrames samples.
+
+bool parseEnvelope(const std::string &spec, EnvelopeOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key == "bucket")
+        {
+            char *end;
+            long n = strtol(val.c_str(), &end, 10);
+            if (end == val.c_str() || *end || n < 16 || n > (1L << 20))
+            {
+                err = "bad value for " + key + ": \"" + val + "\"";
+                return false;
+            }
+            opt.bucketFrames = (int)n;
+        }
+        else
+        {
+            err = "unknown envelope setting \"" + item + "\"";
+            return false;
+        }
+    }
+    opt.side = true;
+    return true;
+}
+
+// b summarised into a
+static void mergeBucket(EnvelopeBucket &a, const EnvelopeBucket &b)
+{
+    if (b.count == 0)
+        return;
+    for (int c=0;c<ENVELOPE_CHANNELS;++c)
+    {
+        if (!(b.flags & (1 << c)))
+            continue;
+        if (!(a.flags & (1 << c)))
+        {
+            a.min[c] = b.min[c];
+            a.max[c] = b.max[c];
+            a.mean[c] = b.mean[c];
+            continue;
+        }
+        if (b.min[c] < a.min[c])
+            a.min[c] = b.min[c];
+        if (b.max[c] > a.max[c])
+            a.max[c] = b.max[c];
+        // weighted by the bucket's samples; a channel that comes and goes within a bucket is rare
+        a.mean[c] = (float)((a.mean[c] * (double)a.count + b.mean[c] * (double)b.count) / ((double)a.count + b.count));
+    }
+    a.count += b.count;
+    a.flags |= b.flags;
+}
+
+//---------------------------------------------------------------------------
+// EnvelopeBuilder
+
+EnvelopeBuilder::EnvelopeBuilder()
+{
+    file = NULL;
+    offset = 0;
+    bytes = 0;
+    bucketFrames = 256;
+    section = -1;
+    previous = -1;
+    clear();
+}
+
+// nothing in any level
+void EnvelopeBuilder::clear()
+{
+    bucket = -1;
+    memset(&current, 0, sizeof(current));
+    for (int c=0;c<ENVELOPE_CHANNELS;++c)
+        sum[c] = 0.0;
+    for (int l=0;l<ENVELOPE_LEVELS;++l)
+    {
+        page[l] = -1;
+        written[l] = 0;
+        lastOffset[l] = -1;
+    }
+}
+
+void EnvelopeBuilder::start(FILE *f, int frames)
+{
+    file = f;
+    bytes = 0;
+    bucketFrames = frames;
+    section = -1;
+    previous = -1;
+    clear();
+    fseek(file, 0, SEEK_END);
+    offset = sinkTell(file);
+    if (offset == 0)
+    {
+        EnvelopeFileHead head;
+        memcpy(head.id, ENVELOPE_FILE_ID, 8);
+        head.wallTime = (double)time(0);
+        head.clockTime = captureClock();
+        fwrite(&head, sizeof(head), 1, file);
+        offset = sizeof(head);
+        bytes = offset;
+    }
+    else if (offset >= (long long)(sizeof(EnvelopeFileHead) + sizeof(EnvelopeTrailer)))
+    {
+        // carry on after the last section; a file that didn't close has none to link to
+        EnvelopeTrailer last;
+        if (sinkSeek(file, offset - sizeof(last)) && fread(&last, sizeof(last), 1, file) == 1 && memcmp(last.id, ENVELOPE_TRAILER_ID, 8) == 0)
+            previous = offset - sizeof(last);
+        fseek(file, 0, SEEK_END);
+    }
+}
+
+void EnvelopeBuilder::beginSection(EnvelopeSectionHead head)
+{
+    if (section >= 0)
+        endSection();
+    memcpy(head.id, ENVELOPE_SECTION_ID, 8);
+    head.bucketFrames = bucketFrames;
+    head.pageBuckets = ENVELOPE_PAGE;
+    fwrite(&head, sizeof(head), 1, file);
+    section = offset;
+    offset += sizeof(head);
+    bytes += sizeof(head);
+    clear();
+}
+
+bool EnvelopeBuilder::inSection() const
+{
+    return (section >= 0);
+}
+long long EnvelopeBuilder::bytesWritten() const
+{
+    return bytes;
+}
+
+void EnvelopeBuilder::add(const float *values, int frames, int nch, const int *cols, long long sample, bool overload)
+{
+    int i = 0;
+    while (i < frames)
+    {
+        long long s = sample + i;
+        long long b = s / bucketFrames;
+        if (bucket < 0)
+            bucket = b;
+        else if (b > bucket)
+        {
+            finishBucket();
+            bucket = b;
+        }
+        // late samples (b < bucket) go into the bucket being filled
+        long long room = (bucket + 1) * bucketFrames - s;
+        int n = (room < frames - i) ? (int)room : frames - i;
+
+        for (int k=0;k<nch;++k)
+        {
+            int c = cols[k];
+            const float *v = values + i * nch + k;
+            float lo, hi;
+            double total = 0.0;
+            if (current.flags & (1 << c))
+            {
+                lo = current.min[c];
+                hi = current.max[c];
+            }
+            else
+                lo = hi = *v;
+            for (int j=0;j<n;++j, v+=nch)
+            {
+                float x = *v;
+                if (x < lo)
+                    lo = x;
+                if (x > hi)
+                    hi = x;
+                total += x;
+            }
+            current.min[c] = lo;
+            current.max[c] = hi;
+            sum[c] += total;
+            current.flags |= 1 << c;
+        }
+        current.count += n;
+        if (overload)
+            current.flags |= ENVELOPE_OVERLOAD;
+        i += n;
+    }
+}
+
+void EnvelopeBuilder::finishBucket()
+{
+    if (bucket >= 0 && current.count > 0)
+    {
+        for (int c=0;c<ENVELOPE_CHANNELS;++c)
+            current.mean[c] = (current.flags & (1 << c)) ? (float)(sum[c] / current.count) : 0.0f;
+        place(0, bucket, current);
+    }
+    memset(&current, 0, sizeof(current));
+    for (int c=0;c<ENVELOPE_CHANNELS;++c)
+        sum[c] = 0.0;
+}
+
+void EnvelopeBuilder::place(int level, long long index, const EnvelopeBucket &b)
+{
+    long long k = index / ENVELOPE_PAGE;
+    if (page[level] != k)
+    {
+        if (page[level] >= 0)
+            flushPage(level);
+        openPage(level, k);
+    }
+    mergeBucket(pages[level][index % ENVELOPE_PAGE], b);
+}
+
+void EnvelopeBuilder::openPage(int level, long long index)
+{
+    page[level] = index;
+    memset(pages[level], 0, sizeof(pages[level]));
+    for (int i=0;i<4;++i)
+        child[level][i] = -1;
+}
+
+// write the open page of a level, and summarise it into the level above
+void EnvelopeBuilder::flushPage(int level)
+{
+    EnvelopePageHead h;
+    memset(&h, 0, sizeof(h));
+    h.level = level;
+    h.index = page[level];
+    for (int i=0;i<4;++i)
+        h.child[i] = child[level][i];
+    fwrite(&h, sizeof(h), 1, file);
+    fwrite(pages[level], sizeof(EnvelopeBucket), ENVELOPE_PAGE, file);
+    long long at = offset;
+    offset += sizeof(h) + sizeof(EnvelopeBucket) * ENVELOPE_PAGE;
+    bytes += sizeof(h) + sizeof(EnvelopeBucket) * ENVELOPE_PAGE;
+    ++written[level];
+    lastOffset[level] = at;
+    long long k = page[level];
+    page[level] = -1;
+
+    if (level + 1 >= ENVELOPE_LEVELS)
+        return;
+    long long parent = k / 4;
+    if (page[level + 1] != parent)
+    {
+        if (page[level + 1] >= 0)
+            flushPage(level + 1);
+        openPage(level + 1, parent);
+    }
+    child[level + 1][k % 4] = at;
+    const EnvelopeBucket *src = pages[level];
+    EnvelopeBucket *dst = pages[level + 1] + (k % 4) * (ENVELOPE_PAGE / 4);
+    for (int m=0;m<ENVELOPE_PAGE/4;++m, src+=4)
+    {
+        for (int i=0;i<4;++i)
+            mergeBucket(dst[m], src[i]);
+    }
+}
+
+void EnvelopeBuilder::endSection()
+{
+    if (section < 0)
+        return;
+    finishBucket();
+    EnvelopeTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    memcpy(trailer.id, ENVELOPE_TRAILER_ID, 8);
+    trailer.section = section;
+    trailer.root = -1;
+    trailer.previous = previous;
+    if (page[0] >= 0)
+    {
+        trailer.buckets = bucket + 1;
+        // flush level by level until one page holds everything
+        for (int l=0;l<ENVELOPE_LEVELS;++l)
+        {
+            long long k = page[l];
+            flushPage(l);
+            if (written[l] == 1 || l + 1 == ENVELOPE_LEVELS)
+            {
+                trailer.root = lastOffset[l];
+                trailer.rootLevel = l;
+                trailer.rootIndex = k;
+                break;
+            }
+        }
+    }
+    fwrite(&trailer, sizeof(trailer), 1, file);
+    previous = offset;
+    offset += sizeof(trailer);
+    bytes += sizeof(trailer);
+    section = -1;
+    clear();
+}
@@ -0,0 +1,147 @@
+//---------------------------------------------------------------------------
+
+#ifndef EnvelopeH
+#define EnvelopeH
+
+#include <stdio.h>
+#include <string>
+
+//---------------------------------------------------------------------------
+
+// min / max / mean pyramid of a capture, for drawing any time span without reading the samples
+//
+// Level 0 summarises every bucketFrames samples of the stream (per channel: min, max, mean);
+// each level above summarises 4 buckets of the one below. Drawing a span of t seconds on
+// w pixels reads the level whose buckets are just narrower than t / w: at most 4 buckets a pixel,
+// whatever the length of the capture.
+//
+// The file is built as the packets arrive and is only ever appended to:
+//   EnvelopeFileHead
+//   section: EnvelopeSectionHead, pages, EnvelopeTrailer
+//   section ...
+// A page holds ENVELOPE_PAGE buckets of one level and the file offsets of the 4 pages below it
+// (-1 where there was no data), and is written once all of them are. Closing a section writes the
+// pages still open and a trailer pointing to the top page, and to the previous section's trailer.
+// A reader starts at the last trailer; every page is found from the top page in one read per level.
+// Buckets are placed by sample index (CapturePacket.sample), so lost packets leave empty buckets,
+// and spans with no data take no room at all.
+// A change of sample rate, or a restart of the stream after a silence, starts a new section.
+// Values are float in engineering units (counts if the sensitivity of integer data is unknown).
+// A section is only readable once closed: the pages of a capture that never closed are in the file,
+// but there is no trailer to find them by.
+
+#define ENVELOPE_PAGE       1024        // buckets per page
+#define ENVELOPE_LEVELS     24          // most levels in a section
+#define ENVELOPE_CHANNELS   4           // X, Y, R, theta (ColumnSink.h order)
+
+#define ENVELOPE_FILE_ID    "SR86xEN1"
+#define ENVELOPE_SECTION_ID "SR86xENS"
+#define ENVELOPE_TRAILER_ID "SR86xENT"
+
+struct EnvelopeOptions
+{
+    int bucketFrames;               // samples (per channel) in a level 0 bucket
+    bool side;                      // write the envelope beside the capture file
+
+    EnvelopeOptions() : bucketFrames(256), side(false) {}
+};
+
+// options from text, e.g. "bucket=1024"; any spec turns the envelope on
+bool parseEnvelope(const std::string &spec, EnvelopeOptions &opt, std::string &err);
+
+struct EnvelopeFileHead
+{
+    char id[8];                     // "SR86xEN1"
+    double wallTime;                // time() when file was created
+    double clockTime;               // captureClock() when file was created
+};
+
+struct EnvelopeSectionHead
+{
+    char id[8];                     // "SR86xENS"
+    unsigned int header;            // packet header of the first packet (content, rate)
+    int bucketFrames;
+    int pageBuckets;                // ENVELOPE_PAGE
+    int scale;                      // scale code of integer data (SampleScale.h)
+    long long firstSample;          // CapturePacket.sample at the start of bucket 0
+    double sampleRate;
+    double origin;                  // time of that sample (captureClock() seconds, from the arrival of the first packet)
+    double bucketSeconds;           // level 0 bucket k starts at origin + k * bucketSeconds
+};
+
+struct EnvelopeBucket
+{
+    int count;                      // samples per channel; 0 = no data
+    unsigned int flags;             // bit c: channel c in the stream; ENVELOPE_OVERLOAD
+    float min[ENVELOPE_CHANNELS];
+    float max[ENVELOPE_CHANNELS];
+    float mean[ENVELOPE_CHANNELS];
+};
+
+#define ENVELOPE_OVERLOAD   0x100   // a packet in the bucket had the overload / error bits set
+
+struct EnvelopePageHead
+{
+    int level;
+    int reserved;
+    long long index;                // holds buckets index * ENVELOPE_PAGE .. + ENVELOPE_PAGE-1 of its level
+    long long child[4];             // file offsets of the pages below; -1 = none (always -1 at level 0)
+};
+
+struct EnvelopeTrailer
+{
+    char id[8];                     // "SR86xENT"
+    long long section;              // file offset of the EnvelopeSectionHead
+    long long root;                 // file offset of the top page; -1 = no data
+    int rootLevel;
+    int reserved;
+    long long rootIndex;            // its page index
+    long long buckets;              // level 0 buckets spanned (last + 1)
+    long long previous;             // file offset of the previous section's trailer; -1 = first
+};
+
+// builds the pyramid into an envelope file, a section at a time
+class EnvelopeBuilder
+{
+protected:
+    FILE *file;
+    long long offset;               // where the next write goes
+    long long bytes;
+    int bucketFrames;
+    long long section;              // offset of the open section's head; -1 = none
+    long long previous;             // offset of the last trailer; -1 = none
+    EnvelopeBucket current;         // level 0 bucket being filled
+    double sum[ENVELOPE_CHANNELS];
+    long long bucket;               // its index; -1 = none yet
+    long long page[ENVELOPE_LEVELS];            // index of the open page of each level; -1 = none
+    long long child[ENVELOPE_LEVELS][4];
+    long long written[ENVELOPE_LEVELS];         // pages written at each level
+    long long lastOffset[ENVELOPE_LEVELS];      // and where the last one went
+    EnvelopeBucket pages[ENVELOPE_LEVELS][ENVELOPE_PAGE];
+
+    void clear();
+    void finishBucket();
+    void place(int level, long long index, const EnvelopeBucket &b);
+    void openPage(int level, long long index);
+    void flushPage(int level);
+
+public:
+    EnvelopeBuilder();
+
+    // f is open for reading & appending ("a+b", or "w+b" for a new file): a new file gets its head,
+    // an existing one is added to after its last section
+    void start(FILE *f, int bucketFrames);
+    // head.bucketFrames, pageBuckets & id are filled in here
+    void beginSection(EnvelopeSectionHead head);
+    // frames of interleaved samples; cols[k] = column (0-3) of the k-th of nch channels;
+    // sample = index of the first frame from head.firstSample
+    void add(const float *values, int frames, int nch, const int *cols, long long sample, bool overload);
+    // write the pages still open and the trailer
+    void endSection();
+    bool inSection() const;
+
+    long long bytesWritten() const; // since start()
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,351 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "EnvelopeSink.h"
+#include "ColumnSink.h"
+#include "PacketSequence.h"
+#include "SampleScale.h"
+#include <string.h>
+#include <math.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// envelope files
+// Sections follow the stream as PacketSequence numbers it: sample indices run on across lost packets,
+// and a new section starts where they stop matching time (new rate, or a restart after a silence).
+
+EnvelopeSink::EnvelopeSink(const EnvelopeOptions &opt, CaptureSink *sampleSink)
+{
+    samples = sampleSink;
+    options = opt;
+    file = NULL;
+    partial = false;
+    rate = 0;
+    firstSample = 0;
+    lastTime = 0.0;
+}
+/*virtual*/ EnvelopeSink::~EnvelopeSink()
+{
+    close();
+    delete samples;
+}
+
+/*virtual*/ bool EnvelopeSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    if (!samples->open(fname, trunc))
+        return false;
+    // "run.dat" -> "run.dat.env"; "run_0000.dat.part" -> "run_0000.dat.env.part"
+    name = fname;
+    SinkPath part = sinkPath(".part");
+    partial = (name.length() > part.length() && name.compare(name.length() - part.length(), part.length(), part) == 0);
+    if (partial)
+        name.erase(name.length() - part.length());
+    name += sinkPath(".env");
+    if (partial)
+        name += part;
+
+    // read as well, to find the last section of an existing file
+    file = sinkOpen(name, trunc ? "w+b" : "a+b");
+    if (!file)
+    {
+        samples->close();
+        return false;
+    }
+    builder.start(file, options.bucketFrames);
+    return true;
+}
+/*virtual*/ bool EnvelopeSink::isOpen() const
+{
+    return (file != NULL);
+}
+/*virtual*/ void EnvelopeSink::close()
+{
+    if (file)
+    {
+        builder.endSection();
+        fclose(file);
+        file = NULL;
+        if (partial)
+            sinkRename(name, name.substr(0, name.length() - 5));    // drop ".part"
+    }
+    samples->close();
+}
+
+void EnvelopeSink::beginSection(const CapturePacket &pkt, int frames)
+{
+    PacketHeader hdr(pkt.buffer[0]);
+    EnvelopeSectionHead head;
+    memset(&head, 0, sizeof(head));
+    head.header = pkt.buffer[0];
+    head.scale = pkt.scale;
+    head.firstSample = pkt.sample;
+    head.sampleRate = hdr.sampleRate();
+    head.origin = pkt.rxTime - frames / head.sampleRate;    // arrival is just after the packet's last sample
+    head.bucketSeconds = options.bucketFrames / head.sampleRate;
+    builder.beginSection(head);
+    rate = hdr.rate;
+    firstSample = pkt.sample;
+}
+
+/*virtual*/ void EnvelopeSink::write(const CapturePacket &pkt)
+{
+    if (!file)
+        return;
+    samples->write(pkt);
+    if (pkt.nwords < 2)
+        return;
+
+    PacketHeader hdr(pkt.buffer[0]);
+    int cols[4];
+    int nch = columnsOf(hdr.what, cols);
+    int frames = packetToFloat(pkt, values) / nch;
+    if (!builder.inSection() || hdr.rate != rate || pkt.rxTime - lastTime > SEQ_RESUME_TIME)
+        beginSection(pkt, frames);
+    lastTime = pkt.rxTime;
+    long long s = pkt.sample - firstSample;
+    builder.add(values, frames, nch, cols, s > 0 ? s : 0, hdr.over);
+}
+
+/*virtual*/ long long EnvelopeSink::bytesWritten()
+{
+    return builder.bytesWritten() + samples->bytesWritten();
+}
+/*virtual*/ long long EnvelopeSink::packetsWritten() const
+{
+    return samples->packetsWritten();
+}
+/*virtual*/ void EnvelopeSink::note(const std::string &text)
+{
+    samples->note(text);
+}
+/*virtual*/ long long EnvelopeSink::syncCount() const
+{
+    return samples->syncCount();
+}
+/*virtual*/ double EnvelopeSink::syncTime() const
+{
+    return samples->syncTime();
+}
+/*virtual*/ void EnvelopeSink::idle(double now)
+{
+    samples->idle(now);
+}
+
+//---------------------------------------------------------------------------
+// EnvelopeReader
+
+EnvelopeReader::EnvelopeReader()
+{
+    file = NULL;
+    bytes = 0;
+    memset(&fileHead, 0, sizeof(fileHead));
+    for (int l=0;l<ENVELOPE_LEVELS;++l)
+        cachedOffset[l] = -1;
+}
+EnvelopeReader::~EnvelopeReader()
+{
+    close();
+}
+
+bool EnvelopeReader::open(const SinkPath &fname)
+{
+    close();
+    file = sinkOpen(fname, "rb");
+    if (!file)
+        return false;
+    if (fread(&fileHead, sizeof(fileHead), 1, file) != 1 || memcmp(fileHead.id, ENVELOPE_FILE_ID, 8) != 0)
+    {
+        close();
+        return false;
+    }
+
+    // sections from the last trailer back
+    fseek(file, 0, SEEK_END);
+    long long at = sinkTell(file) - (long long)sizeof(EnvelopeTrailer);
+    while (at >= (long long)sizeof(fileHead))
+    {
+        Section s;
+        if (!sinkSeek(file, at) || fread(&s.trailer, sizeof(s.trailer), 1, file) != 1 || memcmp(s.trailer.id, ENVELOPE_TRAILER_ID, 8) != 0
+            || !sinkSeek(file, s.trailer.section) || fread(&s.head, sizeof(s.head), 1, file) != 1 || memcmp(s.head.id, ENVELOPE_SECTION_ID, 8) != 0)
+            break;
+        sections.insert(sections.begin(), s);
+        if (s.trailer.previous >= at)
+            break;
+        at = s.trailer.previous;
+    }
+    if (sections.empty())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+void EnvelopeReader::close()
+{
+    if (file)
+        fclose(file);
+    file = NULL;
+    sections.clear();
+    for (int l=0;l<ENVELOPE_LEVELS;++l)
+        cachedOffset[l] = -1;
+}
+
+const EnvelopeFileHead &EnvelopeReader::info() const
+{
+    return fileHead;
+}
+int EnvelopeReader::sectionCount() const
+{
+    return (int)sections.size();
+}
+const EnvelopeSectionHead &EnvelopeReader::section(int i) const
+{
+    return sections[i].head;
+}
+double EnvelopeReader::startTime() const
+{
+    return sections.empty() ? 0.0 : sections.front().head.origin;
+}
+double EnvelopeReader::endTime() const
+{
+    if (sections.empty())
+        return 0.0;
+    const Section &s = sections.back();
+    return s.head.origin + s.trailer.buckets * s.head.bucketSeconds;
+}
+long long EnvelopeReader::bytesRead() const
+{
+    return bytes;
+}
+
+bool EnvelopeReader::readPageHead(long long offset, EnvelopePageHead &h)
+{
+    if (!sinkSeek(file, offset) || fread(&h, sizeof(h), 1, file) != 1)
+        return false;
+    bytes += sizeof(h);
+    return true;
+}
+
+// file offset of a page, walking down from the section's top page; -1 if it holds no data
+long long EnvelopeReader::findPage(const Section &s, int level, long long index)
+{
+    int top = s.trailer.rootLevel;
+    if (s.trailer.root < 0 || level > top || (index >> (2 * (top - level))) != s.trailer.rootIndex)
+        return -1;
+    long long at = s.trailer.root;
+    for (int l=top;l>level;--l)
+    {
+        if (cachedOffset[l] != at)
+        {
+            if (!readPageHead(at, cached[l]))
+                return -1;
+            cachedOffset[l] = at;
+        }
+        at = cached[l].child[(index >> (2 * (l - 1 - level))) & 3];
+        if (at < 0)
+            return -1;
+    }
+    return at;
+}
+
+void EnvelopeReader::merge(EnvelopePoint &p, const EnvelopeBucket &b)
+{
+    for (int c=0;c<ENVELOPE_CHANNELS;++c)
+    {
+        if (!(b.flags & (1 << c)))
+            continue;
+        if (p.count[c] == 0)
+        {
+            p.min[c] = b.min[c];
+            p.max[c] = b.max[c];
+            p.mean[c] = b.mean[c];
+        }
+        else
+        {
+            if (b.min[c] < p.min[c])
+                p.min[c] = b.min[c];
+            if (b.max[c] > p.max[c])
+                p.max[c] = b.max[c];
+            p.mean[c] += (b.mean[c] - p.mean[c]) * b.count / (double)(p.count[c] + b.count);
+        }
+        p.count[c] += b.count;
+    }
+    p.flags |= b.flags;
+}
+
+int EnvelopeReader::query(double t0, double t1, int points, EnvelopePoint *out)
+{
+    if (points < 1)
+        return -1;
+    memset(out, 0, sizeof(EnvelopePoint) * points);
+    if (!file || !(t1 > t0))
+        return -1;
+    double width = (t1 - t0) / points;
+    int used = -1;
+    for (size_t n=0;n<sections.size();++n)
+    {
+        const Section &s = sections[n];
+        double origin = s.head.origin;
+        double end = origin + s.trailer.buckets * s.head.bucketSeconds;
+        if (s.trailer.root < 0 || end <= t0 || origin >= t1)
+            continue;
+
+        // coarsest level with buckets no wider than a point
+        int level = 0;
+        double w = s.head.bucketSeconds;
+        while (level < s.trailer.rootLevel && 4.0 * w <= width)
+        {
+            ++level;
+            w *= 4.0;
+        }
+        long long last = (s.trailer.buckets - 1) >> (2 * level);
+        long long i0 = (long long)floor(((t0 > origin ? t0 : origin) - origin) / w);
+        long long i1 = (long long)ceil(((t1 < end ? t1 : end) - origin) / w) - 1;
+        if (i0 < 0)
+            i0 = 0;
+        if (i1 > last)
+            i1 = last;
+
+        for (long long k=i0/ENVELOPE_PAGE;k<=i1/ENVELOPE_PAGE;++k)
+        {
+            long long at = findPage(s, level, k);
+            if (at < 0)
+                continue;
+            long long j0 = (i0 > k * ENVELOPE_PAGE) ? i0 : k * ENVELOPE_PAGE;
+            long long j1 = (i1 < k * ENVELOPE_PAGE + ENVELOPE_PAGE - 1) ? i1 : k * ENVELOPE_PAGE + ENVELOPE_PAGE - 1;
+            int nb = (int)(j1 - j0 + 1);
+            long long pos = at + (long long)sizeof(EnvelopePageHead) + (j0 - k * ENVELOPE_PAGE) * (long long)sizeof(EnvelopeBucket);
+            if (!sinkSeek(file, pos) || fread(buf, sizeof(EnvelopeBucket), nb, file) != (size_t)nb)
+                continue;
+            bytes += sizeof(EnvelopeBucket) * nb;
+            for (int i=0;i<nb;++i)
+            {
+                if (buf[i].count == 0)
+                    continue;
+                double b0 = origin + (j0 + i) * w;
+                int p0, p1;
+                if (w > width)
+                {
+                    // wider than a point: every point it spans
+                    p0 = (int)floor((b0 - t0) / width);
+                    p1 = (int)ceil((b0 + w - t0) / width) - 1;
+                }
+                else
+                    p0 = p1 = (int)floor((b0 + 0.5 * w - t0) / width);
+                if (p0 < 0)
+                    p0 = 0;
+                if (p1 >= points)
+                    p1 = points - 1;
+                for (int p=p0;p<=p1;++p)
+                    merge(out[p], buf[i]);
+            }
+            used = level;
+        }
+    }
+    return used;
+}
@@ -0,0 +1,110 @@
+//---------------------------------------------------------------------------
+
+#ifndef EnvelopeSinkH
+#define EnvelopeSinkH
+
+#include <stdio.h>
+#include <vector>
+#include "CaptureSink.h"
+#include "Envelope.h"
+
+//---------------------------------------------------------------------------
+
+// min / max / mean pyramid beside a capture file (see Envelope.h)
+//
+// The samples are saved as usual and the pyramid goes to "run.dat.env" beside them;
+// segmented captures get one per segment ("run_0000.dat.env"). Every packet the capture file
+// gets is summarised, on the writer thread; the receive side is not touched.
+// A 1.25 MHz X,Y stream in 256 sample buckets adds about 3.6% to the capture.
+
+class EnvelopeSink : public CaptureSink
+{
+protected:
+    CaptureSink *samples;           // capture file the samples go to
+    EnvelopeOptions options;
+    EnvelopeBuilder builder;
+    FILE *file;
+    SinkPath name;
+    bool partial;                   // ".part" until closed (segment)
+
+    int rate;                       // rate code of the open section
+    long long firstSample;          // its CapturePacket.sample at bucket 0
+    double lastTime;                // arrival of the last packet
+    float values[512];
+
+    void beginSection(const CapturePacket &pkt, int frames);
+
+public:
+    // takes ownership of samples
+    EnvelopeSink(const EnvelopeOptions &opt, CaptureSink *samples);
+    virtual ~EnvelopeSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();           // samples and envelope
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+    virtual long long syncCount() const;
+    virtual double syncTime() const;
+    virtual void idle(double now);
+};
+
+// one point of a drawing: everything in its span
+struct EnvelopePoint
+{
+    long long count[ENVELOPE_CHANNELS];     // samples of each channel; 0 = none in the span
+    unsigned int flags;             // as EnvelopeBucket
+    float min[ENVELOPE_CHANNELS];
+    float max[ENVELOPE_CHANNELS];
+    double mean[ENVELOPE_CHANNELS];
+};
+
+// read back envelopes
+class EnvelopeReader
+{
+protected:
+    struct Section
+    {
+        EnvelopeSectionHead head;
+        EnvelopeTrailer trailer;
+    };
+    FILE *file;
+    EnvelopeFileHead fileHead;
+    std::vector<Section> sections;  // oldest first
+    // last page head read at each level of the current section, for walking down
+    long long cachedOffset[ENVELOPE_LEVELS];
+    EnvelopePageHead cached[ENVELOPE_LEVELS];
+    EnvelopeBucket buf[ENVELOPE_PAGE];
+    long long bytes;
+
+    void merge(EnvelopePoint &p, const EnvelopeBucket &b);
+    bool readPageHead(long long offset, EnvelopePageHead &h);
+    long long findPage(const Section &s, int level, long long index);
+
+public:
+    EnvelopeReader();
+    ~EnvelopeReader();
+
+    bool open(const SinkPath &fname);
+    void close();
+
+    const EnvelopeFileHead &info() const;
+    int sectionCount() const;
+    const EnvelopeSectionHead &section(int i) const;
+    double startTime() const;       // captureClock() seconds; 0 if empty
+    double endTime() const;
+
+    // span t0 .. t1 (captureClock() seconds) drawn as points columns: fills out[0 .. points-1];
+    // returns the level read (of the last section in the span), -1 if the span has no data
+    // Buckets are read from the level with at most 4 to a point; below level 0's resolution
+    // a bucket fills every point it spans.
+    int query(double t0, double t1, int points, EnvelopePoint *out);
+
+    long long bytesRead() const;    // by queries so far
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,119 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "Fft.h"
+#include "CaptureSimd.h"
+#include <math.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// radix-2 FFT for the noise spectra (WelchPsd.cpp)
+// Stages with half length 1 and 2 are plain C++; from 4 on, SSE2 / NEON do 4 butterflies per step
+// with the same multiplies and adds in the same order, so results match the plain version.
+
+bool isPowerOf2(int n)
+{
+    return (n > 0 && (n & (n - 1)) == 0);
+}
+
+Fft::Fft(int size)
+{
+    n = size;
+    int bits = 0;
+    while ((1 << bits) < n)
+        ++bits;
+    for (int i=0;i<n;++i)
+    {
+        int r = 0;
+        for (int b=0;b<bits;++b)
+            if (i & (1 << b))
+                r |= 1 << (bits - 1 - b);
+        if (r > i)
+        {
+            swaps.push_back(i);
+            swaps.push_back(r);
+        }
+    }
+    // twiddles in double, rounded once
+    twRe.resize(n > 1 ? n - 1 : 1);
+    twIm.resize(n > 1 ? n - 1 : 1);
+    const double pi = 3.14159265358979323846;
+    for (int h=1;h<n;h*=2)
+    {
+        for (int j=0;j<h;++j)
+        {
+            twRe[h - 1 + j] = (float)cos(pi * j / h);
+            twIm[h - 1 + j] = (float)-sin(pi * j / h);
+        }
+    }
+}
+
+int Fft::size() const
+{
+    return n;
+}
+
+void Fft::forward(float *re, float *im) const
+{
+    for (size_t s=0;s<swaps.size();s+=2)
+    {
+        int a = swaps[s], b = swaps[s + 1];
+        float t = re[a]; re[a] = re[b]; re[b] = t;
+        t = im[a]; im[a] = im[b]; im[b] = t;
+    }
+
+    for (int h=1;h<n;h*=2)
+    {
+        const float *wr = &twRe[h - 1];
+        const float *wi = &twIm[h - 1];
+        for (int s=0;s<n;s+=2*h)
+        {
+            float *ar = re + s, *ai = im + s;
+            float *br = ar + h, *bi = ai + h;
+            int j = 0;
+#if defined(CAPTURE_SSE2)
+            for (; j+4<=h; j+=4)
+            {
+                __m128 xr = _mm_loadu_ps(br + j), xi = _mm_loadu_ps(bi + j);
+                __m128 cr = _mm_loadu_ps(wr + j), ci = _mm_loadu_ps(wi + j);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(cr, xr), _mm_mul_ps(ci, xi));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(cr, xi), _mm_mul_ps(ci, xr));
+                __m128 ur = _mm_loadu_ps(ar + j), ui = _mm_loadu_ps(ai + j);
+                _mm_storeu_ps(br + j, _mm_sub_ps(ur, tr));
+                _mm_storeu_ps(bi + j, _mm_sub_ps(ui, ti));
+                _mm_storeu_ps(ar + j, _mm_add_ps(ur, tr));
+                _mm_storeu_ps(ai + j, _mm_add_ps(ui, ti));
+            }
+#elif defined(CAPTURE_NEON)
+            for (; j+4<=h; j+=4)
+            {
+                float32x4_t xr = vld1q_f32(br + j), xi = vld1q_f32(bi + j);
+                float32x4_t cr = vld1q_f32(wr + j), ci = vld1q_f32(wi + j);
+                float32x4_t tr = vsubq_f32(vmulq_f32(cr, xr), vmulq_f32(ci, xi));
+                float32x4_t ti = vaddq_f32(vmulq_f32(cr, xi), vmulq_f32(ci, xr));
+                float32x4_t ur = vld1q_f32(ar + j), ui = vld1q_f32(ai + j);
+                vst1q_f32(br + j, vsubq_f32(ur, tr));
+                vst1q_f32(bi + j, vsubq_f32(ui, ti));
+                vst1q_f32(ar + j, vaddq_f32(ur, tr));
+                vst1q_f32(ai + j, vaddq_f32(ui, ti));
+            }
+#endif
+            for (; j<h; ++j)
+            {
+                float xr = br[j], xi = bi[j];
+                float pr = wr[j] * xr, qr = wi[j] * xi;
+                float pi = wr[j] * xi, qi = wi[j] * xr;
+                float tr = pr - qr, ti = pi + qi;
+                float ur = ar[j], ui = ai[j];
+                br[j] = ur - tr;
+                bi[j] = ui - ti;
+                ar[j] = ur + tr;
+                ai[j] = ui + ti;
+            }
+        }
+    }
+}
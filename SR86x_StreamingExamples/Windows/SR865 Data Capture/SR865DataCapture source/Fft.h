@@ -0,0 +1,36 @@
+//---------------------------------------------------------------------------
+
+#ifndef FftH
+#define FftH
+
+#include <vector>
+
+//---------------------------------------------------------------------------
+
+// fixed size complex FFT (radix-2, decimation in time), single precision
+//
+// The size is set once; the bit reversal and twiddle tables are computed then,
+// so forward() does no allocation and no trigonometry.
+// Data is split complex (real & imaginary parts in separate arrays), which lets
+// the butterflies of the later stages work on 4 points at a time (CaptureSimd.h).
+
+class Fft
+{
+protected:
+    int n;
+    std::vector<int> swaps;         // index pairs exchanged by the bit reversal
+    std::vector<float> twRe, twIm;  // twiddles; the stage with half length h keeps its h at [h-1]
+
+public:
+    Fft(int size);                  // power of 2, at least 2
+
+    int size() const;
+
+    // in place, unscaled: X[k] = sum x[j] exp(-2 pi i jk/n)
+    void forward(float *re, float *im) const;
+};
+
+bool isPowerOf2(int n);
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,426 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "FlagSink.h"
+#include "CaptureSync.h"
+#include "PacketSequence.h"
+#include <string.h>
+#include <time.h>
+#include <limits>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// flag timelines
+// A packet's flags come with the packet after it, so each packet is held back (last) until then;
+// an event is written only where the flags of the capture file's packets change.
+
+static const long long never = std::numeric_limits<long long>::max();
+static const float missing = std::numeric_limits<float>::quiet_NaN();
+
+// packets of a binary capture file, by their headers; -1 if it is not one (csv, compressed, columns)
+// or does not end on a packet boundary
+static long long filePackets(const SinkPath &fname)
+{
+    FILE *f = sinkOpen(fname, "rb");
+    if (!f)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    long long size = sinkTell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned int buf[257];
+    long long pos = 0, n = 0;
+    while (pos < size && fread(buf, 4, 1, f) == 1)
+    {
+        PacketHeader hdr(buf[0]);
+        int len = hdr.byteLength();
+        if (!hdr.isGood() || fread(buf + 1, 1, len, f) != (size_t)len)
+            break;
+        pos += 4 + len;
+        ++n;
+    }
+    fclose(f);
+    return (pos == size) ? n : -1;
+}
+
+FlagSink::FlagSink(CaptureSink *sampleSink)
+{
+    samples = sampleSink;
+    file = NULL;
+    partial = false;
+    packets = written = events = 0;
+    memset(&last, 0, sizeof(last));
+    lastSeq = 0;
+    pending = false;
+    endSample = 0;
+    endTime = 0.0;
+    state = 0;
+    inRun = false;
+}
+/*virtual*/ FlagSink::~FlagSink()
+{
+    close();
+    delete samples;
+}
+
+/*virtual*/ bool FlagSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    if (!samples->open(fname, trunc))
+        return false;
+    // "run.dat" -> "run.dat.flg"; "run_0000.dat.part" -> "run_0000.dat.flg.part"
+    name = fname;
+    SinkPath part = sinkPath(".part");
+    partial = (name.length() > part.length() && name.compare(name.length() - part.length(), part.length(), part) == 0);
+    if (partial)
+        name.erase(name.length() - part.length());
+    name += sinkPath(".flg");
+    if (partial)
+        name += part;
+
+    packets = written = events = 0;
+    pending = inRun = false;
+    long long size = 0;
+    if (!trunc && !resume(fname, size))
+    {
+        samples->close();
+        return false;
+    }
+    file = sinkOpen(name, trunc ? "wb" : "ab");
+    if (!file)
+    {
+        samples->close();
+        return false;
+    }
+    if (size == 0)
+    {
+        FlagFileHead head;
+        memset(&head, 0, sizeof(head));
+        memcpy(head.id, FLAG_FILE_ID, 8);
+        head.wallTime = (double)time(0);
+        head.clockTime = captureClock();
+        fwrite(&head, sizeof(head), 1, file);
+    }
+    return true;
+}
+
+// carry on an existing timeline: cut it back to whole records (appending always writes at the end),
+// and take up its packet count; size gets its length, 0 if there is none
+bool FlagSink::resume(const SinkPath &fname, long long &size)
+{
+    const long long headBytes = sizeof(FlagFileHead), eventBytes = sizeof(FlagEvent);
+    FILE *f = sinkOpen(name, "rb");
+    if (!f)
+    {
+        // no timeline yet; it starts after the packets already in the capture file, where they can be counted
+        long long n = filePackets(fname);
+        packets = (n > 0) ? n : 0;
+        return true;
+    }
+    fseek(f, 0, SEEK_END);
+    long long all = sinkTell(f);
+    size = (all < headBytes) ? 0 : all - (all - headBytes) % eventBytes;
+    FlagEvent ev;
+    memset(&ev, 0, sizeof(ev));
+    bool ended = false;
+    if (size >= headBytes + eventBytes && sinkSeek(f, size - eventBytes) && fread(&ev, sizeof(ev), 1, f) == 1)
+        ended = (ev.flags & FLAG_END) != 0;
+    fclose(f);
+    if (size < all && !sinkTruncate(name, size))
+        return false;
+    if (ended)
+    {
+        packets = ev.packet;
+        return true;
+    }
+    // cut off before its end event (or none written yet): how many packets came after its last event
+    // went with it, so count the capture file's; a file that can't be counted is not carried on
+    packets = filePackets(fname);
+    return (packets >= ev.packet);
+}
+/*virtual*/ bool FlagSink::isOpen() const
+{
+    return (file != NULL);
+}
+/*virtual*/ void FlagSink::close()
+{
+    if (file)
+    {
+        if (pending)
+            settle(FLAG_UNKNOWN);
+        if (written > 0)
+        {
+            FlagEvent ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.packet = packets;
+            ev.sample = endSample;
+            ev.time = endTime;
+            ev.flags = FLAG_END;
+            put(ev);
+        }
+        fclose(file);
+        file = NULL;
+        if (partial)
+            sinkRename(name, name.substr(0, name.length() - 5));    // drop ".part"
+    }
+    samples->close();
+}
+
+void FlagSink::put(const FlagEvent &ev)
+{
+    fwrite(&ev, sizeof(ev), 1, file);
+    ++events;
+}
+
+// the held back packet's flags are known
+void FlagSink::settle(unsigned int flags)
+{
+    if (!inRun || flags != state)
+    {
+        FlagEvent ev = last;
+        ev.flags = flags;
+        put(ev);
+        state = flags;
+        inRun = true;
+    }
+    pending = false;
+}
+
+/*virtual*/ void FlagSink::write(const CapturePacket &pkt)
+{
+    if (!file)
+        return;
+    samples->write(pkt);
+    if (pkt.nwords < 1)
+        return;
+
+    unsigned int over = (pkt.buffer[0] >> 24) & (FLAG_OVERLOAD | FLAG_ERROR);
+    if (pending)
+        settle(pkt.seq == lastSeq + 1 ? over : FLAG_UNKNOWN);
+
+    PacketHeader hdr(pkt.buffer[0]);
+    int frames = PacketSequence::framesOf(pkt.buffer[0]);
+    last.packet = packets;
+    last.sample = pkt.sample;
+    last.time = pkt.rxTime - frames / hdr.sampleRate();     // arrival is just after the packet's last sample
+    last.flags = 0;
+    lastSeq = pkt.seq;
+    pending = true;
+    endSample = pkt.sample + frames;
+    endTime = pkt.rxTime;
+    ++packets;
+    ++written;
+}
+
+/*virtual*/ long long FlagSink::bytesWritten()
+{
+    return events * (long long)sizeof(FlagEvent) + samples->bytesWritten();
+}
+/*virtual*/ long long FlagSink::packetsWritten() const
+{
+    return samples->packetsWritten();
+}
+/*virtual*/ void FlagSink::note(const std::string &text)
+{
+    samples->note(text);
+}
+/*virtual*/ long long FlagSink::syncCount() const
+{
+    return samples->syncCount();
+}
+/*virtual*/ double FlagSink::syncTime() const
+{
+    return samples->syncTime();
+}
+/*virtual*/ void FlagSink::idle(double now)
+{
+    samples->idle(now);
+}
+long long FlagSink::eventsWritten() const
+{
+    return events;
+}
+
+//---------------------------------------------------------------------------
+// FlagIndex
+// Run i is event i's packets: up to the next event's packet, or on and on for the last event of a
+// file that was cut off. An end event's run is empty unless it is the last (then it is past the file).
+
+FlagIndex::FlagIndex()
+{
+    memset(&fileHead, 0, sizeof(fileHead));
+}
+
+bool FlagIndex::open(const SinkPath &fname)
+{
+    close();
+    SinkPath name = fname;
+    SinkPath ext = sinkPath(".flg");
+    if (name.length() < ext.length() || name.compare(name.length() - ext.length(), ext.length(), ext) != 0)
+        name += ext;
+    FILE *file = sinkOpen(name, "rb");
+    if (!file)
+        return false;
+    bool ok = (fread(&fileHead, sizeof(fileHead), 1, file) == 1 && memcmp(fileHead.id, FLAG_FILE_ID, 8) == 0);
+    FlagEvent buf[256];
+    size_t n;
+    while (ok && (n = fread(buf, sizeof(FlagEvent), 256, file)) > 0)
+        events.insert(events.end(), buf, buf + n);
+    fclose(file);
+    if (!ok)
+        close();
+    return ok;
+}
+void FlagIndex::close()
+{
+    memset(&fileHead, 0, sizeof(fileHead));
+    events.clear();
+}
+
+const FlagFileHead &FlagIndex::info() const
+{
+    return fileHead;
+}
+int FlagIndex::eventCount() const
+{
+    return (int)events.size();
+}
+const FlagEvent &FlagIndex::event(int i) const
+{
+    return events[i];
+}
+
+// last run starting at or before packet; -1 if none
+int FlagIndex::runOf(long long packet) const
+{
+    int lo = 0, hi = (int)events.size();
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (events[mid].packet <= packet)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+int FlagIndex::runOfSample(long long sample) const
+{
+    int lo = 0, hi = (int)events.size();
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (events[mid].sample <= sample)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+long long FlagIndex::endOf(int run) const
+{
+    return (run + 1 < (int)events.size()) ? events[run + 1].packet : never;
+}
+long long FlagIndex::endSampleOf(int run) const
+{
+    return (run + 1 < (int)events.size()) ? events[run + 1].sample : never;
+}
+
+unsigned int FlagIndex::flagsOf(long long packet) const
+{
+    int r = runOf(packet);
+    return (r < 0) ? 0 : (events[r].flags & ~FLAG_END);
+}
+
+unsigned int FlagIndex::flagsIn(long long first, long long count) const
+{
+    unsigned int flags = 0;
+    int r = runOf(first);
+    if (r < 0)
+        r = 0;
+    for (;r<(int)events.size() && events[r].packet < first + count;++r)
+    {
+        if (endOf(r) > first)
+            flags |= events[r].flags & ~FLAG_END;
+    }
+    return flags;
+}
+
+long long FlagIndex::nextClean(long long packet, unsigned int mask) const
+{
+    int r = runOf(packet);
+    if (r < 0)
+        return events.empty() ? -1 : packet;
+    for (;r<(int)events.size();++r)
+    {
+        long long from = (events[r].packet > packet) ? events[r].packet : packet;
+        if (from >= endOf(r))
+            continue;
+        if (events[r].flags & FLAG_END)
+            return -1;              // past the last packet
+        if (!(events[r].flags & mask))
+            return from;
+    }
+    return -1;
+}
+long long FlagIndex::nextAffected(long long packet, unsigned int mask) const
+{
+    int r = runOf(packet);
+    if (r < 0)
+        r = 0;
+    for (;r<(int)events.size();++r)
+    {
+        long long from = (events[r].packet > packet) ? events[r].packet : packet;
+        if (from >= endOf(r))
+            continue;
+        if (events[r].flags & FLAG_END)
+            return -1;
+        if (events[r].flags & mask)
+            return from;
+    }
+    return -1;
+}
+
+// a cut off last run counts as its first packet
+long long FlagIndex::affectedPackets(unsigned int mask) const
+{
+    long long n = 0;
+    for (int r=0;r<(int)events.size();++r)
+    {
+        if (!(events[r].flags & mask) || (events[r].flags & FLAG_END))
+            continue;
+        long long end = endOf(r);
+        n += (end == never) ? 1 : end - events[r].packet;
+    }
+    return n;
+}
+
+int FlagIndex::maskSamples(long long firstSample, int frames, int nch, float *values, unsigned int mask) const
+{
+    long long end = firstSample + frames;
+    int masked = 0;
+    int r = runOfSample(firstSample);
+    if (r < 0)
+        r = 0;
+    for (;r<(int)events.size() && events[r].sample < end;++r)
+    {
+        if (!(events[r].flags & mask) || (events[r].flags & FLAG_END))
+            continue;
+        long long a = (events[r].sample > firstSample) ? events[r].sample : firstSample;
+        long long b = endSampleOf(r);
+        if (b > end)
+            b = end;
+        for (long long i=a;i<b;++i)
+        {
+            float *f = values + (i - firstSample) * nch;
+            for (int k=0;k<nch;++k)
+                f[k] = missing;
+        }
+        if (b > a)
+            masked += (int)(b - a);
+    }
+    return masked;
+}
@@ -0,0 +1,131 @@
+//---------------------------------------------------------------------------
+
+#ifndef FlagSinkH
+#define FlagSinkH
+
+#include <stdio.h>
+#include <vector>
+#include "CaptureSink.h"
+
+//---------------------------------------------------------------------------
+
+// timeline of the overload / error flags beside a capture file
+//
+// Every packet header carries two flags (bits 24 & 25: overload, error) that tell about the packet
+// before it. FlagSink writes where they change to "run.dat.flg" beside the samples (segments: one per
+// segment, "run_0000.dat.flg"), so a reader can tell which packets are affected from a few records
+// instead of reading every header. The file is a FlagFileHead, then FlagEvents in order (host byte order):
+// each gives the flags of the capture file's packets from its packet up to the next event's.
+// A packet whose successor was not saved (lost, or cut by a trigger) never gets its flags: FLAG_UNKNOWN.
+// The last event of a closed file is FLAG_END, one past its last packet; a file without it was cut off,
+// and its last run goes on to the end of the capture.
+// Appending carries on the timeline from its end event; one that was cut off is carried on only beside
+// a binary capture file, whose packets can be counted (otherwise open() fails).
+
+#define FLAG_OVERLOAD   0x01
+#define FLAG_ERROR      0x02
+#define FLAG_UNKNOWN    0x04        // flags of the packet never arrived
+#define FLAG_END        0x80        // end of the packets written in one go
+
+#define FLAG_FILE_ID    "SR86xFL1"
+
+struct FlagFileHead
+{
+    char id[8];                     // "SR86xFL1"
+    double wallTime;                // time() when file was created
+    double clockTime;               // captureClock() when file was created
+};
+
+struct FlagEvent
+{
+    long long packet;               // index of the packet in the capture file
+    long long sample;               // its CapturePacket.sample (first sample)
+    double time;                    // its first sample (captureClock() seconds; arrival less the packet's length)
+    unsigned int flags;             // FLAG_OVERLOAD .. of this packet and the ones up to the next event
+    unsigned int reserved;
+};
+
+class FlagSink : public CaptureSink
+{
+protected:
+    CaptureSink *samples;           // capture file the samples go to
+    FILE *file;
+    SinkPath name;
+    bool partial;                   // ".part" until closed (segment)
+    long long packets;              // packets of the capture file, before this session's as well
+    long long written;              // packets of this session
+    long long events;
+
+    FlagEvent last;                 // last packet written; its flags are not known yet
+    long long lastSeq;
+    bool pending;                   // last holds a packet
+    long long endSample;            // one past the last packet
+    double endTime;
+    unsigned int state;             // flags of the open run
+    bool inRun;
+
+    bool resume(const SinkPath &fname, long long &size);
+    void put(const FlagEvent &ev);
+    void settle(unsigned int flags);
+
+public:
+    // takes ownership of samples
+    FlagSink(CaptureSink *samples);
+    virtual ~FlagSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();           // samples and flags
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+    virtual long long syncCount() const;
+    virtual double syncTime() const;
+    virtual void idle(double now);
+
+    long long eventsWritten() const;
+};
+
+// read back a flag timeline: the whole file is held, a few records per overload
+// Packets are indices in the capture file, samples CapturePacket.sample; mask is the flags that count
+// as affected (FLAG_OVERLOAD | FLAG_ERROR, with FLAG_UNKNOWN to leave out packets that can't be vouched for).
+class FlagIndex
+{
+protected:
+    FlagFileHead fileHead;
+    std::vector<FlagEvent> events;  // in order of packet
+
+    int runOf(long long packet) const;
+    int runOfSample(long long sample) const;
+    long long endOf(int run) const;
+    long long endSampleOf(int run) const;
+
+public:
+    FlagIndex();
+
+    // fname is the flag file, or the capture file beside it
+    bool open(const SinkPath &fname);
+    void close();
+
+    const FlagFileHead &info() const;
+    int eventCount() const;
+    const FlagEvent &event(int i) const;
+
+    // flags of a packet; 0 outside the file
+    unsigned int flagsOf(long long packet) const;
+    // flags of any of count packets from first
+    unsigned int flagsIn(long long first, long long count) const;
+    // first packet from packet on that is (not) affected; -1 if none
+    long long nextClean(long long packet, unsigned int mask) const;
+    long long nextAffected(long long packet, unsigned int mask) const;
+    long long affectedPackets(unsigned int mask) const;
+
+    // sets the samples of frames frames of nch channels from firstSample to NaN where affected;
+    // returns the number of frames masked (samples are numbered per capture session: not across an append)
+    int maskSamples(long long firstSample, int frames, int nch, float *values, unsigned int mask) const;
+};
+
+//---------------------------------------------------------------------------
+#endif
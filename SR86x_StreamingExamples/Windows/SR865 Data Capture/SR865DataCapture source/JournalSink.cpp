@@ -0,0 +1,327 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "JournalSink.h"
+#include "CaptureSync.h"
+#include <string.h>
+#include <time.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// journaled capture file
+// Order matters: the capture file is synced first, then the checkpoint that points into it,
+// so a checkpoint never claims data that is not on disk yet.
+
+static const char checkpointId[9] = "SR86xCK1";
+
+static unsigned int crc32(const void *data, int n)
+{
+    static unsigned int table[256];
+    static bool init = false;
+    if (!init)
+    {
+        for (unsigned int i=0;i<256;++i)
+        {
+            unsigned int c = i;
+            for (int k=0;k<8;++k)
+                c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+            table[i] = c;
+        }
+        init = true;
+    }
+    const unsigned char *p = (const unsigned char *)data;
+    unsigned int crc = 0xffffffffu;
+    for (int i=0;i<n;++i)
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+static bool validCheckpoint(const CheckpointRecord &rec)
+{
+    return (memcmp(rec.id, checkpointId, 8) == 0
+            && rec.crc == crc32(&rec, (int)((const char *)&rec.crc - (const char *)&rec)));
+}
+
+//---------------------------------------------------------------------------
+// JournalSink
+
+JournalSink::JournalSink(int syncPackets, double syncSeconds)
+{
+    file = NULL;
+    ckp = NULL;
+    everyPackets = syncPackets;
+    everySeconds = syncSeconds;
+    seq = 0;
+    bytes = 0;
+    packets = 0;
+    lastOffset = -1;
+    lastHeader = 0;
+    lastTime = 0.0;
+    pending = 0;
+    lastSync = 0.0;
+    syncs = 0;
+    syncTotal = 0.0;
+    goodBytes = goodPackets = 0;
+    goodOffset = -1;
+    goodHeader = 0;
+    goodTime = 0.0;
+}
+/*virtual*/ JournalSink::~JournalSink()
+{
+    close();
+}
+
+/*virtual*/ bool JournalSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    fileName = fname;
+    ckpName = fname + sinkPath(".ckp");
+    seq = 0;
+    lastOffset = -1;
+    lastHeader = 0;
+    lastTime = 0.0;
+    bool resumed = false;
+    if (!trunc)
+    {
+        // an earlier capture may have died; append after its last good packet
+        CheckpointRecord rec;
+        long long cut;
+        if (recoverCapture(fname, rec, cut) == recoverDone)
+        {
+            seq = rec.seq;
+            lastOffset = rec.lastOffset;
+            lastHeader = rec.lastHeader;
+            lastTime = rec.lastTime;
+            resumed = true;
+        }
+    }
+
+    file = sinkOpen(fname, trunc ? "wb" : "ab");
+    if (!file)
+        return false;
+    setvbuf(file, NULL, _IOFBF, 1 << 18);
+    // a checkpoint that was not carried on (new file, or one that did not match) must not outrank seq 1
+    ckp = resumed ? sinkOpen(ckpName, "r+b") : NULL;
+    if (!ckp)
+        ckp = sinkOpen(ckpName, "w+b");
+    if (!ckp)
+    {
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    bytes = sinkTell(file);
+    packets = 0;
+    notes.setCapture(fname);
+    if (!checkpoint())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+/*virtual*/ bool JournalSink::isOpen() const
+{
+    return (file != NULL);
+}
+/*virtual*/ void JournalSink::close()
+{
+    if (file)
+    {
+        // file is complete; checkpoint no longer needed
+        bool synced = checkpoint();
+        fclose(file);
+        file = NULL;
+        fclose(ckp);
+        ckp = NULL;
+        if (synced)
+            sinkRemove(ckpName);
+    }
+    notes.close();
+}
+/*virtual*/ void JournalSink::note(const std::string &text)
+{
+    if (file)
+        notes.write(text);
+}
+
+bool JournalSink::checkpoint()
+{
+    double t0 = captureClock();
+    if (!sinkSync(file))
+        return false;
+
+    CheckpointRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.id, checkpointId, 8);
+    rec.seq = ++seq;
+    rec.lastHeader = lastHeader;
+    rec.bytes = bytes;
+    rec.lastOffset = lastOffset;
+    rec.lastTime = lastTime;
+    rec.wallTime = (double)time(0);
+    rec.crc = crc32(&rec, (int)((const char *)&rec.crc - (const char *)&rec));
+
+    bool ok = sinkSeek(ckp, (long long)(rec.seq & 1) * sizeof(rec))
+              && fwrite(&rec, sizeof(rec), 1, ckp) == 1
+              && sinkSync(ckp);
+    if (ok)
+    {
+        goodBytes = bytes;
+        goodPackets = packets;
+        goodOffset = lastOffset;
+        goodHeader = lastHeader;
+        goodTime = lastTime;
+    }
+
+    double t1 = captureClock();
+    pending = 0;
+    lastSync = t1;
+    if (ok)
+    {
+        syncTotal += t1 - t0;
+        ++syncs;
+    }
+    return ok;
+}
+
+/*virtual*/ void JournalSink::write(const CapturePacket &pkt)
+{
+    if (!file)
+        return;
+
+    int n = pkt.nwords << 2;
+    if (fwrite(pkt.buffer, 1, n, file) != (size_t)n)
+    {
+        backToCheckpoint(packets - goodPackets + 1);    // disk full; part of a packet may be in the file
+        return;
+    }
+    lastOffset = bytes;
+    lastHeader = pkt.buffer[0];
+    lastTime = pkt.rxTime;
+    bytes += n;
+    ++packets;
+    ++pending;
+
+    if ((everyPackets > 0 && pending >= everyPackets)
+        || (everySeconds > 0.0 && pkt.rxTime - lastSync >= everySeconds))
+    {
+        if (!checkpoint())
+            backToCheckpoint(packets - goodPackets);
+    }
+}
+
+/*virtual*/ void JournalSink::idle(double now)
+{
+    // no packet to trigger the timed sync; don't leave the last ones in stdio buffers
+    if (file && pending > 0 && everySeconds > 0.0 && now - lastSync >= everySeconds)
+    {
+        if (!checkpoint())
+            backToCheckpoint(packets - goodPackets);
+    }
+}
+
+// after a failed write or sync the file's length is not known (buffered packets may be partly written):
+// cut it back to the last checkpoint, so bytes and lastOffset match the file again
+bool JournalSink::backToCheckpoint(long long lost)
+{
+    fclose(file);
+    file = NULL;
+    if (sinkTruncate(fileName, goodBytes))
+        file = sinkOpen(fileName, "ab");
+    if (!file)
+    {
+        // the .ckp stays; recoverCapture() cuts the file back later
+        fclose(ckp);
+        ckp = NULL;
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 18);
+    bytes = goodBytes;
+    packets = goodPackets;
+    lastOffset = goodOffset;
+    lastHeader = goodHeader;
+    lastTime = goodTime;
+    pending = 0;
+    char text[80];
+    sprintf(text, "%lld packets not saved: write to disk failed", lost);
+    notes.write(text);
+    return true;
+}
+
+/*virtual*/ long long JournalSink::bytesWritten()
+{
+    return bytes;
+}
+/*virtual*/ long long JournalSink::packetsWritten() const
+{
+    return packets;
+}
+
+/*virtual*/ long long JournalSink::syncCount() const
+{
+    return syncs;
+}
+/*virtual*/ double JournalSink::syncTime() const
+{
+    return syncTotal;
+}
+
+//---------------------------------------------------------------------------
+// recovery
+
+bool readCheckpoint(const SinkPath &ckpName, CheckpointRecord &rec)
+{
+    FILE *f = sinkOpen(ckpName, "rb");
+    if (!f)
+        return false;
+    CheckpointRecord slot[2];
+    int n = (int)fread(slot, sizeof(CheckpointRecord), 2, f);
+    fclose(f);
+
+    bool found = false;
+    for (int i=0;i<n;++i)
+    {
+        if (validCheckpoint(slot[i]) && (!found || slot[i].seq > rec.seq))
+        {
+            rec = slot[i];
+            found = true;
+        }
+    }
+    return found;
+}
+
+RecoverResult recoverCapture(const SinkPath &fname, CheckpointRecord &rec, long long &cut, bool truncate)
+{
+    cut = 0;
+    if (!readCheckpoint(fname + sinkPath(".ckp"), rec))
+        return recoverNone;
+
+    FILE *f = sinkOpen(fname, "rb");
+    if (!f)
+        return recoverFailed;
+    fseek(f, 0, SEEK_END);
+    long long size = sinkTell(f);
+
+    // the last durable packet must be where the checkpoint says it is
+    bool ok = (size >= rec.bytes);
+    if (ok && rec.lastOffset >= 0)
+    {
+        unsigned int hdr = 0;
+        ok = sinkSeek(f, rec.lastOffset) && fread(&hdr, 4, 1, f) == 1 && hdr == rec.lastHeader;
+    }
+    fclose(f);
+    if (!ok)
+        return recoverFailed;
+
+    cut = size - rec.bytes;
+    if (cut > 0 && truncate && !sinkTruncate(fname, rec.bytes))
+        return recoverFailed;
+    return recoverDone;
+}
@@ -0,0 +1,98 @@
+//---------------------------------------------------------------------------
+
+#ifndef JournalSinkH
+#define JournalSinkH
+
+#include <stdio.h>
+#include "CaptureSink.h"
+
+//---------------------------------------------------------------------------
+
+// journaled binary capture file
+//
+// Same file format as FileSink (binary), but the file is synced to disk on a packet boundary
+// every syncPackets packets and/or syncSeconds seconds, and after each sync a checkpoint
+// is written to "run.dat.ckp". If the program or computer dies, everything up to the last
+// checkpoint is known good; recoverCapture() cuts off the rest without reading the file.
+// The .ckp file is removed when the capture file is closed normally.
+// If a write or sync fails (disk full), the file is cut back to the last checkpoint and capture goes on.
+//
+// run.dat.ckp holds two CheckpointRecord slots, written alternately,
+// so a crash while writing one slot still leaves the other.
+
+struct CheckpointRecord
+{
+    char id[8];                     // "SR86xCK1"
+    unsigned int seq;               // checkpoint number; the valid slot with the higher seq wins
+    unsigned int lastHeader;        // header of last durable packet (packet counter in low 8 bits)
+    long long bytes;                // durable length of capture file; always a packet boundary
+    long long lastOffset;           // file offset of last durable packet; -1 if none
+    double lastTime;                // arrival time of last durable packet (captureClock() seconds)
+    double wallTime;                // time() of this checkpoint
+    unsigned int reserved;
+    unsigned int crc;               // crc32 of all of the above
+};
+
+class JournalSink : public CaptureSink
+{
+protected:
+    FILE *file;
+    FILE *ckp;
+    SinkPath fileName;
+    SinkPath ckpName;
+    int everyPackets;               // sync after this many packets; 0 = no packet limit
+    double everySeconds;            // sync at least this often; 0 = no time limit
+    unsigned int seq;
+    long long bytes;                // file length (everything written, durable or not)
+    long long packets;
+    long long lastOffset;
+    unsigned int lastHeader;
+    double lastTime;
+    int pending;                    // packets written since last checkpoint
+    double lastSync;                // captureClock() of last checkpoint
+    long long syncs;
+    double syncTotal;               // total seconds spent in checkpoint()
+    long long goodBytes;            // bytes, packets .. at the last checkpoint
+    long long goodPackets;
+    long long goodOffset;
+    unsigned int goodHeader;
+    double goodTime;
+    SinkNotes notes;
+
+    bool checkpoint();
+    bool backToCheckpoint(long long lost);
+
+public:
+    JournalSink(int syncPackets, double syncSeconds);
+    virtual ~JournalSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+
+    virtual long long syncCount() const;    // successful syncs
+    virtual double syncTime() const;    // seconds spent syncing so far
+    virtual void idle(double now);      // sync on time when the stream has stalled
+};
+
+// newest valid checkpoint in ckpName
+bool readCheckpoint(const SinkPath &ckpName, CheckpointRecord &rec);
+
+enum RecoverResult
+{
+    recoverNone,                    // no checkpoint; file was closed normally, or was not journaled
+    recoverDone,                    // file now ends at its last checkpoint
+    recoverFailed                   // checkpoint does not match the file
+};
+
+// cut a journaled capture file back to its last checkpoint;
+// rec gets the checkpoint, cut the number of bytes removed
+RecoverResult recoverCapture(const SinkPath &fname, CheckpointRecord &rec, long long &cut, bool truncate=true);
+
+//---------------------------------------------------------------------------
+#endif
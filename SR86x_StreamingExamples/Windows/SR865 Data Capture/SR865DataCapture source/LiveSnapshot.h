@@ -0,0 +1,88 @@
+//---------------------------------------------------------------------------
+
+#ifndef LiveSnapshotH
+#define LiveSnapshotH
+
+#include <string.h>
+#include "CaptureSync.h"
+
+//---------------------------------------------------------------------------
+
+#define GAP_BUCKETS 9              // network drops by gap size: 1, 2-3, 4-7, ... 128-255, 256+ packets
+
+// live view of the stream, for the user interface and telemetry
+// All counters run from the start of the program and never reset;
+// readers keep their previous copy and take differences.
+struct LiveData
+{
+    int what;                       // content of latest packet; -1 before the first packet
+    int rate;                       // rate code of latest packet
+    float x, y, r, th;              // first sample of latest packet
+    double rxTime;                  // arrival time of latest packet (captureClock() seconds)
+    long long bytes;                // bytes received
+    long long packets;              // packets received
+    long long dropped;              // packets lost (sequence gaps); includes socketDrops
+    long long gaps[GAP_BUCKETS];    // number of sequence gaps, by size
+    long long duplicates;           // packets received twice (not saved again)
+    long long late;                 // packets received out of order (counted in dropped when their gap was seen)
+    long long retracted;            // packets counted in dropped that were a receive stall after all
+    long long unsaved;              // packets received but not queued for saving (queue full)
+    long long overloads;            // packets with the overload or error flag set
+    long long socketQueued;         // bytes waiting in the socket receive buffer, at last publish
+    long long socketBuffer;         // size of the socket receive buffer
+    long long socketDrops;          // packets this computer dropped because the socket buffer was full (Linux only)
+};
+
+// single writer, any number of readers (sequence lock)
+// The writer makes seq odd, changes the data, and makes seq even again.
+// A reader copies the data and keeps the copy only if seq was even
+// and did not change meanwhile; it never blocks the writer, and only retries
+// if it overlapped a publish (a few hundred nanoseconds, a few hundred times a second).
+// T must be plain data.
+template <class T> class SeqSnapshot
+{
+protected:
+    volatile long seq;
+    T data;
+
+public:
+    SeqSnapshot()
+    {
+        seq = 0;
+        memset(&data, 0, sizeof(data));
+    }
+
+    // writer only
+    void publish(const T &d)
+    {
+        long s = seq;
+        atomicStore(&seq, s + 1);
+        atomicFence();
+        data = d;
+        atomicStore(&seq, s + 2);
+    }
+
+    // any thread
+    void read(T &d)
+    {
+        for (;;)
+        {
+            long s = atomicLoad(&seq);
+            if (s & 1)
+                continue;           // publish in progress
+            d = data;
+            atomicFence();
+            if (seq == s)
+                return;
+        }
+    }
+
+private:
+    SeqSnapshot(const SeqSnapshot &);
+    SeqSnapshot &operator=(const SeqSnapshot &);
+};
+
+typedef SeqSnapshot<LiveData> LiveSnapshot;
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,31 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "MetricsThread.h"
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+
+// the metrics thread waits for http requests and answers them from the capture snapshots.
+// It never touches the receive or writer threads directly, so a slow client can't cost any packets.
+
+MetricsThread::MetricsThread(MetricsServer *s) : TThread(true)
+{
+    server = s;
+}
+/*virtual*/ __fastcall MetricsThread::~MetricsThread()
+{
+}
+
+// thread's main execution loop
+/*virtual*/ void __fastcall MetricsThread::Execute(void)
+{
+    do
+    {
+        server->poll(200);
+    }
+    while (!Terminated);
+}
@@ -0,0 +1,23 @@
+//---------------------------------------------------------------------------
+
+#ifndef MetricsThreadH
+#define MetricsThreadH
+
+#include <Classes.hpp>
+#include "CaptureMetrics.h"
+//---------------------------------------------------------------------------
+
+// this thread answers requests to the metrics endpoint
+class MetricsThread : public TThread
+{
+protected:
+    MetricsServer *server;
+
+public:
+    MetricsThread(MetricsServer *s);
+    virtual __fastcall ~MetricsThread();
+
+    virtual void __fastcall Execute(void);
+};
+
+#endif
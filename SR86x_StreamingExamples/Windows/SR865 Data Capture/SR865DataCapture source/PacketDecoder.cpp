@@ -0,0 +1,326 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "PacketDecoder.h"
+#include <string.h>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// packet processing for the receive thread
+// See UDPServerThread.cpp for the UDP packet format.
+
+// live.gaps bucket of a gap: 1, 2-3, 4-7, ...
+static int gapBucket(int missing)
+{
+    int b = 0;
+    while ((missing >> (b + 1)) && b < GAP_BUCKETS-1)
+        ++b;
+    return b;
+}
+
+PacketDecoder::PacketDecoder(PacketQueue *q)
+{
+    queue = q;
+    unsaved = 0;
+    turnGap = 0;
+    ahead = aheadSamples = 0;
+    lastArrival = 0.0;
+    trace = NULL;
+    hdr.setHeader(-1);
+    memset(&live, 0, sizeof(live));
+    live.what = -1;
+    live.rate = -1;
+}
+
+void PacketDecoder::setTrace(CaptureTrace *t)
+{
+    trace = t;
+}
+void PacketDecoder::restart()
+{
+    sequence.restart();
+    queue->publishHeld();
+    turnGap = 0;
+    ahead = aheadSamples = 0;
+}
+void PacketDecoder::idle(double now)
+{
+    // a stalled stream leaves nothing to confirm the turns by
+    if (queue->heldCount() && now - lastArrival >= HOLD_QUIET)
+        queue->publishHeld();
+}
+void PacketDecoder::flush()
+{
+    // turns not confirmed yet go to the writer as counted
+    queue->publishHeld();
+}
+
+CapturePacket *PacketDecoder::slot()
+{
+    // receive straight into next free slot of packet queue
+    CapturePacket *pkt = queue->acquire();
+    if (!pkt)
+        pkt = &spare;               // queue full; packet can't be saved
+    return pkt;
+}
+
+void PacketDecoder::decode(CapturePacket *pkt, int bytes)
+{
+    decode(pkt, bytes, pkt->rxTime);
+}
+void PacketDecoder::decode(CapturePacket *pkt, int bytes, double arrival)
+{
+    if (bytes > (int)sizeof(pkt->buffer))
+        bytes = sizeof(pkt->buffer);
+    pkt->nwords = bytes >> 2;
+    toHost(pkt->buffer, pkt->buffer, bytes);
+    TRACE_STAMP(pkt, TRACE_SWAPPED);
+    process(pkt, bytes, arrival);
+}
+void PacketDecoder::decode(const void *data, int bytes, double rxTime, int scale)
+{
+    // payload still in the receive ring (PacketRing.h): converted to host order on its way into the slot,
+    // so the byte order pass is the only time the data is touched
+    CapturePacket *pkt = slot();
+    TRACE_STAMP(pkt, TRACE_RECV);
+    pkt->rxTime = rxTime;
+    pkt->scale = scale;
+    if (bytes > (int)sizeof(pkt->buffer))
+        bytes = sizeof(pkt->buffer);
+    pkt->nwords = bytes >> 2;
+    toHost(pkt->buffer, (const unsigned int *)data, bytes);
+    TRACE_STAMP(pkt, TRACE_SWAPPED);
+    process(pkt, bytes, rxTime);
+}
+
+// network to host byte order, src to dst (may be the same buffer); at most bytes from src
+// sets hdr from the header word
+void PacketDecoder::toHost(unsigned int *dst, const unsigned int *src, int bytes)
+{
+    // do network transformation
+    // ie big-endian to little-endian
+    // header is always big-endian
+    dst[0] = ntohl(src[0]);             // ntohl() does network (big-endian) to host (little-endian) conversion of a 32bit word
+
+    // interpret header
+    hdr.setHeader(dst[0]);
+    int len = hdr.byteLength();
+    if (len > bytes - 4)
+        len = bytes - 4;
+    if (len <= 0)
+        return;
+    if (hdr.littleEnd)
+    {
+        if (dst != src)
+            memcpy(dst + 1, src + 1, len);
+    }
+    else if (hdr.what >= 4)
+    {
+        // int: convert 16bits at a time
+        const unsigned short *sin = (const unsigned short *)(src + 1);
+        unsigned short *sarr = (unsigned short *)(dst + 1);
+        int nshorts = (len >> 1);
+        for (int i=0;i<nshorts;++i)
+            sarr[i] = ntohs(sin[i]);            // ntohs() does network (big-endian) to host (little-endian) conversion of a 16bit word
+    }
+    else
+    {
+        // float: convert 32bit word at a time
+        const unsigned int *win = src + 1;
+        unsigned int *warr = dst + 1;
+        int nints = (len >> 2);
+        for (int i=0;i<nints;++i)
+            warr[i] = ntohl(win[i]);            // ntohl() does network (big-endian) to host (little-endian) conversion of a 32bit word
+    }
+}
+
+// numbering, live values & counters, then the queue
+void PacketDecoder::process(CapturePacket *pkt, int bytes, double arrival)
+{
+    bool ok = true;
+    live.bytes += bytes;
+    ++live.packets;
+    unsigned int *buffer = pkt->buffer;
+    // words past the header's length are not samples (and would overrun 512 sample buffers)
+    int words = 1 + (hdr.byteLength() >> 2);
+    if (pkt->nwords > words)
+        pkt->nwords = words;
+
+    // check for dropped packets
+    // the 8 bit counter and the arrival time give the packet's sequence number
+    lastArrival = arrival;
+    bool wasProvisional = sequence.provisional();
+    int kind = sequence.next(buffer[0], arrival);
+    int missing = sequence.missing;
+    if (missing)
+    {
+        live.dropped += missing;
+        ++live.gaps[gapBucket(missing)];
+        if (!wasProvisional && sequence.provisional())
+            turnGap = missing;
+    }
+    if (sequence.retracted)
+        retract(sequence.retracted, PacketSequence::framesOf(buffer[0]));
+    pkt->seq = sequence.seq + ahead;
+    pkt->sample = sequence.sample + aheadSamples;
+    pkt->dropped = missing;             // noted in csv file
+    if (kind == SEQ_DUPLICATE)
+    {
+        ++live.duplicates;
+        return;                         // already have it; slot is reused
+    }
+    if (kind == SEQ_LATE)
+        ++live.late;
+    live.retracted += sequence.retracted;
+
+    // union for interpreting 32bit data word as different types
+    union
+    {
+        unsigned int ival;      // 32bit word as unsigned int
+        float fval;             // 32bit word as float
+        short sval[2];          // 32bit word as 2 short ints
+                                // sval[0] is the first int, and sval[1] is the second int
+    }
+    dat;
+    // Grab data at beginning of packet
+    switch (hdr.what)
+    {
+        default:
+            // x-only (float)
+            dat.ival = buffer[1];
+            live.x = dat.fval;              // interpret as float
+            live.y = live.r = live.th = 0.0;
+            break;
+        case 1:
+            // x&y (float)
+            dat.ival = buffer[1];
+            live.x = dat.fval;              // interpret as float
+            dat.ival = buffer[2];
+            live.y = dat.fval;              // interpret as float
+            live.r = live.th = 0.0;
+            break;
+        case 2:
+            // r&th (float)
+            dat.ival = buffer[1];
+            live.r = dat.fval;              // interpret as float
+            dat.ival = buffer[2];
+            live.th = dat.fval;             // interpret as float
+            live.x = live.y = 0.0;
+            break;
+        case 3:
+            // xyr&th (float)
+            dat.ival = buffer[1];
+            live.x = dat.fval;              // interpret as float
+            dat.ival = buffer[2];
+            live.y = dat.fval;              // interpret as float
+            dat.ival = buffer[3];
+            live.r = dat.fval;              // interpret as float
+            dat.ival = buffer[4];
+            live.th = dat.fval;             // interpret as float
+            break;
+
+        case 4:
+            // x-only (int)
+            dat.ival = buffer[1];
+            live.x = dat.sval[0];           // interpret as short int
+            live.y = live.r = live.th = 0.0;
+            break;
+        case 5:
+            // x&y (int)
+            dat.ival = buffer[1];
+            live.x = dat.sval[0];           // interpret as short int
+            live.y = dat.sval[1];           // interpret as short int
+            live.r = live.th = 0.0;
+            break;
+        case 6:
+            // r&th (int)
+            dat.ival = buffer[1];
+            live.r = dat.sval[0];           // interpret as short int
+            live.th = dat.sval[1];          // interpret as short int
+            live.x = live.y = 0.0;
+            break;
+        case 7:
+            // xyr&th (int)
+            dat.ival = buffer[1];
+            live.x = dat.sval[0];           // interpret as short int
+            live.y = dat.sval[1];           // interpret as short int
+            dat.ival = buffer[2];
+            live.r = dat.sval[0];           // interpret as short int
+            live.th = dat.sval[1];          // interpret as short int
+            break;
+    }
+
+    live.what = hdr.what;
+    live.rate = hdr.rate;
+    live.rxTime = pkt->rxTime;
+    if (hdr.over || !ok)
+        ++live.overloads;
+
+    // save file
+    // data saved in native endian format
+    saveData(pkt);
+}
+// turns the clock saw were a receive stall: take the gap back from the packets held since
+// (and from the ones the queue had no room for); a gap the writer already has stays,
+// and the numbering carries on after it
+void PacketDecoder::retract(int back, int frames)
+{
+    int left = back;
+    long long removed = 0;
+    for (int i=0;i<queue->heldCount();++i)
+    {
+        CapturePacket *p = queue->heldSlot(i);
+        int take = (p->dropped < left) ? p->dropped : left;
+        p->dropped -= take;
+        left -= take;
+        removed += take;
+        p->seq -= removed;
+        p->sample -= removed * frames;
+    }
+    int take = (unsaved < left) ? unsaved : left;
+    unsaved -= take;
+    left -= take;
+    ahead += left;
+    aheadSamples += (long long)left * frames;
+
+    if (turnGap > 0)
+    {
+        --live.gaps[gapBucket(turnGap)];
+        turnGap -= back;
+        if (turnGap > 0)
+            ++live.gaps[gapBucket(turnGap)];
+    }
+}
+
+void PacketDecoder::saveData(CapturePacket *pkt)
+{
+    // hand packet to writer thread
+    // packets that could not be queued count as dropped in the saved data
+    if (pkt == &spare)
+    {
+        unsaved += pkt->dropped + 1;
+        ++live.unsaved;
+#ifdef CAPTURE_TRACE
+        if (trace)
+            trace->record(TRACE_RECEIVER, pkt->stamp, TRACE_QUEUED, pkt->buffer[0]);
+#endif
+    }
+    else
+    {
+        pkt->dropped += unsaved;
+        unsaved = 0;
+        TRACE_STAMP(pkt, TRACE_QUEUED);
+        // numbering that may still be taken back waits in the queue (up to half of it)
+        if (sequence.provisional() && queue->heldCount() < queue->capacity() / 2)
+            queue->hold();
+        else
+            queue->publish();
+    }
+}
@@ -0,0 +1,66 @@
+//---------------------------------------------------------------------------
+
+#ifndef PacketDecoderH
+#define PacketDecoderH
+
+#include "PacketHeader.h"
+#include "PacketSequence.h"
+#include "PacketQueue.h"
+#include "LiveSnapshot.h"
+#include "CaptureTrace.h"
+
+//---------------------------------------------------------------------------
+
+#define HOLD_QUIET      0.1         // seconds without packets before held packets go to the writer anyway
+
+// receive side of the capture pipeline, without the socket
+// Converts each received packet to host byte order, numbers it (PacketSequence.h),
+// keeps the live values and counters, and queues the packet for the writer thread.
+// Duplicate packets are counted but not saved.
+// While turns of the counter seen only by the clock may still be taken back (PacketSequence.h),
+// packets are held in the queue, so a receive stall never reaches the writer as a gap;
+// sample indices given to the writer never go back.
+// UDPServerThread feeds it from its UDP socket; test & benchmark programs feed it
+// from files or generated packets, and get exactly the same processing.
+// Not thread safe; one receiving thread at a time.
+class PacketDecoder
+{
+protected:
+    PacketQueue *queue;
+    CapturePacket spare;            // receives packets when the queue is full
+    PacketSequence sequence;
+    int unsaved;                    // packets received but not queued (queue full)
+    int turnGap;                    // gap that started the turns the clock saw (live.gaps)
+    long long ahead;                // writer's numbering less the sequence's: turns taken back
+    long long aheadSamples;         // after their gap was published
+    double lastArrival;
+    PacketHeader hdr;
+    CaptureTrace *trace;            // not owned; may be NULL
+
+    void toHost(unsigned int *dst, const unsigned int *src, int bytes);
+    void process(CapturePacket *pkt, int bytes, double arrival);
+    void retract(int back, int frames);
+    void saveData(CapturePacket *pkt);
+
+public:
+    LiveData live;                  // receiving thread's working copy
+
+    PacketDecoder(PacketQueue *q);
+
+    void setTrace(CaptureTrace *t);
+    void restart();                 // new file; number from 0 again, don't count a gap before the next packet
+    void idle(double now);          // nothing received (captureClock() seconds): publish held packets if the stream is quiet
+    void flush();                   // end of input: publish held packets
+
+    CapturePacket *slot();          // where to receive the next packet
+    void decode(CapturePacket *pkt, int bytes);     // packet from slot(); rxTime & scale already set
+    void decode(CapturePacket *pkt, int bytes, double arrival);    // arrival: when it reached the host, if not rxTime
+    void decode(const void *data, int bytes, double rxTime, int scale);     // payload received elsewhere (PacketRing.h); at least 4 bytes
+
+private:
+    PacketDecoder(const PacketDecoder &);
+    PacketDecoder &operator=(const PacketDecoder &);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -45,4 +45,19 @@ double PacketHeader::sampleRate() const
 {
     return (1.25e6 / pow(2.0, rate));
 }
+int PacketHeader::channels() const
+{
+    // x, x&y, r&th, xyr&th
+    switch (what & 3)
+    {
+        default: return 1;
+        case 1:
+        case 2: return 2;
+        case 3: return 4;
+    }
+}
+bool PacketHeader::isInt() const
+{
+    return (what >= 4);
+}
 
@@ -24,6 +24,8 @@ public:
     bool isGood() const;
     int byteLength() const;
     double sampleRate() const;
+    int channels() const;
+    bool isInt() const;
 };
 
 //---------------------------------------------------------------------------
@@ -0,0 +1,88 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "PacketQueue.h"
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// lock-free packet ring between receive thread and writer thread
+//
+// head and tail are free-running counters; (head - tail) is the number of published slots.
+// Only the producer writes head and only the consumer writes tail,
+// so a full barrier on each store (atomicStore) is all the synchronization needed.
+// Held slots sit between head and the next acquire(); the consumer can't see them yet.
+
+PacketQueue::PacketQueue(int nslots)
+{
+    // round up to power of 2
+    size = 16;
+    while (size < nslots)
+        size <<= 1;
+    mask = size - 1;
+    slots = new CapturePacket[size];
+    head = 0;
+    tail = 0;
+    held = 0;
+}
+PacketQueue::~PacketQueue()
+{
+    delete [] slots;
+}
+
+CapturePacket *PacketQueue::acquire()
+{
+    long h = head + held;           // we own head
+    if ((unsigned long)(h - atomicLoad(&tail)) >= (unsigned long)size)
+        return NULL;                // full; writer has fallen behind
+    return &slots[h & mask];
+}
+void PacketQueue::publish()
+{
+    atomicStore(&head, head + held + 1);
+    held = 0;
+}
+void PacketQueue::hold()
+{
+    ++held;
+}
+void PacketQueue::publishHeld()
+{
+    if (held)
+    {
+        atomicStore(&head, head + held);
+        held = 0;
+    }
+}
+int PacketQueue::heldCount() const
+{
+    return (int)held;
+}
+CapturePacket *PacketQueue::heldSlot(int i)
+{
+    return &slots[(head + i) & mask];
+}
+
+CapturePacket *PacketQueue::front()
+{
+    long t = tail;                  // we own tail
+    if (atomicLoad(&head) == t)
+        return NULL;                // empty
+    return &slots[t & mask];
+}
+void PacketQueue::release()
+{
+    atomicStore(&tail, tail + 1);
+}
+
+int PacketQueue::depth()
+{
+    return (int)((unsigned long)atomicLoad(&head) - (unsigned long)atomicLoad(&tail));
+}
+int PacketQueue::capacity() const
+{
+    return (int)size;
+}
@@ -0,0 +1,65 @@
+//---------------------------------------------------------------------------
+
+#ifndef PacketQueueH
+#define PacketQueueH
+
+#include "CaptureSync.h"
+#include "CaptureTrace.h"
+
+//---------------------------------------------------------------------------
+
+// one received UDP packet, as it travels from the receive thread to the writer thread
+struct CapturePacket
+{
+    unsigned int buffer[300];       // 1200 bytes; header + data (header & data already in host order)
+    int nwords;                     // number of 32bit words received
+    int dropped;                    // packets missed just before this one (PacketSequence.h)
+    long long seq;                  // sequence number since capture started
+    long long sample;               // index of first sample since capture started
+    double rxTime;                  // arrival time (captureClock() seconds)
+    int scale;                      // instrument sensitivity for integer data (SampleScale.h)
+#ifdef CAPTURE_TRACE
+    traceTick stamp[TRACE_STAGES];  // when the packet passed each stage (CaptureTrace.h)
+#endif
+};
+
+// fixed pool of packet slots, used as a single-producer / single-consumer ring.
+// The receive thread receives directly into the next free slot and publishes it;
+// the writer thread reads published slots and releases them back to the pool.
+// Neither side ever blocks the other.
+class PacketQueue
+{
+protected:
+    CapturePacket *slots;
+    long size;                      // number of slots (power of 2)
+    long mask;
+    volatile long head;             // count of slots published (written by producer only)
+    volatile long tail;             // count of slots released (written by consumer only)
+    long held;                      // slots filled after head, not published yet (producer only)
+
+public:
+    PacketQueue(int nslots=8192);
+    ~PacketQueue();
+
+    // producer (receive thread)
+    CapturePacket *acquire();       // next free slot, or NULL if queue is full
+    void publish();                 // hand slot from acquire() to consumer, with any held before it
+    void hold();                    // keep slot from acquire() back; it goes with the next publish()
+    void publishHeld();             // hand held slots to consumer
+    int heldCount() const;
+    CapturePacket *heldSlot(int i); // i-th held slot, oldest first; still the producer's to change
+
+    // consumer (writer thread)
+    CapturePacket *front();         // oldest published slot, or NULL if queue is empty
+    void release();                 // give slot from front() back to producer
+
+    int depth();
+    int capacity() const;
+
+private:
+    PacketQueue(const PacketQueue &);
+    PacketQueue &operator=(const PacketQueue &);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,118 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "PacketReplay.h"
+#include "SampleScale.h"
+#include <string.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// network capture replay
+// Packets are released in bursts of whatever is due; the caller sleeps a millisecond between calls
+// when nothing is due. At the highest stream rate that's about 20 packets a burst,
+// much like a network adapter that coalesces interrupts.
+
+PacketReplay::PacketReplay()
+{
+    port = 1865;
+    speed = 1.0;
+    scale = SCALE_UNKNOWN;
+    started = false;
+    firstTime = 0.0;
+    startClock = 0.0;
+    pending = false;
+    nextTime = 0.0;
+    lastTime = 0.0;
+    payload = NULL;
+    length = 0;
+    packets = 0;
+    truncated = 0;
+}
+
+bool PacketReplay::open(const SinkPath &fname, int udpPort)
+{
+    port = udpPort;
+    started = false;
+    pending = false;
+    packets = 0;
+    truncated = 0;
+    return reader.open(fname);
+}
+void PacketReplay::setSpeed(double s)
+{
+    // carry on from the current position in the file at the new pace
+    if (started)
+    {
+        firstTime = pending ? nextTime : lastTime;
+        startClock = captureClock();
+    }
+    speed = (s > 0.0) ? s : 0.0;
+}
+void PacketReplay::setScale(int code)
+{
+    scale = code;
+}
+
+int PacketReplay::step(PacketDecoder *decoder, int maxPackets)
+{
+    int n = 0;
+    while (n < maxPackets)
+    {
+        if (!pending)
+        {
+            if (!reader.next(port, nextTime, payload, length))
+            {
+                decoder->flush();
+                return (n > 0) ? n : -1;
+            }
+            pending = true;
+            if (!started)
+            {
+                started = true;
+                firstTime = nextTime;
+                startClock = captureClock();
+            }
+        }
+
+        // wait for it?
+        double now = captureClock();
+        if (speed > 0.0 && startClock + (nextTime - firstTime) / speed > now)
+            break;
+
+        CapturePacket *pkt = decoder->slot();
+        int bytes = length;
+        if (bytes > (int)sizeof(pkt->buffer))
+        {
+            bytes = sizeof(pkt->buffer);
+            ++truncated;
+        }
+        memcpy(pkt->buffer, payload, bytes);
+        TRACE_STAMP(pkt, TRACE_RECV);
+        pkt->rxTime = now;
+        pkt->scale = scale;
+        decoder->decode(pkt, bytes, nextTime);     // capture time numbers the packets as they arrived
+
+        lastTime = nextTime;
+        pending = false;
+        ++packets;
+        ++n;
+    }
+    return n;
+}
+
+long long PacketReplay::packetsReplayed() const
+{
+    return packets;
+}
+long long PacketReplay::packetsTruncated() const
+{
+    return truncated;
+}
+PcapReader &PacketReplay::source()
+{
+    return reader;
+}
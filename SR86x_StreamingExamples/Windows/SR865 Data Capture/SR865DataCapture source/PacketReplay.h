@@ -0,0 +1,52 @@
+//---------------------------------------------------------------------------
+
+#ifndef PacketReplayH
+#define PacketReplayH
+
+#include "PcapReader.h"
+#include "PacketDecoder.h"
+
+//---------------------------------------------------------------------------
+
+// plays the UDP packets of a network capture file into a PacketDecoder,
+// as if they had just arrived on the socket.
+// speed 1 keeps the original timing, 2 plays twice as fast, 0 as fast as possible.
+// Packets get the replay time as arrival time (rxTime), so latency and segment times
+// behave as in a live capture; the capture's own time stamps number them (PacketSequence.h),
+// so gaps are judged by when the packets really arrived, at any replay speed.
+class PacketReplay
+{
+protected:
+    PcapReader reader;
+    int port;                       // UDP port to replay (0 = all)
+    double speed;
+    int scale;                      // sensitivity to tag packets with (SampleScale.h)
+    bool started;
+    double firstTime;               // capture time of first packet
+    double startClock;              // captureClock() when it was replayed
+    bool pending;                   // next packet read but not yet replayed
+    double nextTime;
+    double lastTime;                // capture time of last packet replayed
+    const unsigned char *payload;
+    int length;
+    long long packets;              // packets replayed
+    long long truncated;            // payloads longer than a CapturePacket (not from an SR86x)
+
+public:
+    PacketReplay();
+
+    bool open(const SinkPath &fname, int udpPort=1865);
+    void setSpeed(double s);
+    void setScale(int code);
+
+    // replay the packets that are due by now, at most maxPackets
+    // returns number replayed (0: next packet not due yet), or -1 at end of file
+    int step(PacketDecoder *decoder, int maxPackets=64);
+
+    long long packetsReplayed() const;
+    long long packetsTruncated() const;
+    PcapReader &source();
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,289 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "PacketRing.h"
+#include <string.h>
+#include <sstream>
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#endif
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// TPACKET_V3 receive ring
+// The socket is SOCK_DGRAM, so every frame starts at the IP header whatever the link layer is.
+// The filter keeps unfragmented IPv4 UDP datagrams to the stream ports:
+//   ldb [9]; jeq #17          protocol UDP
+//   ldh [6]; jset #0x1fff     not a fragment
+//   ldxb 4*([0]&0xf)          x = IP header length
+//   ldh [x+2]; jeq #port ...  destination port
+// The UDP port itself is still bound by an ordinary socket (see CaptureLive.cpp),
+// so the computer doesn't answer every packet with "port unreachable".
+
+#define RING_MAX_PORTS  32          // jump offsets in the filter are 8 bits
+#define RING_FRAME      2048        // frame size the ring is described with; V3 packs packets tighter
+
+PacketRing::PacketRing()
+{
+    fd = -1;
+    map = NULL;
+    block = 0;
+    left = 0;
+    frame = NULL;
+    done = false;
+    clockOffset = 0.0;
+    drops = 0;
+    freezes = 0;
+}
+PacketRing::~PacketRing()
+{
+    close();
+}
+
+#ifdef __linux__
+
+static double kernelClock()
+{
+    // packet timestamps are CLOCK_REALTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+bool PacketRing::open(const std::string &nic, const std::vector<int> &ports, const RingOptions &opt, std::string &err)
+{
+    close();
+    options = opt;
+    if (ports.empty() || ports.size() > RING_MAX_PORTS)
+    {
+        err = "packet ring: 1 to 32 ports";
+        return false;
+    }
+    unsigned int ifindex = if_nametoindex(nic.c_str());
+    if (ifindex == 0)
+    {
+        err = "packet ring: no interface \"" + nic + "\"";
+        return false;
+    }
+
+    fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+    if (fd < 0)
+    {
+        err = std::string("packet ring: ") + strerror(errno) + (errno == EPERM ? " (needs CAP_NET_RAW)" : "");
+        return false;
+    }
+
+    // filter before bind, so nothing else gets into the ring
+    int n = (int)ports.size();
+    std::vector<struct sock_filter> code;
+    struct sock_filter head[] =
+    {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, (unsigned char)(n + 4)),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, (unsigned char)(n + 2), 0),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),
+    };
+    code.assign(head, head + sizeof(head) / sizeof(head[0]));
+    for (int i=0;i<n;++i)
+    {
+        struct sock_filter port = BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (unsigned int)ports[i], (unsigned char)(n - i), 0);
+        code.push_back(port);
+    }
+    struct sock_filter drop = BPF_STMT(BPF_RET | BPF_K, 0);
+    struct sock_filter accept = BPF_STMT(BPF_RET | BPF_K, 0xffff);
+    code.push_back(drop);
+    code.push_back(accept);
+    struct sock_fprog prog;
+    prog.len = (unsigned short)code.size();
+    prog.filter = &code[0];
+
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = opt.blockSize;
+    req.tp_block_nr = opt.blocks;
+    req.tp_frame_size = RING_FRAME;
+    req.tp_frame_nr = (unsigned int)(((long long)opt.blockSize * opt.blocks) / RING_FRAME);
+    req.tp_retire_blk_tov = opt.blockTimeoutMs;
+
+    const char *step = NULL;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0)
+        step = "filter";
+    else if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+        step = "TPACKET_V3";
+    else if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0)
+        step = "ring";
+    else
+    {
+        map = (unsigned char *)mmap(NULL, (size_t)opt.blockSize * opt.blocks, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            map = NULL;
+            step = "mmap";
+        }
+    }
+    if (!step)
+    {
+#ifdef PACKET_IGNORE_OUTGOING
+        // loopback would show every datagram twice
+        int one = 1;
+        setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+        struct sockaddr_ll ll;
+        memset(&ll, 0, sizeof(ll));
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = htons(ETH_P_IP);
+        ll.sll_ifindex = ifindex;
+        if (bind(fd, (struct sockaddr *)&ll, sizeof(ll)) != 0)
+            step = "bind";
+    }
+    if (step)
+    {
+        err = std::string("packet ring: ") + step + ": " + strerror(errno);
+        close();
+        return false;
+    }
+
+    block = 0;
+    left = 0;
+    frame = NULL;
+    done = false;
+    clockOffset = captureClock() - kernelClock();
+    return true;
+}
+void PacketRing::close()
+{
+    if (map)
+        munmap(map, (size_t)options.blockSize * options.blocks);
+    map = NULL;
+    if (fd >= 0)
+    {
+        updateStats();
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+// give the block back to the kernel
+void PacketRing::retire()
+{
+    struct tpacket_block_desc *desc = (struct tpacket_block_desc *)(map + (size_t)block * options.blockSize);
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    block = (block + 1) % options.blocks;
+    done = false;
+}
+
+const unsigned char *PacketRing::next(int &bytes, int &port, double &arrival, int timeoutMs)
+{
+    for (;;)
+    {
+        if (done)
+            retire();               // caller is finished with the block's last packet
+        if (left == 0)
+        {
+            struct tpacket_block_desc *desc = (struct tpacket_block_desc *)(map + (size_t)block * options.blockSize);
+            if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+            {
+                struct pollfd p;
+                p.fd = fd;
+                p.events = POLLIN | POLLERR;
+                p.revents = 0;
+                poll(&p, 1, timeoutMs);
+                if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+                    return NULL;
+            }
+            left = desc->hdr.bh1.num_pkts;
+            frame = (unsigned char *)desc + desc->hdr.bh1.offset_to_first_pkt;
+            clockOffset = captureClock() - kernelClock();
+            if (left == 0)
+            {
+                retire();
+                continue;
+            }
+        }
+
+        struct tpacket3_hdr *h = (struct tpacket3_hdr *)frame;
+        frame += h->tp_next_offset;
+        if (--left == 0)
+            done = true;
+
+        // IP header, UDP header, payload
+        const unsigned char *ip = (const unsigned char *)h + h->tp_net;
+        int ipLen = (ip[0] & 0x0f) * 4;
+        const unsigned char *udp = ip + ipLen;
+        int len = ((udp[4] << 8) | udp[5]) - 8;
+        if (len > (int)h->tp_snaplen - ipLen - 8)
+            len = (int)h->tp_snaplen - ipLen - 8;
+        if (len < 4)
+            continue;               // not even a header
+        bytes = len;
+        port = (udp[2] << 8) | udp[3];
+        arrival = h->tp_sec + 1.0e-9 * h->tp_nsec + clockOffset;
+        return udp + 8;
+    }
+}
+
+void PacketRing::updateStats()
+{
+    // reading the counters resets them
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+    if (fd >= 0 && getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0)
+    {
+        drops += st.tp_drops;
+        freezes += st.tp_freeze_q_cnt;
+    }
+}
+
+#else
+
+bool PacketRing::open(const std::string &, const std::vector<int> &, const RingOptions &, std::string &err)
+{
+    err = "packet ring: Linux only";
+    return false;
+}
+void PacketRing::close()
+{
+}
+void PacketRing::retire()
+{
+}
+const unsigned char *PacketRing::next(int &, int &, double &, int)
+{
+    return NULL;
+}
+void PacketRing::updateStats()
+{
+}
+
+#endif
+
+bool PacketRing::isOpen() const
+{
+    return (map != NULL);
+}
+long long PacketRing::kernelDrops()
+{
+    updateStats();
+    return drops;
+}
+long long PacketRing::ringFull()
+{
+    updateStats();
+    return freezes;
+}
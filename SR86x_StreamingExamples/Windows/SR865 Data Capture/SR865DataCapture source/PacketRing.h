@@ -0,0 +1,73 @@
+//---------------------------------------------------------------------------
+
+#ifndef PacketRingH
+#define PacketRingH
+
+#include <string>
+#include <vector>
+#include "CaptureSync.h"
+
+//---------------------------------------------------------------------------
+
+// stream packets straight from a network interface's receive ring (Linux AF_PACKET, TPACKET_V3)
+//
+// For a network card that does nothing but carry instrument streams.
+// The kernel writes the UDP datagrams for the stream ports (a BPF filter picks them)
+// into a ring of blocks shared with this process; no system call per packet, no copy into a socket buffer.
+// next() hands out payloads where they lie in the ring, and PacketDecoder converts them
+// to host order on their way into a packet queue slot.
+//
+// Ownership: a block belongs to this process from when the kernel fills it until every packet in it
+// has been handed out and the caller has asked for the next one; then it goes back to the kernel.
+// Queue slots stay owned by the packet queue, so a slow writer never holds up the ring:
+// if the queue is full the packet is received but not saved, as with a socket.
+//
+// Needs Linux and CAP_NET_RAW (or root). open() fails with the reason otherwise,
+// and the caller goes on with an ordinary UDP socket (ReceiveSocket.h).
+
+struct RingOptions
+{
+    int blockSize;                  // bytes per block (power of 2, multiple of the page size)
+    int blocks;                     // blocks in the ring
+    int blockTimeoutMs;             // kernel hands over a block that isn't full after this long
+
+    RingOptions() : blockSize(1 << 20), blocks(64), blockTimeoutMs(4) {}
+};
+
+class PacketRing
+{
+protected:
+    int fd;
+    unsigned char *map;
+    RingOptions options;
+    int block;                      // block being read
+    int left;                       // packets left in it
+    unsigned char *frame;           // next packet in it
+    bool done;                      // all of block handed out; back to kernel at next call
+    double clockOffset;             // captureClock() - kernel timestamp clock
+    long long drops;                // packets the ring had no room for
+    long long freezes;              // times the ring was full
+
+    void retire();
+    void updateStats();
+
+public:
+    PacketRing();
+    ~PacketRing();
+
+    // receive UDP datagrams to any of ports arriving on interface nic
+    bool open(const std::string &nic, const std::vector<int> &ports, const RingOptions &opt, std::string &err);
+    void close();
+    bool isOpen() const;
+
+    // next payload in the ring (at least 4 bytes), or NULL if none arrives within timeoutMs
+    // The payload stays valid until the next call.
+    // port: destination port; arrival: when the interface received it (captureClock() seconds)
+    const unsigned char *next(int &bytes, int &port, double &arrival, int timeoutMs);
+
+    long long kernelDrops();        // packets dropped because every block was full
+    long long ringFull();           // times that happened
+};
+
+//---------------------------------------------------------------------------
+#endif
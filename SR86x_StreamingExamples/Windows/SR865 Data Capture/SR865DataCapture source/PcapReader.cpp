@@ -0,0 +1,394 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "PcapReader.h"
+#include <string.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// network capture files
+//
+// pcap:   24 byte file header, then (16 byte record header + frame) per packet
+// pcapng: blocks of (type, total length, body, total length);
+//         a section header block sets the byte order, interface description blocks the link type
+//         and timestamp resolution, and enhanced (or simple) packet blocks hold the frames.
+// Header fields of the file are in the byte order of the machine that wrote it;
+// the network headers inside the frames are always big-endian.
+
+#define MAX_FRAME   (1 << 20)       // larger blocks mean a damaged file
+
+#define PCAPNG_SHB  0x0A0D0D0A      // section header (same in both byte orders)
+#define PCAPNG_IDB  1               // interface description
+#define PCAPNG_PB   2               // packet (obsolete)
+#define PCAPNG_SPB  3               // simple packet
+#define PCAPNG_EPB  6               // enhanced packet
+
+static inline unsigned int swap32(unsigned int v)
+{
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+static inline unsigned short be16(const unsigned char *p)
+{
+    return (unsigned short)((p[0] << 8) | p[1]);
+}
+
+PcapReader::PcapReader()
+{
+    file = NULL;
+    ng = false;
+    swapped = false;
+    frames = 0;
+    skipped = 0;
+    lastTime = 0.0;
+}
+PcapReader::~PcapReader()
+{
+    close();
+}
+
+unsigned int PcapReader::u32(const unsigned char *p) const
+{
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return swapped ? swap32(v) : v;
+}
+unsigned short PcapReader::u16(const unsigned char *p) const
+{
+    unsigned short v;
+    memcpy(&v, p, 2);
+    return swapped ? (unsigned short)((v >> 8) | (v << 8)) : v;
+}
+
+bool PcapReader::open(const SinkPath &fname)
+{
+    close();
+    file = sinkOpen(fname, "rb");
+    if (!file)
+        return false;
+
+    unsigned char head[24];
+    if (fread(head, 1, 4, file) != 4)
+    {
+        close();
+        return false;
+    }
+    unsigned int magic;
+    memcpy(&magic, head, 4);
+    frames = 0;
+    skipped = 0;
+    lastTime = 0.0;
+    ifaces.clear();
+
+    if (magic == PCAPNG_SHB)
+    {
+        ng = true;
+        fseek(file, 0, SEEK_SET);
+        unsigned int type, len;
+        if (!readBlock(type, len) || type != PCAPNG_SHB)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    ng = false;
+    double unit;
+    if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1)
+        unit = 1.0e-6;
+    else if (magic == 0xa1b23c4d || magic == 0x4d3cb2a1)
+        unit = 1.0e-9;
+    else
+    {
+        close();
+        return false;
+    }
+    swapped = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+    if (fread(head + 4, 1, 20, file) != 20)
+    {
+        close();
+        return false;
+    }
+    Interface iface;
+    iface.linkType = u32(head + 20) & 0xffff;   // upper bits may hold FCS length
+    iface.tsUnit = unit;
+    ifaces.push_back(iface);
+    return true;
+}
+void PcapReader::close()
+{
+    if (file)
+        fclose(file);
+    file = NULL;
+}
+
+// pcapng block body into frame; handles section headers (byte order, new interface list)
+bool PcapReader::readBlock(unsigned int &type, unsigned int &bodyLength)
+{
+    unsigned char head[12];
+    if (fread(head, 1, 8, file) != 8)
+        return false;
+    unsigned int raw;
+    memcpy(&raw, head, 4);
+
+    unsigned int done = 0;
+    if (raw == PCAPNG_SHB)
+    {
+        // byte order magic follows the length
+        if (fread(head + 8, 1, 4, file) != 4)
+            return false;
+        unsigned int bom;
+        memcpy(&bom, head + 8, 4);
+        if (bom == 0x1A2B3C4D)
+            swapped = false;
+        else if (bom == 0x4D3C2B1A)
+            swapped = true;
+        else
+            return false;
+        ifaces.clear();
+        done = 4;
+    }
+    type = ng ? u32(head) : raw;
+    unsigned int total = u32(head + 4);
+    if (total < 12 + done || (total & 3) || total > MAX_FRAME)
+        return false;
+    bodyLength = total - 12;
+
+    frame.resize(bodyLength + 4);
+    memcpy(&frame[0], head + 8, done);
+    if (fread(&frame[done], 1, bodyLength - done + 4, file) != bodyLength - done + 4)
+        return false;               // body & trailing length
+    return true;
+}
+
+// next link layer frame, left in frame[offset .. offset+length)
+bool PcapReader::nextFrame(int &iface, double &time, int &offset, int &length)
+{
+    if (!file)
+        return false;
+
+    if (!ng)
+    {
+        unsigned char rec[16];
+        if (fread(rec, 1, 16, file) != 16)
+            return false;
+        unsigned int caplen = u32(rec + 8);
+        if (caplen > MAX_FRAME)
+            return false;
+        frame.resize(caplen + 1);
+        if (fread(&frame[0], 1, caplen, file) != caplen)
+            return false;
+        iface = 0;
+        time = u32(rec) + u32(rec + 4) * ifaces[0].tsUnit;
+        offset = 0;
+        length = (int)caplen;
+        ++frames;
+        return true;
+    }
+
+    for (;;)
+    {
+        unsigned int type, len;
+        if (!readBlock(type, len))
+            return false;
+        const unsigned char *b = &frame[0];
+        switch (type)
+        {
+            case PCAPNG_IDB:
+            {
+                if (len < 8)
+                    return false;
+                Interface ifc;
+                ifc.linkType = u16(b);
+                ifc.tsUnit = 1.0e-6;
+                // options: code, length, value padded to 4 bytes
+                unsigned int pos = 8;
+                while (pos + 4 <= len)
+                {
+                    unsigned int code = u16(b + pos);
+                    unsigned int olen = u16(b + pos + 2);
+                    if (code == 0 || pos + 4 + olen > len)
+                        break;
+                    if (code == 9 && olen >= 1)
+                    {
+                        // if_tsresol: negative power of 10, or of 2 if top bit set
+                        int r = b[pos + 4];
+                        double base = (r & 0x80) ? 0.5 : 0.1;
+                        ifc.tsUnit = 1.0;
+                        for (int i=0;i<(r & 0x7f);++i)
+                            ifc.tsUnit *= base;
+                    }
+                    pos += 4 + ((olen + 3) & ~3u);
+                }
+                ifaces.push_back(ifc);
+                break;
+            }
+            case PCAPNG_EPB:
+            case PCAPNG_PB:
+            {
+                if (len < 20)
+                    return false;
+                unsigned int id = (type == PCAPNG_EPB) ? u32(b) : u16(b);
+                if (id >= ifaces.size())
+                    return false;
+                unsigned int caplen = u32(b + 12);
+                if (caplen > len - 20)
+                    return false;
+                double ticks = u32(b + 4) * 4294967296.0 + u32(b + 8);
+                iface = (int)id;
+                time = lastTime = ticks * ifaces[id].tsUnit;
+                offset = 20;
+                length = (int)caplen;
+                ++frames;
+                return true;
+            }
+            case PCAPNG_SPB:
+            {
+                if (len < 4 || ifaces.empty())
+                    return false;
+                unsigned int caplen = u32(b);
+                if (caplen > len - 4)
+                    caplen = len - 4;   // cut to snapshot length
+                iface = 0;
+                time = lastTime;
+                offset = 4;
+                length = (int)caplen;
+                ++frames;
+                return true;
+            }
+            default:
+                break;                  // section headers, statistics, name resolution, ...
+        }
+    }
+}
+
+// UDP payload in frame; returns its length, or -1 if this isn't a complete datagram for port
+int PcapReader::udpPayload(int linkType, int offset, int length, int port, int &payload)
+{
+    const unsigned char *p = &frame[offset];
+    int n = length;
+    int etype;
+    int pos;
+
+    // link layer
+    switch (linkType)
+    {
+        case 1:                         // ethernet
+            if (n < 14)
+                return -1;
+            etype = be16(p + 12);
+            pos = 14;
+            while ((etype == 0x8100 || etype == 0x88a8 || etype == 0x9100) && pos + 4 <= n)
+            {
+                etype = be16(p + pos + 2);     // vlan tag
+                pos += 4;
+            }
+            break;
+        case 113:                       // linux cooked
+            if (n < 16)
+                return -1;
+            etype = be16(p + 14);
+            pos = 16;
+            break;
+        case 276:                       // linux cooked v2
+            if (n < 20)
+                return -1;
+            etype = be16(p);
+            pos = 20;
+            break;
+        case 0:                         // bsd loopback; 4 byte address family
+        case 108:
+            pos = 4;
+            etype = 0;
+            break;
+        case 12:                        // raw ip
+        case 14:
+        case 101:
+        case 228:
+        case 229:
+            pos = 0;
+            etype = 0;
+            break;
+        default:
+            return -1;
+    }
+    if (pos >= n)
+        return -1;
+    if (etype == 0)
+        etype = ((p[pos] >> 4) == 6) ? 0x86dd : 0x0800;
+
+    // network layer
+    int end = n;
+    if (etype == 0x0800)
+    {
+        const unsigned char *ip = p + pos;
+        if (pos + 20 > n || (ip[0] >> 4) != 4)
+            return -1;
+        int ihl = (ip[0] & 0x0f) * 4;
+        if (ihl < 20 || ip[9] != 17 || (be16(ip + 6) & 0x3fff))
+            return -1;                  // not udp, or a fragment
+        if (pos + be16(ip + 2) < end)
+            end = pos + be16(ip + 2);   // ethernet padding
+        pos += ihl;
+    }
+    else if (etype == 0x86dd)
+    {
+        const unsigned char *ip = p + pos;
+        if (pos + 40 > n || (ip[0] >> 4) != 6)
+            return -1;
+        if (pos + 40 + be16(ip + 4) < end)
+            end = pos + 40 + be16(ip + 4);
+        int next = ip[6];
+        pos += 40;
+        // hop-by-hop, routing & destination options headers
+        while ((next == 0 || next == 43 || next == 60) && pos + 8 <= end)
+        {
+            next = p[pos];
+            pos += (p[pos + 1] + 1) * 8;
+        }
+        if (next != 17)
+            return -1;                  // not udp, or a fragment
+    }
+    else
+        return -1;
+
+    // transport layer
+    if (pos + 8 > end)
+        return -1;
+    if (port && be16(p + pos + 2) != port)
+        return -1;
+    int ulen = be16(p + pos + 4);
+    if (ulen < 8 || pos + ulen > end)
+        return -1;                      // cut short by snapshot length
+    payload = offset + pos + 8;
+    return ulen - 8;
+}
+
+bool PcapReader::next(int port, double &time, const unsigned char *&payload, int &length)
+{
+    int iface, offset, len, start;
+    while (nextFrame(iface, time, offset, len))
+    {
+        length = udpPayload(ifaces[iface].linkType, offset, len, port, start);
+        if (length >= 0)
+        {
+            payload = &frame[start];
+            return true;
+        }
+        ++skipped;
+    }
+    return false;
+}
+
+long long PcapReader::framesRead() const
+{
+    return frames;
+}
+long long PcapReader::framesSkipped() const
+{
+    return skipped;
+}
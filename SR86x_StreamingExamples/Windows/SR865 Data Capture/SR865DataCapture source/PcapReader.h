@@ -0,0 +1,60 @@
+//---------------------------------------------------------------------------
+
+#ifndef PcapReaderH
+#define PcapReaderH
+
+#include <stdio.h>
+#include <vector>
+#include "CaptureSink.h"
+
+//---------------------------------------------------------------------------
+
+// UDP datagrams from a network capture file (Wireshark / tcpdump)
+// Reads pcap (microsecond or nanosecond) and pcapng files of either byte order.
+// Link types: Ethernet (with VLAN tags), Linux cooked (SLL & SLL2), raw IP, BSD loopback.
+// IPv4 and IPv6; fragmented datagrams and datagrams cut short by the snapshot length are skipped.
+class PcapReader
+{
+protected:
+    struct Interface
+    {
+        int linkType;
+        double tsUnit;              // seconds per timestamp tick
+    };
+
+    FILE *file;
+    bool ng;                        // pcapng
+    bool swapped;                   // file byte order differs from ours
+    std::vector<Interface> ifaces;  // pcap has exactly one
+    std::vector<unsigned char> frame;
+    double lastTime;                // simple packet blocks have no timestamp
+    long long frames;               // link layer frames read
+    long long skipped;              // frames that were not a complete UDP datagram for our port
+
+    unsigned int u32(const unsigned char *p) const;
+    unsigned short u16(const unsigned char *p) const;
+    bool readBlock(unsigned int &type, unsigned int &bodyLength);
+    bool nextFrame(int &iface, double &time, int &offset, int &length);
+    int udpPayload(int linkType, int offset, int length, int port, int &payload);
+
+public:
+    PcapReader();
+    ~PcapReader();
+
+    bool open(const SinkPath &fname);
+    void close();
+
+    // next UDP payload sent to port (any port if 0); false at end of file
+    // payload stays valid until the next call
+    bool next(int port, double &time, const unsigned char *&payload, int &length);
+
+    long long framesRead() const;
+    long long framesSkipped() const;
+
+private:
+    PcapReader(const PcapReader &);
+    PcapReader &operator=(const PcapReader &);
+};
+
+//---------------------------------------------------------------------------
+#endif
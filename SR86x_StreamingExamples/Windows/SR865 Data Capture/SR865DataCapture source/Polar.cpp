@@ -0,0 +1,247 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "Polar.h"
+#include "CaptureSimd.h"
+#include <stdlib.h>
+#include <math.h>
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// X,Y to R,theta kernels
+// Every step is the same float operation in the plain and the vector code, in the same order:
+//   a = min(|x|,|y|) / max(|x|,|y|)                      0 .. 1
+//   t = a > tan(pi/8) ? (a-1)/(a+1) : a                  |t| <= tan(pi/8)
+//   r = t + t*z*P(z), z = t*t  (+ pi/4 if reduced)       atan(a)
+//   r = pi/2 - r if |y| > |x|;  pi - r if x < 0;  -r if y < 0
+// atan2(0, 0) gives 0, as the instrument does.
+
+#define POLAR_TAN_PI_8  0.414213562373095f
+#define POLAR_PI        3.14159265358979f
+#define POLAR_DEGREES   57.2957795130823f
+#define POLAR_TINY      1.17549435e-38f     // smallest normal float; keeps 0/0 out of the ratio
+
+// Cephes atanf coefficients
+#define POLAR_P0        8.05374449538e-2f
+#define POLAR_P1        (-1.38776856032e-1f)
+#define POLAR_P2        1.99777106478e-1f
+#define POLAR_P3        (-3.33329491539e-1f)
+
+bool parsePolar(const std::string &spec, PolarOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (item == "on")
+            continue;
+        if (key == "unwrap")
+        {
+            if (val == "1" || val.empty())
+                opt.unwrap = true;
+            else if (val == "0")
+                opt.unwrap = false;
+            else
+            {
+                err = "bad value for " + key + ": \"" + val + "\"";
+                return false;
+            }
+        }
+        else
+        {
+            err = "unknown polar setting \"" + item + "\"";
+            return false;
+        }
+    }
+    opt.on = true;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+
+static inline float polarAngle(float x, float y)
+{
+    float ax = fabs(x), ay = fabs(y);
+    float mx = (ax > ay) ? ax : ay;
+    float mn = (ax > ay) ? ay : ax;
+    float a = mn / ((mx > POLAR_TINY) ? mx : POLAR_TINY);
+    bool big = (a > POLAR_TAN_PI_8);
+    float t = big ? (a - 1.0f) / (a + 1.0f) : a;
+    float z = t * t;
+    float p = ((POLAR_P0 * z + POLAR_P1) * z + POLAR_P2) * z + POLAR_P3;
+    float r = p * z * t + t;
+    if (big)
+        r = r + POLAR_PI / 4;
+    if (ay > ax)
+        r = POLAR_PI / 2 - r;
+    if (x < 0.0f)
+        r = POLAR_PI - r;
+    if (y < 0.0f)
+        r = -r;
+    return r * POLAR_DEGREES;
+}
+
+#if defined(CAPTURE_SSE2)
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// 4 x and 4 y to 4 theta
+static inline __m128 polarAngle4(__m128 x, __m128 y)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 ax = _mm_andnot_ps(sign, x), ay = _mm_andnot_ps(sign, y);
+    __m128 mx = _mm_max_ps(ax, ay);
+    __m128 mn = _mm_min_ps(ax, ay);
+    __m128 a = _mm_div_ps(mn, _mm_max_ps(mx, _mm_set1_ps(POLAR_TINY)));
+    __m128 big = _mm_cmpgt_ps(a, _mm_set1_ps(POLAR_TAN_PI_8));
+    __m128 t = select4(big, _mm_div_ps(_mm_sub_ps(a, one), _mm_add_ps(a, one)), a);
+    __m128 z = _mm_mul_ps(t, t);
+    __m128 p = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(POLAR_P0), z), _mm_set1_ps(POLAR_P1));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(POLAR_P2));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(POLAR_P3));
+    __m128 r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), t), t);
+    r = select4(big, _mm_add_ps(r, _mm_set1_ps(POLAR_PI / 4)), r);
+    r = select4(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(POLAR_PI / 2), r), r);
+    r = select4(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_sub_ps(_mm_set1_ps(POLAR_PI), r), r);
+    r = _mm_xor_ps(r, _mm_and_ps(_mm_cmplt_ps(y, _mm_setzero_ps()), sign));
+    return _mm_mul_ps(r, _mm_set1_ps(POLAR_DEGREES));
+}
+#elif defined(CAPTURE_NEON) && defined(__aarch64__)
+static inline float32x4_t polarAngle4(float32x4_t x, float32x4_t y)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    float32x4_t ax = vabsq_f32(x), ay = vabsq_f32(y);
+    float32x4_t mx = vmaxq_f32(ax, ay);
+    float32x4_t mn = vminq_f32(ax, ay);
+    float32x4_t a = vdivq_f32(mn, vmaxq_f32(mx, vdupq_n_f32(POLAR_TINY)));
+    uint32x4_t big = vcgtq_f32(a, vdupq_n_f32(POLAR_TAN_PI_8));
+    float32x4_t t = vbslq_f32(big, vdivq_f32(vsubq_f32(a, one), vaddq_f32(a, one)), a);
+    float32x4_t z = vmulq_f32(t, t);
+    // separate multiply & add (no fused vmla), to round as the plain code does
+    float32x4_t p = vaddq_f32(vmulq_f32(vdupq_n_f32(POLAR_P0), z), vdupq_n_f32(POLAR_P1));
+    p = vaddq_f32(vmulq_f32(p, z), vdupq_n_f32(POLAR_P2));
+    p = vaddq_f32(vmulq_f32(p, z), vdupq_n_f32(POLAR_P3));
+    float32x4_t r = vaddq_f32(vmulq_f32(vmulq_f32(p, z), t), t);
+    r = vbslq_f32(big, vaddq_f32(r, vdupq_n_f32(POLAR_PI / 4)), r);
+    r = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32(POLAR_PI / 2), r), r);
+    r = vbslq_f32(vcltq_f32(x, vdupq_n_f32(0.0f)), vsubq_f32(vdupq_n_f32(POLAR_PI), r), r);
+    r = vbslq_f32(vcltq_f32(y, vdupq_n_f32(0.0f)), vnegq_f32(r), r);
+    return vmulq_f32(r, vdupq_n_f32(POLAR_DEGREES));
+}
+#endif
+
+void xyToPolar(const float *xy, int frames, float *xyrt)
+{
+    int i = 0;
+#if defined(CAPTURE_SSE2)
+    for (; i+4<=frames; i+=4)
+    {
+        __m128 a = _mm_loadu_ps(xy + 2*i);              // x0 y0 x1 y1
+        __m128 b = _mm_loadu_ps(xy + 2*i + 4);          // x2 y2 x3 y3
+        __m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+        __m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+        __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+        __m128 th = polarAngle4(x, y);
+        _MM_TRANSPOSE4_PS(x, y, r, th);                 // back to frames
+        _mm_storeu_ps(xyrt + 4*i, x);
+        _mm_storeu_ps(xyrt + 4*i + 4, y);
+        _mm_storeu_ps(xyrt + 4*i + 8, r);
+        _mm_storeu_ps(xyrt + 4*i + 12, th);
+    }
+#elif defined(CAPTURE_NEON) && defined(__aarch64__)
+    for (; i+4<=frames; i+=4)
+    {
+        float32x4x2_t v = vld2q_f32(xy + 2*i);
+        float32x4x4_t o;
+        o.val[0] = v.val[0];
+        o.val[1] = v.val[1];
+        o.val[2] = vsqrtq_f32(vaddq_f32(vmulq_f32(v.val[0], v.val[0]), vmulq_f32(v.val[1], v.val[1])));
+        o.val[3] = polarAngle4(v.val[0], v.val[1]);
+        vst4q_f32(xyrt + 4*i, o);
+    }
+#endif
+    for (; i<frames; ++i)
+    {
+        float x = xy[2*i], y = xy[2*i + 1];
+        xyrt[4*i] = x;
+        xyrt[4*i + 1] = y;
+        xyrt[4*i + 2] = (float)sqrt((double)(x * x + y * y));     // float sqrt, correctly rounded
+        xyrt[4*i + 3] = polarAngle(x, y);
+    }
+}
+
+void polarToInt16(const float *xyrt, int frames, float perCount, float thetaPerCount, short *out)
+{
+    // round half away from zero: truncate x + 0.5 with the sign of x
+    int n = frames * 4;
+    int i = 0;
+#if defined(CAPTURE_SSE2)
+    const __m128 k = _mm_setr_ps(perCount, perCount, perCount, thetaPerCount);
+    const __m128 hi = _mm_set1_ps(32767.0f), lo = _mm_set1_ps(-32767.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f), half = _mm_set1_ps(0.5f);
+    for (; i+8<=n; i+=8)
+    {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(xyrt + i), k), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(xyrt + i + 4), k), lo), hi);
+        a = _mm_add_ps(a, _mm_or_ps(_mm_and_ps(a, sign), half));
+        b = _mm_add_ps(b, _mm_or_ps(_mm_and_ps(b, sign), half));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+    }
+#endif
+    for (; i<n; ++i)
+    {
+        float v = xyrt[i] * (((i & 3) == 3) ? thetaPerCount : perCount);
+        if (v > 32767.0f)
+            v = 32767.0f;
+        if (v < -32767.0f)
+            v = -32767.0f;
+        out[i] = (short)(v + ((v < 0.0f) ? -0.5f : 0.5f));
+    }
+}
+
+//---------------------------------------------------------------------------
+// PhaseUnwrap
+
+PhaseUnwrap::PhaseUnwrap()
+{
+    reset();
+}
+
+void PhaseUnwrap::reset()
+{
+    turns = 0.0;
+    last = 0.0f;
+    started = false;
+}
+
+void PhaseUnwrap::apply(float *theta, int frames, int stride)
+{
+    for (int i=0;i<frames;++i, theta+=stride)
+    {
+        float th = *theta;
+        if (started)
+        {
+            float d = th - last;
+            if (d > 180.0f)
+                turns -= 360.0;
+            else if (d < -180.0f)
+                turns += 360.0;
+        }
+        started = true;
+        last = th;
+        *theta = (float)(th + turns);
+    }
+}
@@ -0,0 +1,54 @@
+//---------------------------------------------------------------------------
+
+#ifndef PolarH
+#define PolarH
+
+#include <string>
+
+//---------------------------------------------------------------------------
+
+// R and theta from X and Y on this computer, so the instrument only has to stream X,Y
+//
+// R = hypot(X, Y) and theta = atan2(Y, X) in degrees, as the instrument computes them.
+// theta comes from a polynomial (Cephes atanf) after reducing |Y/X| to [0, tan(pi/8)]:
+// within 2.5 float ulps of atan2() (2.4e-5 degrees at most), no table, no branches,
+// so the vector code does 4 frames a step and gives the same result as the plain code.
+// theta can be unwrapped: each step larger than 180 degrees is taken as the short way round,
+// so the phase runs on continuously across packets instead of jumping at +-180.
+
+struct PolarOptions
+{
+    bool on;                        // add R and theta to X,Y streams
+    bool unwrap;                    // continuous theta (no jump at +-180 degrees)
+
+    PolarOptions() : on(false), unwrap(false) {}
+};
+
+// options from text: "on", or "unwrap" for continuous theta; any spec turns the conversion on
+bool parsePolar(const std::string &spec, PolarOptions &opt, std::string &err);
+
+// interleaved X,Y (frames of 2) to interleaved X,Y,R,theta (frames of 4); theta in degrees
+void xyToPolar(const float *xy, int frames, float *xyrt);
+
+// interleaved float X,Y,R,theta to 16bit counts of the same frames:
+// X, Y, R times perCount, theta times thetaPerCount, rounded & limited to +-32767
+void polarToInt16(const float *xyrt, int frames, float perCount, float thetaPerCount, short *out);
+
+// theta of a series of frames, unwrapped across calls
+class PhaseUnwrap
+{
+protected:
+    double turns;                   // degrees added to the wrapped phase
+    float last;                     // last wrapped phase
+    bool started;
+
+public:
+    PhaseUnwrap();
+
+    void reset();                   // next phase is taken as it is
+    // theta[0], theta[stride], ... theta[(frames-1)*stride], in degrees
+    void apply(float *theta, int frames, int stride);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,151 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "PolarSink.h"
+#include "SampleScale.h"
+#include <string.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// X,Y,R,theta packets from X,Y packets
+// Output packets carry the input's CapturePacket fields; the second of a pair starts
+// that many samples later (CapturePacket.sample) and has no packets dropped before it.
+
+PolarSink::PolarSink(const PolarOptions &opt, CaptureSink *sampleSink)
+{
+    samples = sampleSink;
+    options = opt;
+    stream = 0;
+    memset(&out, 0, sizeof(out));
+}
+/*virtual*/ PolarSink::~PolarSink()
+{
+    close();
+    delete samples;
+}
+
+/*virtual*/ bool PolarSink::open(const SinkPath &fname, bool trunc)
+{
+    unwrap.reset();
+    stream = 0;
+    return samples->open(fname, trunc);
+}
+/*virtual*/ bool PolarSink::isOpen() const
+{
+    return samples->isOpen();
+}
+/*virtual*/ void PolarSink::close()
+{
+    samples->close();
+}
+
+/*virtual*/ void PolarSink::write(const CapturePacket &pkt)
+{
+    if (pkt.nwords < 2)
+    {
+        samples->write(pkt);
+        return;
+    }
+    PacketHeader hdr(pkt.buffer[0]);
+    unsigned int s = pkt.buffer[0] & 0x00ff0f00;    // content & rate
+    if (s != stream)
+    {
+        unwrap.reset();
+        stream = s;
+    }
+    bool xy = ((hdr.what & 3) == 1);
+    bool theta = ((hdr.what & 3) >= 2);
+    if (!xy && !(theta && options.unwrap))
+    {
+        samples->write(pkt);
+        return;
+    }
+
+    if (xy && hdr.isInt() && !options.unwrap)
+    {
+        // counts in, counts out
+        static const float ones[2] = { 1.0f, 1.0f };
+        int frames = pkt.nwords - 1;
+        int16ToFloat((const short *)(pkt.buffer + 1), frames, 2, ones, values);
+        xyToPolar(values, frames, polar);
+        emit(pkt, 7, frames, 4, true);
+        return;
+    }
+
+    int nch = hdr.channels();
+    int count = packetToFloat(pkt, values);
+    int frames = count / nch;
+    if (xy)
+    {
+        xyToPolar(values, frames, polar);
+        nch = 4;
+    }
+    else
+    {
+        memcpy(polar, values, count * sizeof(float));
+        if (hdr.isInt() && pkt.scale < 0)
+        {
+            // theta still in counts
+            for (int i=0;i<frames;++i)
+                polar[i*nch + nch - 1] *= countScale(0, true);
+        }
+    }
+    if (options.unwrap)
+        unwrap.apply(polar + nch - 1, frames, nch);
+    emit(pkt, xy ? 3 : (hdr.what & 3), frames, nch, false);
+}
+
+// polar[] as packets of the input's length
+void PolarSink::emit(const CapturePacket &pkt, int what, int frames, int nch, bool isInt)
+{
+    PacketHeader hdr(pkt.buffer[0]);
+    int per = hdr.byteLength() / (nch * (isInt ? 2 : 4));
+    out = pkt;
+    out.buffer[0] = (pkt.buffer[0] & ~0x00000f00u) | ((unsigned int)what << 8);
+    for (int first=0; first<frames; first+=per)
+    {
+        int n = (frames - first < per) ? frames - first : per;
+        if (isInt)
+        {
+            polarToInt16(polar + 4*first, n, 1.0f, (float)(FULL_SCALE_COUNTS / 180.0), (short *)(out.buffer + 1));
+            out.nwords = 1 + n * 2;
+        }
+        else
+        {
+            memcpy(out.buffer + 1, polar + nch*first, n * nch * sizeof(float));
+            out.nwords = 1 + n * nch;
+        }
+        out.sample = pkt.sample + first;
+        out.dropped = first ? 0 : pkt.dropped;
+        samples->write(out);
+    }
+}
+
+/*virtual*/ long long PolarSink::bytesWritten()
+{
+    return samples->bytesWritten();
+}
+/*virtual*/ long long PolarSink::packetsWritten() const
+{
+    return samples->packetsWritten();
+}
+/*virtual*/ void PolarSink::note(const std::string &text)
+{
+    samples->note(text);
+}
+/*virtual*/ long long PolarSink::syncCount() const
+{
+    return samples->syncCount();
+}
+/*virtual*/ double PolarSink::syncTime() const
+{
+    return samples->syncTime();
+}
+/*virtual*/ void PolarSink::idle(double now)
+{
+    samples->idle(now);
+}
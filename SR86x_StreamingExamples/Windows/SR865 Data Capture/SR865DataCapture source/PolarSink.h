@@ -0,0 +1,58 @@
+//---------------------------------------------------------------------------
+
+#ifndef PolarSinkH
+#define PolarSinkH
+
+#include "CaptureSink.h"
+#include "Polar.h"
+
+//---------------------------------------------------------------------------
+
+// X,Y streams saved as X,Y,R,theta (see Polar.h)
+//
+// Streaming X,Y (content 1 or 5) takes half the bandwidth of all four channels (content 3 or 7),
+// so the instrument can run twice as fast before packets are lost. This sink puts R and theta back
+// on the writer thread: every X,Y packet becomes X,Y,R,theta packets of the same length
+// (two for one, with the same header apart from the content code), so every file format,
+// and every side file, sees a four channel stream.
+// Integer packets stay integer: R in the counts of X and Y (limited to 32767, as the instrument
+// does), theta in counts of 180/32767 degrees.
+// With unwrapping on, theta runs on past +-180 degrees, which 16 bits can't hold: integer streams
+// are saved as float then (in engineering units, or counts if the sensitivity is unknown),
+// and the same goes for streams whose theta comes from the instrument.
+// Unwrapping starts again with each capture file (segment) and after a change of content or rate;
+// lost packets don't restart it.
+
+class PolarSink : public CaptureSink
+{
+protected:
+    CaptureSink *samples;           // capture file the packets go to
+    PolarOptions options;
+    PhaseUnwrap unwrap;
+    unsigned int stream;            // content & rate of the last packet
+    CapturePacket out;
+    float values[512];
+    float polar[1024];
+
+    void emit(const CapturePacket &pkt, int what, int frames, int nch, bool isInt);
+
+public:
+    // takes ownership of samples
+    PolarSink(const PolarOptions &opt, CaptureSink *samples);
+    virtual ~PolarSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();
+    virtual long long packetsWritten() const;   // packets of the capture file (two per X,Y packet)
+    virtual void note(const std::string &text);
+    virtual long long syncCount() const;
+    virtual double syncTime() const;
+    virtual void idle(double now);
+};
+
+//---------------------------------------------------------------------------
+#endif
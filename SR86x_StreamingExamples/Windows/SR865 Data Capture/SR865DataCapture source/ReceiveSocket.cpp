@@ -0,0 +1,295 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "ReceiveSocket.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#define INVALID_SOCKET  (-1)
+#define closesocket     ::close
+#endif
+#ifdef __linux__
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL     40
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL    46
+#endif
+#ifndef SO_MEMINFO
+#define SO_MEMINFO      55
+#endif
+#define MEMINFO_RMEM_ALLOC  0       // linux/sock_diag.h SK_MEMINFO_RMEM_ALLOC
+#define MEMINFO_VARS        9
+#endif
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// stream receive socket
+// On Linux every datagram comes with the socket's drop count (SO_RXQ_OVFL) in its control data,
+// so the count is read with recvmsg() and costs no extra system call.
+// Windows & OS X have no such count; kernelDrops() stays 0 there.
+
+bool parseReceive(const std::string &spec, ReceiveOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key == "buffer" || key == "busypoll" || key == "timeout")
+        {
+            char *end;
+            long n = strtol(val.c_str(), &end, 10);
+            if (key == "buffer")
+            {
+                // plain bytes, or k / M
+                if (*end == 'k' || *end == 'K')
+                    n <<= 10, ++end;
+                else if (*end == 'm' || *end == 'M')
+                    n <<= 20, ++end;
+            }
+            if (end == val.c_str() || *end || n < 0 || n > (1L << 30) || (key == "timeout" && n == 0))
+            {
+                err = "bad value for " + key + ": \"" + val + "\"";
+                return false;
+            }
+            if (key == "buffer")
+                opt.bufferBytes = (int)n;
+            else if (key == "busypoll")
+                opt.busyPoll = (int)n;
+            else
+                opt.timeoutMs = (int)n;
+        }
+        else if (key == "force" && eq == std::string::npos)
+            opt.forceBuffer = true;
+        else if (key == "noforce" && eq == std::string::npos)
+            opt.forceBuffer = false;
+        else if (key == "spin" && eq == std::string::npos)
+            opt.spin = true;
+        else
+        {
+            err = "unknown receive setting \"" + item + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+ReceiveSocket::ReceiveSocket()
+{
+    sd = INVALID_SOCKET;
+    granted = 0;
+    overflowCount = 0;
+    overflows = 0;
+}
+ReceiveSocket::~ReceiveSocket()
+{
+    close();
+}
+
+bool ReceiveSocket::open(int port, const ReceiveOptions &opt, std::string &err)
+{
+    close();
+    options = opt;
+    warn.clear();
+    overflowCount = 0;              // new socket, new count
+
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET)
+    {
+        err = "Could not create socket.";
+        return false;
+    }
+
+    // buffer first: Linux sizes the buffer when the socket is bound
+    if (opt.bufferBytes > 0)
+    {
+        int size = opt.bufferBytes;
+        bool set = false;
+#ifdef SO_RCVBUFFORCE
+        if (opt.forceBuffer)
+            set = (setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, (const char *)&size, sizeof(size)) == 0);
+#endif
+        if (!set)
+            setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&size, sizeof(size));
+    }
+    int size = 0;
+#ifdef _WIN32
+    int sizeLen = sizeof(size);
+#else
+    socklen_t sizeLen = sizeof(size);
+#endif
+    getsockopt(s, SOL_SOCKET, SO_RCVBUF, (char *)&size, &sizeLen);
+#ifdef __linux__
+    size /= 2;                      // Linux reports the buffer with its bookkeeping overhead
+#endif
+    granted = size;
+    if (opt.bufferBytes > 0 && granted < opt.bufferBytes)
+    {
+        std::ostringstream out;
+        out << "receive buffer is " << (granted >> 10) << " kB, not the " << (opt.bufferBytes >> 10) << " kB asked for";
+#ifdef __linux__
+        out << " (raise net.core.rmem_max, or allow SO_RCVBUFFORCE with CAP_NET_ADMIN)";
+#endif
+        warn = out.str();
+    }
+
+#ifdef __linux__
+    int one = 1;
+    if (setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) != 0)
+        warn += (warn.empty() ? "" : "; ") + std::string("socket drops not counted (no SO_RXQ_OVFL)");
+    if (opt.busyPoll > 0 && setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &opt.busyPoll, sizeof(opt.busyPoll)) != 0)
+        warn += (warn.empty() ? "" : "; ") + std::string("busy poll refused (needs CAP_NET_ADMIN above net.core.busy_read)");
+#else
+    if (opt.busyPoll > 0)
+        warn += (warn.empty() ? "" : "; ") + std::string("busy poll is Linux only");
+#endif
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);   // any ip address this computer has (e.g ethernet ip + wifi ip)
+    if (bind(s, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        std::ostringstream out;
+        out << "Could not bind to UDP port " << port << ".";
+        err = out.str();
+        closesocket(s);
+        return false;
+    }
+
+    if (opt.spin)
+    {
+#ifdef _WIN32
+        u_long nonBlocking = 1;
+        ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    }
+    else
+    {
+        // wake up now and then when no data arrives, so the live counters catch up
+#ifdef _WIN32
+        DWORD timeout = opt.timeoutMs;
+#else
+        struct timeval timeout;
+        timeout.tv_sec = opt.timeoutMs / 1000;
+        timeout.tv_usec = (opt.timeoutMs % 1000) * 1000;
+#endif
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+    }
+
+    sd = s;
+    return true;
+}
+void ReceiveSocket::close()
+{
+    if (sd != INVALID_SOCKET)
+    {
+        closesocket(sd);
+        sd = INVALID_SOCKET;
+    }
+}
+bool ReceiveSocket::isOpen() const
+{
+    return (sd != INVALID_SOCKET);
+}
+
+int ReceiveSocket::receive(void *buf, int len)
+{
+#ifdef _WIN32
+    int n = recvfrom(sd, (char *)buf, len, 0, NULL, NULL);
+    if (n < 0)
+    {
+        int err = WSAGetLastError();
+        return (err == WSAETIMEDOUT || err == WSAEWOULDBLOCK) ? 0 : -1;
+    }
+    return n;
+#else
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    union
+    {
+        char buf[64];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    int n = (int)recvmsg(sd, &msg, 0);
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+#ifdef __linux__
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+        {
+            // running count; may wrap
+            unsigned int count;
+            memcpy(&count, CMSG_DATA(c), sizeof(count));
+            overflows += (unsigned int)(count - overflowCount);
+            overflowCount = count;
+        }
+    }
+#endif
+    return n;
+#endif
+}
+
+long long ReceiveSocket::kernelDrops() const
+{
+    return overflows;
+}
+int ReceiveSocket::bufferBytes() const
+{
+    return granted;
+}
+long ReceiveSocket::queuedBytes()
+{
+#ifdef _WIN32
+    u_long queued = 0;
+    if (sd == INVALID_SOCKET || ioctlsocket(sd, FIONREAD, &queued) != 0)
+        return 0;
+#elif defined(__linux__)
+    // FIONREAD only gives the next datagram on a Linux UDP socket; the buffer's own count instead
+    // (memory charged against the buffer size, datagram overhead included; 0 before kernel 4.6)
+    unsigned int mem[MEMINFO_VARS];
+    socklen_t len = sizeof(mem);
+    if (sd == INVALID_SOCKET || getsockopt(sd, SOL_SOCKET, SO_MEMINFO, mem, &len) != 0 || len <= MEMINFO_RMEM_ALLOC * sizeof(mem[0]))
+        return 0;
+    unsigned int queued = mem[MEMINFO_RMEM_ALLOC];
+#else
+    int queued = 0;
+    if (sd == INVALID_SOCKET || ioctl(sd, FIONREAD, &queued) != 0)
+        return 0;
+#endif
+    return (long)queued;
+}
+const std::string &ReceiveSocket::warning() const
+{
+    return warn;
+}
@@ -0,0 +1,76 @@
+//---------------------------------------------------------------------------
+
+#ifndef ReceiveSocketH
+#define ReceiveSocketH
+
+#include <string>
+#include "CaptureSync.h"
+
+#ifndef _WIN32
+typedef int SOCKET;
+#endif
+
+//---------------------------------------------------------------------------
+
+// UDP socket the stream is received on
+//
+// The system's default receive buffer (64 kB on Windows, about 200 kB on Linux) holds only a few ms
+// of a fast stream; any longer delay of the receive thread and the system drops datagrams
+// before recvfrom() sees them. Those drops look the same as packets lost on the network
+// (a gap in the packet counter), so on Linux the socket also counts them (SO_RXQ_OVFL)
+// and kernelDrops() tells the two apart.
+//
+// Receive modes:
+//   blocking (default)  recvfrom() waits, and wakes up every timeoutMs so the live counters catch up
+//   busy poll (Linux)   the kernel polls the network card for busyPoll us before the thread sleeps
+//   spin                recvfrom() never waits; the receive thread keeps a core busy for the lowest latency
+
+struct ReceiveOptions
+{
+    int bufferBytes;                // SO_RCVBUF asked for; 0 = system default
+    bool forceBuffer;               // Linux: SO_RCVBUFFORCE, past net.core.rmem_max (needs CAP_NET_ADMIN)
+    int busyPoll;                   // Linux: SO_BUSY_POLL in us; 0 = off
+    bool spin;                      // never block in receive()
+    int timeoutMs;                  // longest wait in receive() when blocking
+
+    ReceiveOptions() : bufferBytes(8 << 20), forceBuffer(true), busyPoll(0), spin(false), timeoutMs(50) {}
+};
+
+// options from text, e.g. "buffer=32M;busypoll=50" or "buffer=4M;noforce;spin"
+bool parseReceive(const std::string &spec, ReceiveOptions &opt, std::string &err);
+
+class ReceiveSocket
+{
+protected:
+    SOCKET sd;
+    ReceiveOptions options;
+    int granted;                    // receive buffer the system gave us (bytes)
+    unsigned int overflowCount;     // latest SO_RXQ_OVFL value (the kernel's count for this socket)
+    long long overflows;
+    std::string warn;
+
+public:
+    ReceiveSocket();
+    ~ReceiveSocket();
+
+    // bind to port on every interface; false (and why) if that fails
+    // Options the system doesn't support or refuses are left out, and warning() says so.
+    bool open(int port, const ReceiveOptions &opt, std::string &err);
+    void close();
+    bool isOpen() const;
+
+    // next datagram into buf: bytes received, 0 if none came (timeout, or none waiting when spinning), -1 on error
+    int receive(void *buf, int len);
+
+    long long kernelDrops() const;  // datagrams the socket buffer had no room for, all opens together
+    int bufferBytes() const;
+    long queuedBytes();             // bytes waiting in the receive buffer (Linux: buffer memory in use, overhead included)
+    const std::string &warning() const;
+
+private:
+    ReceiveSocket(const ReceiveSocket &);
+    ReceiveSocket &operator=(const ReceiveSocket &);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,205 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "ResampleSink.h"
+#include "SampleScale.h"
+#include "CaptureSync.h"
+#include <string.h>
+#include <time.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// resampled capture files
+// The writer thread converts every packet to float and runs it through the resampler;
+// output is gathered into records of up to 1024 values or 0.25 s, whichever is less.
+
+static const char resampleId[9] = "SR86xRS1";
+
+#define RECORD_SECONDS  0.25
+
+ResampleSink::ResampleSink(const ResampleOptions &opt, CaptureSink *sampleSink)
+    : resampler(opt)
+{
+    samples = sampleSink;
+    file = NULL;
+    partial = false;
+    bytes = 0;
+    packets = 0;
+    what = rate = scale = 0;
+    nch = 0;
+    runSample = 0;
+    runTime = 0.0;
+    blockFrames = 1;
+    memset(&rec, 0, sizeof(rec));
+}
+/*virtual*/ ResampleSink::~ResampleSink()
+{
+    close();
+    delete samples;
+}
+
+/*virtual*/ bool ResampleSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    name = fname;
+    partial = false;
+    if (samples)
+    {
+        if (!samples->open(fname, trunc))
+            return false;
+        // "run.dat" -> "run.dat.rsd"; "run_0000.dat.part" -> "run_0000.dat.rsd.part"
+        SinkPath part = sinkPath(".part");
+        partial = (name.length() > part.length() && name.compare(name.length() - part.length(), part.length(), part) == 0);
+        if (partial)
+            name.erase(name.length() - part.length());
+        name += sinkPath(".rsd");
+        if (partial)
+            name += part;
+    }
+
+    file = sinkOpen(name, trunc ? "wb" : "ab");
+    if (!file)
+    {
+        if (samples)
+            samples->close();
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    if (sinkTell(file) == 0)
+    {
+        ResampleFileHead head;
+        memcpy(head.id, resampleId, 8);
+        head.wallTime = (double)time(0);
+        head.clockTime = captureClock();
+        fwrite(&head, sizeof(head), 1, file);
+    }
+    bytes = 0;
+    packets = 0;
+    nch = 0;                        // a new file starts a new run
+    rec.frames = 0;
+    rec.dropped = 0;
+    if (!samples)
+        notes.setCapture(fname);
+    return true;
+}
+/*virtual*/ bool ResampleSink::isOpen() const
+{
+    return (file != NULL);
+}
+/*virtual*/ void ResampleSink::close()
+{
+    if (file)
+    {
+        writeBlock();
+        fclose(file);
+        file = NULL;
+        if (partial)
+            sinkRename(name, name.substr(0, name.length() - 5));    // drop ".part"
+    }
+    if (samples)
+        samples->close();
+    notes.close();
+}
+
+// new run: filters start from nothing
+void ResampleSink::begin(const CapturePacket &pkt, int frames)
+{
+    PacketHeader hdr(pkt.buffer[0]);
+    what = hdr.what;
+    rate = hdr.rate;
+    scale = pkt.scale;
+    nch = hdr.channels();
+    double inRate = hdr.sampleRate();
+    int lost = rec.dropped + pkt.dropped;       // a run that ended before any output passes its losses on
+    resampler.start(inRate, nch);
+    runSample = pkt.sample;
+    runTime = pkt.rxTime - frames / inRate;     // arrival is just after the packet's last sample
+
+    memset(&rec, 0, sizeof(rec));
+    rec.channels = nch;
+    rec.scale = scale;
+    rec.dropped = lost;
+    rec.start = 1;
+    rec.rate = resampler.outputRate();
+    rec.inputRate = inRate;
+    blockFrames = (int)(RECORD_SECONDS * rec.rate);
+    if (blockFrames > 1024 / nch)
+        blockFrames = 1024 / nch;
+    if (blockFrames < 1)
+        blockFrames = 1;
+}
+
+/*virtual*/ void ResampleSink::write(const CapturePacket &pkt)
+{
+    if (!file)
+        return;
+    if (samples)
+        samples->write(pkt);
+    ++packets;
+    if (pkt.nwords < 2)
+        return;
+
+    PacketHeader hdr(pkt.buffer[0]);
+    int count = packetToFloat(pkt, values);
+    if (nch == 0 || hdr.what != what || hdr.rate != rate || (hdr.isInt() && pkt.scale != scale) || pkt.dropped > 0)
+    {
+        writeBlock();
+        begin(pkt, count / hdr.channels());
+    }
+    if (rec.frames == 0)
+    {
+        double pos = resampler.position();
+        rec.header = pkt.buffer[0];
+        rec.firstSample = runSample + pos;
+        rec.firstTime = runTime + pos / rec.inputRate;
+    }
+    rec.header |= pkt.buffer[0] & 0x03000000;   // overload / error bits
+    rec.frames += resampler.push(values, count / nch, block + rec.frames * nch);
+    if (rec.frames >= blockFrames)
+        writeBlock();
+}
+
+void ResampleSink::writeBlock()
+{
+    if (!file || rec.frames == 0)
+        return;
+    fwrite(&rec, sizeof(rec), 1, file);
+    fwrite(block, sizeof(float), rec.frames * rec.channels, file);
+    bytes += sizeof(rec) + sizeof(float) * rec.frames * rec.channels;
+    rec.frames = 0;
+    rec.dropped = 0;
+    rec.start = 0;
+}
+
+/*virtual*/ long long ResampleSink::bytesWritten()
+{
+    return bytes + (samples ? samples->bytesWritten() : 0);
+}
+/*virtual*/ long long ResampleSink::packetsWritten() const
+{
+    return samples ? samples->packetsWritten() : packets;
+}
+/*virtual*/ void ResampleSink::note(const std::string &text)
+{
+    if (samples)
+        samples->note(text);
+    else
+        notes.write(text);
+}
+/*virtual*/ long long ResampleSink::syncCount() const
+{
+    return samples ? samples->syncCount() : 0;
+}
+/*virtual*/ double ResampleSink::syncTime() const
+{
+    return samples ? samples->syncTime() : 0.0;
+}
+/*virtual*/ void ResampleSink::idle(double now)
+{
+    if (samples)
+        samples->idle(now);
+}
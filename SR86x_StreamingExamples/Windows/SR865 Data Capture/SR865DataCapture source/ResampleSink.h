@@ -0,0 +1,90 @@
+//---------------------------------------------------------------------------
+
+#ifndef ResampleSinkH
+#define ResampleSinkH
+
+#include <stdio.h>
+#include "CaptureSink.h"
+#include "Resampler.h"
+
+//---------------------------------------------------------------------------
+
+// resampled capture (see Resampler.h)
+//
+// Saving to "run.rsd" keeps the stream at the output rate only, as float in engineering units.
+// As a side-stream (ResampleOptions.side) the samples are saved as usual and the resampled
+// data goes to "run.dat.rsd" beside them; segmented captures get one per segment.
+// The receive side is not touched: every packet is still received, counted and (as a side-stream) saved.
+//
+// The file starts with a ResampleFileHead, followed by ResampleRecord records (host byte order),
+// each followed by channels * frames floats, interleaved as in the stream packets.
+// A run of records starts again (start = 1) after lost packets or a change of content, rate or
+// sensitivity; the filters are never fed across a gap.
+
+struct ResampleFileHead
+{
+    char id[8];                     // "SR86xRS1"
+    double wallTime;                // time() when file was created
+    double clockTime;               // captureClock() when file was created
+};
+
+struct ResampleRecord
+{
+    unsigned int header;            // header of the input (content, input rate; overload bits of any packet in the record)
+    int channels;
+    int frames;                     // samples per channel that follow
+    int scale;                      // scale code of integer input (SampleScale.h)
+    int dropped;                    // input packets lost just before this record
+    int start;                      // 1 = first record of a run
+    double rate;                    // output samples per second
+    double inputRate;
+    double firstSample;             // input sample index (CapturePacket.sample; fractional) of the first sample;
+                                    // sample i is at firstSample + i * inputRate / rate
+    double firstTime;               // its time (captureClock() seconds, from the arrival of the run's first packet);
+                                    // sample i is at firstTime + i / rate
+};
+
+class ResampleSink : public CaptureSink
+{
+protected:
+    CaptureSink *samples;           // capture file the samples go to; NULL = resampled data only
+    Resampler resampler;
+    FILE *file;
+    SinkPath name;
+    bool partial;
+    long long bytes;
+    long long packets;
+    SinkNotes notes;                // resampled only; "run.rsd.log"
+
+    int what, rate, scale;          // input stream; nch 0 = none yet
+    int nch;
+    long long runSample;            // CapturePacket.sample of the run's first input sample
+    double runTime;                 // its time
+    ResampleRecord rec;             // record being filled
+    int blockFrames;                // frames per record
+    float values[512];
+    float block[1024 + 4 * 520];    // record data, with room for one more packet's output
+
+    void begin(const CapturePacket &pkt, int frames);
+    void writeBlock();
+
+public:
+    // takes ownership of samples
+    ResampleSink(const ResampleOptions &opt, CaptureSink *samples);
+    virtual ~ResampleSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();           // samples and resampled data
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+    virtual long long syncCount() const;
+    virtual double syncTime() const;
+    virtual void idle(double now);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,371 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "Resampler.h"
+#include "CaptureSimd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// sample rate conversion on the writer thread (ResampleSink)
+// The filters are designed in start() when the input rate changes; push() allocates nothing.
+
+#define PHASES          128         // stage 2 kernel phases per input sample
+#define STOPBAND_DB     100.0       // stage 2 design attenuation
+#define CHUNK           512         // frames a decimator buffers beyond its kernel
+#define MAX_FACTOR      64          // largest factor of a stage 1 decimator
+
+bool parseResample(const std::string &spec, ResampleOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key == "rate" || key == "passband")
+        {
+            char *end;
+            double v = strtod(val.c_str(), &end);
+            bool ok = (end != val.c_str() && !*end);
+            if (key == "rate")
+                ok = ok && v >= 0.01 && v <= 1.25e6;
+            else
+                ok = ok && v >= 0.5 && v <= 0.95;
+            if (!ok)
+            {
+                err = "bad value for " + key + ": \"" + val + "\"";
+                return false;
+            }
+            if (key == "rate")
+                opt.rate = v;
+            else
+                opt.passband = v;
+        }
+        else if (key == "side" && eq == std::string::npos)
+            opt.side = true;
+        else
+        {
+            err = "unknown resample setting \"" + item + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+// sum of a[i]*b[i], in 4 interleaved partial sums so the vector and plain versions agree
+static float dotProduct(const float *a, const float *b, int n)
+{
+    int i = 0;
+    float s[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+#if defined(CAPTURE_SSE2)
+    __m128 acc = _mm_setzero_ps();
+    for (; i+4<=n; i+=4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    _mm_storeu_ps(s, acc);
+#elif defined(CAPTURE_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i+4<=n; i+=4)
+        acc = vaddq_f32(acc, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+    vst1q_f32(s, acc);
+#endif
+    for (; i+4<=n; i+=4)
+    {
+        float p0 = a[i] * b[i], p1 = a[i+1] * b[i+1], p2 = a[i+2] * b[i+2], p3 = a[i+3] * b[i+3];
+        s[0] += p0;
+        s[1] += p1;
+        s[2] += p2;
+        s[3] += p3;
+    }
+    for (int k=0; i<n; ++i, ++k)
+        s[k] += a[i] * b[i];
+    return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+// n has no prime factor above MAX_FACTOR
+static bool smooth(long long n)
+{
+    for (int p=2;p<=MAX_FACTOR && n>1;++p)
+        while (n % p == 0)
+            n /= p;
+    return (n == 1);
+}
+
+// zeroth order modified Bessel function, for the Kaiser window
+static double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k=1;k<50;++k)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < 1.0e-12 * sum)
+            break;
+    }
+    return sum;
+}
+
+Resampler::Resampler(const ResampleOptions &opt)
+{
+    options = opt;
+    inRate = 0.0;
+    nch = 0;
+    bypass = true;
+    ratio = 1.0;
+    decim = 1;
+    rho = 1.0;
+    h2 = 0;
+    cap2 = 0;
+    base2 = fill2 = first2 = next2 = 0;
+}
+
+void Resampler::design()
+{
+    ratio = inRate / options.rate;
+    bypass = (ratio <= 1.0);
+    decim = 1;
+    rho = 1.0;
+    h2 = 0;
+    box.clear();
+    if (bypass)
+    {
+        ratio = 1.0;
+        return;
+    }
+
+    // stage 1 factor: rho in [8, 16); an exact divisor if the ratio is a whole number.
+    // Only small factors: there is a power of 2 above ratio / 16 at the latest
+    if (ratio >= 16.0)
+    {
+        decim = (int)(ratio / 8.0);
+        while (!smooth(decim))
+            --decim;
+        long long whole = (long long)floor(ratio + 0.5);
+        if (fabs(ratio - whole) < 1.0e-9 * ratio)
+        {
+            for (long long r=whole/8; r>=1; --r)
+            {
+                if (whole % r == 0 && whole / r < 32 && smooth(r))
+                {
+                    decim = (int)r;
+                    break;
+                }
+                if (whole / r >= 32)
+                    break;
+            }
+        }
+    }
+    rho = ratio / decim;
+
+    // boxcar^4 of R = boxcar^4 of R1, then (at the rate / R1) boxcar^4 of R2 ..., for R = R1 * R2 ...
+    std::vector<int> factors;
+    int left = decim;
+    for (int p=MAX_FACTOR;p>=2;--p)
+    {
+        while (left % p == 0)
+        {
+            // fill up the last factor before starting another
+            if (!factors.empty() && factors.back() * p <= MAX_FACTOR)
+                factors.back() *= p;
+            else
+                factors.push_back(p);
+            left /= p;
+        }
+    }
+    box.resize(factors.size());
+    for (size_t s=0;s<factors.size();++s)
+    {
+        BoxStage &st = box[s];
+        st.factor = factors[s];
+        st.half = 2 * (st.factor - 1);
+        std::vector<double> k(1, 1.0);
+        for (int n=0;n<4;++n)
+        {
+            std::vector<double> next(k.size() + st.factor - 1, 0.0);
+            for (size_t i=0;i<k.size();++i)
+                for (int j=0;j<st.factor;++j)
+                    next[i + j] += k[i] / st.factor;
+            k.swap(next);
+        }
+        st.kernel.assign(k.begin(), k.end());
+        st.cap = (int)st.kernel.size() + CHUNK;
+        for (int c=0;c<4;++c)
+            st.buf[c].assign(st.cap, 0.0f);
+    }
+
+    // stage 2: Kaiser windowed sinc, cut off half way through the transition band
+    double fc = 0.5 / rho;                              // cycles per stage 2 sample
+    double width = (1.0 - options.passband) / rho;
+    double beta = 0.1102 * (STOPBAND_DB - 8.7);
+    int taps = (int)ceil((STOPBAND_DB - 7.95) / (14.36 * width)) + 1;
+    h2 = taps / 2 + 1;
+    int n2 = 2 * h2;
+    k2.assign((PHASES + 1) * n2, 0.0f);
+    const double pi = 3.14159265358979323846;
+    double gain = 0.0;
+    std::vector<double> h(n2);
+    for (int p=0;p<=PHASES;++p)
+    {
+        for (int t=0;t<n2;++t)
+        {
+            double x = (double)p / PHASES - (t - h2 + 1);   // distance from the output point
+            double v = 0.0;
+            if (fabs(x) < h2)
+            {
+                double r = x / h2;
+                double s = (x == 0.0) ? 2.0 * fc : sin(2.0 * pi * fc * x) / (pi * x);
+                v = s * besselI0(beta * sqrt(1.0 - r * r)) / besselI0(beta);
+            }
+            h[t] = v;
+            if (p == 0)
+                gain += v;
+        }
+        for (int t=0;t<n2;++t)
+            k2[p * n2 + t] = (float)h[t];
+    }
+    for (size_t i=0;i<k2.size();++i)
+        k2[i] = (float)(k2[i] / gain);
+
+    cap2 = n2 + CHUNK;
+    for (int c=0;c<4;++c)
+        b2[c].assign(cap2, 0.0f);
+}
+
+void Resampler::start(double rate, int channels)
+{
+    if (rate != inRate)
+    {
+        inRate = rate;
+        design();
+    }
+    nch = channels;
+    // each decimator's first output with all its input
+    long long first = 0;
+    for (size_t s=0;s<box.size();++s)
+    {
+        BoxStage &st = box[s];
+        st.base = first;
+        st.fill = 0;
+        st.next = (first + st.half + st.factor - 1) / st.factor;
+        first = st.next;
+    }
+    first2 = base2 = first;
+    fill2 = 0;
+    // first output whose kernel lies within the stage 1 outputs
+    next2 = (long long)ceil((first2 + h2 - 1) / rho);
+    if (bypass)
+        next2 = 0;
+}
+
+double Resampler::step() const
+{
+    return ratio;
+}
+double Resampler::position() const
+{
+    return next2 * ratio;
+}
+double Resampler::outputRate() const
+{
+    return inRate / ratio;
+}
+
+// stage 2 outputs that have all their input
+void Resampler::stage2(float *out, int &nout)
+{
+    int n2 = 2 * h2;
+    for (;;)
+    {
+        double u = next2 * rho;
+        long long i = (long long)floor(u);
+        if (i + h2 >= base2 + fill2)
+            break;
+        double f = (u - i) * PHASES;
+        int p = (int)f;
+        float frac = (float)(f - p);
+        const float *c0 = &k2[p * n2];
+        long long at = i - h2 + 1 - base2;
+        for (int c=0;c<nch;++c)
+        {
+            const float *y = &b2[c][(size_t)at];
+            float v = dotProduct(y, c0, n2);
+            if (frac != 0.0f)
+                v += frac * (dotProduct(y, c0 + n2, n2) - v);
+            out[nout * nch + c] = v;
+        }
+        ++nout;
+        ++next2;
+    }
+}
+
+int Resampler::push(const float *in, int frames, float *out)
+{
+    int nout = 0;
+    if (bypass)
+    {
+        memcpy(out, in, frames * nch * sizeof(float));
+        next2 += frames;
+        return frames;
+    }
+
+    for (int i=0;i<frames;++i)
+        put(0, in + i * nch, out, nout);
+    return nout;
+}
+
+// one frame into decimator s, or into stage 2 after the last one
+void Resampler::put(int s, const float *frame, float *out, int &nout)
+{
+    if (s == (int)box.size())
+    {
+        if (fill2 == cap2)
+        {
+            // drop input no output needs any more
+            long long keep = (long long)floor(next2 * rho) - h2 + 1;
+            int shift = (int)(keep - base2);
+            for (int c=0;c<nch;++c)
+                memmove(&b2[c][0], &b2[c][shift], (size_t)(fill2 - shift) * sizeof(float));
+            base2 += shift;
+            fill2 -= shift;
+        }
+        for (int c=0;c<nch;++c)
+            b2[c][(size_t)fill2] = frame[c];
+        ++fill2;
+        stage2(out, nout);
+        return;
+    }
+
+    BoxStage &st = box[s];
+    if (st.fill == st.cap)
+    {
+        long long keep = st.next * st.factor - st.half;
+        int shift = (int)(keep - st.base);
+        for (int c=0;c<nch;++c)
+            memmove(&st.buf[c][0], &st.buf[c][shift], (size_t)(st.fill - shift) * sizeof(float));
+        st.base += shift;
+        st.fill -= shift;
+    }
+    for (int c=0;c<nch;++c)
+        st.buf[c][(size_t)st.fill] = frame[c];
+    ++st.fill;
+    // factor >= 2: at most one output per input frame
+    if (st.next * st.factor + st.half < st.base + st.fill)
+    {
+        float y[4];
+        long long at = st.next * st.factor - st.half - st.base;
+        for (int c=0;c<nch;++c)
+            y[c] = dotProduct(&st.buf[c][(size_t)at], &st.kernel[0], (int)st.kernel.size());
+        ++st.next;
+        put(s + 1, y, out, nout);
+    }
+}
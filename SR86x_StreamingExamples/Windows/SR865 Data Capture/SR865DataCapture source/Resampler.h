@@ -0,0 +1,90 @@
+//---------------------------------------------------------------------------
+
+#ifndef ResamplerH
+#define ResamplerH
+
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------------
+
+// anti-aliased sample rate conversion to any lower rate (e.g. exactly 1 kHz from 1.25 MHz / 2^n)
+//
+// Two stages:
+//   1. integer decimation by R with a 4th order CIC response (boxcar^4), computed as FIRs
+//      so float data never sits in a running integrator. R is made of factors of at most 64,
+//      and is done as a cascade of boxcar^4 decimators, one per factor: the same response,
+//      for about 4 taps per input sample and kernels of at most 253 taps, whatever R is
+//   2. polyphase FIR (Kaiser windowed sinc, 128 phases, linear between phases) for the
+//      remaining ratio rho = input rate / (R * output rate), fractional or not; 8 <= rho < 16
+//      whenever the total ratio is 16 or more, so the CIC droop in the passband is small
+//      (0.15 dB at the default passband)
+// Output sample k stands for the signal at input sample position k * step() since start():
+// every stage is centred, so there is no delay to correct for.
+// The response is flat to passband * output Nyquist; everything aliasing onto that band is
+// attenuated by at least 90 dB.
+
+struct ResampleOptions
+{
+    double rate;                    // output samples per second (per channel)
+    double passband;                // part of the output Nyquist band kept flat (0.5 .. 0.95)
+    bool side;                      // write resampled data beside the capture file, not instead of it
+
+    ResampleOptions() : rate(1000.0), passband(0.8), side(false) {}
+};
+
+// options from text, e.g. "rate=1000;passband=0.9;side"
+bool parseResample(const std::string &spec, ResampleOptions &opt, std::string &err);
+
+class Resampler
+{
+protected:
+    ResampleOptions options;
+    double inRate;
+    int nch;
+    bool bypass;                    // output rate not below input rate: samples pass unchanged
+    double ratio;                   // input samples per output sample
+    int decim;                      // stage 1 factor R
+    double rho;                     // stage 2 ratio
+
+    // one decimator of stage 1; its input is the previous one's output (the first one's, input samples)
+    struct BoxStage
+    {
+        int factor;
+        int half;                   // kernel is 2*half+1 taps
+        std::vector<float> kernel;
+        std::vector<float> buf[4];
+        int cap;
+        long long base, fill;       // buf[c][0] is input base
+        long long next;             // next output
+    };
+    std::vector<BoxStage> box;      // none if R is 1
+    std::vector<float> k2;          // stage 2 kernels, one per phase (0 .. 128), 2*h2 taps each
+    int h2;
+    std::vector<float> b2[4];
+    int cap2;
+    long long base2, fill2;         // b2[c][0] is stage 1 output base2
+    long long first2;               // first stage 1 output
+    long long next2;                // next stage 2 output
+
+    void design();
+    void put(int s, const float *frame, float *out, int &nout);
+    void stage2(float *out, int &nout);
+
+public:
+    Resampler(const ResampleOptions &opt);
+
+    // new run of nch channels at inRate; history is dropped, filters are designed again if the rate changed
+    void start(double rate, int channels);
+
+    // frames of interleaved input; returns output frames written to out (interleaved),
+    // at most frames / step() + 1
+    int push(const float *in, int frames, float *out);
+
+    double step() const;            // input samples per output sample
+    double position() const;        // input sample position of the next output sample (since start())
+    double outputRate() const;
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,150 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "SampleScale.h"
+#include "PacketHeader.h"
+#include "CaptureSimd.h"
+#include <string.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// integer to engineering unit conversion
+// Converting costs much less than receiving twice the data as float,
+// so integer streaming halves the network & disk load for free.
+
+int scaleCode(int sensIndex, bool current)
+{
+    if (sensIndex < 0 || sensIndex > 27)
+        return SCALE_UNKNOWN;
+    return sensIndex | (current ? SCALE_CURRENT : 0);
+}
+
+double sensitivityOf(int scale)
+{
+    if (scale < 0)
+        return 0.0;
+    // SCAL? index 0 = 1V (1uA), then 500m, 200m, 100m, 50m, ... 1nV (1fA)
+    static const double mant[3] = { 1.0, 0.5, 0.2 };
+    int i = scale & 0xff;
+    double fs = mant[i % 3];
+    for (int k=0;k<i/3;++k)
+        fs *= 0.1;
+    if (scale & SCALE_CURRENT)
+        fs *= 1.0e-6;
+    return fs;
+}
+
+const char *scaleUnit(int scale)
+{
+    if (scale < 0)
+        return "counts";
+    return (scale & SCALE_CURRENT) ? "A" : "V";
+}
+
+float countScale(int scale, bool theta)
+{
+    if (scale < 0)
+        return 1.0f;
+    if (theta)
+        return (float)(180.0 / FULL_SCALE_COUNTS);
+    return (float)(sensitivityOf(scale) / FULL_SCALE_COUNTS);
+}
+
+void channelScales(int scale, int what, float *perCount)
+{
+    float k = countScale(scale, false);
+    float th = countScale(scale, true);
+    switch (what & 3)
+    {
+        default:
+            perCount[0] = k;
+            break;
+        case 1:
+            perCount[0] = perCount[1] = k;
+            break;
+        case 2:
+            perCount[0] = k;
+            perCount[1] = th;
+            break;
+        case 3:
+            perCount[0] = perCount[1] = perCount[2] = k;
+            perCount[3] = th;
+            break;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void int16ToFloat(const short *in, int frames, int nch, const float *perCount, float *out)
+{
+    int n = frames * nch;
+    int i = 0;
+    if (nch == 1 || nch == 2 || nch == 4)
+    {
+        // channel pattern repeats every 4 values
+        float pat[8];
+        for (int k=0;k<8;++k)
+            pat[k] = perCount[k % nch];
+#if defined(CAPTURE_AVX2)
+        __m256 p8 = _mm256_loadu_ps(pat);
+        for (; i+8<=n; i+=8)
+        {
+            __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), p8));
+        }
+#elif defined(CAPTURE_SSE2)
+        __m128 p4 = _mm_loadu_ps(pat);
+        for (; i+8<=n; i+=8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);     // sign extend
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), p4));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), p4));
+        }
+#elif defined(CAPTURE_NEON)
+        float32x4_t p4 = vld1q_f32(pat);
+        for (; i+8<=n; i+=8)
+        {
+            int16x8_t v = vld1q_s16(in + i);
+            vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), p4));
+            vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), p4));
+        }
+#endif
+    }
+    // i is a multiple of nch here
+    for (int c=0; i<n; ++i)
+    {
+        out[i] = in[i] * perCount[c];
+        if (++c == nch)
+            c = 0;
+    }
+}
+
+int packetToFloat(const CapturePacket &pkt, float *out)
+{
+    if (pkt.nwords < 2)
+        return 0;
+    PacketHeader hdr(pkt.buffer[0]);
+    // no more than the header's length, so out never takes more than 512 values
+    int words = pkt.nwords - 1;
+    if (words > (hdr.byteLength() >> 2))
+        words = hdr.byteLength() >> 2;
+    if (!hdr.isInt())
+    {
+        int n = words;
+        memcpy(out, pkt.buffer + 1, n * sizeof(float));
+        return n;
+    }
+
+    float perCount[4];
+    int nch = hdr.channels();
+    channelScales(pkt.scale, hdr.what, perCount);
+    int frames = (words * 2) / nch;
+    int16ToFloat((const short *)(pkt.buffer + 1), frames, nch, perCount, out);
+    return frames * nch;
+}
@@ -0,0 +1,40 @@
+//---------------------------------------------------------------------------
+
+#ifndef SampleScaleH
+#define SampleScaleH
+
+#include "PacketQueue.h"
+
+//---------------------------------------------------------------------------
+
+// engineering units for integer stream data (content codes 4-7)
+//
+// Integer packets carry 16bit counts:
+//   X, Y, R   counts * sensitivity / 32767     (volts, or amps with current input)
+//   theta     counts * 180 / 32767             (degrees)
+// The sensitivity is not in the packets, so the user interface asks the instrument
+// (SCAL?, IVMD?) and the receive thread tags each packet with the scale code
+// that was current when it arrived.
+
+#define SCALE_UNKNOWN       (-1)        // no sensitivity known; values stay in counts
+#define SCALE_CURRENT       0x100       // or'd into scale code when input is current (IVMD 1)
+#define FULL_SCALE_COUNTS   32767.0
+
+int scaleCode(int sensIndex, bool current);     // from SCAL? and IVMD? replies
+double sensitivityOf(int scale);                // full scale in V or A; 0 if unknown
+const char *scaleUnit(int scale);               // "V", "A" or "counts"
+float countScale(int scale, bool theta);        // units (or degrees) per count; 1 if unknown
+
+// units per count for each channel of content code "what", in packet order
+void channelScales(int scale, int what, float *perCount);
+
+// convert interleaved int16 samples to float; perCount[c] scales channel c
+// nch of 1, 2 and 4 use vector code
+void int16ToFloat(const short *in, int frames, int nch, const float *perCount, float *out);
+
+// all samples of a packet as float, in engineering units if the packet's scale is known
+// (float packets are copied); returns number of values written to out (at most 512)
+int packetToFloat(const CapturePacket &pkt, float *out);
+
+//---------------------------------------------------------------------------
+#endif
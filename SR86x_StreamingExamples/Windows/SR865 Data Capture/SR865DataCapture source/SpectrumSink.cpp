@@ -0,0 +1,141 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "SpectrumSink.h"
+#include "CaptureSync.h"
+#include <string.h>
+#include <time.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// noise spectra files
+// The writer thread feeds every packet to the Welch estimator; finished spectra
+// are appended here as they come (at most a few per second of stream per channel pair).
+
+static const char spectrumId[9] = "SR86xPS1";
+
+SpectrumSink::SpectrumSink(const SpectrumOptions &opt, CaptureSink *sampleSink)
+    : psd(opt, this)
+{
+    samples = sampleSink;
+    file = NULL;
+    partial = false;
+    bytes = 0;
+    packets = 0;
+}
+/*virtual*/ SpectrumSink::~SpectrumSink()
+{
+    close();
+    delete samples;
+}
+
+/*virtual*/ bool SpectrumSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    name = fname;
+    partial = false;
+    if (samples)
+    {
+        if (!samples->open(fname, trunc))
+            return false;
+        // "run.dat" -> "run.dat.psd"; "run_0000.dat.part" -> "run_0000.dat.psd.part"
+        SinkPath part = sinkPath(".part");
+        partial = (name.length() > part.length() && name.compare(name.length() - part.length(), part.length(), part) == 0);
+        if (partial)
+            name.erase(name.length() - part.length());
+        name += sinkPath(".psd");
+        if (partial)
+            name += part;
+    }
+
+    file = sinkOpen(name, trunc ? "wb" : "ab");
+    if (!file)
+    {
+        if (samples)
+            samples->close();
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    if (sinkTell(file) == 0)
+    {
+        SpectrumFileHead head;
+        memcpy(head.id, spectrumId, 8);
+        head.wallTime = (double)time(0);
+        head.clockTime = captureClock();
+        fwrite(&head, sizeof(head), 1, file);
+    }
+    bytes = 0;
+    packets = 0;
+    psd.reset();
+    if (!samples)
+        notes.setCapture(fname);
+    return true;
+}
+/*virtual*/ bool SpectrumSink::isOpen() const
+{
+    return (file != NULL);
+}
+/*virtual*/ void SpectrumSink::close()
+{
+    if (file)
+    {
+        psd.flush();                // spectrum so far
+        fclose(file);
+        file = NULL;
+        if (partial)
+            sinkRename(name, name.substr(0, name.length() - 5));    // drop ".part"
+    }
+    if (samples)
+        samples->close();
+    notes.close();
+}
+
+/*virtual*/ void SpectrumSink::write(const CapturePacket &pkt)
+{
+    if (!file)
+        return;
+    if (samples)
+        samples->write(pkt);
+    psd.add(pkt);
+    ++packets;
+}
+
+/*virtual*/ void SpectrumSink::spectrum(const SpectrumRecord &rec, const float *values)
+{
+    fwrite(&rec, sizeof(rec), 1, file);
+    fwrite(values, sizeof(float), rec.channels * rec.bins, file);
+    bytes += sizeof(rec) + sizeof(float) * rec.channels * rec.bins;
+}
+
+/*virtual*/ long long SpectrumSink::bytesWritten()
+{
+    return bytes + (samples ? samples->bytesWritten() : 0);
+}
+/*virtual*/ long long SpectrumSink::packetsWritten() const
+{
+    return samples ? samples->packetsWritten() : packets;
+}
+/*virtual*/ void SpectrumSink::note(const std::string &text)
+{
+    if (samples)
+        samples->note(text);
+    else
+        notes.write(text);
+}
+/*virtual*/ long long SpectrumSink::syncCount() const
+{
+    return samples ? samples->syncCount() : 0;
+}
+/*virtual*/ double SpectrumSink::syncTime() const
+{
+    return samples ? samples->syncTime() : 0.0;
+}
+/*virtual*/ void SpectrumSink::idle(double now)
+{
+    if (samples)
+        samples->idle(now);
+}
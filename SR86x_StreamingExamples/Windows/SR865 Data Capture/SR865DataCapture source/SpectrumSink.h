@@ -0,0 +1,62 @@
+//---------------------------------------------------------------------------
+
+#ifndef SpectrumSinkH
+#define SpectrumSinkH
+
+#include <stdio.h>
+#include "CaptureSink.h"
+#include "WelchPsd.h"
+
+//---------------------------------------------------------------------------
+
+// noise spectra capture (see WelchPsd.h)
+//
+// Saving to "run.psd" keeps only the averaged spectra: at the default 4096 point segments
+// and 16 averages a 1.25 MHz X,Y stream (10 MB/s) becomes about 0.6 MB/s; more averages, less.
+// As a side-stream (SpectrumOptions.side) the samples are saved as usual and the spectra go to
+// "run.dat.psd" beside them; segmented captures get one per segment ("run_0000.dat.psd").
+//
+// The file starts with a SpectrumFileHead, followed by SpectrumRecord records (host byte order),
+// each followed by its channels * bins floats.
+
+struct SpectrumFileHead
+{
+    char id[8];                     // "SR86xPS1"
+    double wallTime;                // time() when file was created
+    double clockTime;               // captureClock() when file was created
+};
+
+class SpectrumSink : public CaptureSink, protected SpectrumOutput
+{
+protected:
+    CaptureSink *samples;           // capture file the samples go to; NULL = spectra only
+    WelchPsd psd;
+    FILE *file;
+    SinkPath name;
+    bool partial;                   // ".part" until closed (side-stream of a segment)
+    long long bytes;
+    long long packets;
+    SinkNotes notes;                // spectra only; "run.psd.log"
+
+    virtual void spectrum(const SpectrumRecord &rec, const float *values);
+
+public:
+    // takes ownership of samples
+    SpectrumSink(const SpectrumOptions &opt, CaptureSink *samples);
+    virtual ~SpectrumSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();           // samples and spectra
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+    virtual long long syncCount() const;
+    virtual double syncTime() const;
+    virtual void idle(double now);
+};
+
+//---------------------------------------------------------------------------
+#endif
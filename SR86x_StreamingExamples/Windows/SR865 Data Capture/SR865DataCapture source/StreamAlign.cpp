@@ -0,0 +1,582 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "StreamAlign.h"
+#include "ColumnSink.h"
+#include "SampleScale.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sstream>
+#include <limits>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// time alignment of several streams
+// Clock fit: x = instrument time (sample index / nominal rate) since the first packet,
+// y = arrival - first arrival - x; y = offset + drift * x is the shortest latency plus
+// the instruments' clock error, so sample s was taken at (first arrival + x + offset + drift * x).
+// The fit keeps weighted means and co-moments, so it doesn't lose precision over a long run.
+
+static const char alignId[9] = "SR86xAL1";
+
+#define CLOCK_BLOCK     0.25        // seconds of packets per fit point (the earliest arrival counts)
+#define CLOCK_LATE      0.002       // a point this far above the line is left out (the whole block was late) ...
+#define CLOCK_LATE_MAX  8           // ... unless that many in a row were: the latency has changed
+#define CLOCK_JUMP      0.1         // this far off the line, the fit starts again (instrument restarted)
+#define CLOCK_PRIOR     1.0         // holds drift towards 0 until the points span a few seconds (s^2)
+#define KAISER_BETA     6.0         // interpolation window
+
+bool parseAlign(const std::string &spec, AlignOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key != "rate" && key != "passband" && key != "memory" && key != "timeout")
+        {
+            err = "unknown align setting \"" + item + "\"";
+            return false;
+        }
+        char *end;
+        double v = strtod(val.c_str(), &end);
+        bool ok = (end != val.c_str() && !*end);
+        if (key == "rate")
+            ok = ok && v >= 0.01 && v <= 1.25e6;
+        else if (key == "passband")
+            ok = ok && v >= 0.5 && v <= 0.95;
+        else if (key == "memory")
+            ok = ok && v >= 1.0;
+        else
+            ok = ok && v >= 0.01 && v <= 10.0;
+        if (!ok)
+        {
+            err = "bad value for " + key + ": \"" + val + "\"";
+            return false;
+        }
+        if (key == "rate")
+            opt.rate = v;
+        else if (key == "passband")
+            opt.passband = v;
+        else if (key == "memory")
+            opt.memory = v;
+        else
+            opt.timeout = v;
+    }
+    return true;
+}
+
+static const float missing = std::numeric_limits<float>::quiet_NaN();
+
+static bool isNan(float v)
+{
+    return v != v;
+}
+
+//---------------------------------------------------------------------------
+// StreamClock
+
+StreamClock::StreamClock()
+{
+    reset(0.0, 60.0);
+}
+
+void StreamClock::reset(double samplesPerSecond, double memorySeconds)
+{
+    rate = samplesPerSecond;
+    memory = memorySeconds;
+    origin = 0;
+    originTime = 0.0;
+    blockEnd = 0.0;
+    bestX = bestY = 0.0;
+    block = false;
+    weight = 0.0;
+    mx = my = cxx = cxy = 0.0;
+    points = 0;
+    late = 0;
+    offset = drift = 0.0;
+}
+
+void StreamClock::fit(double x, double y)
+{
+    if (points >= 2)
+    {
+        double r = y - (offset + drift * x);
+        if (fabs(r) > CLOCK_JUMP)
+        {
+            weight = 0.0;
+            mx = my = cxx = cxy = 0.0;
+            points = 0;
+        }
+        else if (r > CLOCK_LATE && late < CLOCK_LATE_MAX)
+        {
+            ++late;
+            return;
+        }
+    }
+    late = 0;
+    double lambda = exp(-CLOCK_BLOCK / memory);
+    double w = lambda * weight + 1.0;
+    double dx = x - mx, dy = y - my;
+    double k = lambda * weight / w;
+    cxx = lambda * cxx + k * dx * dx;
+    cxy = lambda * cxy + k * dx * dy;
+    mx += dx / w;
+    my += dy / w;
+    weight = w;
+    ++points;
+    drift = cxy / (cxx + CLOCK_PRIOR);
+    offset = my - drift * mx;
+}
+
+void StreamClock::add(long long last, double rxTime)
+{
+    if (rate <= 0.0)
+        return;
+    if (!block && points == 0)
+    {
+        // first packet
+        origin = last;
+        originTime = rxTime;
+    }
+    double x = (last - origin) / rate;
+    double y = rxTime - originTime - x;
+    if (block && x >= blockEnd)
+    {
+        fit(bestX, bestY);
+        block = false;
+    }
+    if (!block)
+    {
+        block = true;
+        bestX = x;
+        bestY = y;
+        blockEnd = x + CLOCK_BLOCK;
+    }
+    else if (y < bestY)
+    {
+        bestX = x;
+        bestY = y;
+    }
+    if (points == 0)
+    {
+        // no fit yet: the earliest arrival so far
+        offset = bestY;
+        drift = 0.0;
+    }
+}
+
+bool StreamClock::valid() const
+{
+    return (rate > 0.0 && (block || points > 0));
+}
+
+double StreamClock::time(double sample) const
+{
+    double x = (sample - origin) / rate;
+    return originTime + x + offset + drift * x;
+}
+
+double StreamClock::sample(double t) const
+{
+    double x = (t - originTime - offset) / (1.0 + drift);
+    return origin + x * rate;
+}
+
+double StreamClock::driftPpm() const
+{
+    return -drift * 1.0e6;
+}
+
+double StreamClock::lateness(long long last, double rxTime) const
+{
+    return rxTime - time((double)last);
+}
+
+//---------------------------------------------------------------------------
+// StreamAligner
+
+// zeroth order modified Bessel function, for the Kaiser window
+static double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k=1;k<50;++k)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < 1.0e-12 * sum)
+            break;
+    }
+    return sum;
+}
+
+StreamAligner::StreamAligner(const AlignOptions &opt)
+{
+    options = opt;
+    count = 0;
+    file = NULL;
+    csv = false;
+    started = false;
+    gridNext = 0;
+    now = 0.0;
+    firstArrival = 0.0;
+    records = 0;
+
+    // windowed sinc at the resampled rate; tap j is at j - (ALIGN_HALF-1) - fraction,
+    // each kernel scaled to a sum of 1 so a constant stays exact
+    const double pi = 3.14159265358979323846;
+    for (int p=0;p<=64;++p)
+    {
+        double f = p / 64.0;
+        double w[2 * ALIGN_HALF], sum = 0.0;
+        for (int j=0;j<2*ALIGN_HALF;++j)
+        {
+            double d = j - (ALIGN_HALF - 1) - f;
+            double a = d / ALIGN_HALF;
+            double win = (fabs(a) < 1.0) ? besselI0(KAISER_BETA * sqrt(1.0 - a * a)) / besselI0(KAISER_BETA) : 0.0;
+            double sinc = (fabs(d) < 1.0e-9) ? 1.0 : sin(pi * d) / (pi * d);
+            w[j] = sinc * win;
+            sum += w[j];
+        }
+        for (int j=0;j<2*ALIGN_HALF;++j)
+            kernel[p][j] = (float)(w[j] / sum);
+    }
+}
+StreamAligner::~StreamAligner()
+{
+    close();
+    for (int i=0;i<count;++i)
+    {
+        delete streams[i]->resampler;
+        delete streams[i];
+    }
+}
+
+int StreamAligner::addStream(double delay)
+{
+    if (count == ALIGN_MAX_STREAMS)
+        return -1;
+    ResampleOptions ro;
+    ro.rate = options.rate;
+    ro.passband = options.passband;
+    Stream *s = new Stream;
+    s->resampler = new Resampler(ro);
+    s->delay = delay;
+    s->seen = 0.0;
+    s->late = 0.0;
+    s->header = 0;
+    s->scale = 0;
+    s->nch = 0;
+    s->xy = false;
+    s->runSample = 0;
+    s->cap = 0;
+    s->first = s->next = 0;
+    streams[count] = s;
+    return count++;
+}
+
+int StreamAligner::streamCount() const
+{
+    return count;
+}
+
+bool StreamAligner::open(const SinkPath &fname)
+{
+    close();
+    lock.acquire();
+    SinkPath ext = sinkPath(".csv");
+    csv = (fname.length() > ext.length() && fname.compare(fname.length() - ext.length(), ext.length(), ext) == 0);
+    file = sinkOpen(fname, csv ? "w" : "wb");
+    if (file)
+    {
+        if (csv)
+        {
+            fprintf(file, "time");
+            for (int i=1;i<=count;++i)
+                fprintf(file, ",X%d,Y%d,R%d,Th%d", i, i, i, i);
+            fprintf(file, "\n");
+        }
+        else
+        {
+            AlignFileHead head;
+            memset(&head, 0, sizeof(head));
+            memcpy(head.id, alignId, 8);
+            head.wallTime = (double)time(0);
+            head.clockTime = captureClock();
+            head.streams = count;
+            head.rate = options.rate;
+            fwrite(&head, sizeof(head), 1, file);
+        }
+    }
+    for (int i=0;i<count;++i)
+    {
+        streams[i]->header = 0;
+        streams[i]->seen = 0.0;
+    }
+    started = false;
+    now = 0.0;
+    firstArrival = 0.0;
+    records = 0;
+    lock.release();
+    return (file != NULL);
+}
+
+void StreamAligner::close()
+{
+    lock.acquire();
+    if (file)
+    {
+        emit(true);
+        fclose(file);
+        file = NULL;
+    }
+    lock.release();
+}
+
+bool StreamAligner::isOpen() const
+{
+    return (file != NULL);
+}
+
+// new run of a stream: after lost packets, or a change of content, rate or sensitivity
+void StreamAligner::begin(Stream &s, const CapturePacket &pkt)
+{
+    PacketHeader hdr(pkt.buffer[0]);
+    s.header = pkt.buffer[0] & 0x00ff0f00;
+    s.scale = pkt.scale;
+    s.nch = columnsOf(hdr.what, s.cols);
+    bool x = false, y = false;
+    for (int k=0;k<s.nch;++k)
+    {
+        x = x || s.cols[k] == 0;
+        y = y || s.cols[k] == 1;
+    }
+    s.xy = x && y;
+    s.resampler->start(hdr.sampleRate(), s.nch);
+    s.unwrap.reset();
+    s.runSample = pkt.sample;
+
+    // room for timeout seconds, while another stream catches up, and the latest packet's output
+    int cap = (int)ceil((options.timeout + 2 * CLOCK_BLOCK) * s.resampler->outputRate()) + 4 * ALIGN_HALF + 520;
+    if (cap > s.cap)
+    {
+        s.hist.resize(cap * 4);
+        s.cap = cap;
+    }
+    // the resampler's first output is the first with all its input
+    s.first = s.next = (long long)floor(s.resampler->position() / s.resampler->step() + 0.5);
+}
+
+// resampled frames into the stream's ring, as X,Y,R,theta
+void StreamAligner::store(Stream &s, const float *frames, int n)
+{
+    for (int i=0;i<n;++i, frames+=s.nch)
+    {
+        float *h = &s.hist[(size_t)(s.next % s.cap) * 4];
+        h[0] = h[1] = h[2] = h[3] = missing;
+        for (int k=0;k<s.nch;++k)
+            h[s.cols[k]] = frames[k];
+        ++s.next;
+        if (s.next - s.first > s.cap)
+            ++s.first;
+    }
+}
+
+// the stream's X,Y,R,theta at time t (NaN where it has none)
+// returns 0 if the data for t may still come, 1 if xyrt holds all the stream will give
+int StreamAligner::value(Stream &s, double t, bool flush, float *xyrt)
+{
+    xyrt[0] = xyrt[1] = xyrt[2] = xyrt[3] = missing;
+    double seen = (s.seen > 0.0) ? s.seen : firstArrival;
+    bool stale = flush || now - seen > options.timeout;
+    if (!s.header || !s.clock.valid())
+        return stale ? 1 : 0;
+
+    double u = (s.clock.sample(t + s.delay) - s.runSample) / s.resampler->step();
+    double fl = floor(u);
+    long long i0 = (long long)fl - (ALIGN_HALF - 1);
+    if (i0 + 2 * ALIGN_HALF > s.next)
+        return stale ? 1 : 0;
+    if (i0 < s.first)
+        return 1;                   // before the run, or no longer kept
+
+    double p = (u - fl) * 64.0;
+    int ip = (int)p;
+    if (ip > 63)
+        ip = 63;
+    float a = (float)(p - ip);
+    float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int j=0;j<2*ALIGN_HALF;++j)
+    {
+        float w = kernel[ip][j] + a * (kernel[ip + 1][j] - kernel[ip][j]);
+        const float *h = &s.hist[(size_t)((i0 + j) % s.cap) * 4];
+        for (int c=0;c<4;++c)
+            sum[c] += w * h[c];
+    }
+    for (int c=0;c<4;++c)
+        xyrt[c] = sum[c];
+    if (s.xy)
+    {
+        float rt[4];
+        xyToPolar(xyrt, 1, rt);
+        xyrt[2] = rt[2];
+        xyrt[3] = rt[3];
+    }
+    else if (!isNan(xyrt[3]))
+    {
+        // unwrapped theta back to -180 .. 180
+        float th = (float)fmod(xyrt[3] + 180.0f, 360.0f);
+        xyrt[3] = ((th < 0.0f) ? th + 360.0f : th) - 180.0f;
+    }
+    return 1;
+}
+
+// writes the records every stream has data for; at close (flush), up to the last data of any stream
+void StreamAligner::emit(bool flush)
+{
+    if (!file)
+        return;
+    if (!started)
+    {
+        // the first time any stream can be interpolated at
+        bool any = false;
+        double t0 = 0.0;
+        for (int i=0;i<count;++i)
+        {
+            Stream &s = *streams[i];
+            if (!s.header || s.next < 2 * ALIGN_HALF)
+                continue;
+            double t = s.clock.time(s.runSample + (s.first + ALIGN_HALF - 1) * s.resampler->step()) - s.delay;
+            if (!any || t < t0)
+                t0 = t;
+            any = true;
+        }
+        if (!any)
+            return;
+        gridNext = (long long)ceil(t0 * options.rate);
+        started = true;
+    }
+    double end = 0.0;
+    if (flush)
+    {
+        // last time any stream has data for
+        for (int i=0;i<count;++i)
+        {
+            Stream &s = *streams[i];
+            if (!s.header || s.next < 2 * ALIGN_HALF)
+                continue;
+            double t = s.clock.time(s.runSample + (s.next - ALIGN_HALF) * s.resampler->step()) - s.delay;
+            if (t > end)
+                end = t;
+        }
+    }
+    for (;;)
+    {
+        double t = gridNext / options.rate;
+        if (flush && t > end)
+            return;
+        for (int i=0;i<count;++i)
+        {
+            if (!value(*streams[i], t, flush, rec + 4 * i))
+                return;
+        }
+        writeRecord(t);
+        ++gridNext;
+    }
+}
+
+void StreamAligner::writeRecord(double t)
+{
+    if (csv)
+    {
+        fprintf(file, "%.6f", t);
+        for (int i=0;i<4*count;++i)
+        {
+            if (isNan(rec[i]))
+                fputc(',', file);
+            else
+                fprintf(file, ",%.7g", rec[i]);
+        }
+        fputc('\n', file);
+    }
+    else
+    {
+        fwrite(&t, sizeof(t), 1, file);
+        fwrite(rec, sizeof(float), 4 * count, file);
+    }
+    ++records;
+}
+
+void StreamAligner::write(int stream, const CapturePacket &pkt)
+{
+    if (stream < 0 || stream >= count || pkt.nwords < 2)
+        return;
+    lock.acquire();
+    if (file)
+    {
+        Stream &s = *streams[stream];
+        PacketHeader hdr(pkt.buffer[0]);
+        int n = packetToFloat(pkt, values);
+        int frames = n / hdr.channels();
+        unsigned int h = pkt.buffer[0] & 0x00ff0f00;    // content & rate
+        if (h != s.header)
+            s.clock.reset(hdr.sampleRate(), options.memory);
+        if (h != s.header || (hdr.isInt() && pkt.scale != s.scale) || pkt.dropped > 0)
+            begin(s, pkt);
+
+        s.clock.add(pkt.sample + frames - 1, pkt.rxTime);
+        s.late = s.clock.lateness(pkt.sample + frames - 1, pkt.rxTime);
+        s.seen = pkt.rxTime;
+        if (firstArrival == 0.0)
+            firstArrival = pkt.rxTime;
+        if (pkt.rxTime > now)
+            now = pkt.rxTime;
+
+        if (s.cols[s.nch - 1] == 3)
+        {
+            float *th = values + s.nch - 1;
+            if (hdr.isInt() && pkt.scale < 0)
+            {
+                // theta still in counts
+                for (int i=0;i<frames;++i)
+                    th[i * s.nch] *= countScale(0, true);
+            }
+            if (!s.xy)
+                s.unwrap.apply(th, frames, s.nch);
+        }
+        store(s, out, s.resampler->push(values, frames, out));
+        emit(false);
+    }
+    lock.release();
+}
+
+long long StreamAligner::recordsWritten()
+{
+    lock.acquire();
+    long long n = records;
+    lock.release();
+    return n;
+}
+
+bool StreamAligner::clockOf(int stream, double &driftPpm, double &late)
+{
+    if (stream < 0 || stream >= count)
+        return false;
+    lock.acquire();
+    Stream &s = *streams[stream];
+    bool ok = (s.header && s.clock.valid());
+    driftPpm = s.clock.driftPpm();
+    late = s.late;
+    lock.release();
+    return ok;
+}
@@ -0,0 +1,173 @@
+//---------------------------------------------------------------------------
+
+#ifndef StreamAlignH
+#define StreamAlignH
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "CaptureSync.h"
+#include "CaptureSink.h"
+#include "Resampler.h"
+#include "Polar.h"
+
+//---------------------------------------------------------------------------
+
+// time alignment of the streams of several instruments (e.g. two SR86x on ports 1865 and 1866)
+//
+// Every instrument samples on its own clock, at its own rate, and numbers its own packets;
+// the only time they share is this computer's: the arrival time of each packet (rxTime).
+// For every stream, StreamClock fits the sample index (CapturePacket.sample) to arrival time:
+// the earliest arrival in each 0.25 s (the packet the network and the receive thread delayed least)
+// against the index of its last sample, a straight line fitted by least squares with older points
+// forgotten over memory seconds. Its slope is the instrument's clock drift against this computer's;
+// its offset is when the instrument took the sample, plus the shortest latency of the stream.
+// That latency is not known; a fixed delay per stream can be given to take it out
+// (the difference in latency between the streams is what matters).
+//
+// StreamAligner takes the packets of all streams, resamples each to the common rate (Resampler.h,
+// anti-aliased), and interpolates them (16 tap windowed sinc) onto one time grid, t = k / rate
+// in captureClock() seconds, with the times from the fit. A grid point is written as soon as every
+// stream has data past it, or has sent nothing for timeout seconds (stopped, or not started yet).
+// Memory is bounded: each stream keeps timeout seconds of resampled data at most.
+//
+// Records hold the time and X, Y, R, theta of every stream (in units, degrees), NaN where a stream
+// has no data (lost packets, not started, stopped) or lacks the channel. R and theta are computed
+// from X,Y when the stream has them, so they never interpolate across the +-180 degree jump;
+// theta alone is unwrapped before resampling.
+//
+// Files: ".csv" is text (time,X1,Y1,R1,Th1,X2,...; empty where missing); anything else is
+// an AlignFileHead followed by records of one double (time) and streams * 4 floats (host byte order).
+
+#define ALIGN_MAX_STREAMS   8
+#define ALIGN_HALF          8               // interpolation taps each side
+
+struct AlignOptions
+{
+    double rate;                    // records per second
+    double passband;                // part of the output Nyquist band kept flat (Resampler.h)
+    double memory;                  // seconds the clock fit remembers
+    double timeout;                 // seconds without packets before a stream is left out
+
+    AlignOptions() : rate(1000.0), passband(0.8), memory(60.0), timeout(0.5) {}
+};
+
+// options from text, e.g. "rate=1000;passband=0.9;memory=60;timeout=0.5"
+bool parseAlign(const std::string &spec, AlignOptions &opt, std::string &err);
+
+struct AlignFileHead
+{
+    char id[8];                     // "SR86xAL1"
+    double wallTime;                // time() when file was created
+    double clockTime;               // captureClock() when file was created
+    int streams;                    // 4 floats per stream follow the time of each record
+    int reserved;
+    double rate;                    // records per second
+};
+
+// sample index to time of one stream
+class StreamClock
+{
+protected:
+    double rate;                    // nominal samples per second
+    double memory;
+    long long origin;               // sample index of the first point
+    double originTime;
+    double blockEnd;                // x at which the current block of points ends
+    double bestX, bestY;            // earliest arrival of the block
+    bool block;
+    double weight;                  // fit: weighted means and co-moments of x and y
+    double mx, my, cxx, cxy;
+    int points;
+    int late;                       // blocks in a row left out as late
+    double offset, drift;           // y = offset + drift * x
+
+    void fit(double x, double y);
+
+public:
+    StreamClock();
+
+    void reset(double samplesPerSecond, double memorySeconds);
+    // a packet whose last sample is index last arrived at rxTime
+    void add(long long last, double rxTime);
+
+    bool valid() const;             // has had a packet
+    double time(double sample) const;   // captureClock() time of a sample index
+    double sample(double t) const;      // sample index at a time
+    double driftPpm() const;        // instrument clock fast (+) or slow against this computer's
+    double lateness(long long last, double rxTime) const;   // arrival after the fitted line
+};
+
+// merges the streams of several instruments into records on one time grid
+// Thread safe: each stream's writer thread calls write() for its packets.
+class StreamAligner
+{
+protected:
+    struct Stream
+    {
+        StreamClock clock;
+        Resampler *resampler;
+        PhaseUnwrap unwrap;
+        double delay;               // seconds taken off the clock fit
+        double seen;                // rxTime of the last packet; 0 = none yet
+        double late;                // how late it came (StreamClock::lateness())
+        unsigned int header;        // content & rate of the run; 0 = none
+        int scale;
+        int nch;
+        int cols[4];                // ColumnSink.h channel of each packet column
+        bool xy;                    // has X and Y: R and theta are computed
+        long long runSample;        // input sample index of the run's first sample
+        std::vector<float> hist;    // resampled frames as X,Y,R,theta, a ring
+        int cap;                    // frames the ring holds
+        long long first, next;      // output index of the oldest frame in the ring, and of the next one
+    };
+
+    CaptureLock lock;
+    AlignOptions options;
+    Stream *streams[ALIGN_MAX_STREAMS];
+    int count;
+    float kernel[65][2 * ALIGN_HALF];   // interpolation kernels for fractions 0 .. 1 in 64 steps
+    FILE *file;
+    bool csv;
+    bool started;
+    long long gridNext;             // index of the next record (time gridNext / rate)
+    double now;                     // latest arrival, any stream
+    double firstArrival;            // first packet of any stream; 0 = none yet
+    long long records;
+    float values[512];
+    float polar[1024];
+    float out[2048];
+    float rec[4 * ALIGN_MAX_STREAMS];
+
+    void begin(Stream &s, const CapturePacket &pkt);
+    void store(Stream &s, const float *frames, int n);
+    int value(Stream &s, double t, bool flush, float *xyrt);
+    void emit(bool flush);
+    void writeRecord(double t);
+
+public:
+    StreamAligner(const AlignOptions &opt);
+    ~StreamAligner();
+
+    // before open(); delay (seconds) is taken off the stream's times; returns the stream's number
+    int addStream(double delay = 0.0);
+    int streamCount() const;
+
+    bool open(const SinkPath &fname);
+    void close();                   // writes what is left
+    bool isOpen() const;
+
+    void write(int stream, const CapturePacket &pkt);
+
+    long long recordsWritten();
+    // a stream's clock drift (ppm), and how late its last packet came (seconds after the fitted line);
+    // false if it has had no packets
+    bool clockOf(int stream, double &driftPpm, double &late);
+
+private:
+    StreamAligner(const StreamAligner &);
+    StreamAligner &operator=(const StreamAligner &);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,142 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "StreamController.h"
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// closed loop stream settings
+// Loss is judged over policy.window seconds, and only on telemetry taken since the last
+// change, so a change is always judged by its own results.
+// The overload flag in the packets is the lock-in's input overload; no stream setting
+// helps that, so it is left alone.
+
+#define RELAX_LIMIT 16              // relaxTime doubles at most this many times over
+
+StreamController::StreamController(const ControllerPolicy &pol)
+{
+    policy = pol;
+    requested.packetSize = current.packetSize = 0;
+    requested.rate = current.rate = 0;
+    lastChange = cleanSince = 0.0;
+    relax = policy.relaxTime;
+    relaxed = false;
+}
+
+void StreamController::setPolicy(const ControllerPolicy &pol)
+{
+    policy = pol;
+    relax = policy.relaxTime;
+}
+
+void StreamController::start(const StreamSettings &req, double now)
+{
+    requested = current = req;
+    history.clear();
+    lastChange = cleanSince = now;
+    relax = policy.relaxTime;
+    relaxed = false;
+    why.clear();
+}
+
+bool StreamController::update(double now, const LiveData &live, double queueFill)
+{
+    Sample s;
+    s.time = now;
+    s.lost = live.dropped - live.retracted + live.unsaved;
+    s.sent = live.packets + live.dropped - live.retracted;
+    if (!history.empty() && s.lost > history.back().lost)
+        cleanSince = now;
+    history.push_back(s);
+    while (history.size() > 2 && history[1].time <= now - policy.window)
+        history.pop_front();
+
+    if (now - lastChange < policy.holdTime || now - history.front().time < policy.window)
+        return false;
+
+    const Sample &old = history.front();
+    long long sent = s.sent - old.sent;
+    long long lost = s.lost - old.lost;
+    double loss = (sent > 0) ? (double)lost / sent : 0.0;
+    bool behind = (queueFill > policy.queueHigh);
+    StreamSettings next = current;
+    std::ostringstream out;
+    out.precision(2);
+
+    if (loss > policy.targetLoss || behind)
+    {
+        if (behind)
+            out << "packet queue " << (int)(queueFill * 100.0 + 0.5) << "% full";
+        else
+            out << "packet loss " << loss * 100.0 << "% (target " << policy.targetLoss * 100.0 << "%)";
+        if (current.packetSize > 0)
+        {
+            --next.packetSize;
+            out << "; packets " << sizeText(current.packetSize) << " -> " << sizeText(next.packetSize);
+        }
+        else if (current.rate < policy.maxRate)
+        {
+            ++next.rate;
+            out << "; decimation " << rateText(current.rate) << " -> " << rateText(next.rate);
+        }
+        else
+            return false;           // nothing left to give up
+        if (relaxed && now - lastChange < relax && relax < policy.relaxTime * RELAX_LIMIT)
+            relax *= 2.0;           // giving back was too soon
+        relaxed = false;
+    }
+    else
+    {
+        double clean = now - ((cleanSince > lastChange) ? cleanSince : lastChange);
+        if (clean < relax || queueFill > policy.queueHigh * 0.25)
+            return false;
+        out << "no packet loss for " << (int)clean << " s";
+        if (current.rate > requested.rate)
+        {
+            // larger packets cost nothing, so they stay
+            --next.rate;
+            out << "; decimation " << rateText(current.rate) << " -> " << rateText(next.rate);
+        }
+        else
+        {
+            relax = policy.relaxTime;   // back where the user wanted it
+            return false;
+        }
+        relaxed = true;
+    }
+
+    current = next;
+    why = out.str();
+    history.clear();
+    lastChange = now;
+    return true;
+}
+
+const StreamSettings &StreamController::settings() const
+{
+    return current;
+}
+const std::string &StreamController::reason() const
+{
+    return why;
+}
+
+std::string StreamController::sizeText(int code)
+{
+    std::ostringstream out;
+    out << (1024 >> code) << " bytes";
+    return out.str();
+}
+std::string StreamController::rateText(int code)
+{
+    if (code == 0)
+        return "native";
+    std::ostringstream out;
+    out << (1L << code) << "x";
+    return out.str();
+}
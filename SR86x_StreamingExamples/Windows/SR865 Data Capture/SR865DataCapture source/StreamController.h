@@ -0,0 +1,78 @@
+//---------------------------------------------------------------------------
+
+#ifndef StreamControllerH
+#define StreamControllerH
+
+#include <deque>
+#include <string>
+#include "LiveSnapshot.h"
+
+//---------------------------------------------------------------------------
+
+// adaptive packet size & decimation
+//
+// Watches packet loss (network drops plus packets the queue had no room for)
+// and the packet queue's fill, and backs the stream off when the loss rate is
+// over target: first to larger packets (same data, fewer packets to receive),
+// then to more decimation (less data). When the stream has run clean for a while
+// it gives the decimation back, one step at a time, down to what the user asked for;
+// a step back that brings the loss back doubles the wait before the next try.
+// The controller only decides; the user interface sends the commands.
+
+// stream settings the controller may change (instrument codes)
+struct StreamSettings
+{
+    int packetSize;                 // STREAMPCKT: 0 = 1024 bytes, 1 = 512, 2 = 256, 3 = 128
+    int rate;                       // STREAMRATE: decimation 2^rate
+};
+
+struct ControllerPolicy
+{
+    double targetLoss;              // fraction of packets lost that is still acceptable
+    double window;                  // seconds of telemetry behind each decision
+    double holdTime;                // seconds after a change before the next one
+    double relaxTime;               // seconds without loss before giving back one decimation step
+    double queueHigh;               // queue fill (0..1) that counts as the computer falling behind
+    int maxRate;                    // most decimation allowed (STREAMRATE code)
+
+    ControllerPolicy() : targetLoss(1.0e-4), window(2.0), holdTime(3.0), relaxTime(30.0), queueHigh(0.5), maxRate(10) {}
+};
+
+class StreamController
+{
+protected:
+    struct Sample
+    {
+        double time;
+        long long sent;             // packets received or lost
+        long long lost;             // packets lost on the network or not saved
+    };
+
+    ControllerPolicy policy;
+    StreamSettings requested;       // what the user asked for
+    StreamSettings current;
+    std::deque<Sample> history;     // since last change, at most one window
+    double lastChange;
+    double cleanSince;              // time of last loss
+    double relax;                   // current wait before giving back decimation
+    bool relaxed;                   // last change gave back decimation
+    std::string why;
+
+    static std::string sizeText(int code);
+    static std::string rateText(int code);
+
+public:
+    StreamController(const ControllerPolicy &pol = ControllerPolicy());
+
+    void setPolicy(const ControllerPolicy &pol);
+    void start(const StreamSettings &req, double now);     // streaming (re)started by the user
+
+    // telemetry now; true if the stream settings should change to settings()
+    bool update(double now, const LiveData &live, double queueFill);
+
+    const StreamSettings &settings() const;
+    const std::string &reason() const;      // why, for the capture file
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,226 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "StreamStats.h"
+#include "PacketHeader.h"
+#include "SampleScale.h"
+#include "ColumnSink.h"
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// running statistics on the writer thread (CaptureWriter)
+// Every packet is counted, whether or not a file is open.
+
+static const char *statsChannel[4] = { "X", "Y", "R", "Th" };
+
+bool parseStatsLog(const std::string &spec, std::string &file, double &seconds, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key == "file" && !val.empty())
+            file = val;
+        else if (key == "seconds")
+        {
+            char *end;
+            double s = strtod(val.c_str(), &end);
+            if (end == val.c_str() || *end || s <= 0.0)
+            {
+                err = "bad value for seconds: \"" + val + "\"";
+                return false;
+            }
+            seconds = s;
+        }
+        else
+        {
+            err = "unknown statistics setting \"" + item + "\"";
+            return false;
+        }
+    }
+    if (file.empty())
+    {
+        err = "no statistics file given";
+        return false;
+    }
+    return true;
+}
+
+double statsVariance(const ChannelStats &c)
+{
+    return (c.count > 1) ? c.m2 / (c.count - 1) : 0.0;
+}
+double statsAllan(const ChannelStats &c, int level)
+{
+    if (level < 0 || level >= ALLAN_LEVELS || c.avarCount[level] == 0)
+        return 0.0;
+    return sqrt(c.avarSum[level] / c.avarCount[level]);
+}
+
+StatsAccumulator::StatsAccumulator()
+{
+    reset();
+}
+
+void StatsAccumulator::reset()
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.what = -1;
+    stats.scale = SCALE_UNKNOWN;
+    memset(ref, 0, sizeof(ref));
+    restartChains();
+}
+
+void StatsAccumulator::restartChains()
+{
+    for (int c=0;c<4;++c)
+    {
+        for (int k=0;k<ALLAN_LEVELS;++k)
+        {
+            octave[c][k].have = 0;
+            octave[c][k].half = false;
+        }
+    }
+}
+
+// next sum of 2^k samples (k > 0), or next sample (k = 0), of channel c
+void StatsAccumulator::push(int c, int k, double v)
+{
+    Octave &o = octave[c][k];
+    if (o.have == 4)
+    {
+        o.last[0] = o.last[1];
+        o.last[1] = o.last[2];
+        o.last[2] = o.last[3];
+        o.last[3] = v;
+    }
+    else
+        o.last[o.have++] = v;
+
+    ChannelStats &s = stats.ch[c];
+    if (k == 0 && o.have >= 2)
+    {
+        double d = o.last[o.have - 1] - o.last[o.have - 2];
+        s.avarSum[0] += 0.5 * d * d;
+        ++s.avarCount[0];
+    }
+    if (o.have == 4 && k + 1 < ALLAN_LEVELS)
+    {
+        // means of two adjacent windows of 2^(k+1) samples; successive pairs step by 2^k
+        double d = ((o.last[2] + o.last[3]) - (o.last[0] + o.last[1])) / (double)(2LL << k);
+        s.avarSum[k + 1] += 0.5 * d * d;
+        ++s.avarCount[k + 1];
+    }
+    // sums of twice as many samples, not overlapping, for the octave above
+    if (k + 2 < ALLAN_LEVELS)
+    {
+        if (o.half)
+        {
+            o.half = false;
+            push(c, k + 1, o.pending + v);
+        }
+        else
+        {
+            o.pending = v;
+            o.half = true;
+        }
+    }
+}
+
+void StatsAccumulator::add(const CapturePacket &pkt)
+{
+    if (pkt.nwords < 2)
+        return;
+    PacketHeader hdr(pkt.buffer[0]);
+    if (stats.what < 0 || hdr.what != stats.what || hdr.rate != stats.rate || (hdr.isInt() && pkt.scale != stats.scale))
+    {
+        reset();
+        stats.what = hdr.what;
+        stats.rate = hdr.rate;
+        stats.scale = pkt.scale;
+        stats.sampleRate = hdr.sampleRate();
+        stats.since = pkt.rxTime;
+    }
+    else if (pkt.dropped > 0)
+    {
+        restartChains();
+        ++stats.breaks;
+    }
+
+    int cols[4];
+    int nch = columnsOf(hdr.what, cols);
+    int frames = packetToFloat(pkt, values) / nch;
+    for (int k=0;k<nch;++k)
+    {
+        int c = cols[k];
+        ChannelStats &s = stats.ch[c];
+        const float *v = values + k;
+        for (int i=0;i<frames;++i, v+=nch)
+        {
+            float x = *v;
+            if (s.count == 0)
+            {
+                ref[c] = x;
+                s.min = s.max = x;
+            }
+            ++s.count;
+            double delta = x - s.mean;
+            s.mean += delta / s.count;
+            s.m2 += delta * (x - s.mean);
+            if (x < s.min)
+                s.min = x;
+            if (x > s.max)
+                s.max = x;
+            push(c, 0, x - ref[c]);
+        }
+    }
+    stats.updated = pkt.rxTime;
+}
+
+const StreamStats &StatsAccumulator::current() const
+{
+    return stats;
+}
+
+void StatsAccumulator::writeLog(FILE *f, bool header) const
+{
+    if (!f || stats.what < 0)
+        return;
+    if (header)
+    {
+        fprintf(f, "time,rate_hz,channel,samples,mean,stddev,min,max");
+        for (int k=0;k<ALLAN_LEVELS;++k)
+            fprintf(f, ",adev_%.6g_s", (double)(1LL << k) / stats.sampleRate);
+        fprintf(f, "\n");
+    }
+    for (int c=0;c<4;++c)
+    {
+        const ChannelStats &s = stats.ch[c];
+        if (s.count == 0)
+            continue;
+        fprintf(f, "%.6f,%.6g,%s,%lld,%.9g,%.6g,%.9g,%.9g", stats.updated, stats.sampleRate, statsChannel[c],
+                s.count, s.mean, sqrt(statsVariance(s)), s.min, s.max);
+        for (int k=0;k<ALLAN_LEVELS;++k)
+        {
+            if (s.avarCount[k] > 0)
+                fprintf(f, ",%.6g", statsAllan(s, k));
+            else
+                fprintf(f, ",");
+        }
+        fprintf(f, "\n");
+    }
+    fflush(f);
+}
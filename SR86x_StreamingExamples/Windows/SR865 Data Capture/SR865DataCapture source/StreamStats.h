@@ -0,0 +1,90 @@
+//---------------------------------------------------------------------------
+
+#ifndef StreamStatsH
+#define StreamStatsH
+
+#include <stdio.h>
+#include <string>
+#include "PacketQueue.h"
+#include "LiveSnapshot.h"
+
+//---------------------------------------------------------------------------
+
+// running statistics of every channel, for stability runs that need no saved samples
+//
+// Per channel: count, mean & variance (Welford), min & max, and the Allan deviation at
+// tau = 2^k samples, k = 0 .. ALLAN_LEVELS-1.
+// Allan deviation windows step by tau/2 (by 1 sample for k = 0 and 1), which keeps the
+// overlap's statistical gain while the memory stays a few values per octave (O(log N)):
+// each octave keeps the last four sums of tau/2 samples and forms
+//   d = (mean of the later tau samples) - (mean of the tau samples before them)
+//   avar(tau) = sum of d^2 / (2 * number of d)
+// Lost packets break the Allan chains (they start again; sums so far are kept);
+// a change of content, rate or sensitivity starts all statistics again.
+
+#define ALLAN_LEVELS    32          // tau up to 2^31 samples
+
+struct ChannelStats
+{
+    long long count;                // samples
+    double mean;
+    double m2;                      // sum of squared differences from the mean; variance = m2 / (count - 1)
+    float min, max;
+    double avarSum[ALLAN_LEVELS];   // sum of d^2 / 2 at each tau
+    long long avarCount[ALLAN_LEVELS];
+};
+
+// snapshot of the statistics; plain data, for SeqSnapshot
+struct StreamStats
+{
+    int what;                       // content code the statistics are of; -1 = none yet
+    int rate;                       // rate code
+    int scale;                      // scale code of integer data (SampleScale.h)
+    double sampleRate;              // Hz; tau = 2^k / sampleRate
+    double since;                   // arrival of the first packet (captureClock() seconds)
+    double updated;                 // arrival of the latest packet
+    long long breaks;               // times lost packets broke the Allan chains
+    ChannelStats ch[4];             // X, Y, R, theta (ColumnSink.h order); count 0 = not in the stream
+};
+
+double statsVariance(const ChannelStats &c);
+double statsAllan(const ChannelStats &c, int level);    // Allan deviation at tau = 2^level samples; 0 if none yet
+
+typedef SeqSnapshot<StreamStats> StatsSnapshot;
+
+// statistics log settings from text, e.g. "file=run_stats.csv;seconds=60"
+bool parseStatsLog(const std::string &spec, std::string &file, double &seconds, std::string &err);
+
+// accumulates StreamStats from packets; writer thread only
+class StatsAccumulator
+{
+protected:
+    StreamStats stats;
+    struct Octave
+    {
+        double last[4];             // latest sums of 2^k samples, oldest first
+        int have;
+        double pending;             // first half of the next sum for the octave above
+        bool half;
+    };
+    Octave octave[4][ALLAN_LEVELS];
+    double ref[4];                  // first sample; sums are of differences from it, to keep precision
+    float values[512];
+
+    void push(int c, int k, double v);
+    void restartChains();
+
+public:
+    StatsAccumulator();
+
+    void reset();
+    void add(const CapturePacket &pkt);
+    const StreamStats &current() const;
+
+    // append the statistics to a comma separated log: a header line when the stream changes,
+    // then one line per channel
+    void writeLog(FILE *f, bool header) const;
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,347 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "SweepPlan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// sweep scheduling
+// A unit is one instrument's way through the points: READY (command due), SENT (waiting for it
+// to complete), ACKED (completed; waiting for lockstep partners), DUE (capture time known, not yet
+// handed out), CAPTURE (until the capture time is over), FAILED (to be reported), DONE.
+
+#define SWEEP_MAX_POINTS    1000000
+
+bool parseSweep(const std::string &spec, SweepOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        if (item == "lockstep")
+        {
+            opt.lockstep = true;
+            continue;
+        }
+        if (item == "noconfirm")
+        {
+            opt.confirm = false;
+            continue;
+        }
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key != "settle" && key != "capture")
+        {
+            err = "unknown sweep setting \"" + item + "\"";
+            return false;
+        }
+        char *end;
+        double v = strtod(val.c_str(), &end);
+        bool ok = (end != val.c_str() && !*end);
+        if (key == "settle")
+            ok = ok && v >= 0.0 && v <= 3600.0;
+        else
+            ok = ok && v > 0.0 && v <= 3600.0;
+        if (!ok)
+        {
+            err = "bad value for " + key + ": \"" + val + "\"";
+            return false;
+        }
+        if (key == "settle")
+            opt.settle = v;
+        else
+            opt.capture = v;
+    }
+    return true;
+}
+
+static bool toDouble(const std::string &text, double &v)
+{
+    char *end;
+    v = strtod(text.c_str(), &end);
+    return end != text.c_str() && !*end;
+}
+
+bool parseSweepValues(const std::string &spec, std::vector<double> &values, std::string &err)
+{
+    values.clear();
+    if (spec.find(':') != std::string::npos)
+    {
+        std::vector<std::string> parts;
+        std::istringstream in(spec);
+        std::string item;
+        while (std::getline(in, item, ':'))
+            parts.push_back(item);
+        double start, stop, n;
+        bool log = (parts.size() == 4 && parts[3] == "log");
+        if ((parts.size() != 3 && !log) || !toDouble(parts[0], start) || !toDouble(parts[1], stop) ||
+            !toDouble(parts[2], n) || n < 1.0 || n > SWEEP_MAX_POINTS || n != floor(n) ||
+            (log && (start * stop <= 0.0)))
+        {
+            err = "bad sweep values \"" + spec + "\"";
+            return false;
+        }
+        int points = (int)n;
+        for (int i=0;i<points;++i)
+        {
+            double f = (points > 1) ? (double)i / (points - 1) : 0.0;
+            values.push_back(log ? start * pow(stop / start, f) : start + (stop - start) * f);
+        }
+        return true;
+    }
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        double v;
+        if (!toDouble(item, v) || values.size() >= SWEEP_MAX_POINTS)
+        {
+            err = "bad sweep value \"" + item + "\"";
+            return false;
+        }
+        values.push_back(v);
+    }
+    if (values.empty())
+    {
+        err = "no sweep values";
+        return false;
+    }
+    return true;
+}
+
+bool checkSweepCommand(const std::string &templ, std::string &err)
+{
+    int conversions = 0;
+    for (size_t i=0;i<templ.length();++i)
+    {
+        if (templ[i] != '%')
+            continue;
+        if (i+1 < templ.length() && templ[i+1] == '%')
+        {
+            ++i;
+            continue;
+        }
+        size_t k = i + 1;
+        while (k < templ.length() && strchr("-+ #0", templ[k]))
+            ++k;
+        // width and precision of two digits at most, so the text stays short
+        size_t digits = k;
+        while (k < templ.length() && isdigit((unsigned char)templ[k]))
+            ++k;
+        bool ok = (k - digits <= 2);
+        if (k < templ.length() && templ[k] == '.')
+        {
+            digits = ++k;
+            while (k < templ.length() && isdigit((unsigned char)templ[k]))
+                ++k;
+            ok = ok && (k - digits <= 2);
+        }
+        if (!ok || k >= templ.length() || !strchr("gGfeE", templ[k]))
+        {
+            err = "bad sweep command \"" + templ + "\" (one %g for the value)";
+            return false;
+        }
+        ++conversions;
+        i = k;
+    }
+    if (conversions != 1)
+    {
+        err = "bad sweep command \"" + templ + "\" (one %g for the value)";
+        return false;
+    }
+    return true;
+}
+
+std::string sweepCommand(const std::string &templ, double value)
+{
+    // checkSweepCommand() limits the conversion to 99 + 99 characters
+    std::vector<char> text(templ.length() + 256);
+    sprintf(&text[0], templ.c_str(), value);
+    return std::string(&text[0]);
+}
+
+//---------------------------------------------------------------------------
+// SweepScheduler
+
+SweepScheduler::SweepScheduler(const SweepOptions &opt, int instruments, const std::vector<double> &vals)
+{
+    options = opt;
+    values = vals;
+    units.resize(instruments < 1 ? 1 : instruments);
+    started = 0.0;
+    failures = 0;
+    start(0.0);
+}
+
+void SweepScheduler::start(double now)
+{
+    for (size_t i=0;i<units.size();++i)
+    {
+        Unit &u = units[i];
+        u.state = READY;
+        u.point = 0;
+        u.ack = u.start = u.end = 0.0;
+    }
+    started = now;
+    failures = 0;
+}
+
+// every instrument that takes this point has completed its command; start: when the data counts
+bool SweepScheduler::lockstepReady(int point, double &start) const
+{
+    start = 0.0;
+    bool any = false;
+    for (size_t i=0;i<units.size();++i)
+    {
+        const Unit &u = units[i];
+        if (u.point != point)
+            continue;
+        if (u.state != ACKED)
+            return false;
+        if (!any || u.ack > start)
+            start = u.ack;
+        any = true;
+    }
+    start += options.settle;
+    return any;
+}
+
+bool SweepScheduler::next(double now, SweepStep &step)
+{
+    int points = (int)values.size();
+    for (int i=0;i<(int)units.size();++i)
+    {
+        Unit &u = units[i];
+        step.instrument = i;
+        step.point = u.point;
+        step.value = (u.point < points) ? values[u.point] : 0.0;
+        step.start = step.end = 0.0;
+        switch (u.state)
+        {
+        case READY:
+            if (u.point >= points)
+            {
+                u.state = DONE;
+                break;
+            }
+            if (options.lockstep && pointsDone() < u.point)
+                break;              // the others are still on the point before
+            u.state = SENT;
+            step.action = SWEEP_SEND;
+            return true;
+        case FAILED:
+            ++u.point;
+            u.state = READY;
+            ++failures;
+            step.action = SWEEP_FAILED;
+            return true;
+        case ACKED:
+            if (!options.lockstep)
+            {
+                u.start = u.ack + options.settle;
+                u.end = u.start + options.capture;
+                u.state = DUE;
+            }
+            else
+            {
+                double start;
+                if (!lockstepReady(u.point, start))
+                    break;
+                for (size_t k=0;k<units.size();++k)
+                {
+                    Unit &p = units[k];
+                    if (p.point == u.point)
+                    {
+                        p.start = start;
+                        p.end = start + options.capture;
+                        p.state = DUE;
+                    }
+                }
+            }
+            // the capture time is handed out now, before it starts
+            step.action = SWEEP_WINDOW;
+            step.start = u.start;
+            step.end = u.end;
+            u.state = CAPTURE;
+            return true;
+        case DUE:
+            step.action = SWEEP_WINDOW;
+            step.start = u.start;
+            step.end = u.end;
+            u.state = CAPTURE;
+            return true;
+        case CAPTURE:
+            if (now >= u.end)
+            {
+                // this point's data is taken: on to the next, while it is still being reduced
+                ++u.point;
+                u.state = READY;
+                --i;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+void SweepScheduler::completed(int instrument, int point, double when, bool ok)
+{
+    if (instrument < 0 || instrument >= (int)units.size())
+        return;
+    Unit &u = units[instrument];
+    if (u.state != SENT || u.point != point)
+        return;
+    u.ack = when;
+    u.state = ok ? ACKED : FAILED;
+}
+
+bool SweepScheduler::finished() const
+{
+    for (size_t i=0;i<units.size();++i)
+    {
+        if (units[i].point < (int)values.size())
+            return false;
+    }
+    return true;
+}
+int SweepScheduler::pointCount() const
+{
+    return (int)values.size();
+}
+int SweepScheduler::pointsDone() const
+{
+    int done = (int)values.size();
+    for (size_t i=0;i<units.size();++i)
+    {
+        if (units[i].point < done)
+            done = units[i].point;
+    }
+    return done;
+}
+int SweepScheduler::pointOf(int instrument) const
+{
+    return (instrument >= 0 && instrument < (int)units.size()) ? units[instrument].point : 0;
+}
+int SweepScheduler::failureCount() const
+{
+    return failures;
+}
+double SweepScheduler::pointsPerMinute(double now) const
+{
+    return (now > started) ? 60.0 * pointsDone() / (now - started) : 0.0;
+}
@@ -0,0 +1,96 @@
+//---------------------------------------------------------------------------
+
+#ifndef SweepPlanH
+#define SweepPlanH
+
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------------
+
+// sweep of one instrument setting (e.g. "FREQ %g") over a list of values, on several instruments at once
+//
+// Each point is: send the command, wait for the instrument to finish it (*OPC?), let the lock-in
+// settle, then take settle .. settle + capture seconds of the stream as the point's data.
+// The stream runs all the time; a point's data is picked out of it by time (SweepSink.h), on the
+// writer thread, so nothing waits for the data to arrive: the command of the next point goes out
+// as soon as the capture time of this one is over, and the instrument is reconfigured while the
+// last of this point's packets are still on their way and being reduced.
+// Every instrument steps through the values on its own, as fast as its commands complete;
+// with lockstep they all send a point's command together and share its capture time.
+//
+// SweepScheduler only decides; the program sends the commands (one thread per instrument,
+// since a VXI-11 call blocks until the instrument answers) and tells it when each completes.
+
+#define SWEEP_SEND      0           // send the command of point to instrument
+#define SWEEP_WINDOW    1           // the point's data on instrument is start .. end (captureClock() seconds)
+#define SWEEP_FAILED    2           // the point's command failed on instrument: no data
+
+struct SweepOptions
+{
+    double settle;                  // seconds after the command before the data counts
+    double capture;                 // seconds of data per point
+    bool confirm;                   // wait for *OPC? after each command
+    bool lockstep;                  // all instruments take each point together
+
+    SweepOptions() : settle(0.3), capture(0.5), confirm(true), lockstep(false) {}
+};
+
+// options from text, e.g. "settle=0.5;capture=1;lockstep" ("noconfirm": don't ask *OPC?)
+bool parseSweep(const std::string &spec, SweepOptions &opt, std::string &err);
+
+// values from text: "100,200,500", or "start:stop:points" (linear), or "start:stop:points:log"
+bool parseSweepValues(const std::string &spec, std::vector<double> &values, std::string &err);
+
+// the command of a value: template with one %g (or %f, %e), e.g. "FREQ %g"
+bool checkSweepCommand(const std::string &templ, std::string &err);
+std::string sweepCommand(const std::string &templ, double value);
+
+struct SweepStep
+{
+    int action;                     // SWEEP_SEND .. SWEEP_FAILED
+    int instrument;
+    int point;
+    double value;
+    double start, end;              // SWEEP_WINDOW
+};
+
+class SweepScheduler
+{
+protected:
+    enum State { READY, SENT, ACKED, FAILED, DUE, CAPTURE, DONE };
+    struct Unit
+    {
+        State state;
+        int point;
+        double ack;                 // when the command completed
+        double start, end;          // capture time of the point
+    };
+
+    SweepOptions options;
+    std::vector<double> values;
+    std::vector<Unit> units;
+    double started;
+    int failures;
+
+    bool lockstepReady(int point, double &start) const;
+
+public:
+    SweepScheduler(const SweepOptions &opt, int instruments, const std::vector<double> &values);
+
+    void start(double now);
+    // the next thing to do now; false if nothing is due
+    bool next(double now, SweepStep &step);
+    // the command of point completed on instrument at time when (ok false: it failed)
+    void completed(int instrument, int point, double when, bool ok);
+
+    bool finished() const;
+    int pointCount() const;
+    int pointsDone() const;         // points every instrument is past
+    int pointOf(int instrument) const;
+    int failureCount() const;
+    double pointsPerMinute(double now) const;
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,402 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "SweepSink.h"
+#include "ColumnSink.h"
+#include "SampleScale.h"
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <limits>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// sweep points out of the streams
+// The writer thread holds the sink's lock for each packet; the main thread takes it only
+// to add a capture time or give up on one.
+
+static const char sweepId[9] = "SR86xSW1";
+
+#define CLOCK_MEMORY    60.0        // seconds the clock fit remembers
+
+static const float missing = std::numeric_limits<float>::quiet_NaN();
+
+//---------------------------------------------------------------------------
+// SweepDataset
+
+SweepDataset::SweepDataset()
+{
+    file = NULL;
+    csv = false;
+    instruments = points = 0;
+    records = 0;
+}
+SweepDataset::~SweepDataset()
+{
+    close();
+}
+
+bool SweepDataset::open(const SinkPath &fname, int instrumentCount, int pointCount)
+{
+    close();
+    lock.acquire();
+    SinkPath ext = sinkPath(".csv");
+    csv = (fname.length() > ext.length() && fname.compare(fname.length() - ext.length(), ext.length(), ext) == 0);
+    instruments = instrumentCount;
+    points = pointCount;
+    records = 0;
+    file = sinkOpen(fname, csv ? "w" : "w+b");
+    if (file)
+    {
+        if (csv)
+            fprintf(file, "point,instrument,status,value,start,end,samples,lost,X,Y,R,Th,devX,devY,devR,devTh\n");
+        else
+        {
+            SweepFileHead head;
+            memset(&head, 0, sizeof(head));
+            memcpy(head.id, sweepId, 8);
+            head.wallTime = (double)time(0);
+            head.clockTime = captureClock();
+            head.instruments = instruments;
+            head.points = points;
+            fwrite(&head, sizeof(head), 1, file);
+            // every record, empty, so each can be written in its place
+            SweepRecord rec;
+            memset(&rec, 0, sizeof(rec));
+            for (int p=0;p<points;++p)
+            {
+                for (int i=0;i<instruments;++i)
+                {
+                    rec.point = p;
+                    rec.instrument = i;
+                    fwrite(&rec, sizeof(rec), 1, file);
+                }
+            }
+            fflush(file);
+        }
+    }
+    lock.release();
+    return (file != NULL);
+}
+void SweepDataset::close()
+{
+    lock.acquire();
+    if (file)
+    {
+        fclose(file);
+        file = NULL;
+    }
+    lock.release();
+}
+bool SweepDataset::isOpen() const
+{
+    return (file != NULL);
+}
+
+void SweepDataset::write(const SweepRecord &rec)
+{
+    if (rec.point < 0 || rec.point >= points || rec.instrument < 0 || rec.instrument >= instruments)
+        return;
+    lock.acquire();
+    if (file)
+    {
+        if (csv)
+        {
+            fprintf(file, "%d,%d,%d,%.10g,%.6f,%.6f,%d,%d", rec.point, rec.instrument, rec.status, rec.value,
+                    rec.start, rec.end, rec.samples, rec.lost);
+            for (int c=0;c<8;++c)
+            {
+                float v = (c < 4) ? rec.mean[c] : rec.deviation[c - 4];
+                if (v != v)
+                    fputc(',', file);
+                else
+                    fprintf(file, ",%.7g", v);
+            }
+            fputc('\n', file);
+        }
+        else
+        {
+            long index = (long)rec.point * instruments + rec.instrument;
+            fseek(file, (long)sizeof(SweepFileHead) + index * (long)sizeof(SweepRecord), SEEK_SET);
+            fwrite(&rec, sizeof(rec), 1, file);
+        }
+        fflush(file);
+        ++records;
+    }
+    lock.release();
+}
+void SweepDataset::writeMissing(int point, int instrument, double value, int status)
+{
+    SweepRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.point = point;
+    rec.instrument = instrument;
+    rec.status = status;
+    rec.value = value;
+    for (int c=0;c<4;++c)
+        rec.mean[c] = rec.deviation[c] = missing;
+    write(rec);
+}
+long long SweepDataset::recordsWritten()
+{
+    lock.acquire();
+    long long n = records;
+    lock.release();
+    return n;
+}
+
+//---------------------------------------------------------------------------
+// SweepSink
+
+SweepSink::SweepSink(SweepDataset *sweepDataset, int instrumentNumber, double delaySeconds, CaptureSink *sampleSink)
+{
+    dataset = sweepDataset;
+    instrument = instrumentNumber;
+    delay = delaySeconds;
+    samples = sampleSink;
+    opened = false;
+    packets = 0;
+    memset(&sums, 0, sizeof(sums));
+    done = 0;
+    header = 0;
+    scale = 0;
+    nch = 0;
+    xy = theta = false;
+}
+/*virtual*/ SweepSink::~SweepSink()
+{
+    close();
+    delete samples;
+}
+
+void SweepSink::addWindow(int point, double value, double start, double end)
+{
+    Window w;
+    w.point = point;
+    w.value = value;
+    w.start = start;
+    w.end = end;
+    lock.acquire();
+    windows.push_back(w);
+    lock.release();
+}
+void SweepSink::expire(double now, double timeout)
+{
+    lock.acquire();
+    while (!windows.empty() && windows.front().end < now - timeout)
+    {
+        finish(windows.front());
+        windows.pop_front();
+    }
+    lock.release();
+}
+long long SweepSink::pointsWritten()
+{
+    lock.acquire();
+    long long n = done;
+    lock.release();
+    return n;
+}
+bool SweepSink::clockOf(double &driftPpm)
+{
+    lock.acquire();
+    bool ok = clock.valid();
+    driftPpm = ok ? clock.driftPpm() : 0.0;
+    lock.release();
+    return ok;
+}
+
+void SweepSink::begin(const CapturePacket &pkt)
+{
+    PacketHeader hdr(pkt.buffer[0]);
+    header = pkt.buffer[0] & 0x00ff0f00;
+    scale = pkt.scale;
+    nch = columnsOf(hdr.what, cols);
+    bool x = false, y = false;
+    theta = false;
+    for (int k=0;k<nch;++k)
+    {
+        x = x || cols[k] == 0;
+        y = y || cols[k] == 1;
+        theta = theta || cols[k] == 3;
+    }
+    xy = x && y;
+    theta = theta || xy;
+}
+
+// the point's record from the sums of its samples; under the lock
+void SweepSink::finish(const Window &w)
+{
+    SweepRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.point = w.point;
+    rec.instrument = instrument;
+    rec.status = (sums.samples > 0) ? SWEEP_OK : SWEEP_NODATA;
+    rec.samples = sums.samples;
+    rec.value = w.value;
+    rec.start = w.start;
+    rec.end = w.end;
+    rec.lost = sums.lost;
+    for (int c=0;c<4;++c)
+    {
+        if (sums.samples == 0)
+        {
+            rec.mean[c] = rec.deviation[c] = missing;
+            continue;
+        }
+        // NaN where the stream lacks the channel
+        double m = sums.sum[c] / sums.samples;
+        double var = sums.sum2[c] / sums.samples - m * m;
+        double mean = sums.first[c] + m;
+        if (c == 3)
+            mean -= 360.0 * floor((mean + 180.0) / 360.0);
+        rec.mean[c] = (float)mean;
+        rec.deviation[c] = (float)sqrt(var > 0.0 ? var : 0.0);
+    }
+    if (dataset)
+        dataset->write(rec);
+    ++done;
+    memset(&sums, 0, sizeof(sums));
+}
+
+// fname is this stream's own capture file, if it has one
+/*virtual*/ bool SweepSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    if (samples && !samples->open(fname, trunc))
+        return false;
+    lock.acquire();
+    header = 0;
+    memset(&sums, 0, sizeof(sums));
+    lock.release();
+    opened = true;
+    packets = 0;
+    return true;
+}
+/*virtual*/ bool SweepSink::isOpen() const
+{
+    return opened;
+}
+/*virtual*/ void SweepSink::write(const CapturePacket &pkt)
+{
+    if (!opened)
+        return;
+    if (samples)
+        samples->write(pkt);
+    ++packets;
+    if (pkt.nwords < 2)
+        return;
+
+    lock.acquire();
+    PacketHeader hdr(pkt.buffer[0]);
+    int n = packetToFloat(pkt, values);
+    int frames = n / hdr.channels();
+    unsigned int h = pkt.buffer[0] & 0x00ff0f00;    // content & rate
+    if (h != header)
+        clock.reset(hdr.sampleRate(), CLOCK_MEMORY);
+    if (h != header || (hdr.isInt() && pkt.scale != scale))
+        begin(pkt);
+    clock.add(pkt.sample + frames - 1, pkt.rxTime);
+
+    // X, Y, R, theta of every frame
+    if (nch == 2 && xy)
+        xyToPolar(values, frames, polar);
+    else
+    {
+        for (int i=0;i<frames;++i)
+        {
+            float *f = polar + 4 * i;
+            f[0] = f[1] = f[2] = f[3] = missing;
+            for (int k=0;k<nch;++k)
+                f[cols[k]] = values[i * nch + k];
+        }
+        if (cols[nch - 1] == 3 && hdr.isInt() && pkt.scale < 0)
+        {
+            // theta still in counts
+            for (int i=0;i<frames;++i)
+                polar[4 * i + 3] *= countScale(0, true);
+        }
+    }
+
+    double t0 = clock.time((double)pkt.sample) - delay;
+    double dt = clock.time((double)pkt.sample + 1.0) - delay - t0;
+    if (pkt.dropped > 0 && !windows.empty() && t0 + frames * dt > windows.front().start)
+        sums.lost += pkt.dropped;
+
+    int i = 0;
+    while (i < frames && !windows.empty())
+    {
+        const Window &w = windows.front();
+        double a = ceil((w.start - t0) / dt);
+        double b = ceil((w.end - t0) / dt);         // first frame past the capture time
+        int from = (a < i) ? i : (a > frames) ? frames : (int)a;
+        int to = (b < 0.0) ? 0 : (b > frames) ? frames : (int)b;
+        if (from < to)
+        {
+            if (sums.samples == 0)
+                unwrap.reset();
+            if (theta)
+                unwrap.apply(polar + 4 * from + 3, to - from, 4);
+            for (int k=from;k<to;++k)
+            {
+                const float *f = polar + 4 * k;
+                if (sums.samples == 0)
+                {
+                    for (int c=0;c<4;++c)
+                        sums.first[c] = f[c];
+                }
+                for (int c=0;c<4;++c)
+                {
+                    double d = f[c] - sums.first[c];
+                    sums.sum[c] += d;
+                    sums.sum2[c] += d * d;
+                }
+                ++sums.samples;
+            }
+        }
+        if (b > frames - 1)
+            break;                  // the capture time goes on past this packet
+        finish(w);
+        windows.pop_front();
+        if (to > i)
+            i = to;
+    }
+    lock.release();
+}
+/*virtual*/ void SweepSink::close()
+{
+    if (samples)
+        samples->close();
+    opened = false;
+}
+
+/*virtual*/ long long SweepSink::bytesWritten()
+{
+    return samples ? samples->bytesWritten() : 0;
+}
+/*virtual*/ long long SweepSink::packetsWritten() const
+{
+    return samples ? samples->packetsWritten() : packets;
+}
+/*virtual*/ void SweepSink::note(const std::string &text)
+{
+    if (samples)
+        samples->note(text);
+}
+/*virtual*/ long long SweepSink::syncCount() const
+{
+    return samples ? samples->syncCount() : 0;
+}
+/*virtual*/ double SweepSink::syncTime() const
+{
+    return samples ? samples->syncTime() : 0.0;
+}
+/*virtual*/ void SweepSink::idle(double now)
+{
+    if (samples)
+        samples->idle(now);
+}
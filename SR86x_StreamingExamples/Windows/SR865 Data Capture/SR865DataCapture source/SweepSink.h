@@ -0,0 +1,153 @@
+//---------------------------------------------------------------------------
+
+#ifndef SweepSinkH
+#define SweepSinkH
+
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "CaptureSync.h"
+#include "CaptureSink.h"
+#include "StreamAlign.h"
+#include "Polar.h"
+
+//---------------------------------------------------------------------------
+
+// the data of sweep points (SweepPlan.h), picked out of the streams of several instruments
+//
+// SweepSink takes one instrument's packets on its writer thread, as AlignSink does, and times their
+// samples with a StreamClock (StreamAlign.h). Each point's capture time is handed to it beforehand
+// (addWindow()); the samples in it are reduced to the mean and standard deviation of X, Y, R and theta
+// (R and theta of each sample computed from X,Y if the stream lacks them; theta unwrapped over the point),
+// and the point is written to the SweepDataset as soon as a packet past its end arrives.
+//
+// SweepDataset is one file for all instruments and points, indexed by both: a SweepFileHead, then
+// points * instruments SweepRecords, the record of point p on instrument i at index p * instruments + i
+// (host byte order). The file is laid out in full when it is opened, each record filled in when its
+// point is done, so a sweep that stops early leaves a readable file (status 0 where not taken).
+// ".csv" files are text instead: one line per record as they are done, in no particular order.
+
+#define SWEEP_EMPTY     0           // record status: not taken (yet)
+#define SWEEP_OK        1
+#define SWEEP_NODATA    2           // no samples in the capture time (stream stopped or lost)
+#define SWEEP_NOCMD     3           // the instrument did not take the command
+
+struct SweepFileHead
+{
+    char id[8];                     // "SR86xSW1"
+    double wallTime;                // time() when file was created
+    double clockTime;               // captureClock() when file was created
+    int instruments;
+    int points;
+};
+
+struct SweepRecord
+{
+    int point;
+    int instrument;
+    int status;                     // SWEEP_EMPTY .. SWEEP_NOCMD
+    int samples;                    // in the capture time
+    double value;                   // of the swept setting
+    double start, end;              // capture time (captureClock() seconds)
+    int lost;                       // packets lost in the capture time
+    int reserved;
+    float mean[4];                  // X, Y, R, theta (units, degrees); NaN where the stream lacks them
+    float deviation[4];
+};
+
+class SweepDataset
+{
+protected:
+    CaptureLock lock;
+    FILE *file;
+    bool csv;
+    int instruments, points;
+    long long records;
+
+public:
+    SweepDataset();
+    ~SweepDataset();
+
+    bool open(const SinkPath &fname, int instruments, int points);
+    void close();
+    bool isOpen() const;
+
+    // thread safe
+    void write(const SweepRecord &rec);
+    // a point not taken, e.g. SWEEP_NOCMD
+    void writeMissing(int point, int instrument, double value, int status);
+    long long recordsWritten();
+};
+
+class SweepSink : public CaptureSink
+{
+protected:
+    struct Window
+    {
+        int point;
+        double value;
+        double start, end;
+    };
+    struct Sums
+    {
+        int samples;
+        int lost;
+        double first[4];            // the first sample: sums are of differences from it
+        double sum[4], sum2[4];
+    };
+
+    SweepDataset *dataset;
+    int instrument;
+    double delay;                   // seconds taken off the clock fit
+    CaptureSink *samples;           // capture file of this stream; NULL = sweep records only
+    bool opened;
+    long long packets;
+
+    CaptureLock lock;               // windows: main thread adds, writer thread takes
+    std::deque<Window> windows;
+    Sums sums;                      // of the front window
+    long long done;
+
+    StreamClock clock;
+    unsigned int header;
+    int scale;
+    int nch;
+    int cols[4];
+    bool xy;                        // has X and Y: R and theta are computed
+    bool theta;                     // has theta, or X and Y
+    PhaseUnwrap unwrap;
+    float values[512];
+    float polar[1024];
+
+    void begin(const CapturePacket &pkt);
+    void finish(const Window &w);
+
+public:
+    // takes ownership of samples (may be NULL), not of the dataset
+    SweepSink(SweepDataset *dataset, int instrument, double delay, CaptureSink *samples);
+    virtual ~SweepSink();
+
+    // the capture time of a point (main thread); in order of time
+    void addWindow(int point, double value, double start, double end);
+    // writes the points whose capture time ended timeout seconds before now, data or not
+    void expire(double now, double timeout);
+    long long pointsWritten();
+    // this stream's clock drift (ppm); false if it has had no packets
+    bool clockOf(double &driftPpm);
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();
+    virtual long long packetsWritten() const;
+    virtual void note(const std::string &text);
+    virtual long long syncCount() const;
+    virtual double syncTime() const;
+    virtual void idle(double now);
+};
+
+//---------------------------------------------------------------------------
+#endif
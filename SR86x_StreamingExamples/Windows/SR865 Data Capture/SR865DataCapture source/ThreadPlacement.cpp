@@ -0,0 +1,368 @@
+//---------------------------------------------------------------------------
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                 // pthread_setaffinity_np
+#endif
+
+#pragma hdrstop
+
+#include "ThreadPlacement.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+#ifndef _WIN32
+#include <errno.h>
+#endif
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// thread placement
+// Threads are placed from outside (by handle), so a thread that is already running
+// can be moved; TThread & NSThread start before the user interface has read the placement.
+// Linux reads the interface's NUMA node and interrupts from sysfs & procfs:
+//   /sys/class/net/<nic>/device/local_cpulist     cores on the interface's NUMA node
+//   /sys/class/net/<nic>/device/msi_irqs/         the interface's interrupts (or /proc/interrupts)
+//   /proc/irq/<n>/smp_affinity_list               cores that take interrupt n
+
+static const char *roleNames[PLACE_ROLES] = { "receive", "writer", "telemetry" };
+
+const char *roleName(int role)
+{
+    return (role >= 0 && role < PLACE_ROLES) ? roleNames[role] : "?";
+}
+
+bool PlacementPolicy::enabled() const
+{
+    if (!nic.empty())
+        return true;
+    for (int r=0;r<PLACE_ROLES;++r)
+        if (!place[r].cores.empty() || place[r].realtime)
+            return true;
+    return false;
+}
+
+// "2,4-7" -> 2 4 5 6 7 (sorted, no repeats); false if not a core list
+static bool parseCores(const std::string &text, std::vector<int> &cores)
+{
+    cores.clear();
+    const char *p = text.c_str();
+    while (*p && *p != '\n')
+    {
+        char *end;
+        long a = strtol(p, &end, 10);
+        if (end == p || a < 0)
+            return false;
+        long b = a;
+        p = end;
+        if (*p == '-')
+        {
+            b = strtol(p + 1, &end, 10);
+            if (end == p + 1 || b < a)
+                return false;
+            p = end;
+        }
+        if (b - a > 4096)
+            return false;
+        for (long c=a;c<=b;++c)
+            cores.push_back((int)c);
+        if (*p == ',')
+            ++p;
+        else if (*p && *p != '\n')
+            return false;
+    }
+    std::sort(cores.begin(), cores.end());
+    cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+    return !cores.empty();
+}
+
+std::string coreText(const std::vector<int> &cores)
+{
+    std::ostringstream out;
+    for (size_t i=0;i<cores.size();)
+    {
+        size_t j = i;
+        while (j + 1 < cores.size() && cores[j+1] == cores[j] + 1)
+            ++j;
+        if (i)
+            out << ',';
+        out << cores[i];
+        if (j > i)
+            out << '-' << cores[j];
+        i = j + 1;
+    }
+    return out.str();
+}
+
+bool parsePlacement(const std::string &spec, PlacementPolicy &pol, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        int role = -1;
+        for (int r=0;r<PLACE_ROLES;++r)
+            if (key == roleNames[r])
+                role = r;
+
+        if (role >= 0)
+        {
+            if (!parseCores(val, pol.place[role].cores))
+            {
+                err = "bad core list for " + key + ": \"" + val + "\"";
+                return false;
+            }
+        }
+        else if (key == "fifo")
+        {
+            std::istringstream names(val);
+            std::string name;
+            while (std::getline(names, name, ','))
+            {
+                int r = 0;
+                while (r < PLACE_ROLES && name != roleNames[r])
+                    ++r;
+                if (r == PLACE_ROLES)
+                {
+                    err = "unknown thread \"" + name + "\" (receive, writer or telemetry)";
+                    return false;
+                }
+                pol.place[r].realtime = true;
+            }
+        }
+        else if (key == "priority")
+        {
+            pol.priority = atoi(val.c_str());
+            if (pol.priority < 1 || pol.priority > 99)
+            {
+                err = "priority must be between 1 and 99";
+                return false;
+            }
+        }
+        else if (key == "nic")
+            pol.nic = val;
+        else
+        {
+            err = "unknown placement setting \"" + key + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Linux: the interface's NUMA node & interrupts
+
+#ifdef __linux__
+
+static std::string readLine(const std::string &path)
+{
+    std::string line;
+    FILE *f = fopen(path.c_str(), "r");
+    if (f)
+    {
+        char buf[1024];
+        if (fgets(buf, sizeof(buf), f))
+            line = buf;
+        fclose(f);
+    }
+    return line;
+}
+
+// cores on the interface's NUMA node; empty if unknown (virtual interface, no sysfs)
+static std::vector<int> nicCores(const std::string &nic)
+{
+    std::vector<int> cores;
+    if (!nic.empty())
+        parseCores(readLine("/sys/class/net/" + nic + "/device/local_cpulist"), cores);
+    return cores;
+}
+
+// the interface's interrupt numbers
+static std::vector<int> nicIrqs(const std::string &nic)
+{
+    std::vector<int> irqs;
+    std::string dir = "/sys/class/net/" + nic + "/device/msi_irqs";
+    DIR *d = opendir(dir.c_str());
+    if (d)
+    {
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL)
+            if (e->d_name[0] >= '0' && e->d_name[0] <= '9')
+                irqs.push_back(atoi(e->d_name));
+        closedir(d);
+    }
+    if (irqs.empty())
+    {
+        // no MSI: queues named after the interface in /proc/interrupts ("eth0-TxRx-0"), or one legacy line
+        FILE *f = fopen("/proc/interrupts", "r");
+        if (f)
+        {
+            char buf[4096];
+            while (fgets(buf, sizeof(buf), f))
+            {
+                int n;
+                if (strstr(buf, nic.c_str()) && sscanf(buf, " %d:", &n) == 1)
+                    irqs.push_back(n);
+            }
+            fclose(f);
+        }
+        if (irqs.empty())
+        {
+            std::string legacy = readLine("/sys/class/net/" + nic + "/device/irq");
+            if (atoi(legacy.c_str()) > 0)
+                irqs.push_back(atoi(legacy.c_str()));
+        }
+    }
+    std::sort(irqs.begin(), irqs.end());
+    return irqs;
+}
+
+static std::vector<int> irqCores(int irq)
+{
+    std::ostringstream path;
+    path << "/proc/irq/" << irq << "/smp_affinity_list";
+    std::vector<int> cores;
+    parseCores(readLine(path.str()), cores);
+    return cores;
+}
+
+static std::vector<int> common(const std::vector<int> &a, const std::vector<int> &b)
+{
+    std::vector<int> both;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(both));
+    return both;
+}
+
+#endif
+
+//---------------------------------------------------------------------------
+
+bool placeThread(CaptureThread t, int role, const PlacementPolicy &pol, std::string &err)
+{
+    const ThreadPlace &p = pol.place[role];
+    std::vector<int> cores = p.cores;
+    bool ok = true;
+    err.clear();
+
+#ifdef _WIN32
+    if (!cores.empty())
+    {
+        DWORD_PTR mask = 0;
+        for (size_t i=0;i<cores.size();++i)
+            if (cores[i] < (int)(8 * sizeof(mask)))
+                mask |= (DWORD_PTR)1 << cores[i];
+        if (mask == 0 || SetThreadAffinityMask(t, mask) == 0)
+        {
+            err = std::string(roleName(role)) + " thread: can't run on cores " + coreText(cores);
+            ok = false;
+        }
+    }
+    if (p.realtime && !SetThreadPriority(t, THREAD_PRIORITY_TIME_CRITICAL))
+    {
+        err += (err.empty() ? "" : "; ") + std::string(roleName(role)) + " thread: can't raise priority";
+        ok = false;
+    }
+#else
+#ifdef __linux__
+    if (cores.empty())
+        cores = nicCores(pol.nic);  // stay near the interface
+    if (!cores.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i=0;i<cores.size();++i)
+            if (cores[i] < CPU_SETSIZE)
+                CPU_SET(cores[i], &set);
+        int rc = pthread_setaffinity_np(t, sizeof(set), &set);
+        if (rc != 0)
+        {
+            err = std::string(roleName(role)) + " thread: can't run on cores " + coreText(cores) + ": " + strerror(rc);
+            ok = false;
+        }
+    }
+#else
+    if (!cores.empty())
+    {
+        // OS X has affinity hints only
+        err = std::string(roleName(role)) + " thread: pinning to cores is not supported on this system";
+        ok = false;
+    }
+#endif
+    if (p.realtime)
+    {
+        struct sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = pol.priority;
+        int rc = pthread_setschedparam(t, SCHED_FIFO, &sp);
+        if (rc != 0)
+        {
+            err += (err.empty() ? "" : "; ") + std::string(roleName(role)) + " thread: can't use SCHED_FIFO: " + strerror(rc);
+            if (rc == EPERM)
+                err += " (needs root, CAP_SYS_NICE, or an rtprio limit in /etc/security/limits.conf)";
+            ok = false;
+        }
+    }
+#endif
+    return ok;
+}
+
+std::vector<std::string> checkPlacement(const PlacementPolicy &pol)
+{
+    std::vector<std::string> warnings;
+#ifdef __linux__
+    if (pol.nic.empty())
+        return warnings;
+    std::vector<int> local = nicCores(pol.nic);
+    std::vector<int> irqs = nicIrqs(pol.nic);
+    if (irqs.empty())
+        warnings.push_back("can't find the interrupts of " + pol.nic + "; IRQ affinity not checked");
+
+    for (int r=0;r<PLACE_ROLES;++r)
+    {
+        const ThreadPlace &p = pol.place[r];
+        if (!p.cores.empty() && !local.empty() && common(p.cores, local).size() < p.cores.size())
+            warnings.push_back(std::string(roleName(r)) + " thread cores " + coreText(p.cores) + " are not all on "
+                               + pol.nic + "'s NUMA node (cores " + coreText(local) + ")");
+    }
+
+    for (size_t i=0;i<irqs.size();++i)
+    {
+        std::vector<int> cores = irqCores(irqs[i]);
+        if (cores.empty())
+            continue;
+        std::ostringstream irq;
+        irq << pol.nic << " IRQ " << irqs[i] << " (cores " << coreText(cores) << ")";
+        if (!local.empty() && common(cores, local).empty())
+            warnings.push_back(irq.str() + " is handled off the interface's NUMA node");
+        for (int r=0;r<PLACE_ROLES;++r)
+        {
+            const ThreadPlace &p = pol.place[r];
+            if (!p.realtime)
+                continue;
+            // a SCHED_FIFO thread that never sleeps long starves the softirq work behind the interrupt,
+            // and that work is what fills the socket buffer
+            std::vector<int> both = common(cores, p.cores.empty() ? local : p.cores);
+            if (!both.empty())
+                warnings.push_back(irq.str() + " shares cores " + coreText(both) + " with the SCHED_FIFO " + roleName(r)
+                                   + " thread; received packets may wait for the thread to sleep");
+        }
+    }
+#else
+    (void)pol;
+#endif
+    return warnings;
+}
@@ -0,0 +1,73 @@
+//---------------------------------------------------------------------------
+
+#ifndef ThreadPlacementH
+#define ThreadPlacementH
+
+#include <string>
+#include <vector>
+#include "CaptureSync.h"
+
+//---------------------------------------------------------------------------
+
+// which cores the capture threads run on, and at what priority
+//
+// By default the receive, writer and telemetry threads run wherever the scheduler
+// puts them, at normal priority, sharing cores with the user interface.
+// A placement pins each of them to chosen cores and can give them real time priority
+// (SCHED_FIFO on Linux, time critical priority on Windows), so nothing else on the
+// computer delays a recvfrom() long enough for the socket buffer to overflow.
+// On Linux the placement can also name the network interface the stream comes in on:
+// threads without cores of their own are kept on the interface's NUMA node,
+// and checkPlacement() compares the pinned cores with the interface's IRQ affinity.
+
+enum ThreadRole { PLACE_RECEIVE, PLACE_WRITER, PLACE_TELEMETRY, PLACE_ROLES };
+
+#ifdef _WIN32
+typedef HANDLE CaptureThread;       // TThread::Handle
+#else
+typedef pthread_t CaptureThread;
+#endif
+
+inline CaptureThread captureThreadSelf()
+{
+#ifdef _WIN32
+    return GetCurrentThread();
+#else
+    return pthread_self();
+#endif
+}
+
+struct ThreadPlace
+{
+    std::vector<int> cores;         // empty = any core
+    bool realtime;
+
+    ThreadPlace() : realtime(false) {}
+};
+
+struct PlacementPolicy
+{
+    ThreadPlace place[PLACE_ROLES];
+    int priority;                   // SCHED_FIFO priority, 1-99 (Linux & OS X)
+    std::string nic;                // interface the stream arrives on, e.g. "eth0" (Linux); empty = don't know
+
+    PlacementPolicy() : priority(50) {}
+    bool enabled() const;
+};
+
+// placement from text, e.g. "receive=2;writer=3;telemetry=0;fifo=receive,writer;priority=60;nic=eth0"
+// cores are lists and ranges: "2,4-7"
+bool parsePlacement(const std::string &spec, PlacementPolicy &pol, std::string &err);
+
+// moves thread t to its cores & priority; false (and why) if the system refused any of it
+bool placeThread(CaptureThread t, int role, const PlacementPolicy &pol, std::string &err);
+
+// problems with the placement that don't stop it working: cores off the interface's
+// NUMA node, real time threads sharing a core with the interface's interrupts, ...
+std::vector<std::string> checkPlacement(const PlacementPolicy &pol);
+
+const char *roleName(int role);
+std::string coreText(const std::vector<int> &cores);       // "2,4-7"
+
+//---------------------------------------------------------------------------
+#endif
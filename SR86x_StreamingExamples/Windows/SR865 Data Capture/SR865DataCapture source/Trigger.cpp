@@ -0,0 +1,208 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "Trigger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// trigger conditions
+// A condition that is true when the capture starts fires at once (it has "become" true);
+// an edge needs to see the channel on the far side of level first.
+
+static bool parseNumber(const std::string &val, double &x)
+{
+    char *end;
+    x = strtod(val.c_str(), &end);
+    return (end != val.c_str() && !*end);
+}
+
+bool parseTrigger(const std::string &spec, TriggerOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        bool ok = true;
+        double x = 0.0;
+        if (key == "source")
+        {
+            static const char *names[4] = { "X", "Y", "R", "theta" };
+            ok = false;
+            for (int c=0;c<4;++c)
+            {
+                if (val == names[c])
+                {
+                    opt.source = c;
+                    ok = true;
+                }
+            }
+        }
+        else if (key == "edge")
+        {
+            opt.mode = TRIGGER_EDGE;
+            if (val == "rise")
+                opt.slope = TRIGGER_RISE;
+            else if (val == "fall")
+                opt.slope = TRIGGER_FALL;
+            else if (val == "both")
+                opt.slope = TRIGGER_RISE | TRIGGER_FALL;
+            else
+                ok = false;
+        }
+        else if (key == "above" || key == "below")
+        {
+            opt.mode = (key == "above") ? TRIGGER_ABOVE : TRIGGER_BELOW;
+            ok = parseNumber(val, opt.level);
+        }
+        else if (key == "inside" || key == "outside")
+        {
+            opt.mode = (key == "inside") ? TRIGGER_INSIDE : TRIGGER_OUTSIDE;
+            size_t comma = val.find(',');
+            ok = (comma != std::string::npos && parseNumber(val.substr(0, comma), opt.low)
+                  && parseNumber(val.substr(comma + 1), opt.high) && opt.low <= opt.high);
+        }
+        else if (key == "overload" && eq == std::string::npos)
+            opt.mode = TRIGGER_OVERLOAD;
+        else if (key == "level")
+            ok = parseNumber(val, opt.level);
+        else if (key == "hyst")
+            ok = parseNumber(val, opt.hysteresis) && opt.hysteresis >= 0.0;
+        else if (key == "pre" || key == "post" || key == "holdoff")
+        {
+            // the pre-trigger ring is sized for pre at the fastest stream (TriggerSink.h)
+            ok = parseNumber(val, x) && x >= 0.0 && (key != "pre" || x <= 1.0);
+            if (key == "pre")
+                opt.pre = x;
+            else if (key == "post")
+                opt.post = x;
+            else
+                opt.holdoff = x;
+        }
+        else if (key == "count")
+        {
+            char *end;
+            long long n = strtol(val.c_str(), &end, 10);
+            ok = (end != val.c_str() && !*end && n >= 0);
+            opt.maxEvents = n;
+        }
+        else
+        {
+            err = "unknown trigger setting \"" + item + "\"";
+            return false;
+        }
+        if (!ok)
+        {
+            err = "bad value for " + key + ": \"" + val + "\"";
+            return false;
+        }
+    }
+    opt.on = true;
+    return true;
+}
+
+std::string describeTrigger(const TriggerOptions &opt)
+{
+    static const char *names[4] = { "X", "Y", "R", "theta" };
+    char text[128];
+    switch (opt.mode)
+    {
+        default:
+        case TRIGGER_EDGE:
+            sprintf(text, "%s %s through %g", names[opt.source & 3],
+                    opt.slope == TRIGGER_RISE ? "rising" : (opt.slope == TRIGGER_FALL ? "falling" : "crossing"), opt.level);
+            break;
+        case TRIGGER_ABOVE:
+            sprintf(text, "%s above %g", names[opt.source & 3], opt.level);
+            break;
+        case TRIGGER_BELOW:
+            sprintf(text, "%s below %g", names[opt.source & 3], opt.level);
+            break;
+        case TRIGGER_INSIDE:
+            sprintf(text, "%s inside %g .. %g", names[opt.source & 3], opt.low, opt.high);
+            break;
+        case TRIGGER_OUTSIDE:
+            sprintf(text, "%s outside %g .. %g", names[opt.source & 3], opt.low, opt.high);
+            break;
+        case TRIGGER_OVERLOAD:
+            sprintf(text, "overload");
+            break;
+    }
+    return text;
+}
+
+//---------------------------------------------------------------------------
+// TriggerDetector
+
+TriggerDetector::TriggerDetector(const TriggerOptions &opt)
+{
+    options = opt;
+    reset();
+}
+
+void TriggerDetector::reset()
+{
+    state = 0;
+}
+
+int TriggerDetector::find(const float *v, int frames, int stride)
+{
+    int hit = -1;
+    if (options.mode == TRIGGER_EDGE)
+    {
+        float level = (float)options.level;
+        float armRise = (float)(options.level - options.hysteresis);
+        float armFall = (float)(options.level + options.hysteresis);
+        for (int i=0;i<frames;++i, v+=stride)
+        {
+            float x = *v;
+            if ((state & TRIGGER_RISE) && x >= level)
+            {
+                state &= ~TRIGGER_RISE;
+                if ((options.slope & TRIGGER_RISE) && hit < 0)
+                    hit = i;
+            }
+            else if ((state & TRIGGER_FALL) && x <= level)
+            {
+                state &= ~TRIGGER_FALL;
+                if ((options.slope & TRIGGER_FALL) && hit < 0)
+                    hit = i;
+            }
+            if (x < armRise)
+                state |= TRIGGER_RISE;
+            if (x > armFall)
+                state |= TRIGGER_FALL;
+        }
+        return hit;
+    }
+
+    float level = (float)options.level, low = (float)options.low, high = (float)options.high;
+    for (int i=0;i<frames;++i, v+=stride)
+    {
+        float x = *v;
+        bool cond;
+        switch (options.mode)
+        {
+            case TRIGGER_ABOVE:     cond = (x > level); break;
+            case TRIGGER_BELOW:     cond = (x < level); break;
+            case TRIGGER_INSIDE:    cond = (x >= low && x <= high); break;
+            case TRIGGER_OUTSIDE:   cond = (x < low || x > high); break;
+            default:                cond = false; break;
+        }
+        if (cond && !state && hit < 0)
+            hit = i;
+        state = cond ? 1 : 0;
+    }
+    return hit;
+}
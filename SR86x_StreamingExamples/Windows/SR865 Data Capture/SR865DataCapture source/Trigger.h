@@ -0,0 +1,73 @@
+//---------------------------------------------------------------------------
+
+#ifndef TriggerH
+#define TriggerH
+
+#include <string>
+
+//---------------------------------------------------------------------------
+
+// trigger conditions on the stream, for saving only the data around events (see TriggerSink.h)
+//
+// Conditions are tested on every sample of one channel, in engineering units (V or A, degrees for
+// theta; counts if the sensitivity of integer data is unknown):
+//   edge      the channel crosses level (rising, falling or either); after firing, it must go back
+//             past level by hysteresis before it can fire again
+//   above, below, inside (low .. high), outside
+//             the condition becomes true; it fires again only after it has been false
+//   overload  a packet has the overload / error bits set (hdr.over); no channel needed
+// R and theta are computed from X,Y (Polar.h) when the stream doesn't carry them.
+
+#define TRIGGER_X           0           // channel: ColumnSink.h order
+#define TRIGGER_Y           1
+#define TRIGGER_R           2
+#define TRIGGER_THETA       3
+
+enum TriggerMode { TRIGGER_EDGE, TRIGGER_ABOVE, TRIGGER_BELOW, TRIGGER_INSIDE, TRIGGER_OUTSIDE, TRIGGER_OVERLOAD };
+
+#define TRIGGER_RISE        1
+#define TRIGGER_FALL        2
+
+struct TriggerOptions
+{
+    bool on;                        // save only the windows around events
+    int mode;                       // TriggerMode
+    int source;                     // channel tested
+    int slope;                      // edge: TRIGGER_RISE, TRIGGER_FALL or both
+    double level;                   // edge, above, below
+    double hysteresis;              // edge
+    double low, high;               // inside, outside
+    double pre, post;               // seconds saved before & after the event
+    double holdoff;                 // seconds after a window before the next event
+    long long maxEvents;            // stop after this many; 0 = no limit
+
+    TriggerOptions() : on(false), mode(TRIGGER_EDGE), source(TRIGGER_R), slope(TRIGGER_RISE), level(0.0), hysteresis(0.0),
+                       low(0.0), high(0.0), pre(0.01), post(0.1), holdoff(0.0), maxEvents(0) {}
+};
+
+// options from text, e.g. "source=R;edge=rise;level=0.5;hyst=0.01;pre=0.01;post=0.1",
+// "source=theta;outside=-10,10" or "overload;pre=0.5;post=0.5"; any spec turns triggering on
+bool parseTrigger(const std::string &spec, TriggerOptions &opt, std::string &err);
+
+// "R rising through 0.5", for notes
+std::string describeTrigger(const TriggerOptions &opt);
+
+// tests the condition on the samples of one channel
+class TriggerDetector
+{
+protected:
+    TriggerOptions options;
+    int state;                      // edge: armed to fire (TRIGGER_RISE: has been below level - hysteresis,
+                                    // TRIGGER_FALL: above level + hysteresis); others: 1 = condition true
+
+public:
+    TriggerDetector(const TriggerOptions &opt);
+
+    void reset();                   // forget the samples so far
+    // first of frames samples (v[0], v[stride], ...) at which the trigger fires, -1 if none;
+    // every sample counts towards re-arming
+    int find(const float *v, int frames, int stride);
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,215 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "TriggerSink.h"
+#include "ColumnSink.h"
+#include "SampleScale.h"
+#include "Polar.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// triggered capture files
+// Windows are kept in samples (CapturePacket.sample), so lost packets don't stretch them.
+
+#define TRIGGER_RING_FRAMES 64          // fewest frames in a 1024 byte packet (float X,Y,R,theta)
+
+TriggerSink::TriggerSink(const TriggerOptions &opt, CaptureSink *sampleSink)
+    : detector(opt)
+{
+    samples = sampleSink;
+    options = opt;
+    ring = NULL;
+    ringSize = 0;
+    ringFirst = ringCount = 0;
+    stream = 0;
+    rate = 0.0;
+    lastOver = false;
+    saving = false;
+    saveUntil = 0;
+    armAt = 0;
+    events = 0;
+    condition = describeTrigger(opt);
+}
+/*virtual*/ TriggerSink::~TriggerSink()
+{
+    close();
+    delete samples;
+    delete [] ring;
+}
+
+/*virtual*/ bool TriggerSink::open(const SinkPath &fname, bool trunc)
+{
+    close();
+    if (!ring)
+    {
+        ringSize = (int)ceil(options.pre * 1.25e6 / TRIGGER_RING_FRAMES) + 2;
+        ring = new CapturePacket[ringSize];
+    }
+    ringFirst = ringCount = 0;
+    stream = 0;
+    lastOver = false;
+    saving = false;
+    armAt = 0;
+    events = 0;
+    detector.reset();
+    return samples->open(fname, trunc);
+}
+/*virtual*/ bool TriggerSink::isOpen() const
+{
+    return samples->isOpen();
+}
+/*virtual*/ void TriggerSink::close()
+{
+    samples->close();
+}
+
+// samples per channel in a packet
+static int framesOf(const CapturePacket &pkt, const PacketHeader &hdr)
+{
+    int words = pkt.nwords - 1;
+    return (hdr.isInt() ? words * 2 : words) / hdr.channels();
+}
+
+// frame of the packet the trigger fires on, -1 if none
+int TriggerSink::detect(const CapturePacket &pkt, const PacketHeader &hdr, int frames)
+{
+    if (options.mode == TRIGGER_OVERLOAD)
+    {
+        bool fire = (hdr.over && !lastOver);
+        lastOver = hdr.over;
+        return fire ? 0 : -1;
+    }
+
+    int cols[4];
+    int nch = columnsOf(hdr.what, cols);
+    packetToFloat(pkt, values);
+    const float *v = NULL;
+    int stride = nch;
+    for (int k=0;k<nch;++k)
+    {
+        if (cols[k] == options.source)
+            v = values + k;
+    }
+    if (v && options.source == TRIGGER_THETA && hdr.isInt() && pkt.scale < 0)
+    {
+        // theta still in counts
+        for (int i=0;i<frames;++i)
+            values[i*nch + nch - 1] *= countScale(0, true);
+    }
+    if (!v && options.source >= TRIGGER_R && nch == 2 && cols[0] == 0 && cols[1] == 1)
+    {
+        xyToPolar(values, frames, polar);
+        v = polar + options.source;
+        stride = 4;
+    }
+    if (!v)
+        return -1;                  // stream doesn't have the channel
+    return detector.find(v, frames, stride);
+}
+
+// trigger fired at frame hit of pkt
+void TriggerSink::event(const CapturePacket &pkt, int hit, int frames)
+{
+    long long at = pkt.sample + hit;
+    ++events;
+    char text[200];
+    sprintf(text, "Trigger %lld: %s at sample %lld, %.6f s", events, condition.c_str(),
+            at, pkt.rxTime - (frames - hit) / rate);
+    samples->note(text);
+
+    if (!saving)
+    {
+        // the pre window, from the ring
+        long long from = at - (long long)ceil(options.pre * rate);
+        for (int i=0;i<ringCount;++i)
+        {
+            const CapturePacket &p = ring[(ringFirst + i) % ringSize];
+            if (p.sample + framesOf(p, PacketHeader(p.buffer[0])) > from)
+                samples->write(p);
+        }
+        ringCount = 0;
+        saving = true;
+    }
+    saveUntil = at + (long long)ceil(options.post * rate);
+}
+
+/*virtual*/ void TriggerSink::write(const CapturePacket &pkt)
+{
+    if (!samples->isOpen() || pkt.nwords < 2)
+        return;
+    PacketHeader hdr(pkt.buffer[0]);
+    unsigned int s = pkt.buffer[0] & 0x00ff0f00;    // content & rate
+    if (s != stream)
+    {
+        // older packets are another stream; no pre window across the change
+        stream = s;
+        rate = hdr.sampleRate();
+        detector.reset();
+        lastOver = false;
+        ringCount = 0;
+    }
+    int frames = framesOf(pkt, hdr);
+    int hit = detect(pkt, hdr, frames);
+    if (hit >= 0 && options.maxEvents > 0 && events >= options.maxEvents)
+        hit = -1;
+    if (hit >= 0 && !saving && pkt.sample + hit < armAt)
+        hit = -1;                   // holdoff
+    if (hit >= 0)
+        event(pkt, hit, frames);
+
+    if (saving)
+    {
+        samples->write(pkt);
+        if (pkt.sample + frames >= saveUntil)
+        {
+            saving = false;
+            armAt = saveUntil + (long long)ceil(options.holdoff * rate);
+        }
+        return;
+    }
+    // keep it for a pre window
+    if (ringCount == ringSize)
+    {
+        ringFirst = (ringFirst + 1) % ringSize;
+        --ringCount;
+    }
+    ring[(ringFirst + ringCount) % ringSize] = pkt;
+    ++ringCount;
+}
+
+/*virtual*/ long long TriggerSink::bytesWritten()
+{
+    return samples->bytesWritten();
+}
+/*virtual*/ long long TriggerSink::packetsWritten() const
+{
+    return samples->packetsWritten();
+}
+/*virtual*/ void TriggerSink::note(const std::string &text)
+{
+    samples->note(text);
+}
+/*virtual*/ long long TriggerSink::syncCount() const
+{
+    return samples->syncCount();
+}
+/*virtual*/ double TriggerSink::syncTime() const
+{
+    return samples->syncTime();
+}
+/*virtual*/ void TriggerSink::idle(double now)
+{
+    samples->idle(now);
+}
+
+long long TriggerSink::eventCount() const
+{
+    return events;
+}
@@ -0,0 +1,72 @@
+//---------------------------------------------------------------------------
+
+#ifndef TriggerSinkH
+#define TriggerSinkH
+
+#include "CaptureSink.h"
+#include "Trigger.h"
+
+//---------------------------------------------------------------------------
+
+// triggered capture: only the packets around events are saved (see Trigger.h)
+//
+// The instrument's own capture buffer (CAPTURESTART) is limited in size and slow to read out;
+// this watches the whole stream instead, for as long as it runs, and saves pre seconds before
+// and post seconds after each event to the capture file, in whatever format it has.
+// An event inside the post window of the one before extends the window, so windows never
+// overlap or repeat data. Each event is noted in the file ("Trigger 1: R rising through 0.5 at
+// sample 123456, 12.345678 s"; binary files keep notes in "run.dat.log"), with the sample it fired on.
+// Windows are whole packets: the packet holding the first sample of the pre window
+// up to the one holding the last of the post window.
+//
+// The packets of the last pre seconds wait in a ring of packet slots allocated when the file is opened
+// (pre seconds of 1024 byte packets at 1.25 MHz; streams of shorter packets at the top rates get less).
+// Like every sink it runs on the writer thread, behind the lock-free packet queue,
+// so neither the ring nor the detector needs a lock, and the receive thread never waits for them.
+// Side files (spectra, resampled data) still get the whole stream.
+
+class TriggerSink : public CaptureSink
+{
+protected:
+    CaptureSink *samples;           // capture file the windows go to
+    TriggerOptions options;
+    TriggerDetector detector;
+    CapturePacket *ring;            // last packets not saved, oldest at ringFirst
+    int ringSize;
+    int ringFirst, ringCount;
+    unsigned int stream;            // content & rate of the last packet
+    double rate;
+    bool lastOver;                  // overload bits of the last packet
+    bool saving;                    // in a window
+    long long saveUntil;            // sample after the end of the window
+    long long armAt;                // first sample that may start a window (holdoff)
+    long long events;
+    std::string condition;          // describeTrigger()
+    float values[512];
+    float polar[1024];
+
+    int detect(const CapturePacket &pkt, const PacketHeader &hdr, int frames);
+    void event(const CapturePacket &pkt, int hit, int frames);
+
+public:
+    // takes ownership of samples
+    TriggerSink(const TriggerOptions &opt, CaptureSink *samples);
+    virtual ~TriggerSink();
+
+    virtual bool open(const SinkPath &fname, bool trunc);
+    virtual bool isOpen() const;
+    virtual void write(const CapturePacket &pkt);
+    virtual void close();
+
+    virtual long long bytesWritten();
+    virtual long long packetsWritten() const;   // packets saved
+    virtual void note(const std::string &text);
+    virtual long long syncCount() const;
+    virtual double syncTime() const;
+    virtual void idle(double now);
+
+    long long eventCount() const;   // since open
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -4,6 +4,8 @@
 #pragma hdrstop
 
 #include "UDPServerThread.h"
+#include <fstream>
+#include <sstream>
 #include <time.h>
 //---------------------------------------------------------------------------
 
@@ -12,9 +14,19 @@
 
 // this thread receives streaming data from a UDP port
 // it displays the first sample of data,
-// and then saves the data to disk.
+// and then queues the packet for the writer thread, which saves the data to disk.
+// PacketDecoder.cpp does the processing, so test & benchmark programs (CaptureBench.cpp) can run it too.
+// Packets are received straight into a free slot of the packet queue;
+// if the writer falls behind and the queue fills, packets are still received (and displayed) but not saved.
 // For binary file format, the UDP packet is saved in native endian format, and includes the header.
 // For ASCII file format, the data is saved in CSV format, with a date-time at the beginning, and a description of the data & data rate when they change.
+// See CaptureSink.cpp for the file formats, and for segmented (rolling) capture files;
+// CompressedSink.cpp for compressed binary files; ColumnSink.cpp for column (one file per channel) files;
+// JournalSink.cpp for crash-safe binary files (and CaptureRecover.cpp to repair them).
+// CaptureMetrics.cpp serves the receive and writer counters to monitoring tools,
+// and CaptureTrace.cpp times each packet through the stages from recvfrom() to disk.
+// ThreadPlacement.cpp pins the receive, writer & metrics threads to cores (command line option);
+// ReceiveSocket.cpp sizes the socket's receive buffer and counts the datagrams it had to drop.
 
 
 // UDP packet format
@@ -23,6 +35,7 @@
 // Always Big-endian!
 // bits 7-0 (8 bits) are packet counter
 // ie sequential packets have counter incr by 1.
+// (PacketSequence.cpp extends it to a 64 bit sequence number using the arrival time)
 // bits 11-8 (4 bits) are what is contained in packet
 //   0 = x-only (float), 1 = x&y (float) 2 = r&th (float), 3 = xyrth (float)
 //   4 = x-only (int),   5 = x&y (int)   3 = r&th (int),   7 = xyrth (int)
@@ -50,20 +63,25 @@
 UDPServerThread::UDPServerThread() : TThread(true)
 {
     port = 1865;
-    liax = 0.0;
-    liay = 0.0;
-    liar = 0.0;
-    liath = 0.0;
-    byte_count = 0;
-    counter = -1;
-    over = false;
-    missed = false;
-    csvFmt = false;
-    hdr.setHeader(-1);
+    scale = SCALE_UNKNOWN;
+    pending = 0;
+    lastPublish = 0.0;
 
-    sd = INVALID_SOCKET;
     serverMutex = new TMutex(true);     // mutex to handle exclusive access to udp server
-    fileMutex = new TMutex(true);       // mutex to handle exclusive access to file object
+
+    // packet queue and the thread that empties it to disk
+    queue = new PacketQueue();
+    decoder = new PacketDecoder(queue);
+    snapshot.publish(decoder->live);
+    writer = new CaptureWriter(queue);
+#ifdef CAPTURE_TRACE
+    trace = new CaptureTrace();
+    decoder->setTrace(trace);
+    writer->setTrace(trace);
+#endif
+    writerThread = new WriterThread(writer);
+    writerThread->FreeOnTerminate = false;
+    writerThread->Resume();
 
     // start up UDP server (server RECEIVES data)
     WSAData wsdat;
@@ -72,89 +90,202 @@ UDPServerThread::UDPServerThread() : TThread(true)
         fprintf(stderr, "Could not open Winsock connection.\n");
         exit(0);
     }
+
+    // metrics endpoint on this computer, http://127.0.0.1:(port + 8000)/metrics
+    metrics = new MetricsServer(&snapshot, writer, queue);
+#ifdef CAPTURE_TRACE
+    metrics->setTrace(trace);
+#endif
+    metrics->open(port + METRICS_PORT_OFFSET, port);
+    metricsThread = new MetricsThread(metrics);
+    metricsThread->FreeOnTerminate = false;
+    metricsThread->Resume();
 }
 /*virtual*/ __fastcall UDPServerThread::~UDPServerThread()
 {
     stopServer();
+    metricsThread->Terminate();
+    metricsThread->WaitFor();
+    delete metricsThread;
+    delete metrics;
+    // receive loop must be finished before the queue goes away
+    Terminate();
+    WaitFor();
     WSACleanup();
     delete serverMutex;
 
-    closeFile();
+    // writer saves anything still queued, then closes file
+    writerThread->Terminate();
+    writerThread->WaitFor();
+    delete writerThread;
+    delete writer;
+    delete decoder;
+    delete queue;
+#ifdef CAPTURE_TRACE
+    delete trace;
+#endif
 }
 
 void UDPServerThread::setPort(int inport)
 {
     stopServer();
+    if (port != inport)
+        metrics->open(inport + METRICS_PORT_OFFSET, inport);
     port = inport;
     startServer();
 }
 void UDPServerThread::setFileFmt(bool csv)
 {
-    if (csvFmt != csv)
+    if (options.csv != csv)
     {
-        fstream.close();
-        csvFmt = csv;
+        closeFile();
+        options.csv = csv;
     }
 }
+void UDPServerThread::setCompress(bool compress)
+{
+    // binary files only; takes effect at next setFile()
+    options.compress = compress;
+}
+void UDPServerThread::setColumns(bool columns)
+{
+    // takes effect at next setFile()
+    options.columns = columns;
+}
+void UDPServerThread::setSpectra(bool spectra)
+{
+    // noise spectra instead of samples; takes effect at next setFile()
+    options.spectra = spectra;
+}
+void UDPServerThread::setSpectrum(const SpectrumOptions &opt)
+{
+    // segment size, averaging & side-stream; takes effect at next setFile()
+    options.spectrum = opt;
+}
+void UDPServerThread::setResampled(bool resampled)
+{
+    // samples at the resample rate instead of the stream rate; takes effect at next setFile()
+    options.resampled = resampled;
+}
+void UDPServerThread::setResample(const ResampleOptions &opt)
+{
+    // output rate, passband & side-stream; takes effect at next setFile()
+    options.resample = opt;
+}
+void UDPServerThread::setEnvelope(const EnvelopeOptions &opt)
+{
+    // min / max / mean pyramid beside the samples; takes effect at next setFile()
+    options.envelope = opt;
+}
+void UDPServerThread::setFlags(bool flags)
+{
+    // overload / error flag timeline beside the samples; takes effect at next setFile()
+    options.flags = flags;
+}
+void UDPServerThread::setPolar(const PolarOptions &opt)
+{
+    // R & theta added to X,Y streams; takes effect at next setFile()
+    options.polar = opt;
+}
+void UDPServerThread::setTrigger(const TriggerOptions &opt)
+{
+    // samples saved only around events; takes effect at next setFile()
+    options.trigger = opt;
+}
+void UDPServerThread::setJournal(bool journal, int syncPackets, double syncSeconds)
+{
+    // plain binary files only; takes effect at next setFile()
+    options.journal = journal;
+    options.syncPackets = syncPackets;
+    options.syncSeconds = syncSeconds;
+}
+void UDPServerThread::setSegments(const SegmentPolicy &pol)
+{
+    // takes effect at next setFile()
+    segments = pol;
+}
+void UDPServerThread::setScale(int code)
+{
+    // from user interface thread; applies to packets received from now on
+    atomicStore(&scale, code);
+}
 void UDPServerThread::setFile(UnicodeString fname, bool trunc)
 {
     closeFile();
-    fileMutex->Acquire();
-    fstream.clear();
-    fstream.open(fname.c_str(), ios::out | (csvFmt?0:ios::binary) | (trunc?ios::trunc:ios::app));
-    if (!(fstream.is_open() && fstream.good() && !fstream.fail()))
-        fstream.close();
 
-    counter = -1;
-    if (csvFmt)
+    // file is opened here, on the user interface thread;
+    // the writer thread picks it up with the next queued packet
+    SinkPath path(fname.c_str());
+    CaptureSink *sink = NULL;
+    if (segments.enabled())
     {
-        time_t t = time(0);
-        struct tm *now = localtime(&t);
-        char dtbuff[80];
-        strftime(dtbuff, 80, "%Y-%m-%d %H:%M", now);
-        lastHeader = 0;
-        fstream << dtbuff << std::endl;
-        // specify float fmt
-        // precision means (1 + prec) sig fig;
-        // 24 bits of mantissa in float means 7.2 decimal digits,
-        // so we need 8 sig fig to completely specify float
-        // however, 6 sig fig (1ppm) is usually more than enough!
-        // we could go as low as 5 sig fig (1 in 100,000), which is still better than 16bits
-        fstream << std::scientific;
-        fstream.precision(5);
+        SegmentSink *seg = new SegmentSink(options, segments);
+        if (seg->open(path, trunc))
+            sink = seg;
+        else
+            delete seg;
     }
-    fileMutex->Release();
+    else
+    {
+        CaptureSink *file = newFileSink(options);
+        if (file->open(path, trunc))
+            sink = file;
+        else
+            delete file;
+    }
+
+    // the receive thread decodes under serverMutex; numbering restarts between two packets
+    serverMutex->Acquire();
+    decoder->restart();
+    serverMutex->Release();
+    writer->setSink(sink);
 }
 bool UDPServerThread::fileIsOpen()
 {
-    return fstream.is_open();
+    return writer->sinkIsOpen();
 }
 void UDPServerThread::closeFile()
 {
-    fileMutex->Acquire();
-    fstream.close();
-    fileMutex->Release();
+    writer->setSink(NULL);
 }
 
 // thread's main execution loop
 /*virtual*/ void __fastcall UDPServerThread::Execute(void)
 {
-    int client_length = (int)sizeof(struct sockaddr_in);
     int bytes_received;
+    CapturePacket *pkt;
     do
     {
+        // receive straight into next free slot of packet queue
+        // (or a spare slot if the queue is full; that packet can't be saved)
+        pkt = decoder->slot();
+
         // receive up to 1200 bytes from UDP socket
-        bytes_received = recvfrom(sd, (char *)buffer, 1200, 0, (struct sockaddr *)&client, &client_length);
-        if (bytes_received < 0)
+        bytes_received = sock.receive(pkt->buffer, sizeof(pkt->buffer));
+        if (bytes_received <= 0)
         {
-            //fprintf(stderr, "Could not receive datagram.\n");
-            Sleep(10);
+            // stream stopped (receive timeout, or nothing waiting when spinning), or no socket
+            idleData();
+            if (pending)
+                publish();
+            if (bytes_received < 0)
+            {
+                //fprintf(stderr, "Could not receive datagram.\n");
+                Sleep(10);
+            }
         }
         else
         {
             // got packet data!
-            byte_count += bytes_received;
-            gotData(bytes_received >> 2);   // process data
+            TRACE_STAMP(pkt, TRACE_RECV);
+            pkt->rxTime = captureClock();
+            pkt->scale = atomicLoad(&scale);
+            gotData(pkt, bytes_received);   // process data
+
+            // let other threads see the new state every few ms, not every packet
+            ++pending;
+            if (pkt->rxTime - lastPublish >= 0.005)
+                publish();
         }
     }
     while (!Terminated);
@@ -163,293 +294,146 @@ void UDPServerThread::closeFile()
 
 void UDPServerThread::startServer()
 {
-    // create socket
-    sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (sd == INVALID_SOCKET)
-    {
-        fprintf(stderr, "Could not create socket.\n");
-        WSACleanup();
-        exit(0);
-    }
-
-    // bind to local address
-    memset((void *)&server, '\0', sizeof(struct sockaddr_in));
-    server.sin_family = AF_INET;
-    server.sin_port = htons(port);
-    // any ip address this computer has (e.g ethernet ip + wifi ip)
-    server.sin_addr.S_un.S_un_b.s_b1 = (unsigned char)0;
-    server.sin_addr.S_un.S_un_b.s_b2 = (unsigned char)0;
-    server.sin_addr.S_un.S_un_b.s_b3 = (unsigned char)0;
-    server.sin_addr.S_un.S_un_b.s_b4 = (unsigned char)0;
-    /* Bind address to socket */
-    if (bind(sd, (struct sockaddr *)&server,
-                         sizeof(struct sockaddr_in)) == -1)
+    // create socket, size its receive buffer & bind to local address (ReceiveSocket.cpp)
+    // under serverMutex: the receive thread reads the socket's counters under it
+    std::string err;
+    serverMutex->Acquire();
+    bool ok = sock.open(port, receive, err);
+    serverMutex->Release();
+    if (!ok)
     {
-        fprintf(stderr, "Could not bind to port %d.\n",port);
-        closesocket(sd);
-        sd = INVALID_SOCKET;
-        //WSACleanup();
-        //exit(0);
+        fprintf(stderr, "%s\n", err.c_str());
         throw Exception("Could not bind to UDP port.");
     }
 }
 void UDPServerThread::stopServer()
 {
     serverMutex->Acquire();
-    closesocket(sd);
-    sd = INVALID_SOCKET;
+    sock.close();
     serverMutex->Release();
 }
 bool UDPServerThread::serverOk()
 {
-    return (sd != INVALID_SOCKET);
+    return sock.isOpen();
+}
+void UDPServerThread::setReceive(const ReceiveOptions &opt)
+{
+    // buffer size & receive mode; reopens the socket if it is open
+    serverMutex->Acquire();
+    receive = opt;
+    bool reopen = sock.isOpen();
+    if (reopen)
+        sock.close();
+    serverMutex->Release();
+    if (reopen)
+        startServer();
+}
+std::string UDPServerThread::receiveWarning()
+{
+    return sock.warning();
 }
 
 // process UDP packet
 // here, we record first data point(s)
 // and save the packet to disk
-void UDPServerThread::gotData(int nwords)   // number of 32bit words
+void UDPServerThread::gotData(CapturePacket *pkt, int bytes)
 {
     serverMutex->Acquire();
+    decoder->decode(pkt, bytes);
+    serverMutex->Release();
+}
+void UDPServerThread::idleData()
+{
+    serverMutex->Acquire();
+    decoder->idle(captureClock());
+    serverMutex->Release();
+}
+void UDPServerThread::publish()
+{
+    // receive thread only; the socket may be closed & reopened meanwhile (setPort, setReceive)
+    serverMutex->Acquire();
+    decoder->live.socketQueued = sock.queuedBytes();
+    decoder->live.socketBuffer = sock.bufferBytes();
+    decoder->live.socketDrops = sock.kernelDrops();
+    serverMutex->Release();
+    snapshot.publish(decoder->live);
+    pending = 0;
+    lastPublish = captureClock();
+}
+void UDPServerThread::getData(LiveData &data)
+{
+    // latest published state, for the user interface (or any other thread)
+    // counters are totals; caller takes differences
+    snapshot.read(data);
+}
 
+bool UDPServerThread::saveTrace(UnicodeString fname, double seconds)
+{
+    // last few seconds of packets, for chrome://tracing or ui.perfetto.dev
+#ifdef CAPTURE_TRACE
+    std::ofstream out(fname.c_str());
+    if (!out.is_open())
+        return false;
+    double now = captureClock();
+    trace->exportChrome(out, now - seconds, now);
+    return out.good();
+#else
+    return false;
+#endif
+}
+double UDPServerThread::queueFill()
+{
+    // fraction of the packet queue waiting for the writer thread
+    return (double)queue->depth() / queue->capacity();
+}
+void UDPServerThread::note(const std::string &text)
+{
+    // line of text in the capture file, stamped with the time of day
+    time_t t = time(0);
+    char dtbuff[80];
+    strftime(dtbuff, 80, "%Y-%m-%d %H:%M:%S ", localtime(&t));
+    writer->note(dtbuff + text);
+}
+void UDPServerThread::getStreamStats(StreamStats &s)
+{
+    // running mean, deviation & Allan deviation of every channel (StreamStats.h)
+    writer->getStreamStats(s);
+}
+void UDPServerThread::resetStreamStats()
+{
+    writer->resetStreamStats();
+}
+bool UDPServerThread::setStatsLog(UnicodeString fname, double period)
+{
+    // statistics appended to a csv file every period seconds; empty name stops
+    return writer->setStatsLog(SinkPath(fname.c_str()), period);
+}
+bool UDPServerThread::setPlacement(const PlacementPolicy &pol, std::string &err)
+{
+    // the threads are already running; they are moved by handle
+    HANDLE threads[PLACE_ROLES] = { (HANDLE)Handle, (HANDLE)writerThread->Handle, (HANDLE)metricsThread->Handle };
     bool ok = true;
-
-    // do network transformation
-    // ie big-endian to little-endian
-    // header is always big-endian
-    buffer[0] = ntohl(buffer[0]);        // ntohl() does network (big-endian) to host (little-endian) conversion of a 32bit word
-
-    // interpret header
-    hdr.setHeader(buffer[0]);
-    if (!hdr.littleEnd)
+    err.clear();
+    for (int r=0;r<PLACE_ROLES;++r)
     {
-        if (hdr.what >= 4)
-        {
-            // int: convert 16bits at a time
-            unsigned short *sarr = (unsigned short *)(buffer + 1);
-            int nshorts = (hdr.byteLength() >> 1);
-            for (int i=0;i<nshorts;++i)
-                sarr[i] = ntohs(sarr[i]);           // ntohs() does network (big-endian) to host (little-endian) conversion of a 16bit word
-        }
-        else
+        std::string why;
+        if (!placeThread(threads[r], r, pol, why))
         {
-            // float: convert 32bit word at a time
-            unsigned int *warr = (unsigned int *)(buffer + 1);
-            int nints = (hdr.byteLength() >> 2);
-            for (int i=0;i<nints;++i)
-                warr[i] = ntohl(warr[i]);        // ntohl() does network (big-endian) to host (little-endian) conversion of a 32bit word
+            err += (err.empty() ? "" : "\n") + why;
+            ok = false;
         }
     }
-
-    // check for dropped packet
-    // is (last packet counter + 1)%256 == this packet counter?
-    int counter2 = hdr.counter;
-    if (counter >= 0)
-    {
-        counter = (counter + 1)%256;
-        if (counter != counter2)
-        {
-            missed = true;
-            if (csvFmt)
-            {
-                counter = counter2 - counter;
-                if (counter < 0)
-                    counter += 256;
-                fstream << "Dropped " << counter << " packets!" << std::endl;
-            }
-        }
-    }
-    counter = counter2;
-
-    // union for interpreting 32bit data word as different types
-    union
-    {
-        unsigned int ival;      // 32bit word as unsigned int
-        float fval;             // 32bit word as float
-        short sval[2];          // 32bit word as 2 short ints
-                                // sval[0] is the first int, and sval[1] is the second int
-    }
-    dat;
-    // Grab data at beginning of packet
-    switch (hdr.what)
-    {
-        default:
-            // x-only (float)
-            dat.ival = buffer[1];
-            liax = dat.fval;                // interpret as float
-            liay = liar = liath = 0.0;
-            break;
-        case 1:
-            // x&y (float)
-            dat.ival = buffer[1];
-            liax = dat.fval;                // interpret as float
-            dat.ival = buffer[2];
-            liay = dat.fval;                // interpret as float
-            liar = liath = 0.0;
-            break;
-        case 2:
-            // r&th (float)
-            dat.ival = buffer[1];
-            liar = dat.fval;                // interpret as float
-            dat.ival = buffer[2];
-            liath = dat.fval;               // interpret as float
-            liax = liay = 0.0;
-            break;
-        case 3:
-            // xyr&th (float)
-            dat.ival = buffer[1];
-            liax = dat.fval;                // interpret as float
-            dat.ival = buffer[2];
-            liay = dat.fval;                // interpret as float
-            dat.ival = buffer[3];
-            liar = dat.fval;                // interpret as float
-            dat.ival = buffer[4];
-            liath = dat.fval;               // interpret as float
-            break;
-
-        case 4:
-            // x-only (int)
-            dat.ival = buffer[1];
-            liax = dat.sval[0];             // interpret as short int
-            liay = liar = liath = 0.0;
-            break;
-        case 5:
-            // x&y (int)
-            dat.ival = buffer[1];
-            liax = dat.sval[0];             // interpret as short int
-            liay = dat.sval[1];             // interpret as short int
-            liar = liath = 0.0;
-            break;
-        case 6:
-            // r&th (int)
-            dat.ival = buffer[1];
-            liar = dat.sval[0];             // interpret as short int
-            liath = dat.sval[1];            // interpret as short int
-            liax = liay = 0.0;
-            break;
-        case 7:
-            // xyr&th (int)
-            dat.ival = buffer[1];
-            liax = dat.sval[0];             // interpret as short int
-            liay = dat.sval[1];             // interpret as short int
-            dat.ival = buffer[2];
-            liar = dat.sval[0];             // interpret as short int
-            liath = dat.sval[1];            // interpret as short int
-            break;
-    }
-
-    if (!over)
-        over = hdr.over || !ok;
-
-    // save file
-    // data saved in native endian format
-    saveData(nwords);
-    serverMutex->Release();
+    return ok;
 }
-void UDPServerThread::saveData(int nwords)
+UnicodeString UDPServerThread::traceReport()
 {
-    fileMutex->Acquire();
-    if (fstream.is_open())
-    {
-        if (csvFmt)
-        {
-            // comma separated values (ASCII) format
-            // did data content or rate change?
-            if ((lastHeader ^ hdr.getHeader()) & 0x00ff0f00)
-            {
-                lastHeader = hdr.getHeader();
-                switch (hdr.what)
-                {
-                    default: fstream << "X (float)"; break;
-                    case 1: fstream << "X,Y (float)"; break;
-                    case 2: fstream << "R,theta (float)"; break;
-                    case 3: fstream << "X,Y,R,theta (float)"; break;
-                    case 4: fstream << "X (int)"; break;
-                    case 5: fstream << "X,Y (int)"; break;
-                    case 6: fstream << "R,theta (int)"; break;
-                    case 7: fstream << "X,Y,R,theta (int)"; break;
-                }
-                fstream << " @ " << hdr.sampleRate() << " Hz" << std::endl;
-            }
-
-            union
-            {
-                unsigned int raw;
-                float fval;
-                short sval[2];
-            }
-            dat;
-            for (int i=1;i<nwords;)
-            {
-                dat.raw = buffer[i];
-                switch (hdr.what)
-                {
-                    default:
-                        // x only (float)
-                        fstream << dat.fval << std::endl;
-                        ++i;
-                        break;
-                    case 1:
-                    case 2:
-                        // x&y or r&th (float)
-                        fstream << dat.fval << ",";
-                        dat.raw = buffer[i+1];
-                        fstream << dat.fval << std::endl;
-                        i += 2;
-                        break;
-                    case 3:
-                        // xyr&th (float)
-                        fstream << dat.fval << ",";
-                        dat.raw = buffer[i+1];
-                        fstream << dat.fval << ",";
-                        dat.raw = buffer[i+2];
-                        fstream << dat.fval << ",";
-                        dat.raw = buffer[i+3];
-                        fstream << dat.fval << std::endl;
-                        i += 4;
-                        break;
-
-                    case 4:
-                        // x-only (int)
-                        fstream << dat.sval[0] << std::endl << dat.sval[1] << std::endl;
-                        ++i;
-                        break;
-                    case 5:
-                    case 6:
-                        // x&y or r&th (int)
-                        fstream << dat.sval[0] << "," << dat.sval[1] << std::endl;
-                        ++i;
-                        break;
-                    case 7:
-                        // xyr&th (int)
-                        fstream << dat.sval[0] << "," << dat.sval[1] << ",";
-                        dat.raw = buffer[i+1];
-                        fstream << dat.sval[0] << "," << dat.sval[1] << std::endl;
-                        i += 2;
-                        break;
-                }
-            }
-        }
-        else
-            fstream.write((char *)buffer, nwords << 2);     // binary data; save entire udp packet to disk
-    }
-    fileMutex->Release();
-}
-void UDPServerThread::getData(int *pwhat, int *prate, float *pliax, float *pliay, float *pliar, float *pliath, int *pbyte_count, bool *pmissed, bool *pover)
-{
-    // return latest data to user interface
-    *pwhat = hdr.what;
-    *prate = hdr.rate;
-    *pliax = liax;
-    *pliay = liay;
-    *pliar = liar;
-    *pliath = liath;
-    *pbyte_count = byte_count;
-    *pmissed = missed;
-    *pover = over;
-
-    byte_count = 0;
-    missed = false;
-    over = false;
+    // stage latency percentiles since program start
+#ifdef CAPTURE_TRACE
+    std::ostringstream out;
+    trace->report(out);
+    return UnicodeString(out.str().c_str());
+#else
+    return "Tracing not built in (CAPTURE_NO_TRACE).";
+#endif
 }
 
@@ -6,30 +6,44 @@
 #include <Classes.hpp>
 #include <SyncObjs.hpp>
 #include <Sockets.hpp>
-#include <fstream>
 #include "PacketHeader.h"
+#include "PacketQueue.h"
+#include "PacketDecoder.h"
+#include "CaptureSink.h"
+#include "CaptureWriter.h"
+#include "WriterThread.h"
+#include "CaptureMetrics.h"
+#include "MetricsThread.h"
+#include "SampleScale.h"
+#include "LiveSnapshot.h"
+#include "ThreadPlacement.h"
+#include "ReceiveSocket.h"
 //---------------------------------------------------------------------------
 
 class UDPServerThread : public TThread
 {
 protected:
     int port;
-    float liax, liay, liar, liath;
-    unsigned int buffer[300];       // 1200 bytes for receiving UDP packet
-    int byte_count;
-    int counter;
-    bool missed;
-    bool over;
-    ofstream fstream;
-    PacketHeader hdr;
-    bool csvFmt;
-    int lastHeader;
+    volatile long scale;            // sensitivity; tags each received packet (SampleScale.h)
+    LiveSnapshot snapshot;          // what other threads see of decoder->live
+    int pending;                    // packets since last publish
+    double lastPublish;
+    SinkOptions options;
+    SegmentPolicy segments;
     TMutex *serverMutex;
-    TMutex *fileMutex;
 
-    SOCKET sd;
-    sockaddr_in server;
-    sockaddr_in client;
+    PacketQueue *queue;             // received packets waiting to be saved
+    PacketDecoder *decoder;         // byte order, packet counter & live values; fills queue
+    CaptureWriter *writer;          // saves queued packets to current file
+    WriterThread *writerThread;
+    MetricsServer *metrics;         // counters for monitoring tools (CaptureMetrics.h)
+    MetricsThread *metricsThread;
+#ifdef CAPTURE_TRACE
+    CaptureTrace *trace;            // per-stage latency, arrival to disk
+#endif
+
+    ReceiveSocket sock;
+    ReceiveOptions receive;         // buffer size & receive mode
 
 public:
     UDPServerThread();
@@ -37,17 +51,41 @@ public:
 
     void setPort(int inport);
     void setFileFmt(bool csv);
+    void setCompress(bool compress);
+    void setColumns(bool columns);
+    void setSpectra(bool spectra);
+    void setSpectrum(const SpectrumOptions &opt);
+    void setResampled(bool resampled);
+    void setResample(const ResampleOptions &opt);
+    void setEnvelope(const EnvelopeOptions &opt);
+    void setFlags(bool flags);
+    void setPolar(const PolarOptions &opt);
+    void setTrigger(const TriggerOptions &opt);
+    void setJournal(bool journal, int syncPackets, double syncSeconds);
+    void setSegments(const SegmentPolicy &pol);
+    void setScale(int code);
     void setFile(UnicodeString fname, bool trunc);
     bool fileIsOpen();
     void closeFile();
-    void saveData(int nwords);
     virtual void __fastcall Execute(void);
 
     void stopServer();
     void startServer();
     bool serverOk();
-    void gotData(int nwords);
-    void getData(int *pwhat, int *prate, float *pliax, float *pliay, float *pliar, float *pliath, int *pbyte_count, bool *pmissed, bool *pover);
+    void setReceive(const ReceiveOptions &opt);
+    std::string receiveWarning();   // receive buffer smaller than asked for, ...
+    void gotData(CapturePacket *pkt, int bytes);
+    void idleData();
+    void publish();
+    void getData(LiveData &data);
+    bool saveTrace(UnicodeString fname, double seconds);
+    UnicodeString traceReport();
+    double queueFill();
+    void note(const std::string &text);
+    void getStreamStats(StreamStats &s);
+    void resetStreamStats();
+    bool setStatsLog(UnicodeString fname, double period);
+    bool setPlacement(const PlacementPolicy &pol, std::string &err);
 };
 
 #endif
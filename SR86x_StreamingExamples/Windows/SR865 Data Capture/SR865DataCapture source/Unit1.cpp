@@ -14,6 +14,45 @@ TForm1 *Form1;
 //---------------------------------------------------------------------------
 #define DATA_RATE 4.0            // update UI at 4Hz
 
+// the argument after flag on the command line (the last one, if it is given more than once);
+// false if flag isn't there
+static bool commandOption(const char *flag, std::string &arg)
+{
+    bool found = false;
+    for (int i=1;i<ParamCount();++i)
+    {
+        if (ParamStr(i) == flag)
+        {
+            arg = AnsiString(ParamStr(i+1)).c_str();
+            found = true;
+        }
+    }
+    return found;
+}
+// flag's argument parsed into opt; false if flag isn't there, or (added to problems) if it is bad
+template <class T>
+static bool commandOption(const char *flag, const char *what, bool (*parse)(const std::string &, T &, std::string &),
+                          T &opt, std::string &problems)
+{
+    std::string arg, err;
+    if (!commandOption(flag, arg))
+        return false;
+    if (parse(arg, opt, err))
+        return true;
+    problems += std::string(what) + ": " + err + "\n";
+    return false;
+}
+// flag without an argument
+static bool commandSwitch(const char *flag)
+{
+    for (int i=1;i<=ParamCount();++i)
+    {
+        if (ParamStr(i) == flag)
+            return true;
+    }
+    return false;
+}
+
 __fastcall TForm1::TForm1(TComponent* Owner)
     : TForm(Owner)
 {
@@ -40,6 +79,9 @@ __fastcall TForm1::TForm1(TComponent* Owner)
         updateVXIAddr();
     }
     streaming = false;
+    scale = SCALE_UNKNOWN;
+    memset(&lastLive, 0, sizeof(lastLive));
+    receiveChecked = false;
 
     // use native endian
     // test checksum
@@ -57,12 +99,78 @@ __fastcall TForm1::TForm1(TComponent* Owner)
 
     // Timer1 updates UI
     Timer1->Interval = 1000/DATA_RATE;
+    // adaptive control may decimate as far as the rate list goes
+    ControllerPolicy policy;
+    policy.maxRate = RateComboBox->Items->Count - 1;
+    controller.setPolicy(policy);
     // serverThread is the thread that captures data and writes it to disk
     serverThread = new UDPServerThread();
     serverThread->Priority = tpNormal;
     serverThread->FreeOnTerminate = false;
     //serverThread->setPort(port);
     serverThread->Resume();
+    // command line options; the bad ones are reported together at the end
+    std::string problems;
+    // cores & priority of the capture threads (ThreadPlacement.h), e.g.
+    //   SR865DataCapture -P "receive=2;writer=3;telemetry=0;fifo=receive"
+    PlacementPolicy placement;
+    if (commandOption("-P", "Thread placement", parsePlacement, placement, problems))
+    {
+        std::string err;
+        if (!serverThread->setPlacement(placement, err))
+            problems += "Thread placement: " + err + "\n";
+        std::vector<std::string> warnings = checkPlacement(placement);
+        for (size_t w=0;w<warnings.size();++w)
+            problems += "Thread placement: " + warnings[w] + "\n";
+    }
+    // receive buffer & mode (ReceiveSocket.h), e.g. -R "buffer=32M;spin"
+    ReceiveOptions receive;
+    if (commandOption("-R", "Receive options", parseReceive, receive, problems))
+        serverThread->setReceive(receive);
+    // journaled binary files (JournalSink.h), e.g. -j "seconds=0.5": synced with a checkpoint so a crash loses little
+    SinkOptions journal;
+    if (commandOption("-j", "Journal options", parseJournal, journal, problems))
+        serverThread->setJournal(true, journal.syncPackets, journal.syncSeconds);
+    // capture files in segments (CaptureSink.h), e.g. -s "bytes=500M;seconds=3600": run.dat -> run_0000.dat, run_0001.dat, ...
+    SegmentPolicy segments;
+    if (commandOption("-s", "Segment options", parseSegments, segments, problems))
+        serverThread->setSegments(segments);
+    // noise spectra (WelchPsd.h), e.g. -S "fft=8192;averages=32;side" to save them beside every capture file
+    SpectrumOptions spectrum;
+    if (commandOption("-S", "Spectrum options", parseSpectrum, spectrum, problems))
+        serverThread->setSpectrum(spectrum);
+    // output rate of ".rsd" files (Resampler.h), e.g. -D "rate=1000"; "side" resamples beside every capture file
+    ResampleOptions resample;
+    if (commandOption("-D", "Resample options", parseResample, resample, problems))
+        serverThread->setResample(resample);
+    // min / max / mean pyramid beside every capture file, for fast display (Envelope.h), e.g. -E "bucket=256"
+    EnvelopeOptions envelope;
+    if (commandOption("-E", "Envelope options", parseEnvelope, envelope, problems))
+        serverThread->setEnvelope(envelope);
+    // where the overload / error flags change, beside every capture file (FlagSink.h): -F
+    if (commandSwitch("-F"))
+        serverThread->setFlags(true);
+    // R & theta computed here, so the instrument only streams X,Y (Polar.h), e.g. -T "unwrap"
+    PolarOptions polar;
+    if (commandOption("-T", "Polar options", parsePolar, polar, problems))
+        serverThread->setPolar(polar);
+    // only the samples around events saved (TriggerSink.h), e.g. -G "source=R;edge=rise;level=0.5;pre=0.01;post=0.1"
+    TriggerOptions trigger;
+    if (commandOption("-G", "Trigger options", parseTrigger, trigger, problems))
+        serverThread->setTrigger(trigger);
+    // running statistics saved to a csv file (StreamStats.h), e.g. -A "file=stats.csv;seconds=60"
+    std::string stats;
+    if (commandOption("-A", stats))
+    {
+        std::string file, err;
+        double seconds = 60.0;
+        if (!parseStatsLog(stats, file, seconds, err))
+            problems += "Statistics log: " + err + "\n";
+        else if (!serverThread->setStatsLog(UnicodeString(file.c_str()), seconds))
+            problems += "Statistics log: could not open " + file + "\n";
+    }
+    if (!problems.empty())
+        ShowMessage(AnsiString(problems.c_str()).TrimRight());
 
     // create vxiclient after serverthread creation
     // serverthread initializes winsock
@@ -88,12 +196,20 @@ __fastcall TForm1::TForm1(TComponent* Owner)
 // This gets called from a timer loop
 void TForm1::updateInfo()
 {
-    int what, rate, byte_count;
-    float liax, liay, liar, liath;
-    bool missed, over;
     // get snapshot of data from server thread
     // and then format & update UI
-    serverThread->getData(&what, &rate, &liax, &liay, &liar, &liath, &byte_count, &missed, &over);
+    LiveData live;
+    serverThread->getData(live);
+    int what = live.what;
+    int rate = live.rate;
+    float liax = live.x, liay = live.y, liar = live.r, liath = live.th;
+    // counters are totals; what happened since last update?
+    int byte_count = (int)(live.bytes - lastLive.bytes);
+    // lost before reaching this computer (network or instrument), or dropped here (socket buffer or queue full)?
+    bool missedHere = (live.socketDrops + live.unsaved != lastLive.socketDrops + lastLive.unsaved);
+    bool missedThere = (live.dropped - live.socketDrops != lastLive.dropped - lastLive.socketDrops);
+    bool over = (live.overloads != lastLive.overloads);
+    lastLive = live;
     UnicodeString theta = WideChar(0x3b8);  // theta
 
     // content of streamed data
@@ -132,7 +248,15 @@ void TForm1::updateInfo()
     }
 
     // data itself (only data from beginning of packet)
-    if (what>=4 && what<8)
+    if (what>=4 && what<8 && scale != SCALE_UNKNOWN)
+    {
+        // integer counts in volts (amps) & degrees
+        XEdit->Text = formatFloat(liax * countScale(scale, false));
+        YEdit->Text = formatFloat(liay * countScale(scale, false));
+        REdit->Text = formatFloat(liar * countScale(scale, false));
+        ThEdit->Text = formatFloat(liath * countScale(scale, true));
+    }
+    else if (what>=4 && what<8)
     {
         XEdit->Text = AnsiString::FormatFloat("##,##0", liax);
         YEdit->Text = AnsiString::FormatFloat("##,##0", liay);
@@ -162,10 +286,24 @@ void TForm1::updateInfo()
         ProgressBar1->State = pbsNormal;
 
     // dropped packet?
-    if (missed)
+    // red: lost on the network or by the instrument; yellow: this computer couldn't keep up
+    if (missedThere)
         MissedShape->Brush->Color = clRed;
+    else if (missedHere)
+        MissedShape->Brush->Color = clYellow;
     else
         MissedShape->Brush->Color = clSilver;
+    MissedShape->Hint = "Dropped packets: " + AnsiString(live.dropped - live.retracted - live.socketDrops) + " network/instrument, "
+                        + AnsiString(live.socketDrops) + " socket buffer full, " + AnsiString(live.unsaved) + " not saved (queue full)";
+
+    // receive buffer smaller than asked for?
+    if (!receiveChecked && serverThread->serverOk())
+    {
+        receiveChecked = true;
+        std::string warn = serverThread->receiveWarning();
+        if (!warn.empty())
+            ShowMessage("UDP receive: " + AnsiString(warn.c_str()));
+    }
 
     // overload, unlock, error?
     if (over)
@@ -211,8 +349,16 @@ void __fastcall TForm1::SaveButtonClick(TObject *Sender)
             // save data to new file
             FileEdit->Text = SaveDialog1->FileName;
             FileEdit->Enabled = true;
-            isCSV = SaveDialog1->FilterIndex - 1;
+            isCSV = (SaveDialog1->FilterIndex == 2);
+            isCompressed = (SaveDialog1->FilterIndex == 3);
+            isColumns = (SaveDialog1->FilterIndex == 4);
+            isSpectra = (SaveDialog1->FilterIndex == 5);
+            isResampled = (SaveDialog1->FilterIndex == 6);
             serverThread->setFileFmt(isCSV);
+            serverThread->setCompress(isCompressed);
+            serverThread->setColumns(isColumns);
+            serverThread->setSpectra(isSpectra);
+            serverThread->setResampled(isResampled);
             serverThread->setFile(FileEdit->Text, true);
             SaveButton->Caption = "Pause";
             DiskShape->Brush->Color = clBlue;
@@ -244,8 +390,16 @@ void __fastcall TForm1::Button1Click(TObject *Sender)
         // save data to new file
         FileEdit->Text = SaveDialog1->FileName;
         FileEdit->Enabled = true;
-        isCSV = SaveDialog1->FilterIndex - 1;
+        isCSV = (SaveDialog1->FilterIndex == 2);
+        isCompressed = (SaveDialog1->FilterIndex == 3);
+        isColumns = (SaveDialog1->FilterIndex == 4);
+        isSpectra = (SaveDialog1->FilterIndex == 5);
+        isResampled = (SaveDialog1->FilterIndex == 6);
         serverThread->setFileFmt(isCSV);
+        serverThread->setCompress(isCompressed);
+        serverThread->setColumns(isColumns);
+        serverThread->setSpectra(isSpectra);
+        serverThread->setResampled(isResampled);
         serverThread->setFile(FileEdit->Text, true);
         SaveButton->Caption = "Pause";
         DiskShape->Brush->Color = clBlue;
@@ -258,6 +412,8 @@ void __fastcall TForm1::Button1Click(TObject *Sender)
 void __fastcall TForm1::Timer1Timer(TObject *Sender)
 {
     updateInfo();
+    if (connected && streaming && AdaptCheckBox->Checked)
+        adaptStream();
 }
 //---------------------------------------------------------------------------
 
@@ -504,6 +660,12 @@ void __fastcall TForm1::Button3Click(TObject *Sender)
             sendLE = true;
             ChecksumCheckBoxClick(NULL);
         }
+
+        // scale for integer data, before the first packet arrives
+        queryScale();
+
+        // adaptive control starts from the user's settings
+        controller.start(streamSettings(), captureClock());
     }
 
     AnsiString cmd = "STREAM " + AnsiString((int)streaming);
@@ -572,6 +734,8 @@ void TForm1::syncState(bool syncall)
             MaxRate->Text = formatRate(maxRateHz);
         }
     }
+    // sensitivity may be changed at the instrument at any time
+    queryScale();
     if (syncall)
     {
         // data streaming rate
@@ -616,6 +780,9 @@ void TForm1::syncState(bool syncall)
         }
     }
 
+    if (syncall && streaming)
+        controller.start(streamSettings(), captureClock());
+
     // blink save indic
     if (DiskShape->Brush->Color != clSilver)
     {
@@ -648,6 +815,7 @@ void __fastcall TForm1::RateComboBoxChange(TObject *Sender)
             }
         }
     }
+    queryScale();
 }
 //---------------------------------------------------------------------------
 
@@ -678,6 +846,28 @@ void __fastcall TForm1::WhatComboBoxChange(TObject *Sender)
             }
         }
     }
+    queryScale();
+}
+void TForm1::queryScale()
+{
+    // sensitivity & voltage/current input, to convert integer data
+    if (!connected)
+        return;                     // keep the last scale; no RPC on a dead link
+    char id[128];
+    int sens = -1;
+    bool current = false;
+    if (vxiclient->device_write("SCAL?"))
+    {
+        if (vxiclient->device_read(id))
+            sens = AnsiString(id).Trim().ToIntDef(-1);
+    }
+    if (vxiclient->device_write("IVMD?"))
+    {
+        if (vxiclient->device_read(id))
+            current = (AnsiString(id).Trim().ToIntDef(0) == 1);
+    }
+    scale = scaleCode(sens, current);
+    serverThread->setScale(scale);
 }
 
 
@@ -724,22 +914,24 @@ void __fastcall TForm1::Timer2Timer(TObject *Sender)
 
 void __fastcall TForm1::SaveDialog1CanClose(TObject *Sender, bool &CanClose)
 {
-    // make user pick binary or csv save file format
+    // make user pick binary, csv, compressed binary, column, noise spectra or resampled save file format
+    // file extension decides
     AnsiString ext = ExtractFileExt(SaveDialog1->FileName).LowerCase();
-    bool CSV = SaveDialog1->FilterIndex - 1;
-    if (ext == ".csv" && !CSV)
-    {
-        SaveDialog1->FilterIndex = 2;
-        CSV = true;
-    }
-    else if (ext == ".dat" && CSV)
-    {
+    if (ext == ".dat")
         SaveDialog1->FilterIndex = 1;
-        CSV = false;
-    }
-    else if (ext.IsEmpty() || ((ext != ".dat") && (ext != ".csv")))
+    else if (ext == ".csv")
+        SaveDialog1->FilterIndex = 2;
+    else if (ext == ".sdz")
+        SaveDialog1->FilterIndex = 3;
+    else if (ext == ".idx")
+        SaveDialog1->FilterIndex = 4;
+    else if (ext == ".psd")
+        SaveDialog1->FilterIndex = 5;
+    else if (ext == ".rsd")
+        SaveDialog1->FilterIndex = 6;
+    else
     {
-        ShowMessage("You must choose either \".dat\" or \".csv\" file extension.");
+        ShowMessage("You must choose \".dat\", \".csv\", \".sdz\", \".idx\", \".psd\" or \".rsd\" file extension.");
         CanClose = false;
     }
 }
@@ -756,4 +948,48 @@ void __fastcall TForm1::ChecksumCheckBoxClick(TObject *Sender)
 }
 //---------------------------------------------------------------------------
 
+void __fastcall TForm1::AdaptCheckBoxClick(TObject *Sender)
+{
+    // adaptive control takes over from the settings as they are now
+    if (streaming)
+        controller.start(streamSettings(), captureClock());
+}
+//---------------------------------------------------------------------------
+StreamSettings TForm1::streamSettings()
+{
+    StreamSettings s;
+    s.packetSize = packetSize;
+    s.rate = RateComboBox->ItemIndex;
+    return s;
+}
+void TForm1::adaptStream()
+{
+    // let the controller look at the live counters (StreamController.h)
+    LiveData live;
+    serverThread->getData(live);
+    if (!controller.update(captureClock(), live, serverThread->queueFill()))
+        return;
+
+    // instrument takes new stream settings while stopped
+    const StreamSettings &s = controller.settings();
+    vxiclient->device_write("STREAM 0");
+    if (s.packetSize != packetSize)
+    {
+        AnsiString cmd = "STREAMPCKT " + AnsiString(s.packetSize);
+        vxiclient->device_write(cmd.c_str());
+        packetSize = s.packetSize;
+    }
+    if (s.rate != RateComboBox->ItemIndex)
+    {
+        AnsiString cmd = "STREAMRATE " + AnsiString(s.rate);
+        vxiclient->device_write(cmd.c_str());
+        RateComboBox->ItemIndex = s.rate;
+    }
+    vxiclient->device_write("STREAM 1");
+
+    // every change is logged in the capture file
+    serverThread->note("Adaptive: " + controller.reason());
+}
+//---------------------------------------------------------------------------
+
 
@@ -12,6 +12,7 @@
 #include <fstream.h>
 #include "UDPServerThread.h"
 #include "vxi11.h"
+#include "StreamController.h"
 #include <ExtCtrls.hpp>
 #include <Sockets.hpp>
 #include <Menus.hpp>
@@ -46,6 +47,7 @@ __published:	// IDE-managed Components
     TButton *Button1;
     TShape *DiskShape;
     TCheckBox *ChecksumCheckBox;
+    TCheckBox *AdaptCheckBox;
     TLabel *Label2;
     TEdit *WhatEdit;
     TLabel *Label4;
@@ -73,6 +75,7 @@ __published:	// IDE-managed Components
     void __fastcall Timer2Timer(TObject *Sender);
     void __fastcall SaveDialog1CanClose(TObject *Sender, bool &CanClose);
     void __fastcall ChecksumCheckBoxClick(TObject *Sender);
+    void __fastcall AdaptCheckBoxClick(TObject *Sender);
 
 private:	// User declarations
     unsigned int vxiaddr, vxiport;
@@ -84,7 +87,15 @@ private:	// User declarations
     bool connected;
     double maxRateHz;
     int packetSize;
+    int scale;                      // sensitivity code for integer data (SampleScale.h)
+    LiveData lastLive;              // receive counters at last update
+    bool receiveChecked;            // receive socket warning shown
+    StreamController controller;    // adaptive packet size & decimation
     bool isCSV;
+    bool isCompressed;
+    bool isColumns;
+    bool isSpectra;
+    bool isResampled;
     bool isLE;
     bool sendLE;
     bool sendCS;
@@ -95,9 +106,12 @@ public:		// User declarations
     virtual __fastcall ~TForm1();
 
     void updateInfo();
+    void adaptStream();
+    StreamSettings streamSettings();
     AnsiString formatFloat(float val);
     void updateVXIAddr();
     void syncState(bool syncall=true);
+    void queryScale();
     AnsiString formatRate(double Fs);
     int validateIP(AnsiString &ip, bool set);
 };
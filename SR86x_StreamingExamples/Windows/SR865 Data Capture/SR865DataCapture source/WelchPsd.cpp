@@ -0,0 +1,254 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "WelchPsd.h"
+#include "PacketHeader.h"
+#include "SampleScale.h"
+#include "Deinterleave.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sstream>
+
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+// Welch noise spectra
+// Runs on the writer thread (SpectrumSink), one packet at a time; all buffers are sized
+// in the constructor, so a running capture allocates nothing here.
+
+bool parseSpectrum(const std::string &spec, SpectrumOptions &opt, std::string &err)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? std::string() : item.substr(eq + 1);
+        if (key == "fft" || key == "averages")
+        {
+            char *end;
+            long n = strtol(val.c_str(), &end, 10);
+            bool ok = (end != val.c_str() && !*end);
+            if (key == "fft")
+                ok = ok && n >= 64 && n <= 65536 && isPowerOf2((int)n);
+            else
+                ok = ok && n >= 1 && n <= 1000000;
+            if (!ok)
+            {
+                err = "bad value for " + key + ": \"" + val + "\"";
+                return false;
+            }
+            if (key == "fft")
+                opt.fftSize = (int)n;
+            else
+                opt.averages = (int)n;
+        }
+        else if (key == "seconds")
+        {
+            char *end;
+            double s = strtod(val.c_str(), &end);
+            if (end == val.c_str() || *end || s < 0.0)
+            {
+                err = "bad value for seconds: \"" + val + "\"";
+                return false;
+            }
+            opt.maxSeconds = s;
+        }
+        else if (key == "side" && eq == std::string::npos)
+            opt.side = true;
+        else
+        {
+            err = "unknown spectrum setting \"" + item + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+WelchPsd::WelchPsd(const SpectrumOptions &opt, SpectrumOutput *out)
+    : options(opt), output(out), fft(opt.fftSize)
+{
+    n = opt.fftSize;
+    hop = n / 2;
+    bins = n / 2 + 1;
+    // periodic Hann window
+    const double pi = 3.14159265358979323846;
+    window.resize(n);
+    double power = 0.0;
+    for (int i=0;i<n;++i)
+    {
+        window[i] = (float)(0.5 - 0.5 * cos(2.0 * pi * i / n));
+        power += (double)window[i] * window[i];
+    }
+    norm = 1.0 / power;
+    for (int c=0;c<4;++c)
+        seg[c].resize(n);
+    re.resize(n);
+    im.resize(n);
+    sum.resize(4 * bins);
+    psd.resize(4 * bins);
+    spectra = 0;
+    sampleRate = 0.0;
+    reset();
+}
+
+void WelchPsd::reset()
+{
+    nch = 0;
+    fill = 0;
+    segSample = 0;
+    memset(&rec, 0, sizeof(rec));
+}
+
+void WelchPsd::begin(const CapturePacket &pkt)
+{
+    PacketHeader hdr(pkt.buffer[0]);
+    what = hdr.what;
+    rate = hdr.rate;
+    scale = pkt.scale;
+    nch = hdr.channels();
+    sampleRate = hdr.sampleRate();
+    fill = 0;
+    memset(&rec, 0, sizeof(rec));
+    rec.header = pkt.buffer[0];
+    rec.channels = nch;
+    rec.bins = bins;
+    rec.fftSize = n;
+    rec.scale = scale;
+    rec.sampleRate = sampleRate;
+    rec.binWidth = sampleRate / n;
+    for (int i=0;i<nch*bins;++i)
+        sum[i] = 0.0;
+}
+
+void WelchPsd::add(const CapturePacket &pkt)
+{
+    if (pkt.nwords < 2)
+        return;
+    PacketHeader hdr(pkt.buffer[0]);
+    if (nch == 0 || hdr.what != what || hdr.rate != rate || (hdr.isInt() && pkt.scale != scale))
+    {
+        flush();
+        begin(pkt);
+    }
+    else if (pkt.dropped > 0)
+        fill = 0;                   // segments never span lost data
+
+    int frames = packetToFloat(pkt, values) / nch;
+    int i = 0;
+    while (i < frames)
+    {
+        if (fill == 0)
+            segSample = pkt.sample + i;
+        int k = frames - i;
+        if (k > n - fill)
+            k = n - fill;
+        float *out[4];
+        for (int c=0;c<nch;++c)
+            out[c] = &seg[c][fill];
+        deinterleaveFloat(values + i * nch, k, nch, out);
+        fill += k;
+        i += k;
+        if (fill < n)
+            break;
+
+        if (rec.segments == 0)
+        {
+            rec.firstSample = segSample;
+            rec.firstTime = pkt.rxTime;
+        }
+        transform();
+        ++rec.segments;
+        rec.lastTime = pkt.rxTime;
+        long long end = segSample + n;
+
+        // second half starts the next segment
+        for (int c=0;c<nch;++c)
+            memmove(&seg[c][0], &seg[c][hop], hop * sizeof(float));
+        fill = hop;
+        segSample += hop;
+
+        if (rec.segments >= options.averages ||
+            (options.maxSeconds > 0.0 && end - rec.firstSample >= options.maxSeconds * sampleRate))
+            flush();
+    }
+}
+
+// transform the full segment and add it to the sums
+void WelchPsd::transform()
+{
+    for (int c=0;c<nch;c+=2)
+    {
+        bool pair = (c + 1 < nch);
+        // remove the mean; a lock-in output's DC level would otherwise leak into the lowest bins
+        double mean0 = 0.0, mean1 = 0.0;
+        for (int j=0;j<n;++j)
+            mean0 += seg[c][j];
+        mean0 /= n;
+        if (pair)
+        {
+            for (int j=0;j<n;++j)
+                mean1 += seg[c + 1][j];
+            mean1 /= n;
+        }
+        float m0 = (float)mean0, m1 = (float)mean1;
+        for (int j=0;j<n;++j)
+        {
+            re[j] = (seg[c][j] - m0) * window[j];
+            im[j] = pair ? (seg[c + 1][j] - m1) * window[j] : 0.0f;
+        }
+        fft.forward(&re[0], &im[0]);
+
+        double *s0 = &sum[c * bins];
+        if (!pair)
+        {
+            for (int k=0;k<bins;++k)
+                s0[k] += (double)re[k] * re[k] + (double)im[k] * im[k];
+            continue;
+        }
+        // Z = A + iB:  A[k] = (Z[k] + conj Z[n-k]) / 2,  B[k] = (Z[k] - conj Z[n-k]) / 2i
+        double *s1 = &sum[(c + 1) * bins];
+        for (int k=0;k<bins;++k)
+        {
+            int m = (n - k) & (n - 1);
+            double ar = (double)re[k] + re[m], ai = (double)im[k] - im[m];
+            double br = (double)im[k] + im[m], bi = (double)re[m] - re[k];
+            s0[k] += 0.25 * (ar * ar + ai * ai);
+            s1[k] += 0.25 * (br * br + bi * bi);
+        }
+    }
+}
+
+void WelchPsd::flush()
+{
+    if (nch == 0 || rec.segments == 0)
+        return;
+    // one-sided: every bin but DC and Nyquist carries the negative frequencies too
+    double scaleBy = norm / (sampleRate * rec.segments);
+    for (int c=0;c<nch;++c)
+    {
+        const double *s = &sum[c * bins];
+        float *p = &psd[c * bins];
+        for (int k=0;k<bins;++k)
+            p[k] = (float)(s[k] * scaleBy * ((k == 0 || k == bins - 1) ? 1.0 : 2.0));
+    }
+    if (output)
+        output->spectrum(rec, &psd[0]);
+    ++spectra;
+
+    for (int i=0;i<nch*bins;++i)
+        sum[i] = 0.0;
+    rec.segments = 0;
+}
+
+long long WelchPsd::spectrumCount() const
+{
+    return spectra;
+}
@@ -0,0 +1,100 @@
+//---------------------------------------------------------------------------
+
+#ifndef WelchPsdH
+#define WelchPsdH
+
+#include <string>
+#include <vector>
+#include "PacketQueue.h"
+#include "Fft.h"
+
+//---------------------------------------------------------------------------
+
+// averaged noise spectra of the stream (Welch's method)
+//
+// Every channel of the stream is cut into segments of fftSize samples, overlapping by half;
+// each has its mean removed, is multiplied by a Hann window and transformed; the squared magnitudes of "averages"
+// segments are averaged into one spectrum per channel.
+// Two channels share one complex transform (X + iY, R + i theta) and are separated afterwards.
+// Spectra are one-sided power spectral densities: units^2/Hz (V, A, degrees for theta,
+// or counts when the sensitivity of integer data is unknown), bins 0 .. fftSize/2.
+//
+// Latency is bounded: a spectrum is finished after averages segments, or after maxSeconds
+// with the segments it has (at least one). A gap in the packet counter ends the segment
+// being filled (segments are never joined across lost data); a change of content, rate
+// or sensitivity finishes the spectrum so far and starts over.
+
+struct SpectrumOptions
+{
+    int fftSize;                    // samples per segment (power of 2, 64 .. 65536)
+    int averages;                   // segments per spectrum
+    double maxSeconds;              // finish a spectrum at least this often (stream time); 0 = no limit
+    bool side;                      // write spectra beside the capture file, not instead of it
+
+    SpectrumOptions() : fftSize(4096), averages(16), maxSeconds(1.0), side(false) {}
+};
+
+// options from text, e.g. "fft=8192;averages=32;seconds=2;side"
+bool parseSpectrum(const std::string &spec, SpectrumOptions &opt, std::string &err);
+
+// one averaged spectrum; followed by channels * bins floats, channel by channel
+struct SpectrumRecord
+{
+    unsigned int header;            // packet header of the data (content, rate) when the spectrum began
+    int channels;                   // channels in the stream (1, 2 or 4), in packet order
+    int bins;                       // fftSize/2 + 1
+    int segments;                   // segments averaged
+    int fftSize;
+    int scale;                      // scale code of integer data (SampleScale.h)
+    double sampleRate;              // Hz
+    double binWidth;                // Hz between bins
+    long long firstSample;          // first sample in the spectrum (CapturePacket.sample)
+    double firstTime;               // arrival of the packets that completed the first and last segments
+    double lastTime;                // (captureClock() seconds)
+};
+
+// where finished spectra go
+class SpectrumOutput
+{
+public:
+    virtual ~SpectrumOutput() {}
+    virtual void spectrum(const SpectrumRecord &rec, const float *psd) = 0;
+};
+
+class WelchPsd
+{
+protected:
+    SpectrumOptions options;
+    SpectrumOutput *output;
+    Fft fft;
+    int n, hop, bins;
+    std::vector<float> window;
+    double norm;                    // PSD scale: 1 / (sample rate * sum of window^2)
+    int what, rate, scale;          // stream being analysed
+    int nch;                        // its channels; 0 = none yet
+    std::vector<float> seg[4];      // samples of the segment being filled, per channel
+    int fill;                       // samples in seg
+    long long segSample;            // CapturePacket.sample of seg[c][0]
+    double sampleRate;
+    std::vector<float> re, im;      // transform
+    std::vector<double> sum;        // summed |X|^2, channels * bins
+    std::vector<float> psd;
+    SpectrumRecord rec;
+    float values[512];
+    long long spectra;
+
+    void begin(const CapturePacket &pkt);
+    void transform();
+
+public:
+    WelchPsd(const SpectrumOptions &opt, SpectrumOutput *out);
+
+    void add(const CapturePacket &pkt);
+    void flush();                   // finish the spectrum so far, if it has a segment
+    void reset();                   // forget everything since the last spectrum
+
+    long long spectrumCount() const;
+};
+
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,37 @@
+//---------------------------------------------------------------------------
+
+
+#pragma hdrstop
+
+#include "WriterThread.h"
+//---------------------------------------------------------------------------
+
+#pragma package(smart_init)
+
+
+// the writer thread empties the packet queue filled by UDPServerThread.
+// When the queue is empty it sleeps briefly;
+// the queue holds about 0.4 s of packets at the highest stream rate, so a short sleep loses nothing.
+
+WriterThread::WriterThread(CaptureWriter *w) : TThread(true)
+{
+    writer = w;
+}
+/*virtual*/ __fastcall WriterThread::~WriterThread()
+{
+}
+
+// thread's main execution loop
+/*virtual*/ void __fastcall WriterThread::Execute(void)
+{
+    do
+    {
+        if (writer->drain() == 0)
+            Sleep(2);
+    }
+    while (!Terminated);
+
+    // save whatever is left
+    while (writer->drain() > 0)
+        ;
+}
@@ -0,0 +1,23 @@
+//---------------------------------------------------------------------------
+
+#ifndef WriterThreadH
+#define WriterThreadH
+
+#include <Classes.hpp>
+#include "CaptureWriter.h"
+//---------------------------------------------------------------------------
+
+// this thread takes received packets off the packet queue and saves them to disk
+class WriterThread : public TThread
+{
+protected:
+    CaptureWriter *writer;
+
+public:
+    WriterThread(CaptureWriter *w);
+    virtual __fastcall ~WriterThread();
+
+    virtual void __fastcall Execute(void);
+};
+
+#endif
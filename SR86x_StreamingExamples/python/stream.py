@@ -187,9 +187,7 @@ def processPacket(buf,upFmt,prevCntr):
     head = unpack_from('>I',buf)[0]            # convert the header to an 32 bit int
     cntr = head & 0xff                         # extract the packet counter from the header
     if prevCntr is not None and ((prevCntr+1)&0xff) != cntr:   # if this isn't the 1st and the difference isn't 1 then
-        dcnt = cntr - prevCntr                                 # calculate how many we missed
-        if dcnt < 0:
-            dcnt += 0xff
+        dcnt = (cntr - prevCntr - 1) % 256                     # calculate how many we missed (counter wraps at 256)
     else:
         dcnt = 0
     return vals, head, dcnt, cntr
@@ -200,9 +200,7 @@ def process_packet(buf, fmt_unpk, prev_pkt_cntr):
     # check for missed packets
     # if this isn't the 1st and the difference isn't 1 then
     if prev_pkt_cntr is not None and ((prev_pkt_cntr+1)&0xff) != cntr:
-        n_dropped = cntr - prev_pkt_cntr                    # calculate how many we missed
-        if n_dropped < 0:
-            n_dropped += 0xff
+        n_dropped = (cntr - prev_pkt_cntr - 1) % 256        # calculate how many we missed (counter wraps at 256)
     else:
         n_dropped = 0
     return vals, head, n_dropped, cntr